@@ -2002,7 +2002,7 @@ heapam_relation_size(Relation rel, ForkNumber forkNumber)
 	/* InvalidForkNumber indicates returning the size for all forks */
 	if (forkNumber == InvalidForkNumber)
 	{
-		for (int i = 0; i < MAX_FORKNUM; i++)
+		for (int i = 0; i < INIT_FORKNUM; i++)
 			nblocks += smgrnblocks(rel->rd_smgr, i);
 	}
 	else
@@ -302,6 +302,7 @@ index_rescan(IndexScanDesc scan,
 
 	scan->kill_prior_tuple = false; /* for safety */
 	scan->xs_heap_continue = false;
+	scan->xs_batch_remaining = 0;
 
 	scan->indexRelation->rd_indam->amrescan(scan, keys, nkeys,
 											orderbys, norderbys);
@@ -379,6 +380,7 @@ index_restrpos(IndexScanDesc scan)
 
 	scan->kill_prior_tuple = false; /* for safety */
 	scan->xs_heap_continue = false;
+	scan->xs_batch_remaining = 0;
 
 	scan->indexRelation->rd_indam->amrestrpos(scan);
 }
@@ -461,6 +463,7 @@ index_parallelrescan(IndexScanDesc scan)
 
 	if (scan->xs_heapfetch)
 		table_index_fetch_reset(scan->xs_heapfetch);
+	scan->xs_batch_remaining = 0;
 
 	/* amparallelrescan is optional; assume no-op if not provided by AM */
 	if (scan->indexRelation->rd_indam->amparallelrescan != NULL)
@@ -533,6 +536,7 @@ index_getnext_tid(IndexScanDesc scan, ScanDirection direction)
 		/* release resources (like buffer pins) from table accesses */
 		if (scan->xs_heapfetch)
 			table_index_fetch_reset(scan->xs_heapfetch);
+		scan->xs_batch_remaining = 0;
 
 		return NULL;
 	}
@@ -588,6 +592,49 @@ index_fetch_heap(IndexScanDesc scan, TupleTableSlot *slot)
 	return found;
 }
 
+/*
+ * index_prepare_fetch_batch - let the table AM look up upcoming TIDs together
+ *
+ * Called once index_getnext_tid has returned a TID that is to be fetched.
+ * If the index AM can tell which TIDs come next, hand them to the table AM
+ * along with this one, so that it can look up those sharing a block under a
+ * single buffer lock and prefetch the blocks of the others.  That's only
+ * done with MVCC snapshots, under which looking a tuple up early can't give
+ * a different answer.
+ */
+static void
+index_prepare_fetch_batch(IndexScanDesc scan, ScanDirection direction)
+{
+	ItemPointerData tids[MaxIndexFetchBatch];
+	int			ntids;
+
+	/* Still covered by the last batch? */
+	if (scan->xs_batch_remaining > 0)
+	{
+		scan->xs_batch_remaining--;
+		return;
+	}
+
+	if (scan->indexRelation->rd_indam->ampeektids == NULL ||
+		scan->heapRelation->rd_tableam->index_fetch_batch == NULL ||
+		!IsMVCCSnapshot(scan->xs_snapshot))
+		return;
+
+	tids[0] = scan->xs_heaptid;
+	ntids = 1 + scan->indexRelation->rd_indam->ampeektids(scan, direction,
+														  &tids[1],
+														  MaxIndexFetchBatch - 1);
+	if (ntids < 2)
+		return;
+
+	/* The first of the TIDs looked up is about to be fetched. */
+	scan->xs_batch_remaining = table_index_fetch_batch(scan->xs_heapfetch,
+													   tids, ntids,
+													   scan->xs_snapshot);
+	if (scan->xs_batch_remaining > 0)
+		scan->xs_batch_remaining--;
+}
+
 /* ----------------
  *		index_getnext_slot - get the next tuple from a scan
  *
@@ -620,6 +667,8 @@ index_getnext_slot(IndexScanDesc scan, ScanDirection direction, TupleTableSlot *
 				break;
 
 			Assert(ItemPointerEquals(tid, &scan->xs_heaptid));
+
+			index_prepare_fetch_batch(scan, direction);
 		}
 
 		/*
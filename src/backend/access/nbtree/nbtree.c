@@ -143,6 +143,7 @@ bthandler(PG_FUNCTION_ARGS)
 	amroutine->amendscan = btendscan;
 	amroutine->ammarkpos = btmarkpos;
 	amroutine->amrestrpos = btrestrpos;
+	amroutine->ampeektids = btpeektids;
 	amroutine->amestimateparallelscan = btestimateparallelscan;
 	amroutine->aminitparallelscan = btinitparallelscan;
 	amroutine->amparallelrescan = btparallelrescan;
@@ -569,6 +570,43 @@ btrestrpos(IndexScanDesc scan)
 	}
 }
 
+/*
+ *	btpeektids() -- report the heap TIDs the next btgettuple() calls will
+ *		return, without advancing the scan
+ *
+ * Only the items already read from the current leaf page are reported, so
+ * this may return fewer than maxtids even though the scan has more.
+ */
+int
+btpeektids(IndexScanDesc scan, ScanDirection dir, ItemPointer tids,
+		   int maxtids)
+{
+	BTScanOpaque so = (BTScanOpaque) scan->opaque;
+	int			itemIndex;
+	int			ntids = 0;
+
+	if (!BTScanPosIsValid(so->currPos))
+		return 0;
+
+	itemIndex = so->currPos.itemIndex;
+	while (ntids < maxtids)
+	{
+		if (ScanDirectionIsForward(dir))
+		{
+			if (++itemIndex > so->currPos.lastItem)
+				break;
+		}
+		else
+		{
+			if (--itemIndex < so->currPos.firstItem)
+				break;
+		}
+		tids[ntids++] = so->currPos.items[itemIndex].heapTid;
+	}
+
+	return ntids;
+}
+
 /*
  * btestimateparallelscan -- estimate storage for BTParallelScanDescData
  */
@@ -31,6 +31,7 @@
 #include "access/xlog.h"
 #include "access/xloginsert.h"
 #include "access/xlogutils.h"
+#include "access/zkeyshare.h"
 #include "access/tpd.h"
 #include "access/undorequest.h"
 #include "catalog/namespace.h"
@@ -2329,6 +2330,7 @@ CommitTransaction(void)
 	AtEOXact_Namespace(true, is_parallel_worker);
 	AtEOXact_SMgr();
 	AtEOXact_Files(true);
+	AtEOXact_ZHeapKeyShare();
 	AtEOXact_ComboCid();
 	AtEOXact_HashTables(true);
 	AtEOXact_PgStat(true, is_parallel_worker);
@@ -2436,6 +2438,13 @@ PrepareTransaction(UndoRecPtr *start_urec_ptr, UndoRecPtr *end_urec_ptr)
 	 */
 	PreCommit_on_commit_actions();
 
+	/*
+	 * KEY SHARE locks on zheap tuples that are recorded only in shared memory
+	 * would be lost on a restart, so take them in undo instead.  This must be
+	 * done before the undo and WAL of the transaction are prepared.
+	 */
+	AtPrepare_ZHeapKeyShare();
+
 	/* close large objects before lower-level cleanup */
 	AtEOXact_LargeObject(true);
 
@@ -2824,6 +2833,7 @@ AbortTransaction(void)
 		AtEOXact_Namespace(false, is_parallel_worker);
 		AtEOXact_SMgr();
 		AtEOXact_Files(false);
+		AtEOXact_ZHeapKeyShare();
 		AtEOXact_ComboCid();
 		AtEOXact_HashTables(false);
 		AtEOXact_PgStat(false, is_parallel_worker);
@@ -3591,6 +3601,23 @@ ApplyUndoActions(void)
 										 s->latest_urec_ptr[per_level],
 										 s->start_urec_ptr[per_level],
 										 !IsSubTransaction());
+
+					/*
+					 * The undo of a rolled back subtransaction is not needed
+					 * anymore, so give its space back to the transaction.
+					 */
+					if (IsSubTransaction())
+					{
+						UndoLogRewindSubXact(per_level,
+											 s->start_urec_ptr[per_level],
+											 s->parent->latest_urec_ptr[per_level]);
+
+						/*
+						 * The pages touched by the top transaction no longer
+						 * point to their latest undo.
+						 */
+						UndoForgetTouchedPages();
+					}
 				}
 			}
 			PG_CATCH();
@@ -3643,6 +3670,15 @@ ApplyUndoActions(void)
 		AbortTransaction();
 	}
 
+	/*
+	 * The undo of temporary tables isn't needed once it has been applied.  On
+	 * commit, an on-commit action discards it; do the same here, or it would
+	 * only be discarded by a later transaction's commit.
+	 */
+	if (!error && !IsSubTransaction() &&
+		UndoRecPtrIsValid(s->latest_urec_ptr[UNDO_TEMP]))
+		TempUndoDiscard(UndoRecPtrGetLogNo(s->latest_urec_ptr[UNDO_TEMP]));
+
 	/* Reset undo information */
 	ResetUndoActionsInfo();
 
@@ -5281,6 +5317,7 @@ CommitSubTransaction(void)
 	AtEOSubXact_LargeObject(true, s->subTransactionId,
 							s->parent->subTransactionId);
 	AtSubCommit_Notify();
+	AtSubCommit_ZHeapKeyShare(s->nestingLevel);
 
 	CallSubXactCallbacks(SUBXACT_EVENT_COMMIT_SUB, s->subTransactionId,
 						 s->parent->subTransactionId);
@@ -5440,6 +5477,7 @@ AbortSubTransaction(void)
 		AtEOSubXact_LargeObject(false, s->subTransactionId,
 								s->parent->subTransactionId);
 		AtSubAbort_Notify();
+		AtSubAbort_ZHeapKeyShare(s->nestingLevel);
 
 		/* Advertise the fact that we aborted in pg_xact. */
 		(void) RecordTransactionAbort(true);
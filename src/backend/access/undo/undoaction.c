@@ -13,6 +13,7 @@
 
 #include "postgres.h"
 
+#include "access/relation.h"
 #include "access/table.h"
 #include "access/tpd.h"
 #include "access/undoaction_xlog.h"
@@ -32,6 +33,36 @@
 #include "storage/shmem.h"
 #include "access/undodiscard.h"
 
+/*
+ * The pages the current transaction has written undo for, along with the
+ * latest undo record for each.  If a transaction that touched only a few
+ * pages aborts, we can apply its undo page by page by following each page's
+ * undo chain, rather than reading back all the undo of the transaction and
+ * sorting it.  The set is only usable if it is complete, so once it
+ * overflows, or once the undo of a subtransaction has been applied (which
+ * may rewind the undo we point to), we stop maintaining it.
+ */
+#define MAX_UNDO_TOUCHED_PAGES	256
+
+typedef struct UndoTouchedPage
+{
+	RmgrId		rmid;
+	UndoPersistence persistence;
+	Oid			reloid;
+	ForkNumber	fork;
+	BlockNumber blkno;
+	UndoRecPtr	urp;			/* latest undo record for this page */
+} UndoTouchedPage;
+
+static FullTransactionId touched_fxid;
+static bool touched_overflow = false;
+static int	ntouched = 0;
+static int	last_touched = 0;
+static UndoTouchedPage touched_pages[MAX_UNDO_TOUCHED_PAGES];
+
+static bool execute_undo_actions_touched(FullTransactionId full_xid,
+										 UndoPersistence persistence);
+
 /*
  * PrefetchUndoPages - Prefetch undo pages
  *
@@ -225,6 +256,9 @@ UndoRecordBulkFetch(UndoRecPtr *from_urecptr, UndoRecPtr to_urecptr,
 				break;
 		}
 
+		/* All the records we return are applied, so expand them now. */
+		UndoRecordDecompressTuple(uur);
+
 		/* Remember the previous undo record pointer. */
 		prev_urec_ptr = urecptr;
 
@@ -285,6 +319,201 @@ UndoRecordBulkFetch(UndoRecPtr *from_urecptr, UndoRecPtr to_urecptr,
 	return urp_array;
 }
 
+/*
+ * UndoRememberTouchedPage - remember the page an undo record applies to
+ *
+ * Called for every undo record inserted outside recovery, from within a
+ * critical section, so this must not fail.
+ */
+void
+UndoRememberTouchedPage(UnpackedUndoRecord *uur, UndoRecPtr urp)
+{
+	FullTransactionId fxid = GetTopFullTransactionIdIfAny();
+	UndoPersistence persistence;
+	UndoTouchedPage *page;
+	int			i;
+
+	/*
+	 * Start afresh for a new transaction.  Compare full transaction ids, so
+	 * that a transaction id that has wrapped around can't pick up the pages
+	 * of a transaction long gone.
+	 */
+	if (!FullTransactionIdEquals(fxid, touched_fxid))
+	{
+		touched_fxid = fxid;
+		touched_overflow = false;
+		ntouched = 0;
+		last_touched = 0;
+	}
+
+	if (touched_overflow)
+		return;
+
+	/* We only track the undo of our own transaction. */
+	if (!FullTransactionIdIsValid(fxid) ||
+		!TransactionIdEquals(uur->uur_xid, XidFromFullTransactionId(fxid)))
+	{
+		touched_overflow = true;
+		return;
+	}
+
+	persistence = UndoLogGet(UndoRecPtrGetLogNo(urp))->meta.persistence;
+
+	/* We can only apply undo page by page if every record has a page. */
+	if (uur->uur_block == InvalidBlockNumber)
+	{
+		touched_overflow = true;
+		return;
+	}
+
+	/* Consecutive records are usually for the same page, so check it first. */
+	i = last_touched;
+	if (i >= ntouched ||
+		touched_pages[i].blkno != uur->uur_block ||
+		touched_pages[i].reloid != uur->uur_reloid ||
+		touched_pages[i].rmid != uur->uur_rmid ||
+		touched_pages[i].fork != uur->uur_fork ||
+		touched_pages[i].persistence != persistence)
+	{
+		for (i = 0; i < ntouched; i++)
+		{
+			page = &touched_pages[i];
+			if (page->blkno == uur->uur_block &&
+				page->reloid == uur->uur_reloid &&
+				page->rmid == uur->uur_rmid &&
+				page->fork == uur->uur_fork &&
+				page->persistence == persistence)
+				break;
+		}
+	}
+
+	if (i == ntouched)
+	{
+		if (ntouched == MAX_UNDO_TOUCHED_PAGES)
+		{
+			touched_overflow = true;
+			return;
+		}
+		page = &touched_pages[ntouched++];
+		page->rmid = uur->uur_rmid;
+		page->persistence = persistence;
+		page->reloid = uur->uur_reloid;
+		page->fork = uur->uur_fork;
+		page->blkno = uur->uur_block;
+	}
+
+	touched_pages[i].urp = urp;
+	last_touched = i;
+}
+
+/*
+ * UndoForgetTouchedPages - stop tracking the pages touched by the current
+ * transaction
+ *
+ * Called when the undo of a subtransaction is applied: that resets the undo
+ * chains of the pages it touched, so our latest undo record pointers can no
+ * longer be trusted.
+ */
+void
+UndoForgetTouchedPages(void)
+{
+	touched_overflow = true;
+}
+
+/*
+ * undo_touched_page_comparator
+ *
+ * qsort comparator to apply the undo of touched pages in the same order as
+ * undo_record_comparator would.
+ */
+static int
+undo_touched_page_comparator(const void *left, const void *right)
+{
+	const UndoTouchedPage *l = (const UndoTouchedPage *) left;
+	const UndoTouchedPage *r = (const UndoTouchedPage *) right;
+
+	if (l->rmid != r->rmid)
+		return (l->rmid < r->rmid) ? -1 : 1;
+	if (l->reloid != r->reloid)
+		return (l->reloid < r->reloid) ? -1 : 1;
+	if (l->fork != r->fork)
+		return (l->fork < r->fork) ? -1 : 1;
+	if (l->blkno != r->blkno)
+		return (l->blkno < r->blkno) ? -1 : 1;
+	return 0;
+}
+
+/*
+ * execute_undo_actions_touched - Apply the undo of the current transaction
+ * using the set of pages it touched
+ *
+ * Instead of reading back all the undo of the transaction, follow the undo
+ * chain of each touched page from its latest undo record, as is done when
+ * rolling back a single page.  Returns false, without doing anything, if the
+ * set isn't known to be complete for this transaction.
+ */
+static bool
+execute_undo_actions_touched(FullTransactionId full_xid,
+							 UndoPersistence persistence)
+{
+	TransactionId xid = XidFromFullTransactionId(full_xid);
+	UndoTouchedPage *pages;
+	int			undo_apply_size = maintenance_work_mem * 1024L;
+	int			npages = 0;
+	int			i;
+
+	if (touched_overflow || ntouched == 0 ||
+		!FullTransactionIdEquals(touched_fxid, full_xid))
+		return false;
+
+	/* Copy out the pages for this persistence level, in block order. */
+	pages = palloc(sizeof(UndoTouchedPage) * ntouched);
+	for (i = 0; i < ntouched; i++)
+	{
+		if (touched_pages[i].persistence == persistence)
+			pages[npages++] = touched_pages[i];
+	}
+	qsort(pages, npages, sizeof(UndoTouchedPage),
+		  undo_touched_page_comparator);
+
+	for (i = 0; i < npages; i++)
+	{
+		UndoRecPtr	urec_ptr = pages[i].urp;
+
+		do
+		{
+			UndoRecInfo *urp_array;
+			int			nrecords;
+			int			j;
+
+			urp_array = UndoRecordBulkFetch(&urec_ptr, InvalidUndoRecPtr,
+											undo_apply_size, &nrecords, true);
+			if (nrecords == 0)
+				break;
+
+			/*
+			 * The page's undo chain ends where another transaction's undo
+			 * starts.
+			 */
+			if (TransactionIdEquals(urp_array[0].uur->uur_xid, xid))
+				execute_undo_actions_page(urp_array, 0, nrecords - 1,
+										  pages[i].reloid, full_xid,
+										  pages[i].blkno,
+										  !UndoRecPtrIsValid(urec_ptr));
+			else
+				urec_ptr = InvalidUndoRecPtr;
+
+			for (j = 0; j < nrecords; j++)
+				UndoRecordRelease(urp_array[j].uur);
+			pfree(urp_array);
+		} while (UndoRecPtrIsValid(urec_ptr));
+	}
+
+	pfree(pages);
+
+	return true;
+}
+
 /*
  * undo_record_comparator
  *
@@ -323,6 +552,72 @@ undo_record_comparator(const void *left, const void *right)
 		return 1;
 }
 
+/*
+ * PrefetchUndoTargetPages - Prefetch the data pages to apply undo actions on
+ *
+ * urp_array must be sorted by target block, see undo_record_comparator.
+ * Starting at *prefetch_index, this prefetches one target block at a time
+ * until *prefetch_pages reaches prefetch_target, and advances both counters.
+ * The caller decrements *prefetch_pages as it applies the actions for each
+ * block, so the prefetches run that many blocks ahead of the apply.
+ */
+static void
+PrefetchUndoTargetPages(UndoRecInfo *urp_array, int nrecords,
+						int prefetch_target, int *prefetch_index,
+						int *prefetch_pages)
+{
+	Relation	rel = NULL;
+	BlockNumber nblocks = 0;
+	int			i = *prefetch_index;
+
+	while (i < nrecords && *prefetch_pages < prefetch_target)
+	{
+		UnpackedUndoRecord *uur = urp_array[i].uur;
+
+		if (OidIsValid(uur->uur_reloid) && uur->uur_fork == MAIN_FORKNUM &&
+			BlockNumberIsValid(uur->uur_block))
+		{
+			/*
+			 * Take the same lock as the undo actions will, so that the
+			 * relation can't be truncated or dropped while we look at it.
+			 */
+			if (rel == NULL || RelationGetRelid(rel) != uur->uur_reloid)
+			{
+				if (rel != NULL)
+					relation_close(rel, RowExclusiveLock);
+				rel = try_relation_open(uur->uur_reloid, RowExclusiveLock);
+				nblocks = (rel != NULL) ? RelationGetNumberOfBlocks(rel) : 0;
+			}
+
+			if (uur->uur_block < nblocks)
+				PrefetchBuffer(rel, MAIN_FORKNUM, uur->uur_block);
+		}
+
+		/*
+		 * Count the block even if we didn't prefetch it, so that we stay in
+		 * step with the caller.
+		 */
+		(*prefetch_pages)++;
+
+		/* Skip the remaining records for the same block. */
+		for (i++; i < nrecords; i++)
+		{
+			UnpackedUndoRecord *next = urp_array[i].uur;
+
+			if (next->uur_rmid != uur->uur_rmid ||
+				next->uur_reloid != uur->uur_reloid ||
+				next->uur_fork != uur->uur_fork ||
+				next->uur_block != uur->uur_block)
+				break;
+		}
+	}
+
+	if (rel != NULL)
+		relation_close(rel, RowExclusiveLock);
+
+	*prefetch_index = i;
+}
+
 /*
  * execute_undo_actions - Execute the undo actions
  *
@@ -384,6 +679,14 @@ execute_undo_actions(FullTransactionId full_xid, UndoRecPtr from_urecptr,
 
 		UndoRecordRelease(uur);
 		uur = NULL;
+
+		/*
+		 * If we know all the pages this transaction has touched, apply the
+		 * undo page by page instead.
+		 */
+		if (execute_undo_actions_touched(full_xid,
+										 UndoLogGet(UndoRecPtrGetLogNo(from_urecptr))->meta.persistence))
+			urec_ptr = InvalidUndoRecPtr;
 	}
 
 	/*
@@ -399,6 +702,7 @@ execute_undo_actions(FullTransactionId full_xid, UndoRecPtr from_urecptr,
 		int			i;
 		int			nrecords;
 		int			last_index = 0;
+		int			prefetch_index = 0;
 		int			prefetch_pages = 0;
 
 		/*
@@ -435,6 +739,17 @@ execute_undo_actions(FullTransactionId full_xid, UndoRecPtr from_urecptr,
 		else
 			blk_chain_complete = false;
 
+		/*
+		 * The target blocks are now in order, so start reading them in
+		 * ahead of applying the undo actions on them.  Don't bother for a
+		 * subtransaction: it has only just modified those blocks, so they
+		 * are almost certainly still in shared buffers.
+		 */
+		if (target_prefetch_pages > 0 && nopartial)
+			PrefetchUndoTargetPages(urp_array, nrecords,
+									target_prefetch_pages,
+									&prefetch_index, &prefetch_pages);
+
 		/*
 		 * Now we have urp_array which is sorted in the block order so
 		 * traverse this array and apply the undo action block by block.
@@ -461,6 +776,15 @@ execute_undo_actions(FullTransactionId full_xid, UndoRecPtr from_urecptr,
 				/* We have consumed one prefetched page. */
 				if (prefetch_pages > 0)
 					prefetch_pages--;
+
+				/*
+				 * If prefetch_pages are half of the prefetch target then it's
+				 * time to prefetch again.
+				 */
+				if (nopartial && prefetch_pages < target_prefetch_pages / 2)
+					PrefetchUndoTargetPages(urp_array, nrecords,
+											target_prefetch_pages,
+											&prefetch_index, &prefetch_pages);
 			}
 
 			prev_rmid = uur->uur_rmid;
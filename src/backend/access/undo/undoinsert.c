@@ -64,6 +64,7 @@
 #include "access/undorecord.h"
 #include "access/undoinsert.h"
 #include "access/undolog_xlog.h"
+#include "access/undorequest.h"
 #include "access/xact.h"
 #include "access/xlog.h"
 #include "access/xlogutils.h"
@@ -140,6 +141,12 @@ static int	prepare_idx;
 static int	max_prepared_undo = MAX_PREPARED_UNDO;
 static UndoRecPtr prepared_urec_ptr = InvalidUndoRecPtr;
 
+/*
+ * Running count of the undo records UndoFetchRecord has read, so that callers
+ * can tell how far back along an undo chain a lookup had to go.
+ */
+uint64		UndoRecordsFetched = 0;
+
 /*
  * By default prepared_undo and undo_buffer points to the static memory.
  * In case caller wants to support more than default max_prepared undo records
@@ -709,7 +716,12 @@ resize:
 		(log->meta.insert == log->meta.last_xact_start || log_switched))
 	{
 		need_xact_hdr = true;
-		urec->uur_info = 0;		/* force recomputation of info bits */
+		/*
+		 * Force recomputation of info bits, but retain the ones describing
+		 * the payload as those are set by the caller.
+		 */
+		urec->uur_info &= ~(UREC_INFO_RELATION_DETAILS | UREC_INFO_BLOCK |
+							UREC_INFO_PAYLOAD | UREC_INFO_TRANSACTION);
 		goto resize;
 	}
 
@@ -1054,6 +1066,21 @@ InsertPreparedUndo(void)
 		 * to perform rollback during abort of transaction.
 		 */
 		SetCurrentUndoLocation(urp);
+
+		/* Remember the page, in case we need to roll back. */
+		if (!InRecovery)
+			UndoRememberTouchedPage(uur, urp);
+
+		/*
+		 * The compressed copy of the tuple is not needed once the record is
+		 * written; the stored length is kept so the size can be recomputed.
+		 */
+		if ((uur->uur_info & UREC_INFO_TUPLE_COMPRESSED) != 0 &&
+			uur->uur_ztuple.data != NULL)
+		{
+			pfree(uur->uur_ztuple.data);
+			uur->uur_ztuple.data = NULL;
+		}
 	}
 
 	/* Update previously prepared transaction headers. */
@@ -1184,6 +1211,11 @@ ResetUndoRecord(UnpackedUndoRecord *urec, UndoRecPtr urp, RelFileNode *rnode,
 			ReleaseBuffer(urec->uur_buffer);
 			urec->uur_buffer = InvalidBuffer;
 		}
+
+		/* A decompressed tuple never points into the buffer. */
+		if ((urec->uur_info & UREC_INFO_TUPLE_COMPRESSED) != 0 &&
+			urec->uur_tuple.data)
+			pfree(urec->uur_tuple.data);
 	}
 	else
 	{
@@ -1195,11 +1227,16 @@ ResetUndoRecord(UnpackedUndoRecord *urec, UndoRecPtr urp, RelFileNode *rnode,
 			pfree(urec->uur_payload.data);
 		if (urec->uur_tuple.data)
 			pfree(urec->uur_tuple.data);
+		if ((urec->uur_info & UREC_INFO_TUPLE_COMPRESSED) != 0 &&
+			urec->uur_ztuple.data)
+			pfree(urec->uur_ztuple.data);
 	}
 
 	/* Reset the urec before fetching the tuple */
 	urec->uur_tuple.data = NULL;
 	urec->uur_tuple.len = 0;
+	urec->uur_ztuple.data = NULL;
+	urec->uur_ztuple.len = 0;
 	urec->uur_payload.data = NULL;
 	urec->uur_payload.len = 0;
 }
@@ -1268,9 +1305,14 @@ UndoFetchRecord(UndoRecPtr urp, BlockNumber blkno, OffsetNumber offset,
 			return NULL;
 		}
 
-		/* Fetch the current undo record. */
+		/*
+		 * Fetch the current undo record.  Its tuple isn't decompressed until
+		 * we know it's the one we want, as the callback only looks at the
+		 * header and payload.
+		 */
 		UndoGetOneRecord(urec, urp, rnode, log->meta.persistence, false);
 		LWLockRelease(&log->discard_lock);
+		UndoRecordsFetched++;
 
 		if (blkno == InvalidBlockNumber)
 			break;
@@ -1289,6 +1331,8 @@ UndoFetchRecord(UndoRecPtr urp, BlockNumber blkno, OffsetNumber offset,
 		ResetUndoRecord(urec, urp, &rnode, &prevrec_rnode);
 	}
 
+	UndoRecordDecompressTuple(urec);
+
 	if (urec_ptr_out)
 		*urec_ptr_out = urp;
 	return urec;
@@ -1443,6 +1487,11 @@ UndoRecordRelease(UnpackedUndoRecord *urec)
 	if (BufferIsValid(urec->uur_buffer))
 	{
 		ReleaseBuffer(urec->uur_buffer);
+
+		/* A decompressed tuple never points into the buffer. */
+		if ((urec->uur_info & UREC_INFO_TUPLE_COMPRESSED) != 0 &&
+			urec->uur_tuple.data)
+			pfree(urec->uur_tuple.data);
 	}
 	else
 	{
@@ -1450,6 +1499,9 @@ UndoRecordRelease(UnpackedUndoRecord *urec)
 			pfree(urec->uur_payload.data);
 		if (urec->uur_tuple.data)
 			pfree(urec->uur_tuple.data);
+		if ((urec->uur_info & UREC_INFO_TUPLE_COMPRESSED) != 0 &&
+			urec->uur_ztuple.data)
+			pfree(urec->uur_ztuple.data);
 	}
 
 	pfree(urec);
@@ -87,6 +87,49 @@
 /* Extract the lower bits of an xid, for undo log mapping purposes. */
 #define UndoLogGetXidLow(xid) ((xid) & ((1 << UndoLogXidLowBits) - 1))
 
+/*
+ * Cumulative write statistics for one undo tablespace.  Slots are handed out
+ * under UndoLogLock and never reused; the counters are updated without any
+ * lock.
+ */
+#define MAX_UNDO_TABLESPACE_STATS 32
+
+typedef struct UndoTablespaceStats
+{
+	Oid			tablespace;
+	pg_atomic_uint64 attaches;	/* number of times an undo log was attached */
+	pg_atomic_uint64 logs_created;	/* undo logs created */
+	pg_atomic_uint64 bytes_written; /* undo bytes allocated */
+	pg_atomic_uint64 segments_created;	/* segment files created */
+} UndoTablespaceStats;
+
+/*
+ * Every this many checkpoints CheckPointUndoLogs() writes a full snapshot of
+ * the undo log meta-data, rather than a delta against the previous file.
+ */
+#define UNDO_CHECKPOINT_FULL_INTERVAL 8
+
+/*
+ * Header of a file under pg_undo.  It is followed by 'nentries'
+ * UndoCheckPointEntry structs; a full snapshot has one for each log between
+ * low_logno and high_logno, a delta only for those that changed since the
+ * file for base_redo was written.
+ */
+typedef struct UndoCheckPointHeader
+{
+	UndoLogNumber low_logno;	/* the lowest logno */
+	UndoLogNumber high_logno;	/* one past the highest logno */
+	XLogRecPtr	base_redo;		/* file this delta applies to, or invalid */
+	XLogRecPtr	full_redo;		/* full snapshot at the head of the chain */
+	uint32		nentries;		/* number of entries that follow */
+} UndoCheckPointHeader;
+
+typedef struct UndoCheckPointEntry
+{
+	UndoLogNumber logno;
+	UndoLogMetaData meta;
+} UndoCheckPointEntry;
+
 /*
  * Main control structure for undo log management in shared memory.
  */
@@ -105,6 +148,23 @@ typedef struct UndoLogSharedData
 	 * 'banks'.
 	 */
 	dsm_handle	banks[UndoLogBanks];
+
+	/*
+	 * The newest file under pg_undo, the full snapshot its chain starts from
+	 * and the number of deltas in between.  Set by StartupUndoLogs() before
+	 * any checkpoint or restartpoint can run, and then only accessed by
+	 * CheckPointUndoLogs().
+	 */
+	XLogRecPtr	checkpoint_redo;
+	XLogRecPtr	checkpoint_full_redo;
+	int			checkpoint_chain_length;
+
+	/* Round-robin position in undo_tablespaces for newly attached logs. */
+	pg_atomic_uint32 next_tablespace;
+
+	/* Per-tablespace statistics, protected by UndoLogLock. */
+	int			ntablespace_stats;
+	UndoTablespaceStats tablespace_stats[MAX_UNDO_TABLESPACE_STATS];
 }			UndoLogSharedData;
 
 /*
@@ -174,18 +234,22 @@ char	   *undo_tablespaces = NULL;
 
 static UndoLogControl *get_undo_log_by_number(UndoLogNumber logno);
 static void ensure_undo_log_number(UndoLogNumber logno);
-static void attach_undo_log(UndoPersistence level, Oid tablespace);
+static void attach_undo_log(UndoPersistence level, Oid *tablespaces,
+							int ntablespaces);
 static void detach_current_undo_log(UndoPersistence level, bool exhausted);
 static void extend_undo_log(UndoLogNumber logno, UndoLogOffset new_end);
 static void undo_log_before_exit(int code, Datum value);
 static void forget_undo_buffers(int logno, UndoLogOffset old_discard,
 								UndoLogOffset new_discard,
 								bool drop_tail);
-static bool choose_undo_tablespace(bool force_detach, Oid *oid);
+static bool choose_undo_tablespace(bool force_detach, Oid **tablespaces,
+								   int *ntablespaces);
 static void undolog_xid_map_gc(void);
 static void undolog_bank_gc(void);
+static UndoTablespaceStats *get_undo_tablespace_stats(UndoLogControl *log);
 
 PG_FUNCTION_INFO_V1(pg_stat_get_undo_logs);
+PG_FUNCTION_INFO_V1(pg_stat_get_undo_tablespaces);
 
 /*
  * Return the amount of traditional smhem required for undo log management.
@@ -224,6 +288,17 @@ UndoLogShmemInit(void)
 			shared->free_lists[i] = InvalidUndoLogNumber;
 		shared->low_bankno = 0;
 		shared->high_bankno = 0;
+		pg_atomic_init_u32(&shared->next_tablespace, 0);
+		for (i = 0; i < MAX_UNDO_TABLESPACE_STATS; ++i)
+		{
+			UndoTablespaceStats *stats = &shared->tablespace_stats[i];
+
+			stats->tablespace = InvalidOid;
+			pg_atomic_init_u64(&stats->attaches, 0);
+			pg_atomic_init_u64(&stats->logs_created, 0);
+			pg_atomic_init_u64(&stats->bytes_written, 0);
+			pg_atomic_init_u64(&stats->segments_created, 0);
+		}
 	}
 	else
 		Assert(found);
@@ -464,7 +539,7 @@ undo_log_before_exit(int code, Datum arg)
  */
 static void
 allocate_empty_undo_segment(UndoLogNumber logno, Oid tablespace,
-							UndoLogOffset end)
+							UndoLogOffset end, bool preallocate)
 {
 	struct stat stat_buffer;
 	off_t		size;
@@ -543,6 +618,18 @@ allocate_empty_undo_segment(UndoLogNumber logno, Oid tablespace,
 	}
 	if (fd < 0)
 		elog(ERROR, "could not create new file \"%s\": %m", path);
+
+	/*
+	 * A segment of a temporary undo log is only created when one of its
+	 * pages is written out of the local buffers, and won't survive a crash
+	 * anyway, so it may stay sparse and needn't be flushed.
+	 */
+	if (!preallocate)
+	{
+		CloseTransientFile(fd);
+		return;
+	}
+
 	if (fstat(fd, &stat_buffer) < 0)
 		elog(ERROR, "could not stat \"%s\": %m", path);
 	size = stat_buffer.st_size;
@@ -578,7 +665,19 @@ void
 UndoLogNewSegment(UndoLogNumber logno, Oid tablespace, int segno)
 {
 	Assert(InRecovery);
-	allocate_empty_undo_segment(logno, tablespace, segno * UndoLogSegmentSize);
+	allocate_empty_undo_segment(logno, tablespace, segno * UndoLogSegmentSize,
+								true);
+}
+
+/*
+ * Create a segment of a temporary undo log, when the first of its pages is
+ * written out of the local buffers.  See extend_undo_log.
+ */
+void
+UndoLogNewTempSegment(UndoLogNumber logno, Oid tablespace, int segno)
+{
+	allocate_empty_undo_segment(logno, tablespace, segno * UndoLogSegmentSize,
+								false);
 }
 
 /*
@@ -589,16 +688,32 @@ static void
 extend_undo_log(UndoLogNumber logno, UndoLogOffset new_end)
 {
 	UndoLogControl *log;
+	UndoTablespaceStats *stats;
 	char		dir[MAXPGPATH];
 	size_t		end;
 
 	log = get_undo_log_by_number(logno);
+	stats = get_undo_tablespace_stats(log);
 
 	Assert(log != NULL);
 	Assert(log->meta.end % UndoLogSegmentSize == 0);
 	Assert(new_end % UndoLogSegmentSize == 0);
 	Assert(MyUndoLogState.logs[log->meta.persistence] == log || InRecovery);
 
+	/*
+	 * The undo of temporary tables lives in this backend's local buffers,
+	 * and only reaches the disk if they overflow; the segment file is then
+	 * created by undofile.c.  So there are no files to create here, and
+	 * nothing to WAL-log, since temporary undo logs are reset after a crash.
+	 */
+	if (log->meta.persistence == UNDO_TEMP)
+	{
+		LWLockAcquire(&log->mutex, LW_EXCLUSIVE);
+		log->meta.end = new_end;
+		LWLockRelease(&log->mutex);
+		return;
+	}
+
 	/*
 	 * Create all the segments needed to increase 'end' to the requested size.
 	 * This is quite expensive, so we will try to avoid it completely by
@@ -607,8 +722,10 @@ extend_undo_log(UndoLogNumber logno, UndoLogOffset new_end)
 	end = log->meta.end;
 	while (end < new_end)
 	{
-		allocate_empty_undo_segment(logno, log->meta.tablespace, end);
+		allocate_empty_undo_segment(logno, log->meta.tablespace, end, true);
 		end += UndoLogSegmentSize;
+		if (stats != NULL)
+			pg_atomic_fetch_add_u64(&stats->segments_created, 1);
 	}
 
 	/*
@@ -712,15 +829,17 @@ retry:
 	/* See if we need to check the undo_tablespaces GUC. */
 	if (unlikely(MyUndoLogState.need_to_choose_tablespace || log == NULL))
 	{
-		Oid			tablespace;
+		Oid		   *tablespaces;
+		int			ntablespaces;
 		bool		need_to_unlock;
 
 		need_to_unlock =
 			choose_undo_tablespace(MyUndoLogState.need_to_choose_tablespace,
-								   &tablespace);
-		attach_undo_log(persistence, tablespace);
+								   &tablespaces, &ntablespaces);
+		attach_undo_log(persistence, tablespaces, ntablespaces);
 		if (need_to_unlock)
 			LWLockRelease(TablespaceCreateLock);
+		pfree(tablespaces);
 		log = MyUndoLogState.logs[persistence];
 		MyUndoLogState.need_to_choose_tablespace = false;
 	}
@@ -885,6 +1004,7 @@ void
 UndoLogAdvance(UndoRecPtr insertion_point, size_t size, UndoPersistence persistence)
 {
 	UndoLogControl *log = NULL;
+	UndoTablespaceStats *stats;
 	UndoLogNumber logno = UndoRecPtrGetLogNo(insertion_point);
 
 	/*
@@ -901,6 +1021,10 @@ UndoLogAdvance(UndoRecPtr insertion_point, size_t size, UndoPersistence persiste
 	LWLockAcquire(&log->mutex, LW_EXCLUSIVE);
 	log->meta.insert = UndoLogOffsetPlusUsableBytes(log->meta.insert, size);
 	LWLockRelease(&log->mutex);
+
+	stats = get_undo_tablespace_stats(log);
+	if (stats != NULL)
+		pg_atomic_fetch_add_u64(&stats->bytes_written, size);
 }
 
 /*
@@ -970,6 +1094,7 @@ UndoLogDiscard(UndoRecPtr discard_point, TransactionId xid)
 	new_segno = discard / UndoLogSegmentSize;
 	if (segno < new_segno)
 	{
+		bool		temp = (log->meta.persistence == UNDO_TEMP);
 		int			recycle;
 		UndoLogOffset pointer;
 
@@ -977,7 +1102,7 @@ UndoLogDiscard(UndoRecPtr discard_point, TransactionId xid)
 		 * We always WAL-log discards, but we only need to flush the WAL if we
 		 * have performed a filesystem operation.
 		 */
-		need_to_flush_wal = true;
+		need_to_flush_wal = !temp;
 
 		/*
 		 * XXX When we rename or unlink a file, it's possible that some
@@ -1014,7 +1139,7 @@ UndoLogDiscard(UndoRecPtr discard_point, TransactionId xid)
 		 * (2) reduce the rate of fsyncs require for recycling by doing
 		 * several at once
 		 */
-		if (log->meta.end - log->meta.insert < UndoLogSegmentSize)
+		if (log->meta.end - log->meta.insert < UndoLogSegmentSize && !temp)
 			recycle = 1;
 		else
 			recycle = 0;
@@ -1027,8 +1152,9 @@ UndoLogDiscard(UndoRecPtr discard_point, TransactionId xid)
 			char		discard_path[MAXPGPATH];
 
 			/* Tell the checkpointer that the file is going away. */
-			undofile_forget_sync(log->logno, pointer / UndoLogSegmentSize,
-								 log->meta.tablespace);
+			if (!temp)
+				undofile_forget_sync(log->logno, pointer / UndoLogSegmentSize,
+									 log->meta.tablespace);
 
 			UndoLogSegmentPath(logno, pointer / UndoLogSegmentSize,
 							   log->meta.tablespace, discard_path);
@@ -1060,14 +1186,15 @@ UndoLogDiscard(UndoRecPtr discard_point, TransactionId xid)
 			{
 				if (unlink(discard_path) == 0)
 					elog(LOG, "unlinked undo segment \"%s\"", discard_path);	/* XXX: remove me */
-				else
+				else if (!temp || errno != ENOENT)
 					elog(ERROR, "could not unlink \"%s\": %m", discard_path);
 			}
 			pointer += UndoLogSegmentSize;
 		}
 	}
 
-	/* WAL log the discard. */
+	/* WAL log the discard, unless it's of temporary undo. */
+	if (log->meta.persistence != UNDO_TEMP)
 	{
 		xl_undolog_discard xlrec;
 		XLogRecPtr	ptr;
@@ -1172,7 +1299,8 @@ UndoLogRewind(UndoRecPtr insert_urp)
 	log->need_attach_wal_record = true;
 	LWLockRelease(&log->mutex);
 
-	/* WAL log the rewind. */
+	/* WAL log the rewind, unless it's a temporary or unlogged undo log. */
+	if (log->meta.persistence == UNDO_PERMANENT)
 	{
 		xl_undolog_rewind xlrec;
 
@@ -1185,6 +1313,49 @@ UndoLogRewind(UndoRecPtr insert_urp)
 	}
 }
 
+/*
+ * Discard the undo written by a subtransaction that has just been rolled
+ * back, by rewinding the insert pointer of our undo log back to 'start_urp',
+ * where the subtransaction's undo began.  Once its undo actions have been
+ * applied nothing refers to that undo anymore, and rewinding keeps the undo
+ * of the toplevel transaction contiguous.  This matters for workloads that
+ * abort a subtransaction per row, e.g. PL/pgSQL EXCEPTION blocks, which would
+ * otherwise keep the undo of every aborted subtransaction until the toplevel
+ * transaction's undo is discarded.
+ *
+ * 'parent_urp' is the latest undo record of the parent transaction, if any.
+ * We only rewind if the subtransaction's undo and the parent's are all in the
+ * undo log we are currently attached to, so that we never need to undo a log
+ * switch.  Returns true if the insert pointer was rewound.
+ */
+bool
+UndoLogRewindSubXact(UndoPersistence persistence, UndoRecPtr start_urp,
+					 UndoRecPtr parent_urp)
+{
+	UndoLogControl *log = MyUndoLogState.logs[persistence];
+
+	Assert(IsSubTransaction());
+
+	if (log == NULL || !UndoRecPtrIsValid(start_urp))
+		return false;
+	if (UndoRecPtrGetLogNo(start_urp) != log->logno)
+		return false;
+	if (UndoRecPtrIsValid(parent_urp) &&
+		UndoRecPtrGetLogNo(parent_urp) != log->logno)
+		return false;
+
+	/*
+	 * No need for the mutex to read the insert pointer, since only the
+	 * attached backend changes it.
+	 */
+	if (UndoRecPtrGetOffset(start_urp) >= log->meta.insert)
+		return false;
+
+	UndoLogRewind(start_urp);
+
+	return true;
+}
+
 /*
  * Delete unreachable files under pg_undo.  Any files corresponding to LSN
  * positions before the previous checkpoint are no longer needed.
@@ -1235,20 +1406,33 @@ CleanUpUndoCheckPointFiles(XLogRecPtr checkPointRedo)
  * contents of undo logs is in shared buffers and therefore handled by
  * CheckPointBuffers(), but here we record the table of undo logs and their
  * properties.
+ *
+ * With many undo logs, most of them idle, rewriting the meta-data of all of
+ * them at every checkpoint is wasteful.  So only every
+ * UNDO_CHECKPOINT_FULL_INTERVAL checkpoints we write a full snapshot; in
+ * between we write a delta file holding only the logs whose meta-data changed
+ * since the previous file, which it names as its base.  StartupUndoLogs()
+ * follows that chain back to the full snapshot.
  */
 void
 CheckPointUndoLogs(XLogRecPtr checkPointRedo, XLogRecPtr priorCheckPointRedo)
 {
 	UndoLogSharedData *shared = MyUndoLogState.shared;
-	UndoLogMetaData *serialized = NULL;
+	UndoCheckPointHeader hdr;
+	UndoCheckPointEntry *entries = NULL;
+	XLogRecPtr	prior_full_redo = shared->checkpoint_full_redo;
+	XLogRecPtr	keep_redo;
 	UndoLogNumber low_logno;
 	UndoLogNumber high_logno;
 	UndoLogNumber logno;
 	size_t		serialized_size = 0;
 	char	   *data;
 	char		path[MAXPGPATH];
+	bool		full;
 	int			num_logs;
+	int			nentries = 0;
 	int			fd;
+	int			i;
 	pg_crc32c	crc;
 
 	/*
@@ -1281,6 +1465,14 @@ CheckPointUndoLogs(XLogRecPtr checkPointRedo, XLogRecPtr priorCheckPointRedo)
 	/* Detach from any banks that we don't need if low_logno advanced. */
 	undolog_bank_gc();
 
+	/*
+	 * Decide whether to write a full snapshot.  We must if there's no file
+	 * to base a delta on, which is the case after initdb.
+	 */
+	full = XLogRecPtrIsInvalid(shared->checkpoint_redo) ||
+		shared->checkpoint_redo >= checkPointRedo ||
+		shared->checkpoint_chain_length >= UNDO_CHECKPOINT_FULL_INTERVAL;
+
 	/*
 	 * We acquire UndoLogLock to prevent any undo logs from being created or
 	 * discarded while we build a snapshot of them.  This isn't expected to
@@ -1301,8 +1493,8 @@ CheckPointUndoLogs(XLogRecPtr checkPointRedo, XLogRecPtr priorCheckPointRedo)
 	 */
 	if (num_logs > 0)
 	{
-		serialized_size = sizeof(UndoLogMetaData) * num_logs;
-		serialized = (UndoLogMetaData *) palloc0(serialized_size);
+		entries = (UndoCheckPointEntry *)
+			palloc0(sizeof(UndoCheckPointEntry) * num_logs);
 
 		for (logno = low_logno; logno != high_logno; ++logno)
 		{
@@ -1315,13 +1507,27 @@ CheckPointUndoLogs(XLogRecPtr checkPointRedo, XLogRecPtr priorCheckPointRedo)
 			/* Capture snapshot while holding the mutex. */
 			LWLockAcquire(&log->mutex, LW_EXCLUSIVE);
 			log->need_attach_wal_record = true;
-			memcpy(&serialized[logno], &log->meta, sizeof(UndoLogMetaData));
+			if (full || memcmp(&log->meta, &log->checkpointed_meta,
+							   sizeof(UndoLogMetaData)) != 0)
+			{
+				entries[nentries].logno = logno;
+				memcpy(&entries[nentries].meta, &log->meta,
+					   sizeof(UndoLogMetaData));
+				++nentries;
+			}
 			LWLockRelease(&log->mutex);
 		}
 	}
 
 	LWLockRelease(UndoLogLock);
 
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.low_logno = low_logno;
+	hdr.high_logno = high_logno;
+	hdr.base_redo = full ? InvalidXLogRecPtr : shared->checkpoint_redo;
+	hdr.full_redo = full ? checkPointRedo : shared->checkpoint_full_redo;
+	hdr.nentries = nentries;
+
 	/* Dump into a file under pg_undo. */
 	snprintf(path, MAXPGPATH, "pg_undo/%016" INT64_MODIFIER "X",
 			 checkPointRedo);
@@ -1334,20 +1540,19 @@ CheckPointUndoLogs(XLogRecPtr checkPointRedo, XLogRecPtr priorCheckPointRedo)
 
 	/* Compute header checksum. */
 	INIT_CRC32C(crc);
-	COMP_CRC32C(crc, &low_logno, sizeof(low_logno));
-	COMP_CRC32C(crc, &high_logno, sizeof(high_logno));
+	COMP_CRC32C(crc, &hdr, sizeof(hdr));
 	FIN_CRC32C(crc);
 
-	/* Write out range of active log numbers + crc. */
-	if ((write(fd, &low_logno, sizeof(low_logno)) != sizeof(low_logno)) ||
-		(write(fd, &high_logno, sizeof(high_logno)) != sizeof(high_logno)) ||
+	/* Write out the header + crc. */
+	if ((write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) ||
 		(write(fd, &crc, sizeof(crc)) != sizeof(crc)))
 		ereport(ERROR,
 				(errcode_for_file_access(),
 				 errmsg("could not write to file \"%s\": %m", path)));
 
-	/* Write out the meta data for all undo logs in that range. */
-	data = (char *) serialized;
+	/* Write out the meta data for the undo logs we captured. */
+	serialized_size = sizeof(UndoCheckPointEntry) * nentries;
+	data = (char *) entries;
 	INIT_CRC32C(crc);
 	while (serialized_size > 0)
 	{
@@ -1377,68 +1582,184 @@ CheckPointUndoLogs(XLogRecPtr checkPointRedo, XLogRecPtr priorCheckPointRedo)
 	fsync_fname("pg_undo", true);
 	pgstat_report_wait_end();
 
-	if (serialized)
-		pfree(serialized);
+	/*
+	 * Now that the file is durable, remember what we wrote so that the next
+	 * checkpoint can skip unchanged logs.  Only the checkpointer reaches
+	 * here, and nobody else can remove logs in the range we captured.
+	 */
+	for (i = 0; i < nentries; ++i)
+	{
+		UndoLogControl *log = get_undo_log_by_number(entries[i].logno);
+
+		if (log != NULL)
+			memcpy(&log->checkpointed_meta, &entries[i].meta,
+				   sizeof(UndoLogMetaData));
+	}
+	shared->checkpoint_redo = checkPointRedo;
+	shared->checkpoint_full_redo = hdr.full_redo;
+	shared->checkpoint_chain_length = full ? 0 :
+		shared->checkpoint_chain_length + 1;
+
+	if (entries)
+		pfree(entries);
 
-	CleanUpUndoCheckPointFiles(priorCheckPointRedo);
+	/*
+	 * The files from the previous checkpoint's redo point onwards are still
+	 * needed, along with the chain of files leading to it.
+	 */
+	keep_redo = priorCheckPointRedo;
+	if (!XLogRecPtrIsInvalid(prior_full_redo) && prior_full_redo < keep_redo)
+		keep_redo = prior_full_redo;
+	CleanUpUndoCheckPointFiles(keep_redo);
 	undolog_xid_map_gc();
 }
 
-void
-StartupUndoLogs(XLogRecPtr checkPointRedo)
+/*
+ * Read one file under pg_undo and verify its checksums.  Returns the
+ * meta-data entries in a palloc'd array.
+ */
+static UndoCheckPointEntry *
+read_undo_checkpoint_file(XLogRecPtr redo, UndoCheckPointHeader *hdr)
 {
-	UndoLogSharedData *shared = MyUndoLogState.shared;
+	UndoCheckPointEntry *entries;
 	char		path[MAXPGPATH];
-	int			logno;
+	size_t		size;
 	int			fd;
 	pg_crc32c	crc;
 	pg_crc32c	new_crc;
 
-	/* If initdb is calling, there is no file to read yet. */
-	if (IsBootstrapProcessingMode())
-		return;
-
-	/* Open the pg_undo file corresponding to the given checkpoint. */
-	snprintf(path, MAXPGPATH, "pg_undo/%016" INT64_MODIFIER "X",
-			 checkPointRedo);
-	pgstat_report_wait_start(WAIT_EVENT_UNDO_CHECKPOINT_READ);
+	snprintf(path, MAXPGPATH, "pg_undo/%016" INT64_MODIFIER "X", redo);
 	fd = OpenTransientFile(path, O_RDONLY | PG_BINARY);
 	if (fd < 0)
 		elog(ERROR, "cannot open undo checkpoint snapshot \"%s\": %m", path);
 
-	/* Read the active log number range. */
-	if ((read(fd, &shared->low_logno, sizeof(shared->low_logno))
-		 != sizeof(shared->low_logno)) ||
-		(read(fd, &shared->high_logno, sizeof(shared->high_logno))
-		 != sizeof(shared->high_logno)) ||
+	/* Read the header. */
+	if ((read(fd, hdr, sizeof(*hdr)) != sizeof(*hdr)) ||
 		(read(fd, &crc, sizeof(crc)) != sizeof(crc)))
 		elog(ERROR, "pg_undo file \"%s\" is corrupted", path);
 
 	/* Verify the header checksum. */
 	INIT_CRC32C(new_crc);
-	COMP_CRC32C(new_crc, &shared->low_logno, sizeof(shared->low_logno));
-	COMP_CRC32C(new_crc, &shared->high_logno, sizeof(shared->high_logno));
+	COMP_CRC32C(new_crc, hdr, sizeof(*hdr));
 	FIN_CRC32C(new_crc);
 
 	if (crc != new_crc)
 		elog(ERROR,
 			 "pg_undo file \"%s\" has incorrect checksum", path);
 
-	/* Initialize all the logs and set up the freelist. */
+	if (hdr->nentries > (uint32) (hdr->high_logno - hdr->low_logno))
+		elog(ERROR, "pg_undo file \"%s\" is corrupted", path);
+
+	/* Read the meta-data entries and verify the body checksum. */
+	size = sizeof(UndoCheckPointEntry) * hdr->nentries;
+	entries = (UndoCheckPointEntry *) palloc(Max(size, 1));
+	if (read(fd, entries, size) != size)
+		elog(ERROR, "corrupted pg_undo meta data in file \"%s\": %m",
+			 path);
 	INIT_CRC32C(new_crc);
+	COMP_CRC32C(new_crc, entries, size);
+	FIN_CRC32C(new_crc);
+
+	if (read(fd, &crc, sizeof(crc)) != sizeof(crc))
+		elog(ERROR, "pg_undo file \"%s\" is corrupted", path);
+	if (crc != new_crc)
+		elog(ERROR,
+			 "pg_undo file \"%s\" has incorrect checksum", path);
+
+	CloseTransientFile(fd);
+
+	return entries;
+}
+
+void
+StartupUndoLogs(XLogRecPtr checkPointRedo)
+{
+	UndoLogSharedData *shared = MyUndoLogState.shared;
+	UndoCheckPointHeader latest;
+	UndoLogMetaData *metas;
+	bool	   *found;
+	XLogRecPtr	redo = checkPointRedo;
+	int			num_logs;
+	int			chain_length = -1;
+	int			logno;
+
+	/* If initdb is calling, there is no file to read yet. */
+	if (IsBootstrapProcessingMode())
+		return;
+
+	pgstat_report_wait_start(WAIT_EVENT_UNDO_CHECKPOINT_READ);
+
+	/*
+	 * Walk the chain of files from the one for the given checkpoint back to
+	 * the full snapshot it is based on.  The newest version of each log's
+	 * meta-data wins, so we visit newer files first.
+	 */
+	metas = NULL;
+	found = NULL;
+	num_logs = 0;
+	memset(&latest, 0, sizeof(latest));
+	do
+	{
+		UndoCheckPointHeader hdr;
+		UndoCheckPointEntry *entries;
+		uint32		i;
+
+		if (++chain_length > UNDO_CHECKPOINT_FULL_INTERVAL)
+			elog(ERROR, "undo checkpoint chain for %X/%X is too long",
+				 (uint32) (checkPointRedo >> 32), (uint32) checkPointRedo);
+
+		entries = read_undo_checkpoint_file(redo, &hdr);
+
+		/* The newest file determines the range of active log numbers. */
+		if (metas == NULL)
+		{
+			latest = hdr;
+			num_logs = hdr.high_logno - hdr.low_logno;
+			metas = palloc0(sizeof(UndoLogMetaData) * Max(num_logs, 1));
+			found = palloc0(sizeof(bool) * Max(num_logs, 1));
+		}
+
+		for (i = 0; i < hdr.nentries; ++i)
+		{
+			int			idx = entries[i].logno - latest.low_logno;
+
+			/* Ignore logs forgotten by a later checkpoint. */
+			if (entries[i].logno < latest.low_logno ||
+				entries[i].logno >= latest.high_logno || found[idx])
+				continue;
+			memcpy(&metas[idx], &entries[i].meta, sizeof(UndoLogMetaData));
+			found[idx] = true;
+		}
+		pfree(entries);
+
+		redo = hdr.base_redo;
+	} while (!XLogRecPtrIsInvalid(redo));
+
+	pgstat_report_wait_end();
+
+	shared->low_logno = latest.low_logno;
+	shared->high_logno = latest.high_logno;
+	shared->checkpoint_redo = checkPointRedo;
+	shared->checkpoint_full_redo = latest.full_redo;
+	shared->checkpoint_chain_length = chain_length;
+
+	/* Initialize all the logs and set up the freelist. */
 	for (logno = shared->low_logno; logno < shared->high_logno; ++logno)
 	{
 		UndoLogControl *log;
+		int			idx = logno - shared->low_logno;
+
+		if (!found[idx])
+			elog(ERROR, "meta data for undo log %u is missing from undo checkpoint %X/%X",
+				 logno,
+				 (uint32) (checkPointRedo >> 32), (uint32) checkPointRedo);
 
 		/* Get a zero-initialized control objects. */
 		ensure_undo_log_number(logno);
 		log = get_undo_log_by_number(logno);
 
-		/* Read in the meta data for this undo log. */
-		if (read(fd, &log->meta, sizeof(log->meta)) != sizeof(log->meta))
-			elog(ERROR, "corrupted pg_undo meta data in file \"%s\": %m",
-				 path);
-		COMP_CRC32C(new_crc, &log->meta, sizeof(log->meta));
+		memcpy(&log->meta, &metas[idx], sizeof(UndoLogMetaData));
+		memcpy(&log->checkpointed_meta, &metas[idx], sizeof(UndoLogMetaData));
 
 		/*
 		 * At normal start-up, or during recovery, all active undo logs start
@@ -1452,17 +1773,9 @@ StartupUndoLogs(XLogRecPtr checkPointRedo)
 			shared->free_lists[log->meta.persistence] = logno;
 		}
 	}
-	FIN_CRC32C(new_crc);
-
-	/* Verify body checksum. */
-	if (read(fd, &crc, sizeof(crc)) != sizeof(crc))
-		elog(ERROR, "pg_undo file \"%s\" is corrupted", path);
-	if (crc != new_crc)
-		elog(ERROR,
-			 "pg_undo file \"%s\" has incorrect checksum", path);
 
-	CloseTransientFile(fd);
-	pgstat_report_wait_end();
+	pfree(metas);
+	pfree(found);
 }
 
 /*
@@ -1640,49 +1953,84 @@ ensure_undo_log_number(UndoLogNumber logno)
 
 /*
  * Attach to an undo log, possibly creating or recycling one.
+ *
+ * 'tablespaces' lists the tablespaces we may use, most preferred first.  A
+ * new undo log is only created in the first one, and only if there is no
+ * detached undo log in any of them.
  */
 static void
-attach_undo_log(UndoPersistence persistence, Oid tablespace)
+attach_undo_log(UndoPersistence persistence, Oid *tablespaces,
+				int ntablespaces)
 {
 	UndoLogSharedData *shared = MyUndoLogState.shared;
+	UndoTablespaceStats *stats;
 	UndoLogControl *log = NULL;
 	UndoLogNumber logno;
 	UndoLogNumber *place;
+	UndoLogNumber *best_place = NULL;
+	int			best_rank = ntablespaces;
+	UndoLogOffset best_space = 0;
+	bool		created = false;
 
 	Assert(!InRecovery);
 	Assert(MyUndoLogState.logs[persistence] == NULL);
+	Assert(ntablespaces > 0);
 
 	LWLockAcquire(UndoLogLock, LW_EXCLUSIVE);
 
 	/*
 	 * For now we have a simple linked list of unattached undo logs for each
-	 * persistence level.  We'll grovel though it to find something for the
-	 * tablespace you asked for.  If you're not using multiple tablespaces
-	 * it'll be able to pop one off the front.  We might need a hash table
-	 * keyed by tablespace if this simple scheme turns out to be too slow when
-	 * using many tablespaces and many undo logs, but that seems like an
-	 * unusual use case not worth optimizing for.
+	 * persistence level.  We'll grovel though it to find the best one: in the
+	 * most preferred tablespace, and with the most space left in segments
+	 * that have already been allocated, so that reusing it avoids creating
+	 * new segment files.  Sessions that come and go frequently thereby keep
+	 * reusing the same few undo logs, rather than creating new ones.  We
+	 * might need a hash table keyed by tablespace if this simple scheme turns
+	 * out to be too slow when using many tablespaces and many undo logs, but
+	 * that seems like an unusual use case not worth optimizing for.
 	 */
 	place = &shared->free_lists[persistence];
 	while (*place != InvalidUndoLogNumber)
 	{
 		UndoLogControl *candidate = get_undo_log_by_number(*place);
+		UndoLogOffset space;
+		int			rank;
 
 		if (candidate == NULL)
 			elog(ERROR, "corrupted undo log freelist");
-		if (candidate->meta.tablespace == tablespace)
+
+		for (rank = 0; rank < ntablespaces; ++rank)
 		{
-			logno = *place;
-			log = candidate;
-			*place = candidate->next_free;
-			break;
+			if (candidate->meta.tablespace == tablespaces[rank])
+				break;
+		}
+
+		/*
+		 * No need for the mutex to read 'insert' and 'end', since only the
+		 * attached backend changes them.
+		 */
+		space = candidate->meta.end - Min(candidate->meta.insert,
+										  candidate->meta.end);
+		if (rank < ntablespaces &&
+			(rank < best_rank || (rank == best_rank && space > best_space)))
+		{
+			best_place = place;
+			best_rank = rank;
+			best_space = space;
 		}
 		place = &candidate->next_free;
 	}
 
+	if (best_place != NULL)
+	{
+		logno = *best_place;
+		log = get_undo_log_by_number(logno);
+		*best_place = log->next_free;
+	}
+
 	/*
-	 * All existing undo logs for this tablespace and persistence level are
-	 * busy, so we'll have to create a new one.
+	 * All existing undo logs for these tablespaces and this persistence
+	 * level are busy, so we'll have to create a new one.
 	 */
 	if (log == NULL)
 	{
@@ -1718,9 +2066,10 @@ attach_undo_log(UndoPersistence persistence, Oid tablespace)
 		log->meta.insert = UndoLogBlockHeaderSize;
 		log->meta.discard = UndoLogBlockHeaderSize;
 
-		log->meta.tablespace = tablespace;
+		log->meta.tablespace = tablespaces[0];
 		log->meta.persistence = persistence;
 		log->meta.status = UNDO_LOG_STATUS_ACTIVE;
+		created = true;
 
 		/* Move the high log number pointer past this one. */
 		++shared->high_logno;
@@ -1752,6 +2101,55 @@ attach_undo_log(UndoPersistence persistence, Oid tablespace)
 	LWLockRelease(&log->mutex);
 
 	MyUndoLogState.logs[persistence] = log;
+
+	stats = get_undo_tablespace_stats(log);
+	if (stats != NULL)
+	{
+		pg_atomic_fetch_add_u64(&stats->attaches, 1);
+		if (created)
+			pg_atomic_fetch_add_u64(&stats->logs_created, 1);
+	}
+}
+
+/*
+ * Find the statistics slot for the tablespace of an undo log, assigning a
+ * new one if needed.  The slot index is cached in the log's control object,
+ * so UndoLogLock is only taken the first time.  Returns NULL if all slots
+ * are in use, in which case no statistics are kept for the tablespace.
+ */
+static UndoTablespaceStats *
+get_undo_tablespace_stats(UndoLogControl *log)
+{
+	UndoLogSharedData *shared = MyUndoLogState.shared;
+	int			slot = log->tsstats_slot;
+
+	if (slot == 0)
+	{
+		Oid			tablespace = log->meta.tablespace;
+		int			i;
+
+		LWLockAcquire(UndoLogLock, LW_EXCLUSIVE);
+		for (i = 0; i < shared->ntablespace_stats; ++i)
+		{
+			if (shared->tablespace_stats[i].tablespace == tablespace)
+				break;
+		}
+		if (i == shared->ntablespace_stats &&
+			i < MAX_UNDO_TABLESPACE_STATS)
+		{
+			shared->tablespace_stats[i].tablespace = tablespace;
+			shared->ntablespace_stats++;
+		}
+		LWLockRelease(UndoLogLock);
+
+		/* Slots are stored one-based, so that zero means unassigned. */
+		slot = (i < MAX_UNDO_TABLESPACE_STATS) ? i + 1 : -1;
+		log->tsstats_slot = slot;
+	}
+
+	if (slot < 0)
+		return NULL;
+	return &shared->tablespace_stats[slot - 1];
 }
 
 /*
@@ -1918,8 +2316,16 @@ assign_undo_tablespaces(const char *newval, void *extra)
 	MyUndoLogState.need_to_choose_tablespace = true;
 }
 
+/*
+ * Resolve undo_tablespaces into the list of tablespaces that a new undo log
+ * may be attached in, most preferred first.  The result is palloc'd.
+ *
+ * Returns true if TablespaceCreateLock was acquired, in which case the caller
+ * must release it once it has attached to an undo log.
+ */
 static bool
-choose_undo_tablespace(bool force_detach, Oid *tablespace)
+choose_undo_tablespace(bool force_detach, Oid **tablespaces,
+					   int *ntablespaces)
 {
 	char	   *rawname;
 	List	   *namelist;
@@ -1935,6 +2341,8 @@ choose_undo_tablespace(bool force_detach, Oid *tablespace)
 		elog(ERROR, "undo_tablespaces is unexpectedly malformed");
 
 	length = list_length(namelist);
+	*tablespaces = palloc(sizeof(Oid) * Max(length, 1));
+	*ntablespaces = 0;
 	if (length == 0 ||
 		(length == 1 && ((char *) linitial(namelist))[0] == '\0'))
 	{
@@ -1942,60 +2350,58 @@ choose_undo_tablespace(bool force_detach, Oid *tablespace)
 		 * If it's an empty string, then we'll use the default tablespace.  No
 		 * locking is required because it can't be dropped.
 		 */
-		*tablespace = DEFAULTTABLESPACE_OID;
+		(*tablespaces)[(*ntablespaces)++] = DEFAULTTABLESPACE_OID;
 		need_to_unlock = false;
 	}
 	else
 	{
 		/*
-		 * Choose an OID using our pid, so that if several backends have the
-		 * same multi-tablespace setting they'll spread out.  We could easily
-		 * do better than this if more serious load balancing is judged
-		 * useful.
+		 * Stripe newly attached undo logs across the listed tablespaces in
+		 * round-robin order, using a counter shared by all backends.  Since
+		 * a backend attaches to a new undo log whenever its current one is
+		 * exhausted, this also spreads the undo of long-lived sessions.  The
+		 * remaining tablespaces follow in list order, so that an idle undo
+		 * log in one of them can be reused instead of creating a new one.
 		 */
-		int			index = MyProcPid % length;
-		int			first_index = index;
-		Oid			oid = InvalidOid;
+		int			first_index = pg_atomic_fetch_add_u32(&MyUndoLogState.shared->next_tablespace,
+														  1) % length;
+		const char *name = NULL;
 
 		/*
-		 * Take the tablespace create/drop lock while we look the name up.
-		 * This prevents the tablespace from being dropped while we're trying
-		 * to resolve the name, or while the called is trying to create an
-		 * undo log in it.  The caller will have to release this lock.
+		 * Take the tablespace create/drop lock while we look the names up.
+		 * This prevents the tablespaces from being dropped while we're trying
+		 * to resolve the names, or while the caller is trying to attach to
+		 * an undo log in one of them.  The caller will have to release this
+		 * lock.
 		 */
 		LWLockAcquire(TablespaceCreateLock, LW_EXCLUSIVE);
-		for (;;)
+		for (i = 0; i < length; ++i)
 		{
-			const char *name = list_nth(namelist, index);
+			Oid			oid;
 
+			name = list_nth(namelist, (first_index + i) % length);
 			oid = get_tablespace_oid(name, true);
-			if (oid == InvalidOid)
-			{
-				/* Unknown tablespace, try the next one. */
-				index = (index + 1) % length;
 
-				/*
-				 * But if we've tried them all, it's time to complain.  We'll
-				 * arbitrarily complain about the last one we tried in the
-				 * error message.
-				 */
-				if (index == first_index)
-					ereport(ERROR,
-							(errcode(ERRCODE_UNDEFINED_OBJECT),
-							 errmsg("tablespace \"%s\" does not exist", name),
-							 errhint("Create the tablespace or set undo_tablespaces to a valid or empty list.")));
+			/* Unknown tablespace, try the next one. */
+			if (oid == InvalidOid)
 				continue;
-			}
 			if (oid == GLOBALTABLESPACE_OID)
 				ereport(ERROR,
 						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
 						 errmsg("undo logs cannot be placed in pg_global tablespace")));
-			/* If we got here we succeeded in finding one. */
-			break;
+			(*tablespaces)[(*ntablespaces)++] = oid;
 		}
 
-		Assert(oid != InvalidOid);
-		*tablespace = oid;
+		/*
+		 * If none of them exist, it's time to complain.  We'll arbitrarily
+		 * complain about the last one we tried in the error message.
+		 */
+		if (*ntablespaces == 0)
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_OBJECT),
+					 errmsg("tablespace \"%s\" does not exist", name),
+					 errhint("Create the tablespace or set undo_tablespaces to a valid or empty list.")));
+
 		need_to_unlock = true;
 	}
 
@@ -2357,6 +2763,12 @@ pg_stat_get_undo_logs(PG_FUNCTION_ARGS)
 			nulls[7] = true;
 		else
 			values[7] = Int32GetDatum((int64) log->pid);
+		/* Segment files between the discard and end pointers. */
+		values[8] = Int32GetDatum((int32)
+								  ((log->meta.end -
+									(log->meta.discard -
+									 log->meta.discard % UndoLogSegmentSize)) /
+								   UndoLogSegmentSize));
 		LWLockRelease(&log->mutex);
 
 		/*
@@ -2388,6 +2800,77 @@ pg_stat_get_undo_logs(PG_FUNCTION_ARGS)
 	return (Datum) 0;
 }
 
+/*
+ * Return cumulative undo write statistics for each tablespace that has held
+ * undo logs since the server started.
+ */
+Datum
+pg_stat_get_undo_tablespaces(PG_FUNCTION_ARGS)
+{
+#define PG_STAT_GET_UNDO_TABLESPACES_COLS 5
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	UndoLogSharedData *shared = MyUndoLogState.shared;
+	int			nstats;
+	int			i;
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not " \
+						"allowed in this context")));
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	/* Slots are never reused, so only the count needs the lock. */
+	LWLockAcquire(UndoLogLock, LW_SHARED);
+	nstats = shared->ntablespace_stats;
+	LWLockRelease(UndoLogLock);
+
+	for (i = 0; i < nstats; ++i)
+	{
+		UndoTablespaceStats *stats = &shared->tablespace_stats[i];
+		Datum		values[PG_STAT_GET_UNDO_TABLESPACES_COLS];
+		bool		nulls[PG_STAT_GET_UNDO_TABLESPACES_COLS] = {false};
+		char	   *tablespace_name;
+
+		tablespace_name = get_tablespace_name(stats->tablespace);
+		if (tablespace_name)
+			values[0] = CStringGetTextDatum(tablespace_name);
+		else
+			nulls[0] = true;
+		values[1] = Int64GetDatum((int64) pg_atomic_read_u64(&stats->attaches));
+		values[2] = Int64GetDatum((int64) pg_atomic_read_u64(&stats->logs_created));
+		values[3] = Int64GetDatum((int64) pg_atomic_read_u64(&stats->bytes_written));
+		values[4] = Int64GetDatum((int64) pg_atomic_read_u64(&stats->segments_created));
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
+
 /*
  * replay the creation of a new undo log
  */
@@ -2610,7 +3093,8 @@ undolog_xlog_discard(XLogReaderState *record)
 	/* Create any further new segments that are needed the slow way. */
 	while (end < xlrec->end)
 	{
-		allocate_empty_undo_segment(xlrec->logno, log->meta.tablespace, end);
+		allocate_empty_undo_segment(xlrec->logno, log->meta.tablespace, end,
+									true);
 		end += UndoLogSegmentSize;
 	}
 
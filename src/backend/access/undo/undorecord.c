@@ -15,6 +15,7 @@
 #include "access/subtrans.h"
 #include "access/undorecord.h"
 #include "catalog/pg_tablespace.h"
+#include "common/pg_lzcompress.h"
 #include "storage/block.h"
 
 /* Workspace for InsertUndoRecord and UnpackUndoRecord. */
@@ -31,6 +32,14 @@ static bool InsertUndoBytes(char *sourceptr, int sourcelen,
 static bool ReadUndoBytes(char *destptr, int readlen,
 						  char **readptr, char *endptr,
 						  int *my_bytes_read, int *total_bytes_read, bool nocopy);
+static void UndoRecordCompressTuple(UnpackedUndoRecord *uur);
+
+/*
+ * The tuple bytes as they are stored in the undo log.
+ */
+#define UndoRecordStoredTuple(uur) \
+	(((uur)->uur_info & UREC_INFO_TUPLE_COMPRESSED) != 0 ? \
+	 &(uur)->uur_ztuple : &(uur)->uur_tuple)
 
 /*
  * Compute and return the expected size of an undo record.
@@ -51,7 +60,7 @@ UndoRecordExpectedSize(UnpackedUndoRecord *uur)
 	{
 		size += SizeOfUndoRecordPayload;
 		size += uur->uur_payload.len;
-		size += uur->uur_tuple.len;
+		size += UndoRecordStoredTuple(uur)->len;
 	}
 
 	return size;
@@ -72,6 +81,10 @@ UnpackedUndoRecordSize(UnpackedUndoRecord *uur)
 	{
 		size += uur->uur_payload.len;
 		size += uur->uur_tuple.len;
+
+		/* The stored bytes of a compressed tuple are kept as well. */
+		if ((uur->uur_info & UREC_INFO_TUPLE_COMPRESSED) != 0)
+			size += uur->uur_ztuple.len;
 	}
 
 	return size;
@@ -146,7 +159,7 @@ InsertUndoRecord(UnpackedUndoRecord *uur, Page page,
 		work_txn.urec_prevurp = uur->uur_prevurp;
 		work_txn.urec_next = uur->uur_next;
 		work_payload.urec_payload_len = uur->uur_payload.len;
-		work_payload.urec_tuple_len = uur->uur_tuple.len;
+		work_payload.urec_tuple_len = UndoRecordStoredTuple(uur)->len;
 	}
 	else
 	{
@@ -171,7 +184,7 @@ InsertUndoRecord(UnpackedUndoRecord *uur, Page page,
 		Assert(work_txn.urec_prevurp == uur->uur_prevurp);
 		Assert(work_txn.urec_next == uur->uur_next);
 		Assert(work_payload.urec_payload_len == uur->uur_payload.len);
-		Assert(work_payload.urec_tuple_len == uur->uur_tuple.len);
+		Assert(work_payload.urec_tuple_len == UndoRecordStoredTuple(uur)->len);
 	}
 
 	/*
@@ -233,9 +246,10 @@ InsertUndoRecord(UnpackedUndoRecord *uur, Page page,
 							 &my_bytes_written, already_written))
 			return false;
 
-		/* Tuple bytes. */
-		if (uur->uur_tuple.len > 0 &&
-			!InsertUndoBytes(uur->uur_tuple.data, uur->uur_tuple.len,
+		/* Tuple bytes, compressed if UndoRecordSetInfo decided so. */
+		if (UndoRecordStoredTuple(uur)->len > 0 &&
+			!InsertUndoBytes(UndoRecordStoredTuple(uur)->data,
+							 UndoRecordStoredTuple(uur)->len,
 							 &writeptr, endptr,
 							 &my_bytes_written, already_written))
 			return false;
@@ -321,6 +335,10 @@ InsertUndoBytes(char *sourceptr, int sourcelen,
  * record continues on the next page.  In the latter case, the function
  * should be called again with the next page, passing starting_byte as the
  * sizeof(PageHeaderData).
+ *
+ * A compressed tuple is unpacked into uur_ztuple only; callers that need the
+ * tuple itself must call UndoRecordDecompressTuple once they know they want
+ * this record.
  */
 bool
 UnpackUndoRecord(UnpackedUndoRecord *uur, Page page, int starting_byte,
@@ -330,6 +348,17 @@ UnpackUndoRecord(UnpackedUndoRecord *uur, Page page, int starting_byte,
 	char	   *endptr = (char *) page + BLCKSZ;
 	int			my_bytes_decoded = *already_decoded;
 	bool		is_undo_splited = (my_bytes_decoded > 0) ? true : false;
+	StringInfo	tuple;
+
+	/*
+	 * The compressed tuple buffer is private to this function, so reset it
+	 * when we start decoding a new record.
+	 */
+	if (!is_undo_splited)
+	{
+		uur->uur_ztuple.data = NULL;
+		uur->uur_ztuple.len = 0;
+	}
 
 	/* Decode header (if not already done). */
 	if (!ReadUndoBytes((char *) &work_hdr, SizeOfUndoRecordHeader,
@@ -394,8 +423,13 @@ UnpackUndoRecord(UnpackedUndoRecord *uur, Page page, int starting_byte,
 						   &my_bytes_decoded, already_decoded, false))
 			return false;
 
+		/*
+		 * If the tuple is compressed, read the stored bytes into uur_ztuple
+		 * and leave uur_tuple empty until UndoRecordDecompressTuple.
+		 */
+		tuple = UndoRecordStoredTuple(uur);
 		uur->uur_payload.len = work_payload.urec_payload_len;
-		uur->uur_tuple.len = work_payload.urec_tuple_len;
+		tuple->len = work_payload.urec_tuple_len;
 
 		/*
 		 * If we can read the complete record from a single page and copy_data
@@ -408,28 +442,28 @@ UnpackUndoRecord(UnpackedUndoRecord *uur, Page page, int starting_byte,
 		 * allocate the memory for that.
 		 */
 		if (!copy_data && !is_undo_splited &&
-			uur->uur_payload.len + uur->uur_tuple.len <= (endptr - readptr))
+			uur->uur_payload.len + tuple->len <= (endptr - readptr))
 		{
 			uur->uur_payload.data = readptr;
 			readptr += uur->uur_payload.len;
 
-			uur->uur_tuple.data = readptr;
+			tuple->data = readptr;
 		}
 		else
 		{
 			if (uur->uur_payload.len > 0 && uur->uur_payload.data == NULL)
 				uur->uur_payload.data = (char *) palloc0(uur->uur_payload.len);
 
-			if (uur->uur_tuple.len > 0 && uur->uur_tuple.data == NULL)
-				uur->uur_tuple.data = (char *) palloc0(uur->uur_tuple.len);
+			if (tuple->len > 0 && tuple->data == NULL)
+				tuple->data = (char *) palloc0(tuple->len);
 
 			if (!ReadUndoBytes((char *) uur->uur_payload.data,
 							   uur->uur_payload.len, &readptr, endptr,
 							   &my_bytes_decoded, already_decoded, false))
 				return false;
 
-			if (!ReadUndoBytes((char *) uur->uur_tuple.data,
-							   uur->uur_tuple.len, &readptr, endptr,
+			if (!ReadUndoBytes((char *) tuple->data,
+							   tuple->len, &readptr, endptr,
 							   &my_bytes_decoded, already_decoded, false))
 				return false;
 		}
@@ -511,4 +545,74 @@ UndoRecordSetInfo(UnpackedUndoRecord *uur)
 		uur->uur_info |= UREC_INFO_TRANSACTION;
 	if (uur->uur_payload.len || uur->uur_tuple.len)
 		uur->uur_info |= UREC_INFO_PAYLOAD;
+
+	/*
+	 * Large tuple images, as written by DELETE and non-in-place UPDATE, are
+	 * compressed.  We can be called more than once for the same record while
+	 * the caller retries the allocation, so compress only once.
+	 */
+	if (uur->uur_tuple.len >= UNDO_TUPLE_COMPRESS_THRESHOLD &&
+		(uur->uur_info & UREC_INFO_TUPLE_COMPRESSED) == 0)
+		UndoRecordCompressTuple(uur);
+}
+
+/*
+ * Try to compress the tuple bytes of an undo record into uur_ztuple.  The
+ * caller's uur_tuple is left untouched, because WAL-logging code still needs
+ * the uncompressed image.  If the data doesn't compress well enough, the
+ * record is stored as is.
+ */
+static void
+UndoRecordCompressTuple(UnpackedUndoRecord *uur)
+{
+	uint16		rawlen = uur->uur_tuple.len;
+	char	   *buf;
+	int32		clen;
+
+	buf = palloc(sizeof(uint16) + PGLZ_MAX_OUTPUT(rawlen));
+	clen = pglz_compress(uur->uur_tuple.data, rawlen,
+						 buf + sizeof(uint16), PGLZ_strategy_default);
+	if (clen < 0)
+	{
+		pfree(buf);
+		return;
+	}
+
+	memcpy(buf, &rawlen, sizeof(uint16));
+	uur->uur_ztuple.data = buf;
+	uur->uur_ztuple.len = sizeof(uint16) + clen;
+	uur->uur_ztuple.maxlen = uur->uur_ztuple.len;
+	uur->uur_info |= UREC_INFO_TUPLE_COMPRESSED;
+}
+
+/*
+ * Decompress the tuple of an unpacked undo record into uur_tuple, if it is
+ * compressed and that hasn't been done yet.
+ *
+ * UnpackUndoRecord leaves this to the caller, so that walking an undo chain
+ * only pays for decompressing the records it actually uses.  The
+ * decompressed data is always palloc'd, so callers releasing the record must
+ * free it even when it still holds the undo buffer; the stored bytes in
+ * uur_ztuple are kept, as they are either in that buffer or need to be
+ * released along with the record.
+ */
+void
+UndoRecordDecompressTuple(UnpackedUndoRecord *uur)
+{
+	uint16		rawlen;
+
+	if ((uur->uur_info & UREC_INFO_TUPLE_COMPRESSED) == 0 ||
+		uur->uur_tuple.data != NULL)
+		return;
+
+	if (uur->uur_ztuple.len < sizeof(uint16))
+		elog(ERROR, "compressed undo tuple is too short");
+
+	memcpy(&rawlen, uur->uur_ztuple.data, sizeof(uint16));
+	uur->uur_tuple.data = palloc(rawlen);
+	if (pglz_decompress(uur->uur_ztuple.data + sizeof(uint16),
+						uur->uur_ztuple.len - sizeof(uint16),
+						uur->uur_tuple.data, rawlen, true) != rawlen)
+		elog(ERROR, "compressed undo tuple is corrupt");
+	uur->uur_tuple.len = rawlen;
 }
@@ -34,6 +34,15 @@
  *
  * Also note that, if the work queues are full, then we put backpressure on
  * backends to complete the requests by themselves.
+ *
+ * The rollback hash table is partitioned, and each partition is protected by
+ * its own LWLock.  The queues are protected by RollbackRequestLock.  Most
+ * aborts are small enough that the backend applies the undo itself and only
+ * needs to register the request in the hash table, so such registrations
+ * take just the one partition lock and never touch RollbackRequestLock.  When
+ * both are needed, RollbackRequestLock must be acquired first.  The size of
+ * the queues (and so of the hash table) is controlled by
+ * rollback_request_queue_size.
  *-------------------------------------------------------------------------
  */
 
@@ -50,15 +59,23 @@
 #include "access/xact.h"
 #include "catalog/indexing.h"
 #include "catalog/pg_database.h"
+#include "funcapi.h"
 #include "lib/binaryheap.h"
+#include "nodes/execnodes.h"
 #include "storage/shmem.h"
+#include "utils/builtins.h"
 #include "utils/fmgroids.h"
+#include "utils/timestamp.h"
 #include "access/xlog.h"
 
-#define ROLLBACK_REQUEST_QUEUE_SIZE 1024
-#define	MAX_UNDO_WORK_QUEUES	3
 #define UNDO_PEEK_DEPTH		10
 
+/* Number of partitions of the rollback hash table */
+#define NUM_ROLLBACK_HT_PARTITIONS	16
+
+#define RollbackHTPartitionLock(hashcode) \
+	(&RollbackHTPartitionLocks[(hashcode) % NUM_ROLLBACK_HT_PARTITIONS].lock)
+
 typedef struct
 {
 	binaryheap *bh;
@@ -72,6 +89,7 @@ typedef struct
 
 /* This is the hash table to store all the rollabck requests. */
 static HTAB *RollbackHT;
+static LWLockPadded *RollbackHTPartitionLocks;
 static UndoWorkerQueue UndoWorkerQueues[MAX_UNDO_WORK_QUEUES];
 
 static uint32 cur_undo_queue = 0;
@@ -104,11 +122,12 @@ static uint32 cur_undo_queue = 0;
 	DatumGetPointer(binaryheap_nth(UndoWorkerQueues[XID_QUEUE].bh, n)) \
 )
 
-#define SetXidQueueElem(elem, e_dbid, e_full_xid, e_start_urec_ptr) \
+#define SetXidQueueElem(elem, e_dbid, e_full_xid, e_start_urec_ptr, e_enqueued_at) \
 ( \
 	GetXidQueueElem(elem).dbid = e_dbid, \
 	GetXidQueueElem(elem).full_xid = e_full_xid, \
-	GetXidQueueElem(elem).start_urec_ptr = e_start_urec_ptr \
+	GetXidQueueElem(elem).start_urec_ptr = e_start_urec_ptr, \
+	GetXidQueueElem(elem).enqueued_at = e_enqueued_at \
 )
 
 /* Different operations for SIZE queue */
@@ -139,12 +158,13 @@ static uint32 cur_undo_queue = 0;
 	DatumGetPointer(binaryheap_nth(UndoWorkerQueues[SIZE_QUEUE].bh, n)) \
 )
 
-#define SetSizeQueueElem(elem, e_dbid, e_full_xid, e_size, e_start_urec_ptr) \
+#define SetSizeQueueElem(elem, e_dbid, e_full_xid, e_size, e_start_urec_ptr, e_enqueued_at) \
 ( \
 	GetSizeQueueElem(elem).dbid = e_dbid, \
 	GetSizeQueueElem(elem).full_xid = e_full_xid, \
 	GetSizeQueueElem(elem).request_size = e_size, \
-	GetSizeQueueElem(elem).start_urec_ptr = e_start_urec_ptr \
+	GetSizeQueueElem(elem).start_urec_ptr = e_start_urec_ptr, \
+	GetSizeQueueElem(elem).enqueued_at = e_enqueued_at \
 )
 
 /* Different operations for Error queue */
@@ -233,26 +253,26 @@ undo_err_time_comparator(Datum a, Datum b, void *arg)
 	return -1;
 }
 
-static int
+static Size
 UndoXidQueueElemsShmSize(void)
 {
-	return mul_size(ROLLBACK_REQUEST_QUEUE_SIZE, sizeof(UndoXidQueue));
+	return mul_size(rollback_request_queue_size, sizeof(UndoXidQueue));
 }
 
-static int
+static Size
 UndoSizeQueueElemsShmSize(void)
 {
-	return mul_size(ROLLBACK_REQUEST_QUEUE_SIZE, sizeof(UndoSizeQueue));
+	return mul_size(rollback_request_queue_size, sizeof(UndoSizeQueue));
 }
 
-static int
+static Size
 UndoErrorQueueElemsShmSize(void)
 {
-	return mul_size(ROLLBACK_REQUEST_QUEUE_SIZE, sizeof(UndoErrorQueue));
+	return mul_size(rollback_request_queue_size, sizeof(UndoErrorQueue));
 }
 
-static int
-UndoRollbackHashTableSize()
+static long
+UndoRollbackHashTableSize(void)
 {
 	/*
 	 * The rollback hash table is used to avoid duplicate undo requests by
@@ -264,8 +284,34 @@ UndoRollbackHashTableSize()
 	 * an error queue (currently this is same as request queue) and max
 	 * backends. This will ensure that it won't get filled.
 	 */
-	return ((2 * ROLLBACK_REQUEST_QUEUE_SIZE) + ROLLBACK_REQUEST_QUEUE_SIZE +
-			MaxBackends);
+	return ((2 * (long) rollback_request_queue_size) +
+			rollback_request_queue_size + MaxBackends);
+}
+
+/*
+ * Returns true if the request is present in the rollback hash table and no
+ * one is processing it yet, false otherwise.
+ */
+static bool
+RollbackRequestIsPending(RollbackHashKey *hkey)
+{
+	RollbackHashEntry *rh;
+	uint32		hashcode;
+	LWLock	   *partitionLock;
+	bool		result;
+
+	hashcode = get_hash_value(RollbackHT, (void *) hkey);
+	partitionLock = RollbackHTPartitionLock(hashcode);
+
+	LWLockAcquire(partitionLock, LW_SHARED);
+	rh = (RollbackHashEntry *) hash_search_with_hash_value(RollbackHT,
+														   (void *) hkey,
+														   hashcode,
+														   HASH_FIND, NULL);
+	result = (rh != NULL && !rh->in_progress);
+	LWLockRelease(partitionLock);
+
+	return result;
 }
 
 /* Get the first free element of xid based request array. */
@@ -274,7 +320,7 @@ UndoXidQueueGetFreeElem(void)
 {
 	int			i;
 
-	for (i = 0; i < ROLLBACK_REQUEST_QUEUE_SIZE; i++)
+	for (i = 0; i < rollback_request_queue_size; i++)
 	{
 		if (FullTransactionIdEquals(GetXidQueueElem(i).full_xid,
 									InvalidFullTransactionId))
@@ -290,11 +336,12 @@ UndoXidQueueGetFreeElem(void)
 
 /* Push an element in the xid based request queue */
 static void
-PushXidQueueElem(UndoRequestInfo *urinfo)
+PushXidQueueElem(UndoRequestInfo *urinfo, TimestampTz now)
 {
 	int			elem = UndoXidQueueGetFreeElem();
 
-	SetXidQueueElem(elem, urinfo->dbid, urinfo->full_xid, urinfo->start_urec_ptr);
+	SetXidQueueElem(elem, urinfo->dbid, urinfo->full_xid, urinfo->start_urec_ptr,
+					now);
 
 	binaryheap_add(UndoWorkerQueues[XID_QUEUE].bh,
 				   PointerGetDatum(&GetXidQueueElem(elem)));
@@ -318,7 +365,7 @@ UndoSizeQueueGetFreeElem(void)
 {
 	int			i;
 
-	for (i = 0; i < ROLLBACK_REQUEST_QUEUE_SIZE; i++)
+	for (i = 0; i < rollback_request_queue_size; i++)
 	{
 		if (FullTransactionIdEquals(GetSizeQueueElem(i).full_xid,
 									InvalidFullTransactionId))
@@ -347,21 +394,17 @@ RemoveOldElemsFromXidQueue()
 
 	while (i < GetXidQueueSize())
 	{
-		RollbackHashEntry *rh;
 		RollbackHashKey hkey;
 		UndoXidQueue *elem = (UndoXidQueue *) GetXidQueueNthElem(i);
 
 		hkey.full_xid = elem->full_xid;
 		hkey.start_urec_ptr = elem->start_urec_ptr;
-		rh = (RollbackHashEntry *) hash_search(RollbackHT,
-											   (void *) &hkey,
-											   HASH_FIND, NULL);
 
 		/*
 		 * If some undo worker is already processing the rollback request or
 		 * it is already processed, then we drop that request from the queue.
 		 */
-		if (!rh || rh->in_progress)
+		if (!RollbackRequestIsPending(&hkey))
 		{
 			elem->dbid = InvalidOid;
 			elem->full_xid = InvalidFullTransactionId;
@@ -381,12 +424,12 @@ RemoveOldElemsFromXidQueue()
 
 /* Push an element in the size based request queue */
 static void
-PushSizeQueueElem(UndoRequestInfo *urinfo)
+PushSizeQueueElem(UndoRequestInfo *urinfo, TimestampTz now)
 {
 	int			elem = UndoSizeQueueGetFreeElem();
 
 	SetSizeQueueElem(elem, urinfo->dbid, urinfo->full_xid, urinfo->request_size,
-					 urinfo->start_urec_ptr);
+					 urinfo->start_urec_ptr, now);
 
 	binaryheap_add(UndoWorkerQueues[SIZE_QUEUE].bh,
 				   PointerGetDatum(&GetSizeQueueElem(elem)));
@@ -419,21 +462,17 @@ RemoveOldElemsFromSizeQueue()
 
 	while (i < GetSizeQueueSize())
 	{
-		RollbackHashEntry *rh;
 		RollbackHashKey hkey;
 		UndoSizeQueue *elem = (UndoSizeQueue *) GetSizeQueueNthElem(i);
 
 		hkey.full_xid = elem->full_xid;
 		hkey.start_urec_ptr = elem->start_urec_ptr;
-		rh = (RollbackHashEntry *) hash_search(RollbackHT,
-											   (void *) &hkey,
-											   HASH_FIND, NULL);
 
 		/*
 		 * If some undo worker is already processing the rollback request or
 		 * it is already processed, then we drop that request from the queue.
 		 */
-		if (!rh || rh->in_progress)
+		if (!RollbackRequestIsPending(&hkey))
 		{
 			elem->dbid = InvalidOid;
 			elem->full_xid = InvalidFullTransactionId;
@@ -457,7 +496,7 @@ UndoErrorQueueGetFreeElem(void)
 {
 	int			i;
 
-	for (i = 0; i < ROLLBACK_REQUEST_QUEUE_SIZE; i++)
+	for (i = 0; i < rollback_request_queue_size; i++)
 	{
 		if (FullTransactionIdEquals(GetErrorQueueElem(i).full_xid,
 									InvalidFullTransactionId))
@@ -511,21 +550,17 @@ RemoveOldElemsFromErrorQueue()
 
 	while (i < GetErrorQueueSize())
 	{
-		RollbackHashEntry *rh;
 		RollbackHashKey hkey;
 		UndoErrorQueue *elem = (UndoErrorQueue *) GetErrorQueueNthElem(i);
 
 		hkey.full_xid = elem->full_xid;
 		hkey.start_urec_ptr = elem->start_urec_ptr;
-		rh = (RollbackHashEntry *) hash_search(RollbackHT,
-											   (void *) &hkey,
-											   HASH_FIND, NULL);
 
 		/*
 		 * If some undo worker is already processing the rollback request or
 		 * it is already processed, then we drop that request from the queue.
 		 */
-		if (!rh || rh->in_progress)
+		if (!RollbackRequestIsPending(&hkey))
 		{
 			elem->dbid = InvalidOid;
 			elem->full_xid = InvalidFullTransactionId;
@@ -819,19 +854,15 @@ FindUndoEndLocationAndSize(UndoRecPtr start_urecptr,
 
 
 /*
- * Returns true, if we can push the rollback request to undo wrokers, false,
- * otherwise.
+ * Returns true, if the rollback request is a candidate for being pushed to
+ * undo workers, false, otherwise.
+ *
+ * This doesn't look at the queues, so it can be checked without holding
+ * RollbackRequestLock.
  */
-static bool
-CanPushReqToUndoWorker(UndoRecPtr start_urec_ptr, UndoRecPtr end_urec_ptr,
-					   uint64 req_size)
+static inline bool
+RollbackReqWantsUndoWorker(uint64 req_size)
 {
-	/*
-	 * This must be called after acquring RollbackRequestLock as we will check
-	 * the binary heaps which can change.
-	 */
-	Assert(LWLockHeldByMeInMode(RollbackRequestLock, LW_EXCLUSIVE));
-
 	/*
 	 * We normally push the rollback request to undo workers if the size of
 	 * same is above a certain threshold.  However, discard worker is allowed
@@ -850,11 +881,28 @@ CanPushReqToUndoWorker(UndoRecPtr start_urec_ptr, UndoRecPtr end_urec_ptr,
 	 * avoid such a race as this won't lead to any problem and OTOH, we might
 	 * need some more trickery in the code to avoid such a race condition.
 	 */
-	if (req_size >= rollback_overflow_size * 1024 * 1024 ||
-		IsDiscardProcess())
+	return (req_size >= rollback_overflow_size * 1024 * 1024 ||
+			IsDiscardProcess());
+}
+
+/*
+ * Returns true, if we can push the rollback request to undo wrokers, false,
+ * otherwise.
+ */
+static bool
+CanPushReqToUndoWorker(UndoRecPtr start_urec_ptr, UndoRecPtr end_urec_ptr,
+					   uint64 req_size)
+{
+	/*
+	 * This must be called after acquring RollbackRequestLock as we will check
+	 * the binary heaps which can change.
+	 */
+	Assert(LWLockHeldByMeInMode(RollbackRequestLock, LW_EXCLUSIVE));
+
+	if (RollbackReqWantsUndoWorker(req_size))
 	{
-		if (GetXidQueueSize() >= ROLLBACK_REQUEST_QUEUE_SIZE ||
-			GetSizeQueueSize() >= ROLLBACK_REQUEST_QUEUE_SIZE)
+		if (GetXidQueueSize() >= rollback_request_queue_size ||
+			GetSizeQueueSize() >= rollback_request_queue_size)
 		{
 			/*
 			 * If one of the queues is full traverse both the queues and
@@ -868,15 +916,15 @@ CanPushReqToUndoWorker(UndoRecPtr start_urec_ptr, UndoRecPtr end_urec_ptr,
 			 * the entries from the queues when we detect that the database is
 			 * dropped and remove the corresponding entries from hash table.
 			 */
-			if (GetXidQueueSize() >= ROLLBACK_REQUEST_QUEUE_SIZE)
+			if (GetXidQueueSize() >= rollback_request_queue_size)
 				RemoveOldElemsFromXidQueue();
-			if (GetSizeQueueSize() >= ROLLBACK_REQUEST_QUEUE_SIZE)
+			if (GetSizeQueueSize() >= rollback_request_queue_size)
 				RemoveOldElemsFromSizeQueue();
 		}
 
-		if ((GetXidQueueSize() < ROLLBACK_REQUEST_QUEUE_SIZE))
+		if ((GetXidQueueSize() < rollback_request_queue_size))
 		{
-			Assert(GetSizeQueueSize() < ROLLBACK_REQUEST_QUEUE_SIZE);
+			Assert(GetSizeQueueSize() < rollback_request_queue_size);
 			return true;
 		}
 	}
@@ -887,14 +935,16 @@ CanPushReqToUndoWorker(UndoRecPtr start_urec_ptr, UndoRecPtr end_urec_ptr,
 /*
  * To return the size of the request queues and hash-table for rollbacks.
  */
-int
+Size
 PendingUndoShmemSize(void)
 {
 	Size		size;
 
 	size = hash_estimate_size(UndoRollbackHashTableSize(), sizeof(RollbackHashEntry));
+	size = add_size(size, mul_size(NUM_ROLLBACK_HT_PARTITIONS,
+								   sizeof(LWLockPadded)));
 	size = add_size(size, mul_size(MAX_UNDO_WORK_QUEUES,
-								   binaryheap_shmem_size(ROLLBACK_REQUEST_QUEUE_SIZE)));
+								   binaryheap_shmem_size(rollback_request_queue_size)));
 	size = add_size(size, UndoXidQueueElemsShmSize());
 	size = add_size(size, UndoSizeQueueElemsShmSize());
 	size = add_size(size, UndoErrorQueueElemsShmSize());
@@ -910,6 +960,7 @@ void
 PendingUndoShmemInit(void)
 {
 	HASHCTL		info;
+	bool		foundLocks = false;
 	bool		foundXidQueue = false;
 	bool		foundSizeQueue = false;
 	bool		foundErrorQueue = false;
@@ -923,14 +974,31 @@ PendingUndoShmemInit(void)
 	info.keysize = sizeof(TransactionId);
 	info.entrysize = sizeof(RollbackHashEntry);
 	info.hash = tag_hash;
+	info.num_partitions = NUM_ROLLBACK_HT_PARTITIONS;
 
 	RollbackHT = ShmemInitHash("Undo Actions Lookup Table",
 							   UndoRollbackHashTableSize(),
 							   UndoRollbackHashTableSize(), &info,
-							   HASH_ELEM | HASH_FUNCTION | HASH_FIXED_SIZE);
+							   HASH_ELEM | HASH_FUNCTION | HASH_PARTITION |
+							   HASH_FIXED_SIZE);
+
+	RollbackHTPartitionLocks = (LWLockPadded *)
+		ShmemInitStruct("Undo Actions Lookup Table Locks",
+						mul_size(NUM_ROLLBACK_HT_PARTITIONS,
+								 sizeof(LWLockPadded)),
+						&foundLocks);
+
+	if (!foundLocks)
+	{
+		int			i;
+
+		for (i = 0; i < NUM_ROLLBACK_HT_PARTITIONS; i++)
+			LWLockInitialize(&RollbackHTPartitionLocks[i].lock,
+							 LWTRANCHE_ROLLBACK_HT);
+	}
 
 	bh = binaryheap_allocate_shm("Undo Xid Binary Heap",
-								 ROLLBACK_REQUEST_QUEUE_SIZE,
+								 rollback_request_queue_size,
 								 undo_age_comparator,
 								 NULL);
 
@@ -946,7 +1014,7 @@ PendingUndoShmemInit(void)
 	InitXidQueue(bh, xid_elems);
 
 	bh = binaryheap_allocate_shm("Undo Size Binary Heap",
-								 ROLLBACK_REQUEST_QUEUE_SIZE,
+								 rollback_request_queue_size,
 								 undo_size_comparator,
 								 NULL);
 	size_elems = (UndoSizeQueue *) ShmemInitStruct("Undo Size Queue Elements",
@@ -960,7 +1028,7 @@ PendingUndoShmemInit(void)
 	InitSizeQueue(bh, size_elems);
 
 	bh = binaryheap_allocate_shm("Undo Error Binary Heap",
-								 ROLLBACK_REQUEST_QUEUE_SIZE,
+								 rollback_request_queue_size,
 								 undo_err_time_comparator,
 								 NULL);
 
@@ -987,17 +1055,178 @@ UndoWorkerQueuesEmpty(void)
 	return false;
 }
 
+/*
+ * Collect the statistics of each undo worker queue into stats, which must
+ * have room for MAX_UNDO_WORK_QUEUES entries.
+ *
+ * Queue entries whose request has already been picked up or processed are
+ * skipped, so the numbers reflect the work still waiting for a worker.
+ */
+void
+UndoGetQueueStats(UndoQueueStats *stats)
+{
+	int			cur_queue;
+
+	LWLockAcquire(RollbackRequestLock, LW_SHARED);
+
+	for (cur_queue = 0; cur_queue < MAX_UNDO_WORK_QUEUES; cur_queue++)
+	{
+		UndoQueueStats *qstats = &stats[cur_queue];
+		int			n;
+
+		qstats->nrequests = 0;
+		qstats->pending_bytes = 0;
+		qstats->oldest_full_xid = InvalidFullTransactionId;
+		qstats->oldest_enqueued_at = 0;
+
+		for (n = 0;; n++)
+		{
+			RollbackHashKey hkey;
+			TimestampTz enqueued_at;
+			uint64		request_size = 0;
+
+			if (cur_queue == XID_QUEUE)
+			{
+				UndoXidQueue *elem;
+
+				if (n >= GetXidQueueSize())
+					break;
+				elem = (UndoXidQueue *) GetXidQueueNthElem(n);
+				hkey.full_xid = elem->full_xid;
+				hkey.start_urec_ptr = elem->start_urec_ptr;
+				enqueued_at = elem->enqueued_at;
+			}
+			else if (cur_queue == SIZE_QUEUE)
+			{
+				UndoSizeQueue *elem;
+
+				if (n >= GetSizeQueueSize())
+					break;
+				elem = (UndoSizeQueue *) GetSizeQueueNthElem(n);
+				hkey.full_xid = elem->full_xid;
+				hkey.start_urec_ptr = elem->start_urec_ptr;
+				enqueued_at = elem->enqueued_at;
+				request_size = elem->request_size;
+			}
+			else
+			{
+				UndoErrorQueue *elem;
+
+				Assert(cur_queue == ERROR_QUEUE);
+				if (n >= GetErrorQueueSize())
+					break;
+				elem = (UndoErrorQueue *) GetErrorQueueNthElem(n);
+				hkey.full_xid = elem->full_xid;
+				hkey.start_urec_ptr = elem->start_urec_ptr;
+				enqueued_at = elem->err_occurred_at;
+			}
+
+			if (!RollbackRequestIsPending(&hkey))
+				continue;
+
+			qstats->nrequests++;
+			qstats->pending_bytes += request_size;
+			if (!FullTransactionIdIsValid(qstats->oldest_full_xid) ||
+				FullTransactionIdPrecedes(hkey.full_xid,
+										  qstats->oldest_full_xid))
+				qstats->oldest_full_xid = hkey.full_xid;
+			if (qstats->oldest_enqueued_at == 0 ||
+				enqueued_at < qstats->oldest_enqueued_at)
+				qstats->oldest_enqueued_at = enqueued_at;
+		}
+	}
+
+	LWLockRelease(RollbackRequestLock);
+}
+
+/*
+ * SQL-callable function to report the state of the undo worker queues.
+ */
+Datum
+pg_stat_get_undo_queues(PG_FUNCTION_ARGS)
+{
+#define PG_STAT_GET_UNDO_QUEUES_COLS 5
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	UndoQueueStats stats[MAX_UNDO_WORK_QUEUES];
+	static const char *const queue_names[MAX_UNDO_WORK_QUEUES] = {
+		"xid", "size", "error"
+	};
+	int			i;
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not " \
+						"allowed in this context")));
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	UndoGetQueueStats(stats);
+
+	for (i = 0; i < MAX_UNDO_WORK_QUEUES; i++)
+	{
+		Datum		values[PG_STAT_GET_UNDO_QUEUES_COLS];
+		bool		nulls[PG_STAT_GET_UNDO_QUEUES_COLS] = {false};
+
+		values[0] = CStringGetTextDatum(queue_names[i]);
+		values[1] = Int32GetDatum(stats[i].nrequests);
+		if (i == SIZE_QUEUE)
+			values[2] = Int64GetDatum((int64) stats[i].pending_bytes);
+		else
+			nulls[2] = true;
+		if (stats[i].nrequests == 0)
+		{
+			nulls[3] = true;
+			nulls[4] = true;
+		}
+		else
+		{
+			values[3] = TransactionIdGetDatum(XidFromFullTransactionId(stats[i].oldest_full_xid));
+			values[4] = TimestampTzGetDatum(stats[i].oldest_enqueued_at);
+		}
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
+
 /* Insert the request in both xid and size based queues. */
 void
 InsertRequestIntoUndoQueues(UndoRequestInfo *urinfo)
 {
+	TimestampTz now = GetCurrentTimestamp();
+
 	/*
 	 * This must be called after acquring RollbackRequestLock as we will
 	 * insert into the binary heaps which can change.
 	 */
 	Assert(LWLockHeldByMeInMode(RollbackRequestLock, LW_EXCLUSIVE));
-	PushXidQueueElem(urinfo);
-	PushSizeQueueElem(urinfo);
+	PushXidQueueElem(urinfo, now);
+	PushSizeQueueElem(urinfo, now);
 
 	elog(DEBUG1, "Undo action pushed Xid: " UINT64_FORMAT ", Size: " UINT64_FORMAT ", "
 		 "Start: " UndoRecPtrFormat ", End: " UndoRecPtrFormat "",
@@ -1010,11 +1239,14 @@ bool
 InsertRequestIntoErrorUndoQueue(volatile UndoRequestInfo *urinfo)
 {
 	RollbackHashEntry *rh;
+	RollbackHashKey hkey;
+	uint32		hashcode;
+	LWLock	   *partitionLock;
 
 	LWLockAcquire(RollbackRequestLock, LW_EXCLUSIVE);
 
 	/* We can't insert into an error queue if it is already full. */
-	if (GetErrorQueueSize() >= ROLLBACK_REQUEST_QUEUE_SIZE)
+	if (GetErrorQueueSize() >= rollback_request_queue_size)
 	{
 		int			num_removed = 0;
 
@@ -1032,9 +1264,18 @@ InsertRequestIntoErrorUndoQueue(volatile UndoRequestInfo *urinfo)
 	 * Mark the undo request in hash table as not in_progress so that undo
 	 * launcher or other undo worker don't remove the entry from queues.
 	 */
-	rh = (RollbackHashEntry *) hash_search(RollbackHT, (void *) &urinfo->full_xid,
-										   HASH_FIND, NULL);
+	hkey.full_xid = urinfo->full_xid;
+	hkey.start_urec_ptr = urinfo->start_urec_ptr;
+	hashcode = get_hash_value(RollbackHT, (void *) &hkey);
+	partitionLock = RollbackHTPartitionLock(hashcode);
+
+	LWLockAcquire(partitionLock, LW_EXCLUSIVE);
+	rh = (RollbackHashEntry *) hash_search_with_hash_value(RollbackHT,
+														   (void *) &hkey,
+														   hashcode,
+														   HASH_FIND, NULL);
 	rh->in_progress = false;
+	LWLockRelease(partitionLock);
 
 	/* Insert the request into error queue for processing it later. */
 	PushErrorQueueElem(urinfo);
@@ -1091,6 +1332,8 @@ UndoGetWork(bool allow_peek, bool remove_from_queue, UndoRequestInfo *urinfo,
 	{
 		RollbackHashKey hkey;
 		RollbackHashEntry *rh;
+		uint32		hashcode;
+		LWLock	   *partitionLock;
 		int			cur_queue = (int) (cur_undo_queue % MAX_UNDO_WORK_QUEUES);
 
 		if (!GetRollbackHashKeyFromQueue(cur_queue, 0, &hkey))
@@ -1099,9 +1342,14 @@ UndoGetWork(bool allow_peek, bool remove_from_queue, UndoRequestInfo *urinfo,
 			continue;
 		}
 
-		rh = (RollbackHashEntry *) hash_search(RollbackHT,
-											   (void *) &hkey,
-											   HASH_FIND, NULL);
+		hashcode = get_hash_value(RollbackHT, (void *) &hkey);
+		partitionLock = RollbackHTPartitionLock(hashcode);
+
+		LWLockAcquire(partitionLock, LW_EXCLUSIVE);
+		rh = (RollbackHashEntry *) hash_search_with_hash_value(RollbackHT,
+															   (void *) &hkey,
+															   hashcode,
+															   HASH_FIND, NULL);
 
 		/*
 		 * If some undo worker is already processing the rollback request or
@@ -1110,6 +1358,7 @@ UndoGetWork(bool allow_peek, bool remove_from_queue, UndoRequestInfo *urinfo,
 		 */
 		if (!rh || rh->in_progress)
 		{
+			LWLockRelease(partitionLock);
 			RemoveRequestFromQueue(cur_queue, 0);
 			cur_undo_queue++;
 			continue;
@@ -1126,8 +1375,12 @@ UndoGetWork(bool allow_peek, bool remove_from_queue, UndoRequestInfo *urinfo,
 		{
 			bool		exists;
 
+			/* set the undo request info to process */
+			SetUndoRequestInfoFromRHEntry(urinfo, rh, cur_queue);
+			LWLockRelease(partitionLock);
+
 			StartTransactionCommand();
-			exists = dbid_exists(rh->dbid);
+			exists = dbid_exists(urinfo->dbid);
 			CommitTransactionCommand();
 
 			/*
@@ -1137,14 +1390,12 @@ UndoGetWork(bool allow_peek, bool remove_from_queue, UndoRequestInfo *urinfo,
 			if (!exists)
 			{
 				RemoveRequestFromQueue(cur_queue, 0);
-				RollbackHTRemoveEntry(rh->full_xid, rh->start_urec_ptr);
+				RollbackHTRemoveEntry(urinfo->full_xid, urinfo->start_urec_ptr);
+				ResetUndoRequestInfo(urinfo);
 				cur_undo_queue++;
 				continue;
 			}
 
-			/* set the undo request info to process */
-			SetUndoRequestInfoFromRHEntry(urinfo, rh, cur_queue);
-
 			cur_undo_queue++;
 			LWLockRelease(RollbackRequestLock);
 			return true;
@@ -1170,6 +1421,7 @@ UndoGetWork(bool allow_peek, bool remove_from_queue, UndoRequestInfo *urinfo,
 
 			/* set the undo request info to process */
 			SetUndoRequestInfoFromRHEntry(urinfo, rh, cur_queue);
+			LWLockRelease(partitionLock);
 
 			/*
 			 * Remove the request from queue so that other undo worker doesn't
@@ -1184,6 +1436,7 @@ UndoGetWork(bool allow_peek, bool remove_from_queue, UndoRequestInfo *urinfo,
 		else
 			in_other_db = true;
 
+		LWLockRelease(partitionLock);
 		cur_undo_queue++;
 	}
 
@@ -1199,6 +1452,8 @@ UndoGetWork(bool allow_peek, bool remove_from_queue, UndoRequestInfo *urinfo,
 					cur_queue;
 		RollbackHashKey hkey;
 		RollbackHashEntry *rh;
+		uint32		hashcode;
+		LWLock	   *partitionLock;
 
 		/*
 		 * We shouldn't have come here if we've found a work above for our
@@ -1213,9 +1468,13 @@ UndoGetWork(bool allow_peek, bool remove_from_queue, UndoRequestInfo *urinfo,
 				if (!GetRollbackHashKeyFromQueue(cur_queue, depth, &hkey))
 					continue;
 
-				rh = (RollbackHashEntry *) hash_search(RollbackHT,
-													   (void *) &hkey,
-													   HASH_FIND, NULL);
+				hashcode = get_hash_value(RollbackHT, (void *) &hkey);
+				partitionLock = RollbackHTPartitionLock(hashcode);
+
+				LWLockAcquire(partitionLock, LW_EXCLUSIVE);
+				rh = (RollbackHashEntry *)
+					hash_search_with_hash_value(RollbackHT, (void *) &hkey,
+												hashcode, HASH_FIND, NULL);
 
 				/*
 				 * If some undo worker is already processing the rollback
@@ -1223,7 +1482,10 @@ UndoGetWork(bool allow_peek, bool remove_from_queue, UndoRequestInfo *urinfo,
 				 * entry from the queue.
 				 */
 				if (!rh || rh->in_progress)
+				{
+					LWLockRelease(partitionLock);
 					continue;
+				}
 
 				found_work = true;
 
@@ -1248,6 +1510,7 @@ UndoGetWork(bool allow_peek, bool remove_from_queue, UndoRequestInfo *urinfo,
 
 					/* set the undo request info to process */
 					SetUndoRequestInfoFromRHEntry(urinfo, rh, cur_queue);
+					LWLockRelease(partitionLock);
 
 					/*
 					 * Remove the request from queue so that other undo worker
@@ -1259,6 +1522,8 @@ UndoGetWork(bool allow_peek, bool remove_from_queue, UndoRequestInfo *urinfo,
 				}
 				else
 					in_other_db = true;
+
+				LWLockRelease(partitionLock);
 			}
 		}
 	}
@@ -1289,7 +1554,8 @@ RegisterRollbackReq(UndoRecPtr end_urec_ptr, UndoRecPtr start_urec_ptr,
 					Oid dbid, FullTransactionId full_xid)
 {
 	bool		found = false;
-	bool		can_push;
+	bool		wants_push;
+	bool		can_push = false;
 	bool		pushed = false;
 	bool		request_registered = false;
 	RollbackHashEntry *rh;
@@ -1314,13 +1580,19 @@ RegisterRollbackReq(UndoRecPtr end_urec_ptr, UndoRecPtr start_urec_ptr,
 	if (!UndoRecPtrIsValid(end_urec_ptr))
 		return false;
 
-	LWLockAcquire(RollbackRequestLock, LW_EXCLUSIVE);
-
 	/*
 	 * Check whether we can push the rollback request to the undo worker. This
-	 * must be done under lock, see CanPushReqToUndoWorker.
+	 * must be done under lock, see CanPushReqToUndoWorker.  Requests that are
+	 * too small to be handed over don't need to look at the queues at all, so
+	 * they skip RollbackRequestLock and only lock their hash table partition.
 	 */
-	can_push = CanPushReqToUndoWorker(start_urec_ptr, end_urec_ptr, req_size);
+	wants_push = RollbackReqWantsUndoWorker(req_size);
+	if (wants_push)
+	{
+		LWLockAcquire(RollbackRequestLock, LW_EXCLUSIVE);
+		can_push = CanPushReqToUndoWorker(start_urec_ptr, end_urec_ptr,
+										  req_size);
+	}
 
 	/*
 	 * Backends always register the rollback request in the rollback hash
@@ -1335,15 +1607,25 @@ RegisterRollbackReq(UndoRecPtr end_urec_ptr, UndoRecPtr start_urec_ptr,
 		(!can_push && !IsDiscardProcess()))
 	{
 		RollbackHashKey hkey;
+		uint32		hashcode;
+		LWLock	   *partitionLock;
 
 		hkey.full_xid = full_xid;
 		hkey.start_urec_ptr = start_urec_ptr;
-
-		rh = (RollbackHashEntry *) hash_search(RollbackHT, &hkey,
-											   HASH_ENTER_NULL, &found);
+		hashcode = get_hash_value(RollbackHT, (void *) &hkey);
+		partitionLock = RollbackHTPartitionLock(hashcode);
+
+		LWLockAcquire(partitionLock, LW_EXCLUSIVE);
+		rh = (RollbackHashEntry *) hash_search_with_hash_value(RollbackHT,
+															   (void *) &hkey,
+															   hashcode,
+															   HASH_ENTER_NULL,
+															   &found);
 		if (!rh)
 		{
-			LWLockRelease(RollbackRequestLock);
+			LWLockRelease(partitionLock);
+			if (wants_push)
+				LWLockRelease(RollbackRequestLock);
 			return false;
 		}
 
@@ -1400,9 +1682,12 @@ RegisterRollbackReq(UndoRecPtr end_urec_ptr, UndoRecPtr start_urec_ptr,
 			/* Indicates that the request will be processed by undo worker. */
 			request_registered = true;
 		}
+
+		LWLockRelease(partitionLock);
 	}
 
-	LWLockRelease(RollbackRequestLock);
+	if (wants_push)
+		LWLockRelease(RollbackRequestLock);
 
 	/*
 	 * If we are able to successfully push the request, wakeup the undo worker
@@ -1421,15 +1706,19 @@ void
 RollbackHTRemoveEntry(FullTransactionId full_xid, UndoRecPtr start_urec_ptr)
 {
 	RollbackHashKey hkey;
+	uint32		hashcode;
+	LWLock	   *partitionLock;
 
 	hkey.full_xid = full_xid;
 	hkey.start_urec_ptr = start_urec_ptr;
+	hashcode = get_hash_value(RollbackHT, (void *) &hkey);
+	partitionLock = RollbackHTPartitionLock(hashcode);
 
-	LWLockAcquire(RollbackRequestLock, LW_EXCLUSIVE);
+	LWLockAcquire(partitionLock, LW_EXCLUSIVE);
 
-	hash_search(RollbackHT, &hkey, HASH_REMOVE, NULL);
+	hash_search_with_hash_value(RollbackHT, &hkey, hashcode, HASH_REMOVE, NULL);
 
-	LWLockRelease(RollbackRequestLock);
+	LWLockRelease(partitionLock);
 }
 
 /*
@@ -1442,16 +1731,13 @@ RollbackHTRemoveEntry(FullTransactionId full_xid, UndoRecPtr start_urec_ptr)
 bool
 RollbackHTIsFull(void)
 {
-	bool		result = false;
-
-	LWLockAcquire(RollbackRequestLock, LW_SHARED);
-
-	if (hash_get_num_entries(RollbackHT) >= UndoRollbackHashTableSize())
-		result = true;
-
-	LWLockRelease(RollbackRequestLock);
-
-	return result;
+	/*
+	 * For a partitioned table, the entry count is maintained under the
+	 * freelist spinlocks rather than the partition locks, so we can read it
+	 * without locking any partition.  The answer is only advisory anyway, as
+	 * the count can change as soon as we return.
+	 */
+	return (hash_get_num_entries(RollbackHT) >= UndoRollbackHashTableSize());
 }
 
 /*
@@ -1464,9 +1750,14 @@ RollbackHTCleanup(Oid dbid)
 {
 	RollbackHashEntry *rh;
 	HASH_SEQ_STATUS status;
+	int			i;
 
-	/* Fetch the rollback requests */
-	LWLockAcquire(RollbackRequestLock, LW_SHARED);
+	/*
+	 * Fetch the rollback requests.  Scanning the whole table requires all the
+	 * partition locks, which must be taken in order.
+	 */
+	for (i = 0; i < NUM_ROLLBACK_HT_PARTITIONS; i++)
+		LWLockAcquire(&RollbackHTPartitionLocks[i].lock, LW_EXCLUSIVE);
 
 	Assert(hash_get_num_entries(RollbackHT) <= UndoRollbackHashTableSize());
 	hash_seq_init(&status, RollbackHT);
@@ -1484,5 +1775,6 @@ RollbackHTCleanup(Oid dbid)
 		}
 	}
 
-	LWLockRelease(RollbackRequestLock);
+	for (i = NUM_ROLLBACK_HT_PARTITIONS; --i >= 0;)
+		LWLockRelease(&RollbackHTPartitionLocks[i].lock);
 }
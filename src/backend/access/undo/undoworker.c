@@ -20,6 +20,14 @@
  * less than undo_worker_quantum ms after starting.  Also, if there is no
  * work, it lingers for UNDO_WORKER_LINGER_MS.  This avoids restarting
  * the workers too frequently.
+ *
+ * The launcher sizes the pool from the state of the queues: one worker per
+ * UNDO_BYTES_PER_WORKER of pending undo, and as many as there are requests
+ * once the oldest request has waited longer than undo_worker_quantum_ms,
+ * since that request holds back oldestXidHavingUndo.  When the next request
+ * belongs to a database that already has a lingering worker, that worker is
+ * woken up instead of launching a new one.  Idle workers above the target
+ * exit without lingering, except that one is kept around.
  *-------------------------------------------------------------------------
  */
 
@@ -78,6 +86,12 @@ int			undo_worker_quantum_ms = 10000;
  */
 #define UNDO_WORKER_LINGER_MS 10000
 
+/*
+ * Amount of pending undo, in bytes, that the launcher considers enough work
+ * for one worker.
+ */
+#define UNDO_BYTES_PER_WORKER ((uint64) 256 * 1024 * 1024)
+
 /* Flags set by signal handlers */
 static volatile sig_atomic_t got_SIGHUP = false;
 static volatile sig_atomic_t got_SIGTERM = false;
@@ -117,6 +131,9 @@ typedef struct UndoApplyCtxStruct
 	/* latch to wake up undo launcher. */
 	Latch	   *undo_launcher_latch;
 
+	/* Number of workers the launcher wants, see UndoLauncherComputeTarget. */
+	int			target_workers;
+
 	/* Background workers. */
 	UndoApplyWorker workers[FLEXIBLE_ARRAY_MEMBER];
 }			UndoApplyCtxStruct;
@@ -267,17 +284,16 @@ UndoWorkerAttach(int slot)
 }
 
 /*
- * Returns whether an undo worker is available.
+ * Returns the number of undo worker slots in use.
  */
 static int
-IsUndoWorkerAvailable(void)
+UndoWorkerCount(void)
 {
 	int			i;
 	int			alive_workers = 0;
 
-	LWLockAcquire(UndoWorkerLock, LW_EXCLUSIVE);
+	Assert(LWLockHeldByMe(UndoWorkerLock));
 
-	/* Search for attached worker for a given db id. */
 	for (i = 0; i < max_undo_workers; i++)
 	{
 		UndoApplyWorker *w = &UndoApplyCtx->workers[i];
@@ -286,9 +302,88 @@ IsUndoWorkerAvailable(void)
 			alive_workers++;
 	}
 
+	return alive_workers;
+}
+
+/*
+ * Wake up a lingering worker connected to the given database, if any.
+ * Returns true if we found one.
+ */
+static bool
+WakeupLingeringUndoWorker(Oid dbid)
+{
+	int			i;
+
+	Assert(LWLockHeldByMe(UndoWorkerLock));
+
+	for (i = 0; i < max_undo_workers; i++)
+	{
+		UndoApplyWorker *w = &UndoApplyCtx->workers[i];
+
+		if (w->in_use && w->lingering && w->dbid == dbid)
+		{
+			SetLatch(&w->proc->procLatch);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Compute the number of undo workers we want, based on the pending requests.
+ */
+static int
+UndoLauncherComputeTarget(void)
+{
+	UndoQueueStats stats[MAX_UNDO_WORK_QUEUES];
+	int			nrequests;
+	int			target;
+
+	UndoGetQueueStats(stats);
+
+	/* The xid and size queues contain the same requests. */
+	nrequests = Max(stats[XID_QUEUE].nrequests, stats[SIZE_QUEUE].nrequests) +
+		stats[ERROR_QUEUE].nrequests;
+	if (nrequests == 0)
+		return 0;
+
+	target = 1 + (int) Min(stats[SIZE_QUEUE].pending_bytes / UNDO_BYTES_PER_WORKER,
+						   (uint64) max_undo_workers);
+
+	/*
+	 * If the oldest request has been waiting for too long, it is holding back
+	 * oldestXidHavingUndo and so the discarding of undo; throw every worker
+	 * we can at the queues.
+	 */
+	if (stats[XID_QUEUE].nrequests > 0 &&
+		TimestampDifferenceExceeds(stats[XID_QUEUE].oldest_enqueued_at,
+								   GetCurrentTimestamp(),
+								   undo_worker_quantum_ms))
+		target = nrequests;
+
+	/* A worker processes one request at a time. */
+	target = Min(target, nrequests);
+
+	return Min(target, max_undo_workers);
+}
+
+/*
+ * Returns true if this worker has nothing to do and the pool is larger than
+ * the launcher wants, in which case it should exit rather than linger.  We
+ * keep one worker lingering, so that a new burst of requests does not need
+ * to wait for a worker to start up and connect.
+ */
+static bool
+UndoWorkerIsSurplus(void)
+{
+	bool		result;
+
+	LWLockAcquire(UndoWorkerLock, LW_SHARED);
+	result = UndoWorkerCount() > Max(UndoApplyCtx->target_workers, 1);
 	LWLockRelease(UndoWorkerLock);
 
-	return (alive_workers < max_undo_workers);
+	return result;
 }
 
 static void
@@ -469,7 +564,7 @@ UndoWorkerPerformRequest(UndoRequestInfo *urinfo)
 		 * Register the unprocessed request in an error queue, so that it can
 		 * be processed in a timely fashion.
 		 */
-		if (InsertRequestIntoErrorUndoQueue(urinfo))
+		if (!InsertRequestIntoErrorUndoQueue(urinfo))
 			RollbackHTRemoveEntry(urinfo->full_xid, urinfo->start_urec_ptr);
 
 		/* Prevent interrupts while cleaning up. */
@@ -594,14 +689,50 @@ UndoLauncherMain(Datum main_arg)
 	while (!got_SIGTERM)
 	{
 		int			rc;
+		int			target;
+		int			nlaunched;
 
 		CHECK_FOR_INTERRUPTS();
 
-		ResetUndoRequestInfo(&urinfo);
+		target = UndoLauncherComputeTarget();
+
+		LWLockAcquire(UndoWorkerLock, LW_EXCLUSIVE);
+		UndoApplyCtx->target_workers = target;
+		LWLockRelease(UndoWorkerLock);
+
+		/*
+		 * Launch workers until the pool reaches the target.  Each launched
+		 * worker removes the request it was launched for from the queue
+		 * before attaching, so the next call to UndoGetWork sees the next
+		 * request.
+		 */
+		for (nlaunched = 0; nlaunched < max_undo_workers; nlaunched++)
+		{
+			bool		woken;
+
+			LWLockAcquire(UndoWorkerLock, LW_SHARED);
+			if (UndoWorkerCount() >= target)
+			{
+				LWLockRelease(UndoWorkerLock);
+				break;
+			}
+			LWLockRelease(UndoWorkerLock);
+
+			ResetUndoRequestInfo(&urinfo);
+			if (!UndoGetWork(false, false, &urinfo, NULL))
+				break;
+
+			/*
+			 * Prefer a worker that is already connected to the request's
+			 * database; it will pick the request up by itself.
+			 */
+			LWLockAcquire(UndoWorkerLock, LW_EXCLUSIVE);
+			woken = WakeupLingeringUndoWorker(urinfo.dbid);
+			LWLockRelease(UndoWorkerLock);
 
-		if (UndoGetWork(false, false, &urinfo, NULL) &&
-			IsUndoWorkerAvailable())
-			UndoWorkerLaunch(urinfo);
+			if (woken || !UndoWorkerLaunch(urinfo))
+				break;
+		}
 
 		/* Wait for more work. */
 		rc = WaitLatch(MyLatch,
@@ -720,9 +851,10 @@ UndoWorkerMain(Datum main_arg)
 
 			/*
 			 * We don't need to linger if we have already spent
-			 * UNDO_WORKER_LINGER_MS since last transaction has processed.
+			 * UNDO_WORKER_LINGER_MS since last transaction has processed, or
+			 * if the launcher wants fewer workers than are running.
 			 */
-			if (timeout <= GetCurrentTimestamp())
+			if (timeout <= GetCurrentTimestamp() || UndoWorkerIsSurplus())
 			{
 				proc_exit(0);
 			}
@@ -787,17 +919,10 @@ WakeupUndoWorker(Oid dbid)
 	LWLockAcquire(UndoWorkerLock, LW_EXCLUSIVE);
 
 	/* wake up lingering worker in the given database. */
-	for (i = 0; i < max_undo_workers; i++)
+	if (WakeupLingeringUndoWorker(dbid))
 	{
-		UndoApplyWorker *w = &UndoApplyCtx->workers[i];
-
-		if (w->in_use && w->lingering && w->dbid == dbid)
-		{
-			SetLatch(&w->proc->procLatch);
-
-			LWLockRelease(UndoWorkerLock);
-			return;
-		}
+		LWLockRelease(UndoWorkerLock);
+		return;
 	}
 
 	/*
@@ -15,9 +15,9 @@
 
 #include "access/tpd.h"
 #include "access/tpd_xlog.h"
+#include "commands/vacuum.h"
 #include "miscadmin.h"
 #include "storage/bufpage.h"
-#include "storage/freespace.h"
 #include "storage/proc.h"
 
 typedef struct TPDPruneState
@@ -181,30 +181,59 @@ TPDPagePrune(Relation rel, Buffer tpdbuf, BufferAccessStrategy strategy,
 free_tpd_page:
 	if (can_free && PageIsEmpty(tpdpage))
 	{
-		Size		freespace;
-
 		/* If the page is empty, we have certainly pruned all the tpd entries. */
 		if (tpd_e_pruned)
 			*tpd_e_pruned = true;
 
 		/*
-		 * We can reuse empty page as either a heap page or a TPD page, so no
-		 * need to consider opaque space.
+		 * TPD page is empty, remove it from TPD used page list and add it to
+		 * the free list in the metapage.
 		 */
-		freespace = BLCKSZ - SizeOfPageHeaderData;
-
-		/*
-		 * TPD page is empty, remove it from TPD used page list and record it
-		 * in FSM.
-		 */
-		if (TPDFreePage(rel, tpdbuf, strategy))
-			RecordPageWithFreeSpace(rel, BufferGetBlockNumber(tpdbuf),
-									freespace);
+		(void) TPDFreePage(rel, tpdbuf, strategy);
 	}
 
 	return prstate.nunused;
 }
 
+/*
+ * TPDVacuumPages - Prune all the pages of the TPD fork.
+ *
+ * This is called by vacuum after it has processed the heap pages.  The TPD
+ * pages that become empty are removed from the TPD page list and made
+ * available for reuse.  Any zeroed page that couldn't be remembered in the
+ * free list earlier (say, because the list was full at that time) is added
+ * to it here, if there is room.
+ */
+void
+TPDVacuumPages(Relation rel, BufferAccessStrategy strategy)
+{
+	BlockNumber nblocks;
+	BlockNumber blkno;
+
+	nblocks = TPDNumberOfBlocks(rel);
+
+	for (blkno = 0; blkno < nblocks; blkno++)
+	{
+		Buffer		buf;
+		Page		page;
+
+		vacuum_delay_point();
+
+		buf = ReadBufferExtended(rel, TPD_FORKNUM, blkno, RBM_NORMAL,
+								 strategy);
+		LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+		page = BufferGetPage(buf);
+
+		if (PageIsNew(page))
+			TPDRecordFreePage(rel, buf);
+		else if (IsTPDPage(page))
+			TPDPagePrune(rel, buf, strategy, InvalidOffsetNumber, 0, true,
+						 NULL, NULL);
+
+		UnlockReleaseBuffer(buf);
+	}
+}
+
 /*
  * TPDEntryPrune - Check whether the TPD entry is prunable.
  *
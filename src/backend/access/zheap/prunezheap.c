@@ -843,6 +843,31 @@ ZPageRepairFragmentation(Buffer buffer, Page tmppage,
 					return;
 			}
 		}
+		else if (ItemIdIsDeleted(lp) &&
+				 !(ItemIdGetVisibilityInfo(lp) & ITEMID_XACT_INVALID))
+		{
+			ZHeapTupleTransInfo zinfo;
+
+			/*
+			 * The storage of an item deleted by an open transaction might
+			 * have been taken over by a tuple inserted by the same
+			 * transaction (see ZPageGetReusableItem).  The rollback of such
+			 * an insert gives the storage back to the deleted item, so we
+			 * can't move it around.
+			 */
+			zinfo.trans_slot = ItemIdGetTransactionSlot(lp);
+			if (zinfo.trans_slot == ZHTUP_SLOT_FROZEN)
+				continue;
+
+			GetTransactionSlotInfo(buffer, i, zinfo.trans_slot,
+								   NoTPDBufLock, false, &zinfo);
+			if (zinfo.trans_slot == ZHTUP_SLOT_FROZEN)
+				continue;
+
+			if (TransactionIdIsValid(zinfo.xid) &&
+				!TransactionIdDidCommit(zinfo.xid))
+				return;
+		}
 	}
 
 	/*
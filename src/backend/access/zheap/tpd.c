@@ -12,9 +12,11 @@
  * deadlock, (b) To support cases where a large number of transactions acquire
  * SHARE or KEY SHARE locks on a single page.
  *
- * The TPD overflow pages will be stored in the zheap itself, interleaved with
- * regular pages.  We have a meta page in zheap from which all overflow pages
- * are tracked.
+ * The TPD overflow pages are stored in a separate fork of the zheap relation
+ * (TPD_FORKNUM), so that scans, bulk inserts and the FSM of the main fork
+ * never have to deal with them.  We have a meta page in zheap from which all
+ * overflow pages are tracked.  The pages freed by pruning are remembered in
+ * a small free list in the meta page, from which they are reused.
  *
  * TPD Entry acts like an extension of the transaction slot array in heap
  * page.  Tuple headers normally point to the transaction slot responsible for
@@ -36,10 +38,12 @@
 #include "access/tpd_xlog.h"
 #include "access/zheap.h"
 #include "access/zheapam_xlog.h"
+#include "catalog/storage_xlog.h"
 #include "miscadmin.h"
 #include "storage/bufmgr.h"
 #include "storage/buf_internals.h"
 #include "storage/lmgr.h"
+#include "storage/smgr.h"
 #include "storage/proc.h"
 #include "utils/lsyscache.h"
 #include "utils/relfilenodemap.h"
@@ -93,8 +97,14 @@ static Buffer registered_tpd_buffers[MAX_TPD_BUFFERS];
 static TPDBuffers tpd_buffers[MAX_TPD_BUFFERS];
 static int	tpd_buf_idx;
 static int	registered_tpd_buf_idx;
+static Buffer ReadTPDBuffer(Relation rel, BlockNumber blk,
+							BufferAccessStrategy strategy);
 static int	GetTPDBuffer(Relation rel, BlockNumber blk, Buffer tpd_buf,
 						 TPDACTION tpd_action, bool *already_exists);
+static bool TPDIsFreePage(ZHeapMetaPage metapage, BlockNumber blkno);
+static void TPDRemoveFreePage(ZHeapMetaPage metapage, BlockNumber blkno);
+static void TPDFormMetaData(ZHeapMetaPage metapage,
+							xl_zheap_metadata *xl_meta);
 static void TPDEntryUpdate(Relation relation, TPDEntryInfo *tpd_info,
 						   uint16 tpd_e_offset);
 static void TPDAllocatePageAndAddEntry(Relation relation, Buffer metabuf,
@@ -119,6 +129,186 @@ ResetRegisteredTPDBuffers()
 	registered_tpd_buf_idx = 0;
 }
 
+/*
+ * TPDSmgrHasBlock - Check whether the given block of the TPD fork exists.
+ *
+ * The size of the fork is cached in smgr_tpd_nblocks.  The fork only grows,
+ * except when it's truncated, which resets the cached size in every backend
+ * by means of an smgr invalidation, so a cached size that already covers the
+ * block is good enough.  Otherwise, we look again.  Thus the common case
+ * doesn't need any system call.
+ */
+static bool
+TPDSmgrHasBlock(SMgrRelation smgr, BlockNumber blk)
+{
+	if (smgr->smgr_tpd_nblocks != InvalidBlockNumber &&
+		blk < smgr->smgr_tpd_nblocks)
+		return true;
+
+	if (smgrexists(smgr, TPD_FORKNUM))
+		smgr->smgr_tpd_nblocks = smgrnblocks(smgr, TPD_FORKNUM);
+	else
+		smgr->smgr_tpd_nblocks = 0;
+
+	return blk < smgr->smgr_tpd_nblocks;
+}
+
+/*
+ * ReadTPDBuffer - Read the given block of the TPD fork.
+ *
+ * P_NEW can be passed to extend the fork, in which case we create the fork
+ * first if it doesn't exist yet.  Caller is responsible for holding the
+ * relation extension lock in that case.
+ */
+static Buffer
+ReadTPDBuffer(Relation rel, BlockNumber blk, BufferAccessStrategy strategy)
+{
+	Buffer		buf;
+
+	if (blk == P_NEW)
+	{
+		RelationOpenSmgr(rel);
+
+		/* A fork known to have blocks surely exists. */
+		if (rel->rd_smgr->smgr_tpd_nblocks == InvalidBlockNumber ||
+			rel->rd_smgr->smgr_tpd_nblocks == 0)
+		{
+			if (!smgrexists(rel->rd_smgr, TPD_FORKNUM))
+				smgrcreate(rel->rd_smgr, TPD_FORKNUM, false);
+		}
+
+		buf = ReadBufferExtended(rel, TPD_FORKNUM, P_NEW, RBM_NORMAL,
+								 strategy);
+
+		/* The relcache entry's smgr might have been reopened meanwhile. */
+		RelationOpenSmgr(rel);
+		rel->rd_smgr->smgr_tpd_nblocks = BufferGetBlockNumber(buf) + 1;
+
+		return buf;
+	}
+
+	return ReadBufferExtended(rel, TPD_FORKNUM, blk, RBM_NORMAL, strategy);
+}
+
+/*
+ * TPDNumberOfBlocks - Get the number of blocks in the TPD fork.
+ *
+ * The fork is created lazily when the first TPD page is allocated, so it's
+ * perfectly normal for it to not exist.
+ */
+BlockNumber
+TPDNumberOfBlocks(Relation rel)
+{
+	RelationOpenSmgr(rel);
+	(void) TPDSmgrHasBlock(rel->rd_smgr, InvalidBlockNumber);
+
+	return rel->rd_smgr->smgr_tpd_nblocks;
+}
+
+/*
+ * TPDHasBlock - Check whether the given block of the TPD fork exists.
+ */
+static bool
+TPDHasBlock(Relation rel, BlockNumber blk)
+{
+	RelationOpenSmgr(rel);
+
+	return TPDSmgrHasBlock(rel->rd_smgr, blk);
+}
+
+/*
+ * TPDTruncate - Remove all the pages of the TPD fork.
+ *
+ * This is used when the relation is truncated non-transactionally and its
+ * metapage is re-initialized, at which point none of the TPD pages can be
+ * referenced anymore.
+ */
+void
+TPDTruncate(Relation rel)
+{
+	if (TPDNumberOfBlocks(rel) == 0)
+		return;
+
+	if (RelationNeedsWAL(rel))
+	{
+		xl_smgr_truncate xlrec;
+
+		xlrec.blkno = 0;
+		xlrec.rnode = rel->rd_node;
+		xlrec.flags = SMGR_TRUNCATE_TPD;
+
+		XLogBeginInsert();
+		XLogRegisterData((char *) &xlrec, sizeof(xlrec));
+
+		(void) XLogInsert(RM_SMGR_ID,
+						  XLOG_SMGR_TRUNCATE | XLR_SPECIAL_REL_UPDATE);
+	}
+
+	smgrtruncate(rel->rd_smgr, TPD_FORKNUM, 0);
+	rel->rd_smgr->smgr_tpd_nblocks = 0;
+}
+
+/*
+ * TPDIsFreePage - Check whether the block is in the free list of TPD pages.
+ *
+ * Caller must hold a lock on the metapage.
+ */
+static bool
+TPDIsFreePage(ZHeapMetaPage metapage, BlockNumber blkno)
+{
+	uint32		i;
+
+	for (i = 0; i < metapage->zhm_num_free_tpd_pages; i++)
+	{
+		if (metapage->zhm_free_tpd_pages[i] == blkno)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * TPDRemoveFreePage - Remove the block from the free list of TPD pages.
+ *
+ * Caller must hold an exclusive lock on the metapage and be in a critical
+ * section.
+ */
+static void
+TPDRemoveFreePage(ZHeapMetaPage metapage, BlockNumber blkno)
+{
+	uint32		i;
+
+	for (i = 0; i < metapage->zhm_num_free_tpd_pages; i++)
+	{
+		if (metapage->zhm_free_tpd_pages[i] == blkno)
+		{
+			metapage->zhm_num_free_tpd_pages--;
+			metapage->zhm_free_tpd_pages[i] =
+				metapage->zhm_free_tpd_pages[metapage->zhm_num_free_tpd_pages];
+			return;
+		}
+	}
+
+	elog(PANIC, "TPD page %u is not in the free list", blkno);
+}
+
+/*
+ * TPDFormMetaData - Form the data required to regenerate the metapage during
+ *		replay.
+ *
+ * xl_meta must have space for ZHEAP_MAX_FREE_TPD_PAGES free pages; only
+ * SizeOfMetaData(xl_meta->num_free_tpd_pages) bytes need to be logged.
+ */
+static void
+TPDFormMetaData(ZHeapMetaPage metapage, xl_zheap_metadata *xl_meta)
+{
+	xl_meta->first_used_tpd_page = metapage->zhm_first_used_tpd_page;
+	xl_meta->last_used_tpd_page = metapage->zhm_last_used_tpd_page;
+	xl_meta->num_free_tpd_pages = metapage->zhm_num_free_tpd_pages;
+	memcpy(xl_meta->free_tpd_pages, metapage->zhm_free_tpd_pages,
+		   metapage->zhm_num_free_tpd_pages * sizeof(uint32));
+}
+
 /*
  * GetTPDBuffer - Get the tpd buffer corresponding to give block number.
  *
@@ -192,7 +382,7 @@ GetTPDBuffer(Relation rel, BlockNumber blk, Buffer tpd_buf,
 	 */
 	if (i == tpd_buf_idx)
 	{
-		buf = ReadBuffer(rel, blk);
+		buf = ReadTPDBuffer(rel, blk, NULL);
 		tpd_buffers[tpd_buf_idx].blk = BufferGetBlockNumber(buf);
 		tpd_buffers[tpd_buf_idx].buf = buf;
 		tpd_buf_idx++;
@@ -1010,7 +1200,7 @@ TPDFreePage(Relation rel, Buffer buf, BufferAccessStrategy bstrategy)
 	Page		page,
 				prevpage = NULL,
 				nextpage = NULL;
-	BlockNumber curblkno PG_USED_FOR_ASSERTS_ONLY = InvalidBlockNumber;
+	BlockNumber curblkno = InvalidBlockNumber;
 	BlockNumber prevblkno = InvalidBlockNumber;
 	BlockNumber nextblkno = InvalidBlockNumber;
 	Buffer		prevbuf = InvalidBuffer;
@@ -1033,22 +1223,22 @@ TPDFreePage(Relation rel, Buffer buf, BufferAccessStrategy bstrategy)
 	 * by this time.  If we don't wait here for other backends who have
 	 * already read this page, then it is possible that by the time they try
 	 * to acquire lock on this page, we would have freed this page and some
-	 * other backend could have reused it as heap page and had a lock on it.
-	 * In such a situation, the system can deadlock because the backend-1
-	 * which tries to acquire a lock on this page thinking it is a TPD page
-	 * would wait on backend-2 which has reused it as a heap page and
-	 * backend-2 can wait start waiting on some page on which backend-1 has a
-	 * lock (this can usually happen when multiple heap buffers are involved
-	 * in a single operation like in case of non-in-place updates).
+	 * other backend could have reused it for a different TPD entry and had a
+	 * lock on it.  In such a situation, the system can deadlock because the
+	 * backend-1 which tries to acquire a lock on this page for the pruned
+	 * entry would wait on backend-2 which has reused it and backend-2 can
+	 * start waiting on some page on which backend-1 has a lock (this can
+	 * usually happen when multiple heap buffers are involved in a single
+	 * operation like in case of non-in-place updates).
 	 *
 	 * For new backends that come to access this as a TPD page after we
 	 * acquire cleanup lock here would definitely see this as a invalid TPD
 	 * page (no valid TPD entries).
 	 *
-	 * One can imagine that after we release the lock, vacuum or some other
-	 * process can record this page in FSM, but that is not possible as we
-	 * haven't cleared the special space which will make it appear as a TPD
-	 * page and it will just ignore this page.  See lazy_scan_zheap.
+	 * One can imagine that after we release the lock, some other process can
+	 * add this page to the free list, but that is not possible as we haven't
+	 * cleared the special space which will make it appear as a TPD page in
+	 * use.  See TPDVacuumPages.
 	 */
 	LockBuffer(buf, BUFFER_LOCK_UNLOCK);
 	LockBufferForCleanup(buf);
@@ -1082,8 +1272,7 @@ TPDFreePage(Relation rel, Buffer buf, BufferAccessStrategy bstrategy)
 		 * avoids the deadlock risks.  See atop TPDAllocatePageAndAddEntry.
 		 */
 		LockBuffer(buf, BUFFER_LOCK_UNLOCK);
-		prevbuf = ReadBufferExtended(rel, MAIN_FORKNUM, prevblkno, RBM_NORMAL,
-									 bstrategy);
+		prevbuf = ReadTPDBuffer(rel, prevblkno, bstrategy);
 		LockBuffer(prevbuf, BUFFER_LOCK_EXCLUSIVE);
 		LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
 
@@ -1109,8 +1298,7 @@ TPDFreePage(Relation rel, Buffer buf, BufferAccessStrategy bstrategy)
 	/* Fetch and lock the next buffer. */
 	if (BlockNumberIsValid(nextblkno))
 	{
-		nextbuf = ReadBufferExtended(rel, MAIN_FORKNUM, nextblkno, RBM_NORMAL,
-									 bstrategy);
+		nextbuf = ReadTPDBuffer(rel, nextblkno, bstrategy);
 		LockBuffer(nextbuf, BUFFER_LOCK_EXCLUSIVE);
 	}
 
@@ -1124,13 +1312,11 @@ TPDFreePage(Relation rel, Buffer buf, BufferAccessStrategy bstrategy)
 	START_CRIT_SECTION();
 
 	/*
-	 * Update the current page so that it can be reused as new TPD or zheap
-	 * page from FSM.
-	 * Here, we will meset full page as zero because if we will not do this,
-	 * then from RelationGetBufferForZTuple, it will be costly to decide that
-	 * page is still in meta list or not because it is possible that empty TPD
-	 * page is still in meta list(see ExtendTPDEntry, there we can make page
-	 * as empty and will not remove from mera list to avoid deadlock).
+	 * Update the current page so that it can be reused as a new TPD page.
+	 * Here, we will memset full page as zero, which distinguishes the free
+	 * pages from the empty TPD pages that are still in the TPD page list (see
+	 * ExtendTPDEntry, there we can make page as empty and will not remove
+	 * from meta list to avoid deadlock).
 	 */
 	MemSet((PageHeader) page, 0, BufferGetPageSize(buf));
 
@@ -1210,10 +1396,29 @@ TPDFreePage(Relation rel, Buffer buf, BufferAccessStrategy bstrategy)
 		Assert(metapage->zhm_last_used_tpd_page != curblkno);
 	}
 
+	/*
+	 * Remember the page in the free list of the metapage, so that it can be
+	 * reused for TPD entries.  If the free list is full, the page stays
+	 * zeroed until vacuum finds room for it.
+	 */
+	if (metapage->zhm_num_free_tpd_pages < ZHEAP_MAX_FREE_TPD_PAGES)
+	{
+		Assert(!TPDIsFreePage(metapage, curblkno));
+		metapage->zhm_free_tpd_pages[metapage->zhm_num_free_tpd_pages++] =
+			curblkno;
+		MarkBufferDirty(metabuf);
+		update_meta = true;
+	}
+
 	if (RelationNeedsWAL(rel))
 	{
 		XLogRecPtr	recptr;
 		xl_tpd_free_page xlrec;
+		union
+		{
+			xl_zheap_metadata meta;
+			char		data[SizeOfMetaData(ZHEAP_MAX_FREE_TPD_PAGES)];
+		}			xl_meta;
 		uint8		info = XLOG_TPD_FREE_PAGE;
 
 		xlrec.prevblkno = prevblkno;
@@ -1228,13 +1433,11 @@ TPDFreePage(Relation rel, Buffer buf, BufferAccessStrategy bstrategy)
 			XLogRegisterBuffer(2, nextbuf, REGBUF_STANDARD);
 		if (update_meta)
 		{
-			xl_zheap_metadata xl_meta;
-
 			info |= XLOG_TPD_INIT_PAGE;
-			xl_meta.first_used_tpd_page = metapage->zhm_first_used_tpd_page;
-			xl_meta.last_used_tpd_page = metapage->zhm_last_used_tpd_page;
+			TPDFormMetaData(metapage, &xl_meta.meta);
 			XLogRegisterBuffer(3, metabuf, REGBUF_STANDARD | REGBUF_WILL_INIT);
-			XLogRegisterBufData(3, (char *) &xl_meta, SizeOfMetaData);
+			XLogRegisterBufData(3, (char *) &xl_meta,
+								SizeOfMetaData(xl_meta.meta.num_free_tpd_pages));
 		}
 
 		recptr = XLogInsert(RM_TPD_ID, info);
@@ -1258,6 +1461,79 @@ TPDFreePage(Relation rel, Buffer buf, BufferAccessStrategy bstrategy)
 	return true;
 }
 
+/*
+ * TPDRecordFreePage - Add a zeroed TPD page to the free list in the metapage.
+ *
+ * We expect that the caller must have acquired EXCLUSIVE lock on the buffer
+ * (buf) and will be responsible for releasing the same.
+ *
+ * The metapage is locked conditionally because a backend allocating a new
+ * TPD page can wait for the lock on this page while holding the metapage
+ * lock.  Not getting the lock is fine; some later vacuum will add the page.
+ */
+void
+TPDRecordFreePage(Relation rel, Buffer buf)
+{
+	ZHeapMetaPage metapage;
+	Buffer		metabuf;
+	BlockNumber blkno = BufferGetBlockNumber(buf);
+
+	Assert(PageIsNew(BufferGetPage(buf)));
+
+	metabuf = ReadBuffer(rel, ZHEAP_METAPAGE);
+	if (!ConditionalLockBuffer(metabuf))
+	{
+		ReleaseBuffer(metabuf);
+		return;
+	}
+
+	metapage = ZHeapPageGetMeta(BufferGetPage(metabuf));
+	Assert(metapage->zhm_magic == ZHEAP_MAGIC);
+
+	if (metapage->zhm_num_free_tpd_pages >= ZHEAP_MAX_FREE_TPD_PAGES ||
+		TPDIsFreePage(metapage, blkno))
+	{
+		UnlockReleaseBuffer(metabuf);
+		return;
+	}
+
+	START_CRIT_SECTION();
+
+	metapage->zhm_free_tpd_pages[metapage->zhm_num_free_tpd_pages++] = blkno;
+	MarkBufferDirty(metabuf);
+
+	if (RelationNeedsWAL(rel))
+	{
+		XLogRecPtr	recptr;
+		xl_tpd_free_page xlrec;
+		union
+		{
+			xl_zheap_metadata meta;
+			char		data[SizeOfMetaData(ZHEAP_MAX_FREE_TPD_PAGES)];
+		}			xl_meta;
+
+		/* The page is not part of the TPD page list. */
+		xlrec.prevblkno = InvalidBlockNumber;
+		xlrec.nextblkno = InvalidBlockNumber;
+
+		XLogBeginInsert();
+		XLogRegisterData((char *) &xlrec, SizeOfTPDFreePage);
+		XLogRegisterBuffer(1, buf, REGBUF_STANDARD);
+		TPDFormMetaData(metapage, &xl_meta.meta);
+		XLogRegisterBuffer(3, metabuf, REGBUF_STANDARD | REGBUF_WILL_INIT);
+		XLogRegisterBufData(3, (char *) &xl_meta,
+							SizeOfMetaData(xl_meta.meta.num_free_tpd_pages));
+
+		recptr = XLogInsert(RM_TPD_ID, XLOG_TPD_FREE_PAGE | XLOG_TPD_INIT_PAGE);
+
+		PageSetLSN(BufferGetPage(metabuf), recptr);
+	}
+
+	END_CRIT_SECTION();
+
+	UnlockReleaseBuffer(metabuf);
+}
+
 /*
  * TPDEntryUpdate - Update the TPD entry inplace and write a WAL record for
  *					the same.
@@ -1318,10 +1594,12 @@ TPDEntryUpdate(Relation relation, TPDEntryInfo *tpd_info, uint16 tpd_e_offset)
  * old buffer block will always be lesser (or equal) than last buffer block.
  * However, if anytime we change our strategy such that after acquiring
  * metapage lock we try to acquire lock on any existing page, then we might
- * need to reconsider our locking order.
+ * need to reconsider our locking order.  A page taken from the metapage's
+ * free list is only ever locked conditionally, so it doesn't participate in
+ * this ordering.
  *
- * always_extend, this parameter indicates whether we can use FSM to get the
- * new TPD page or not.  This is required to avoid some deadlock hazards by
+ * always_extend, this parameter indicates whether we can reuse a page from
+ * the free list in the metapage to get the new TPD page or not.  This is required to avoid some deadlock hazards by
  * the callers, basically they don't want to lock any tpd page with lower
  * number, when they already have lock on some other tpd page.
  */
@@ -1343,11 +1621,11 @@ TPDAllocatePageAndAddEntry(Relation relation, Buffer metabuf, Buffer pagebuf,
 	BlockNumber last_used_tpd_page;
 	OffsetNumber offset_num;
 	bool		free_last_used_tpd_buf = false;
+	bool		reuse_free_page = false;
 
 	if (add_new_tpd_page)
 	{
 		BlockNumber targetBlock = InvalidBlockNumber;
-		Size		len = MaxTPDEntrySize;
 		int			buf_idx;
 		bool		needLock;
 		bool		already_exists;
@@ -1359,25 +1637,21 @@ TPDAllocatePageAndAddEntry(Relation relation, Buffer metabuf, Buffer pagebuf,
 		Assert(!delete_old_entry || BufferIsValid(tpd_info->old_tpd_buf));
 		Assert(delete_old_entry || !BufferIsValid(tpd_info->old_tpd_buf));
 
-		/*
-		 * FIXME: We can allow the free pages to be used from FSM once we fix
-		 * lock ordering w.r.t buffer locks, otherwise it can lead to
-		 * deadlocks.
-		 */
-		always_extend = true;
-
 		/* Always extend when asked to do so. */
 		if (!always_extend)
 		{
-			/* Before extending the relation, check the FSM for free page. */
-			targetBlock = GetPageWithFreeSpace(relation, len);
+			BlockNumber freeBlock = InvalidBlockNumber;
 
-			while (targetBlock != InvalidBlockNumber)
-			{
-				Page		page;
-				Size		pageFreeSpace;
+			/* Before extending the TPD fork, check the free list. */
+			LockBuffer(metabuf, BUFFER_LOCK_SHARE);
+			metapage = ZHeapPageGetMeta(BufferGetPage(metabuf));
+			if (metapage->zhm_num_free_tpd_pages > 0)
+				freeBlock = metapage->zhm_free_tpd_pages[metapage->zhm_num_free_tpd_pages - 1];
+			LockBuffer(metabuf, BUFFER_LOCK_UNLOCK);
 
-				tpd_buf = ReadBuffer(relation, targetBlock);
+			if (BlockNumberIsValid(freeBlock))
+			{
+				tpd_buf = ReadTPDBuffer(relation, freeBlock, NULL);
 
 				/*
 				 * We need to take the lock on meta page before new page to
@@ -1386,51 +1660,38 @@ TPDAllocatePageAndAddEntry(Relation relation, Buffer metabuf, Buffer pagebuf,
 				LockBuffer(metabuf, BUFFER_LOCK_EXCLUSIVE);
 
 				/*
-				 * It's possible that FSM returns a zheap page on which the
-				 * current backend already holds a lock in exclusive mode.
-				 * Hence, try using conditional lock. If it can't get the lock
-				 * immediately, extend the relation and allocate a new TPD
-				 * block.
+				 * Some other backend might have reused the page meanwhile or
+				 * might be in the process of doing so.  Hence, recheck the
+				 * free list and try using conditional lock.  If we can't get
+				 * the page, extend the fork and allocate a new TPD block.
 				 */
-				if (ConditionalLockBuffer(tpd_buf))
+				if (TPDIsFreePage(metapage, freeBlock) &&
+					ConditionalLockBuffer(tpd_buf))
 				{
-					page = BufferGetPage(tpd_buf);
+					Page		page = BufferGetPage(tpd_buf);
 
 					if (PageIsNew(page) || PageIsEmpty(page))
 					{
-						GetTPDBuffer(relation, targetBlock, tpd_buf,
+						GetTPDBuffer(relation, freeBlock, tpd_buf,
 									 TPD_BUF_FIND_OR_KNOWN_ENTER,
 									 &already_exists);
-						break;
+						targetBlock = freeBlock;
+						reuse_free_page = true;
 					}
-
-					LockBuffer(metabuf, BUFFER_LOCK_UNLOCK);
-
-					if (IsTPDPage(page))
-						pageFreeSpace = PageGetTPDFreeSpace(page);
 					else
-						pageFreeSpace = PageGetZHeapFreeSpace(page);
-
-					/*
-					 * Update FSM as to condition of this page, and ask for
-					 * another page to try.
-					 */
-					targetBlock = RecordAndGetPageWithFreeSpace(relation,
-																targetBlock,
-																pageFreeSpace,
-																len);
-					UnlockReleaseBuffer(tpd_buf);
+						LockBuffer(tpd_buf, BUFFER_LOCK_UNLOCK);
 				}
-				else
+
+				if (!reuse_free_page)
 				{
 					LockBuffer(metabuf, BUFFER_LOCK_UNLOCK);
 					ReleaseBuffer(tpd_buf);
-					targetBlock = InvalidBlockNumber;
+					tpd_buf = InvalidBuffer;
 				}
 			}
 		}
 
-		/* Extend the relation, if required? */
+		/* Extend the TPD fork, if required? */
 		if (targetBlock == InvalidBlockNumber)
 		{
 			/* Acquire the extension lock, if extension is required. */
@@ -1447,17 +1708,17 @@ TPDAllocatePageAndAddEntry(Relation relation, Buffer metabuf, Buffer pagebuf,
 			LockBuffer(tpd_buf, BUFFER_LOCK_EXCLUSIVE);
 			targetBlock = BufferGetBlockNumber(tpd_buf);
 
+			/*
+			 * Vacuum could have found this page zeroed and added it to the
+			 * free list before we got the lock on it.
+			 */
+			metapage = ZHeapPageGetMeta(BufferGetPage(metabuf));
+			reuse_free_page = TPDIsFreePage(metapage, targetBlock);
+
 			if (needLock)
 				UnlockRelationForExtension(relation, ExclusiveLock);
 		}
 
-		/*
-		 * Once we've allocated a TPD page, we should update the FSM with the
-		 * available freespace which is zero in this case. This restricts
-		 * other backends from getting the same page from FSM.
-		 */
-		RecordPageWithFreeSpace(relation, targetBlock, 0);
-
 		/*
 		 * Lock the last tpd page in list, so that we can append new page to
 		 * it.
@@ -1475,8 +1736,9 @@ recheck_meta:
 
 			if (buf_idx == -1)
 			{
-				last_used_tpd_buf = ReadBuffer(relation,
-											   metapage->zhm_last_used_tpd_page);
+				last_used_tpd_buf = ReadTPDBuffer(relation,
+												  metapage->zhm_last_used_tpd_page,
+												  NULL);
 
 				/*
 				 * To avoid deadlock, ensure that we never acquire lock on any
@@ -1526,6 +1788,10 @@ recheck_meta:
 		tpdblkno = BufferGetBlockNumber(tpd_buf);
 		tpdopaque = (TPDPageOpaque) PageGetSpecialPointer(tpdpage);
 
+		/* The page is no longer free. */
+		if (reuse_free_page)
+			TPDRemoveFreePage(metapage, tpdblkno);
+
 		if (metapage->zhm_first_used_tpd_page == InvalidBlockNumber)
 			metapage->zhm_first_used_tpd_page = tpdblkno;
 		else
@@ -1593,7 +1859,11 @@ recheck_meta:
 	{
 		XLogRecPtr	recptr;
 		xl_tpd_allocate_entry xlrec;
-		xl_zheap_metadata metadata;
+		union
+		{
+			xl_zheap_metadata meta;
+			char		data[SizeOfMetaData(ZHEAP_MAX_FREE_TPD_PAGES)];
+		}			xl_meta;
 		int			bufflags = 0;
 		uint8		info = XLOG_ALLOCATE_TPD_ENTRY;
 
@@ -1621,9 +1891,9 @@ recheck_meta:
 		if (add_new_tpd_page)
 		{
 			XLogRegisterBuffer(2, metabuf, REGBUF_WILL_INIT | REGBUF_STANDARD);
-			metadata.first_used_tpd_page = metapage->zhm_first_used_tpd_page;
-			metadata.last_used_tpd_page = metapage->zhm_last_used_tpd_page;
-			XLogRegisterBufData(2, (char *) &metadata, SizeOfMetaData);
+			TPDFormMetaData(metapage, &xl_meta.meta);
+			XLogRegisterBufData(2, (char *) &xl_meta,
+								SizeOfMetaData(xl_meta.meta.num_free_tpd_pages));
 
 			if (BufferIsValid(last_used_tpd_buf))
 				XLogRegisterBuffer(3, last_used_tpd_buf, REGBUF_STANDARD);
@@ -1862,7 +2132,6 @@ TPDPageGetTransactionSlots(Relation relation, Buffer heapbuf,
 	Buffer		tpd_buf;
 	Page		tpdpage;
 	BlockNumber tpdblk;
-	BlockNumber lastblock;
 	TPDEntryHeaderData tpd_e_hdr;
 	Size		size_tpd_e_map;
 	Size		size_tpd_e_slots;
@@ -1897,9 +2166,7 @@ TPDPageGetTransactionSlots(Relation relation, Buffer heapbuf,
 
 	if (!InRecovery)
 	{
-		lastblock = RelationGetNumberOfBlocks(relation);
-
-		if (lastblock <= tpdblk)
+		if (!TPDHasBlock(relation, tpdblk))
 		{
 			/*
 			 * The required TPD block has been pruned and then truncated away
@@ -2383,7 +2650,6 @@ TPDPageGetTransactionSlotInfo(Buffer heapbuf, int trans_slot,
 	if (NoTPDBufLock)
 	{
 		SMgrRelation smgr;
-		BlockNumber lastblock;
 
 		BufferGetTag(heapbuf, &rnode, &forknum, &heapblk);
 
@@ -2401,12 +2667,10 @@ TPDPageGetTransactionSlotInfo(Buffer heapbuf, int trans_slot,
 						relpersistence == RELPERSISTENCE_TEMP ?
 						MyBackendId : InvalidBackendId);
 
-		lastblock = smgrnblocks(smgr, forknum);
-
 		/* required block exists? */
-		if (tpdblk < lastblock)
+		if (TPDSmgrHasBlock(smgr, tpdblk))
 		{
-			tpdbuffer = ReadBufferWithoutRelcache(rnode, forknum, tpdblk, RBM_NORMAL,
+			tpdbuffer = ReadBufferWithoutRelcache(rnode, TPD_FORKNUM, tpdblk, RBM_NORMAL,
 												  NULL, relpersistence);
 
 			/* Check whether TPD entry can exist on page? */
@@ -3019,8 +3283,7 @@ TPDPageLock(Relation relation, Buffer heapbuf)
 {
 	Page		heappage = BufferGetPage(heapbuf);
 	Buffer		tpd_buf;
-	BlockNumber tpdblk,
-				lastblock;
+	BlockNumber tpdblk;
 	int			buf_idx;
 	bool		already_exists;
 	OffsetNumber tpdItemOff;
@@ -3029,9 +3292,7 @@ TPDPageLock(Relation relation, Buffer heapbuf)
 
 	GetTPDBlockAndOffset(heappage, &tpdblk, &tpdItemOff);
 
-	lastblock = RelationGetNumberOfBlocks(relation);
-
-	if (lastblock <= tpdblk)
+	if (!TPDHasBlock(relation, tpdblk))
 	{
 		/*
 		 * The required TPD block has been pruned and then truncated away
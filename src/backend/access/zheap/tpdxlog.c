@@ -110,12 +110,14 @@ tpd_xlog_allocate_entry(XLogReaderState *record)
 		metabuf = XLogInitBufferForRedo(record, 2);
 		ptr = XLogRecGetBlockData(record, 2, &len);
 
-		Assert(len == SizeOfMetaData);
 		Assert(BufferGetBlockNumber(metabuf) == ZHEAP_METAPAGE);
 		xlrecmeta = (xl_zheap_metadata *) ptr;
+		Assert(len == SizeOfMetaData(xlrecmeta->num_free_tpd_pages));
 
 		zheap_init_meta_page(metabuf, xlrecmeta->first_used_tpd_page,
-							 xlrecmeta->last_used_tpd_page);
+							 xlrecmeta->last_used_tpd_page,
+							 xlrecmeta->num_free_tpd_pages,
+							 xlrecmeta->free_tpd_pages);
 		MarkBufferDirty(metabuf);
 		PageSetLSN(BufferGetPage(metabuf), lsn);
 
@@ -366,7 +368,6 @@ static void
 tpd_xlog_free_page(XLogReaderState *record)
 {
 	XLogRecPtr	lsn = record->EndRecPtr;
-	RelFileNode rnode;
 	xl_tpd_free_page *xlrec = (xl_tpd_free_page *) XLogRecGetData(record);
 	Buffer		buffer = InvalidBuffer,
 				prevbuf = InvalidBuffer,
@@ -375,7 +376,6 @@ tpd_xlog_free_page(XLogReaderState *record)
 	BlockNumber blkno;
 	Page		page;
 	XLogRedoAction action;
-	Size		freespace;
 
 	if (XLogRecHasBlockRef(record, 0))
 	{
@@ -399,7 +399,7 @@ tpd_xlog_free_page(XLogReaderState *record)
 		}
 	}
 
-	XLogRecGetBlockTag(record, 1, &rnode, NULL, &blkno);
+	XLogRecGetBlockTag(record, 1, NULL, NULL, &blkno);
 	action = XLogReadBufferForRedo(record, 1, &buffer);
 
 	/*
@@ -454,12 +454,14 @@ tpd_xlog_free_page(XLogReaderState *record)
 		metabuf = XLogInitBufferForRedo(record, 3);
 		ptr = XLogRecGetBlockData(record, 3, &len);
 
-		Assert(len == SizeOfMetaData);
 		Assert(BufferGetBlockNumber(metabuf) == ZHEAP_METAPAGE);
 		xlrecmeta = (xl_zheap_metadata *) ptr;
+		Assert(len == SizeOfMetaData(xlrecmeta->num_free_tpd_pages));
 
 		zheap_init_meta_page(metabuf, xlrecmeta->first_used_tpd_page,
-							 xlrecmeta->last_used_tpd_page);
+							 xlrecmeta->last_used_tpd_page,
+							 xlrecmeta->num_free_tpd_pages,
+							 xlrecmeta->free_tpd_pages);
 		MarkBufferDirty(metabuf);
 		PageSetLSN(BufferGetPage(metabuf), lsn);
 	}
@@ -472,11 +474,6 @@ tpd_xlog_free_page(XLogReaderState *record)
 		UnlockReleaseBuffer(nextbuf);
 	if (BufferIsValid(metabuf))
 		UnlockReleaseBuffer(metabuf);
-
-	freespace = BLCKSZ - SizeOfPageHeaderData;
-
-	/* Record the empty page in FSM. */
-	XLogRecordPageWithFreeSpace(rnode, blkno, freespace);
 }
 
 /*
@@ -0,0 +1,553 @@
+/*-------------------------------------------------------------------------
+ *
+ * zcrcache.c
+ *	  Shared cache of consistent-read zheap page images.
+ *
+ * A scan with an old snapshot over a heavily updated zheap page has to walk
+ * the undo chain of nearly every tuple on it to find the version it can see,
+ * and every other scan with a similar snapshot repeats exactly the same
+ * walks.  To avoid that, page-at-a-time scans keep the set of tuples they
+ * found visible on such a page (a "consistent-read" image of the page) in
+ * a small shared cache, from which other scans can take it instead of
+ * reading the undo again.
+ *
+ * An image is only a correct answer for snapshots that would have made the
+ * same visibility decisions as the one that built it.  While the image is
+ * built, the visibility code reports every transaction whose visibility to
+ * the snapshot it had to decide, along with the answer (see
+ * ZHeapCRCacheNoteXid).  Another snapshot may use the image if the page has
+ * not changed since (its LSN is the same) and the snapshot sees each of
+ * those transactions the same way: the visibility checks would then take
+ * exactly the same path through the undo and arrive at the same tuples.
+ * This is what lets snapshots with different xmin and xmax share an image;
+ * we don't need to bucket snapshots by their horizons.  Images that depend
+ * on our own transaction are never cached, as their answers also depend on
+ * the command id.
+ *
+ * Once undo discard has moved past every transaction an image depends on,
+ * the visibility checks for the page no longer need undo at all, so the
+ * image is of no further use and its slot is recycled first.
+ *
+ * The cache has a single entry per page, replaced by whichever scan builds
+ * an image for it next.  Like the buffer mapping table, the lookup table is
+ * partitioned by the hash of the page, each partition with its own lock, so
+ * that scans of different pages don't contend.  Each partition also owns
+ * every ZCR_NUM_PARTITIONS'th slot of the cache and runs its own clock
+ * sweep over them to choose a victim when it is full, so a new image only
+ * ever displaces one of the same partition.  The size of the cache is set by
+ * zheap_cr_cache_size; zero disables it.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/access/zheap/zcrcache.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/transam.h"
+#include "access/undoinsert.h"
+#include "access/xact.h"
+#include "access/zcrcache.h"
+#include "access/zheap.h"
+#include "storage/bufmgr.h"
+#include "storage/lwlock.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+#include "utils/hsearch.h"
+#include "utils/rel.h"
+#include "utils/snapmgr.h"
+
+/*
+ * Maximum number of distinct transactions an image may depend on.  Pages
+ * whose visibility depends on more than that aren't cached; such images
+ * would rarely be reusable anyway.
+ */
+#define ZCR_MAX_XIDS		64
+
+/* Space for the tuples of one image. */
+#define ZCR_IMAGE_SIZE		BLCKSZ
+
+/* Number of partitions of the cache; must be a power of 2. */
+#define ZCR_NUM_PARTITIONS	16
+
+#define ZCRCacheHashPartition(hashcode) \
+	((hashcode) % ZCR_NUM_PARTITIONS)
+#define ZCRCachePartitionLock(partition) \
+	(&ZCRCache->locks[(partition)].lock)
+
+typedef struct ZCRCacheTag
+{
+	RelFileNode rnode;
+	BlockNumber blkno;
+} ZCRCacheTag;
+
+/* Hash table entry, mapping a page to the slot holding its image. */
+typedef struct ZCRCacheLookupEnt
+{
+	ZCRCacheTag tag;
+	int			slot;
+} ZCRCacheLookupEnt;
+
+typedef struct ZCRCacheEntry
+{
+	ZCRCacheTag tag;
+	bool		valid;
+	pg_atomic_uint32 usage_count;	/* for the clock sweep */
+	XLogRecPtr	lsn;			/* page LSN the image was built from */
+	TransactionId newest_xid;	/* newest xid the image depends on */
+	int			nxids;
+	TransactionId xids[ZCR_MAX_XIDS];
+	bool		in_snapshot[ZCR_MAX_XIDS];
+	int			ntuples;
+	Size		len;			/* bytes used in data */
+	char		data[FLEXIBLE_ARRAY_MEMBER];	/* ZCRCacheTuple array */
+} ZCRCacheEntry;
+
+#define ZCRCacheEntrySize \
+	MAXALIGN(offsetof(ZCRCacheEntry, data) + ZCR_IMAGE_SIZE)
+
+/* Each tuple of an image is stored as this header followed by its data. */
+typedef struct ZCRCacheTuple
+{
+	ItemPointerData t_self;
+	uint32		t_len;
+} ZCRCacheTuple;
+
+typedef struct ZCRCacheControl
+{
+	LWLockPadded locks[ZCR_NUM_PARTITIONS];
+	/* clock hands, each protected by its partition's lock */
+	int			next_victim[ZCR_NUM_PARTITIONS];
+	char		entries[FLEXIBLE_ARRAY_MEMBER];
+} ZCRCacheControl;
+
+#define ZCRCacheGetEntry(i) \
+	((ZCRCacheEntry *) (ZCRCache->entries + (Size) (i) * ZCRCacheEntrySize))
+
+/* The slot after slot in the given partition's clock sweep. */
+#define ZCRCacheNextSlot(partition, slot) \
+	((slot) + ZCR_NUM_PARTITIONS < zheap_cr_cache_size ? \
+	 (slot) + ZCR_NUM_PARTITIONS : (partition))
+
+/* GUC variable */
+int			zheap_cr_cache_size = 128;
+
+bool		ZHeapCRCacheBuilding = false;
+
+static ZCRCacheControl *ZCRCache = NULL;
+static HTAB *ZCRCacheHash = NULL;
+
+/* State of the image being built by this backend. */
+static bool zcr_uncacheable;
+static int	zcr_nxids;
+static TransactionId zcr_xids[ZCR_MAX_XIDS];
+static bool zcr_in_snapshot[ZCR_MAX_XIDS];
+static uint64 zcr_undo_fetched;
+
+static bool ZCRCacheEntryIsStale(ZCRCacheEntry *entry);
+static int	ZCRCacheGetVictim(int partition);
+
+/*
+ * ZHeapCRCacheShmemSize - report shared memory space needed
+ */
+Size
+ZHeapCRCacheShmemSize(void)
+{
+	Size		size;
+
+	if (zheap_cr_cache_size <= 0)
+		return 0;
+
+	size = offsetof(ZCRCacheControl, entries);
+	size = add_size(size, mul_size(zheap_cr_cache_size, ZCRCacheEntrySize));
+	size = add_size(size, hash_estimate_size(zheap_cr_cache_size,
+											 sizeof(ZCRCacheLookupEnt)));
+
+	return size;
+}
+
+/*
+ * ZHeapCRCacheShmemInit - initialize the consistent-read page cache
+ */
+void
+ZHeapCRCacheShmemInit(void)
+{
+	HASHCTL		info;
+	bool		found;
+	int			i;
+
+	if (zheap_cr_cache_size <= 0)
+		return;
+
+	ZCRCache = (ZCRCacheControl *)
+		ShmemInitStruct("ZHeap CR Page Cache",
+						add_size(offsetof(ZCRCacheControl, entries),
+								 mul_size(zheap_cr_cache_size,
+										  ZCRCacheEntrySize)),
+						&found);
+
+	if (!found)
+	{
+		for (i = 0; i < ZCR_NUM_PARTITIONS; i++)
+		{
+			LWLockInitialize(&ZCRCache->locks[i].lock, LWTRANCHE_ZHEAP_CR_CACHE);
+			ZCRCache->next_victim[i] = i;
+		}
+		for (i = 0; i < zheap_cr_cache_size; i++)
+		{
+			ZCRCacheEntry *entry = ZCRCacheGetEntry(i);
+
+			entry->valid = false;
+			pg_atomic_init_u32(&entry->usage_count, 0);
+		}
+	}
+
+	MemSet(&info, 0, sizeof(info));
+	info.keysize = sizeof(ZCRCacheTag);
+	info.entrysize = sizeof(ZCRCacheLookupEnt);
+	info.num_partitions = ZCR_NUM_PARTITIONS;
+
+	ZCRCacheHash = ShmemInitHash("ZHeap CR Page Cache Lookup Table",
+								 zheap_cr_cache_size, zheap_cr_cache_size,
+								 &info,
+								 HASH_ELEM | HASH_BLOBS | HASH_PARTITION);
+}
+
+/*
+ * ZHeapCRCacheUsable - can a scan of this relation with this snapshot use
+ * the cache?
+ *
+ * We rely on the page LSN to tell whether a page has changed, so only
+ * WAL-logged relations qualify.  Serializable transactions need to check
+ * each tuple for conflicts, so they always do the visibility checks
+ * themselves.
+ */
+bool
+ZHeapCRCacheUsable(Relation rel, Snapshot snapshot)
+{
+	return ZCRCache != NULL &&
+		snapshot->snapshot_type == SNAPSHOT_MVCC &&
+		RelationNeedsWAL(rel) &&
+		!IsolationIsSerializable();
+}
+
+/*
+ * ZHeapCRCacheLookup - find an image of the page usable by our snapshot
+ *
+ * The caller must hold at least a share lock on the buffer.  If an image is
+ * found, the tuples visible to the snapshot are returned in tuples (which
+ * must have room for MaxZHeapTuplesPerPage entries) and *ntuples.
+ */
+bool
+ZHeapCRCacheLookup(Relation rel, Buffer buffer, Snapshot snapshot,
+				   ZHeapTuple *tuples, int *ntuples)
+{
+	ZCRCacheTag tag;
+	ZCRCacheLookupEnt *ent;
+	ZCRCacheEntry *entry;
+	ZCRCacheEntry *copy;
+	uint32		hashcode;
+	LWLock	   *partitionLock;
+	char	   *ptr;
+	int			i;
+
+	tag.rnode = rel->rd_node;
+	tag.blkno = BufferGetBlockNumber(buffer);
+
+	hashcode = get_hash_value(ZCRCacheHash, &tag);
+	partitionLock = ZCRCachePartitionLock(ZCRCacheHashPartition(hashcode));
+
+	LWLockAcquire(partitionLock, LW_SHARED);
+
+	ent = (ZCRCacheLookupEnt *) hash_search_with_hash_value(ZCRCacheHash,
+															&tag, hashcode,
+															HASH_FIND, NULL);
+	if (ent == NULL)
+	{
+		LWLockRelease(partitionLock);
+		return false;
+	}
+
+	entry = ZCRCacheGetEntry(ent->slot);
+	Assert(entry->valid);
+
+	/* An image of an older version of the page is of no use. */
+	if (entry->lsn != BufferGetLSNAtomic(buffer))
+	{
+		LWLockRelease(partitionLock);
+		return false;
+	}
+
+	/*
+	 * Take a copy, so that we don't need to hold the lock while checking
+	 * the transactions against our snapshot.
+	 */
+	copy = palloc(offsetof(ZCRCacheEntry, data) + entry->len);
+	memcpy(copy, entry, offsetof(ZCRCacheEntry, data) + entry->len);
+	pg_atomic_write_u32(&entry->usage_count, 1);
+
+	LWLockRelease(partitionLock);
+
+	/* Our snapshot must see every transaction the same way as the builder. */
+	for (i = 0; i < copy->nxids; i++)
+	{
+		if (TransactionIdIsCurrentTransactionId(copy->xids[i]) ||
+			XidInMVCCSnapshot(copy->xids[i], snapshot) != copy->in_snapshot[i])
+		{
+			pfree(copy);
+			return false;
+		}
+	}
+
+	ptr = copy->data;
+	for (i = 0; i < copy->ntuples; i++)
+	{
+		ZCRCacheTuple *ctup = (ZCRCacheTuple *) ptr;
+		ZHeapTuple	tuple;
+
+		ptr += MAXALIGN(sizeof(ZCRCacheTuple));
+
+		tuple = palloc(ZHEAPTUPLESIZE + ctup->t_len);
+		tuple->t_len = ctup->t_len;
+		tuple->t_self = ctup->t_self;
+		tuple->t_tableOid = RelationGetRelid(rel);
+		tuple->t_data = (ZHeapTupleHeader) ((char *) tuple + ZHEAPTUPLESIZE);
+		memcpy(tuple->t_data, ptr, ctup->t_len);
+		ptr += MAXALIGN(ctup->t_len);
+
+		tuples[i] = tuple;
+	}
+	*ntuples = copy->ntuples;
+
+	pfree(copy);
+
+	return true;
+}
+
+/*
+ * ZHeapCRCacheBeginBuild - start recording the visibility decisions made
+ * for a page
+ *
+ * If we error out before ZHeapCRCacheEndBuild, ZHeapCRCacheBuilding is
+ * simply left set until the next build begins; recording is harmless.
+ */
+void
+ZHeapCRCacheBeginBuild(void)
+{
+	ZHeapCRCacheBuilding = true;
+	zcr_uncacheable = false;
+	zcr_nxids = 0;
+	zcr_undo_fetched = UndoRecordsFetched;
+}
+
+/*
+ * ZHeapCRCacheRecordXid - remember that the image depends on the visibility
+ * of xid
+ */
+void
+ZHeapCRCacheRecordXid(TransactionId xid, bool in_snapshot)
+{
+	int			i;
+
+	for (i = 0; i < zcr_nxids; i++)
+	{
+		if (TransactionIdEquals(zcr_xids[i], xid))
+			return;
+	}
+
+	if (zcr_nxids >= ZCR_MAX_XIDS)
+	{
+		zcr_uncacheable = true;
+		return;
+	}
+
+	zcr_xids[zcr_nxids] = xid;
+	zcr_in_snapshot[zcr_nxids] = in_snapshot;
+	zcr_nxids++;
+}
+
+/*
+ * ZHeapCRCacheRecordUncacheable - the image can't be shared
+ */
+void
+ZHeapCRCacheRecordUncacheable(void)
+{
+	zcr_uncacheable = true;
+}
+
+/*
+ * ZHeapCRCacheEndBuild - stop recording, and cache the image if it's worth
+ * sharing
+ *
+ * The caller must still hold the buffer lock it held while making the
+ * visibility decisions, so that the page LSN we store goes with them.
+ */
+void
+ZHeapCRCacheEndBuild(Relation rel, Buffer buffer, ZHeapTuple *tuples,
+					 int ntuples)
+{
+	ZCRCacheTag tag;
+	ZCRCacheLookupEnt *ent;
+	ZCRCacheEntry *entry;
+	TransactionId newest_xid = InvalidTransactionId;
+	Size		len = 0;
+	uint32		hashcode;
+	int			partition;
+	LWLock	   *partitionLock;
+	bool		found;
+	char	   *ptr;
+	int			i;
+
+	ZHeapCRCacheBuilding = false;
+
+	/*
+	 * Only pages whose visibility checks had to read undo are worth caching;
+	 * others are as cheap to check again.
+	 */
+	if (zcr_uncacheable || zcr_nxids == 0 ||
+		UndoRecordsFetched == zcr_undo_fetched)
+		return;
+
+	for (i = 0; i < ntuples; i++)
+		len += MAXALIGN(sizeof(ZCRCacheTuple)) + MAXALIGN(tuples[i]->t_len);
+	if (len > ZCR_IMAGE_SIZE)
+		return;
+
+	for (i = 0; i < zcr_nxids; i++)
+	{
+		if (TransactionIdIsNormal(zcr_xids[i]) &&
+			(!TransactionIdIsValid(newest_xid) ||
+			 TransactionIdFollows(zcr_xids[i], newest_xid)))
+			newest_xid = zcr_xids[i];
+	}
+
+	tag.rnode = rel->rd_node;
+	tag.blkno = BufferGetBlockNumber(buffer);
+
+	hashcode = get_hash_value(ZCRCacheHash, &tag);
+	partition = ZCRCacheHashPartition(hashcode);
+	partitionLock = ZCRCachePartitionLock(partition);
+
+	/* With fewer slots than partitions, some partitions have none. */
+	if (partition >= zheap_cr_cache_size)
+		return;
+
+	LWLockAcquire(partitionLock, LW_EXCLUSIVE);
+
+	/*
+	 * Replace any existing image of the page, else pick a victim among our
+	 * partition's slots.  The victim's hash entry must go first, as the
+	 * table has no room to spare; it's in our partition too, since the
+	 * victim's page was cached in one of its slots.
+	 */
+	ent = (ZCRCacheLookupEnt *) hash_search_with_hash_value(ZCRCacheHash,
+															&tag, hashcode,
+															HASH_FIND, NULL);
+	if (ent == NULL)
+	{
+		int			slot = ZCRCacheGetVictim(partition);
+
+		entry = ZCRCacheGetEntry(slot);
+		if (entry->valid)
+		{
+			uint32		victim_hashcode;
+
+			victim_hashcode = get_hash_value(ZCRCacheHash, &entry->tag);
+			Assert(ZCRCacheHashPartition(victim_hashcode) == partition);
+			hash_search_with_hash_value(ZCRCacheHash, &entry->tag,
+										victim_hashcode, HASH_REMOVE, NULL);
+			entry->valid = false;
+		}
+		ent = (ZCRCacheLookupEnt *)
+			hash_search_with_hash_value(ZCRCacheHash, &tag, hashcode,
+										HASH_ENTER, &found);
+		Assert(!found);
+		ent->slot = slot;
+	}
+	entry = ZCRCacheGetEntry(ent->slot);
+
+	entry->tag = tag;
+	entry->valid = true;
+	pg_atomic_write_u32(&entry->usage_count, 1);
+	entry->lsn = BufferGetLSNAtomic(buffer);
+	entry->newest_xid = newest_xid;
+	entry->nxids = zcr_nxids;
+	memcpy(entry->xids, zcr_xids, sizeof(TransactionId) * zcr_nxids);
+	memcpy(entry->in_snapshot, zcr_in_snapshot, sizeof(bool) * zcr_nxids);
+	entry->ntuples = ntuples;
+	entry->len = len;
+
+	ptr = entry->data;
+	for (i = 0; i < ntuples; i++)
+	{
+		ZCRCacheTuple *ctup = (ZCRCacheTuple *) ptr;
+
+		ctup->t_self = tuples[i]->t_self;
+		ctup->t_len = tuples[i]->t_len;
+		ptr += MAXALIGN(sizeof(ZCRCacheTuple));
+		memcpy(ptr, tuples[i]->t_data, tuples[i]->t_len);
+		ptr += MAXALIGN(tuples[i]->t_len);
+	}
+
+	LWLockRelease(partitionLock);
+}
+
+/*
+ * ZCRCacheEntryIsStale - has undo discard made this image useless?
+ */
+static bool
+ZCRCacheEntryIsStale(ZCRCacheEntry *entry)
+{
+	TransactionId oldestXidHavingUndo;
+
+	if (!TransactionIdIsValid(entry->newest_xid))
+		return false;
+
+	oldestXidHavingUndo = GetXidFromEpochXid(
+											 pg_atomic_read_u64(&ProcGlobal->oldestXidWithEpochHavingUndo));
+
+	return TransactionIdPrecedes(entry->newest_xid, oldestXidHavingUndo);
+}
+
+/*
+ * ZCRCacheGetVictim - choose a slot of the given partition for a new image
+ *
+ * Free slots and slots whose images discard has made useless are taken
+ * first; otherwise the partition's clock hand moves on until it finds a slot
+ * that hasn't been used since it last passed.  Caller must hold the
+ * partition's lock exclusively, and the partition must own a slot.
+ */
+static int
+ZCRCacheGetVictim(int partition)
+{
+	int			nslots;
+	int			i;
+
+	nslots = (zheap_cr_cache_size - partition + ZCR_NUM_PARTITIONS - 1) /
+		ZCR_NUM_PARTITIONS;
+	Assert(nslots > 0);
+
+	for (i = 0; i < 2 * nslots; i++)
+	{
+		int			slot = ZCRCache->next_victim[partition];
+		ZCRCacheEntry *entry = ZCRCacheGetEntry(slot);
+
+		ZCRCache->next_victim[partition] = ZCRCacheNextSlot(partition, slot);
+
+		if (!entry->valid || ZCRCacheEntryIsStale(entry))
+			return slot;
+		if (pg_atomic_read_u32(&entry->usage_count) == 0)
+			return slot;
+		pg_atomic_write_u32(&entry->usage_count, 0);
+	}
+
+	/* Every slot was in use twice around; just take the next one. */
+	i = ZCRCache->next_victim[partition];
+	ZCRCache->next_victim[partition] = ZCRCacheNextSlot(partition, i);
+	return i;
+}
@@ -54,8 +54,11 @@
 #include "access/zheapam_xlog.h"
 #include "access/zheap.h"
 #include "access/zheapscan.h"
+#include "access/zkeyshare.h"
+#include "access/zlocktable.h"
 #include "access/zmultilocker.h"
 #include "catalog/catalog.h"
+#include "catalog/storage_xlog.h"
 #include "executor/tuptable.h"
 #include "miscadmin.h"
 #include "nodes/tidbitmap.h"
@@ -65,6 +68,7 @@
 #include "storage/predicate.h"
 #include "storage/procarray.h"
 #include "storage/itemid.h"
+#include "storage/smgr.h"
 #include "storage/buf_internals.h"
 #include "utils/datum.h"
 #include "utils/expandeddatum.h"
@@ -73,6 +77,9 @@
 #include "utils/rel.h"
 #include "utils/ztqual.h"
 
+/* GUC variable */
+bool		zheap_undo_version_skip = false;
+
 extern bool synchronize_seqscans;
 
 /* defines the return status for a lock wait */
@@ -83,6 +90,22 @@ typedef enum
 	LOCK_WAIT_SUCCESS			/* we can modify the tuple */
 }			LockWaitStatus;
 
+/*
+ * The bulk append zheap_multi_insert is currently adding pages to, if any.
+ * It's only valid for the command that started it, see zheap_multi_insert.
+ */
+typedef struct ZHeapBulkAppendState
+{
+	Oid			reloid;
+	FullTransactionId fxid;
+	SubTransactionId subxid;
+	CommandId	cid;
+	BlockNumber start_blkno;	/* first block of the bulk append */
+	UndoRecPtr	urecptr;		/* its UNDO_BULK_APPEND undo record */
+} ZHeapBulkAppendState;
+
+static ZHeapBulkAppendState bulk_append_state = {InvalidOid};
+
 static bool zheap_delete_wait_helper(Relation relation,
 									 Buffer buffer, ZHeapTuple zheaptup,
 									 FullTransactionId fxid, TransactionId xwait,
@@ -106,6 +129,11 @@ static bool zheap_update_wait_helper(Relation relation,
 static bool zheap_tuple_already_locked(ZHeapTuple zhtup, UndoRecPtr urec_ptr,
 									   TransactionId xid, LockTupleMode mode,
 									   int trans_slot_id, uint16 infomask, TM_Result *result);
+static bool zheap_wait_for_key_share_lockers(Relation relation, Buffer buffer,
+											 ItemPointer tid, LockTupleMode mode,
+											 LockWaitPolicy wait_policy,
+											 XLTW_Oper oper, bool *have_tuple_lock,
+											 bool *would_block);
 static LockWaitStatus zheap_lock_wait_helper(Relation relation, Buffer buffer,
 											 ZHeapTuple zhtup, FullTransactionId fxid, TransactionId xwait,
 											 int xwait_trans_slot, SubTransactionId xwait_subxid,
@@ -131,8 +159,14 @@ static void compute_new_xid_infomask(ZHeapTuple zhtup, Buffer buf,
 									 int trans_slot, TransactionId single_locker_xid,
 									 LockTupleMode mode, LockOper lockoper,
 									 uint16 *result_infomask, int *result_trans_slot);
+static void zheap_prepare_version_skip(Buffer buffer, OffsetNumber offnum,
+									   ZHeapUndoVersionSkip *skip,
+									   UndoRecPtr *basis);
+static bool zheap_version_skip_applies(uint16 infomask);
+static void zheap_init_version_skip(ZHeapUndoVersionSkip *skip);
 static void log_zheap_insert(ZHeapWALInfo *walinfo, Relation relation,
-							 int options, bool skip_undo);
+							 int options, bool skip_undo,
+							 ZHeapReusedItem *reused_item);
 static void log_zheap_update(ZHeapWALInfo *oldinfo, ZHeapWALInfo *newinfo, bool inplace_update);
 static void log_zheap_delete(ZHeapWALInfo *walinfo, bool changingPart,
 							 SubTransactionId subxid, TransactionId tup_xid);
@@ -149,6 +183,8 @@ static bool RefetchAndCheckTupleStatus(Relation relation, Buffer buffer,
 									   TransactionId *single_locker_xid,
 									   LockTupleMode *mode, ZHeapTupleData *zhtup);
 static bool CheckZheapPageSlotsAreEmpty(Page page);
+static void copy_zrelation_block(SMgrRelation dst, ForkNumber forknum,
+								 BlockNumber blkno, Buffer buffer, bool use_wal);
 
 /*
  * Subroutine for zheap_insert(). Prepares a tuple for insertion.
@@ -172,8 +208,9 @@ zheap_prepare_insert(Relation relation, ZHeapTuple tup, int options,
 	 * and fsync them at end of the operation in some function similar to
 	 * heap_sync. But, if we're freezing the tuple during insertion, we can
 	 * use the TABLE_INSERT_SKIP_WAL optimization since we don't write undo
-	 * for the same. Thus just skip the optimization if only
-	 * TABLE_INSERT_SKIP_WAL is specified.
+	 * for the same; zheapam_finish_bulk_insert syncs the relation in that
+	 * case. Thus just skip the optimization if only TABLE_INSERT_SKIP_WAL is
+	 * specified.
 	 */
 
 	/*
@@ -262,6 +299,9 @@ zheap_insert(Relation relation, ZHeapTuple tup, CommandId cid,
 	uint8		vm_status = 0;
 	bool		lock_reacquired;
 	bool		skip_undo;
+	bool		try_reuse;
+	OffsetNumber reused_offnum = InvalidOffsetNumber;
+	ZHeapReusedItem reused_item;
 	ZHeapPrepareUndoInfo zh_undo_info;
 
 	/*
@@ -270,6 +310,15 @@ zheap_insert(Relation relation, ZHeapTuple tup, CommandId cid,
 	 */
 	skip_undo = (options & ZHEAP_INSERT_FROZEN);
 
+	/*
+	 * Check whether we can try to reuse the space freed by the current
+	 * subtransaction.  Bulk inserts have their own way of choosing the target
+	 * block, and speculative insertions already use the undo payload for the
+	 * token, so we don't bother for those.
+	 */
+	try_reuse = (!skip_undo && bistate == NULL &&
+				 !(options & ZHEAP_INSERT_SPECULATIVE));
+
 	/* We don't need a transaction id if we are skipping undo */
 	if (!skip_undo)
 		fxid = GetTopFullTransactionId();
@@ -294,9 +343,32 @@ reacquire_buffer:
 		vmbuffer = InvalidBuffer;
 	}
 
-	buffer = RelationGetBufferForZTuple(relation, zheaptup->t_len,
-										InvalidBuffer, options, bistate,
-										&vmbuffer, NULL);
+	buffer = InvalidBuffer;
+	reused_offnum = InvalidOffsetNumber;
+	if (try_reuse)
+	{
+		BlockNumber reuse_blkno;
+
+		/*
+		 * Prefer a block on which the current subtransaction has deleted a
+		 * tuple big enough to make room for this one.
+		 */
+		reuse_blkno = ZHeapGetBlockWithReusableSpace(relation,
+													 zheaptup->t_len);
+		if (BlockNumberIsValid(reuse_blkno))
+		{
+			buffer = ReadBuffer(relation, reuse_blkno);
+			visibilitymap_pin(relation, reuse_blkno, &vmbuffer);
+			LockBuffer(buffer, BUFFER_LOCK_EXCLUSIVE);
+		}
+		else
+			try_reuse = false;
+	}
+
+	if (!BufferIsValid(buffer))
+		buffer = RelationGetBufferForZTuple(relation, zheaptup->t_len,
+											InvalidBuffer, options, bistate,
+											&vmbuffer, NULL);
 	page = BufferGetPage(buffer);
 
 	if (!skip_undo)
@@ -330,6 +402,7 @@ reacquire_buffer:
 		{
 			UnlockReleaseBuffer(buffer);
 
+			pgstat_count_zheap_slot_wait(relation);
 			pgstat_report_wait_start(PG_WAIT_PAGE_TRANS_SLOT);
 			pg_usleep(10000L);	/* 10 ms */
 			pgstat_report_wait_end();
@@ -341,6 +414,29 @@ reacquire_buffer:
 		Assert(trans_slot_id != InvalidXactSlotId);
 	}
 
+	/*
+	 * If we have chosen the block to reuse the space of a deleted tuple and
+	 * the page doesn't have enough free space otherwise, find the item whose
+	 * storage we can take over.  If there is none after all, fall back to the
+	 * regular way of finding the block.
+	 */
+	if (try_reuse &&
+		PageGetZHeapFreeSpace(page) < SHORTALIGN(zheaptup->t_len))
+	{
+		reused_offnum = ZPageGetReusableItem(relation, buffer, trans_slot_id,
+											 zheaptup->t_len);
+		if (!OffsetNumberIsValid(reused_offnum))
+		{
+			UnlockReleaseBuffer(buffer);
+			try_reuse = false;
+			goto reacquire_buffer;
+		}
+
+		reused_item.offnum = reused_offnum;
+		reused_item.lp_off = ItemIdGetOffset(PageGetItemId(page, reused_offnum));
+		reused_item.lp_len = ItemIdGetLength(PageGetItemId(page, reused_offnum));
+	}
+
 	if (options & ZHEAP_INSERT_SPECULATIVE)
 	{
 		/*
@@ -372,6 +468,7 @@ reacquire_buffer:
 
 		urecptr = zheap_prepare_undoinsert(&zh_undo_info, specToken,
 										   (options & ZHEAP_INSERT_SPECULATIVE) ? true : false,
+										   OffsetNumberIsValid(reused_offnum) ? &reused_item : NULL,
 										   &undorecord, NULL, &undometa);
 	}
 
@@ -408,7 +505,19 @@ reacquire_buffer:
 	if (!(options & ZHEAP_INSERT_FROZEN))
 		ZHeapTupleHeaderSetXactSlot(zheaptup->t_data, trans_slot_id);
 
-	RelationPutZHeapTuple(relation, buffer, zheaptup);
+	if (OffsetNumberIsValid(reused_offnum))
+	{
+		OffsetNumber offnum;
+
+		offnum = ZPageAddItemReusingStorage(page, reused_offnum,
+											(Item) zheaptup->t_data,
+											zheaptup->t_len,
+											InvalidOffsetNumber);
+		ItemPointerSet(&(zheaptup->t_self), BufferGetBlockNumber(buffer),
+					   offnum);
+	}
+	else
+		RelationPutZHeapTuple(relation, buffer, zheaptup);
 
 	if ((vm_status & VISIBILITYMAP_ALL_VISIBLE) ||
 		(vm_status & VISIBILITYMAP_POTENTIAL_ALL_VISIBLE))
@@ -430,8 +539,9 @@ reacquire_buffer:
 
 	MarkBufferDirty(buffer);
 
-	/* XLOG stuff */
-	if (RelationNeedsWAL(relation))
+	/* XLOG stuff; see zheap_prepare_insert for when we may skip it */
+	if (RelationNeedsWAL(relation) &&
+		!(skip_undo && (options & ZHEAP_INSERT_SKIP_WAL)))
 	{
 		ZHeapWALInfo ins_wal_info;
 
@@ -445,7 +555,8 @@ reacquire_buffer:
 		ins_wal_info.all_visible_cleared = all_visible_cleared;
 		ins_wal_info.undorecord = NULL;
 
-		log_zheap_insert(&ins_wal_info, relation, options, skip_undo);
+		log_zheap_insert(&ins_wal_info, relation, options, skip_undo,
+						 OffsetNumberIsValid(reused_offnum) ? &reused_item : NULL);
 	}
 
 	END_CRIT_SECTION();
@@ -675,6 +786,24 @@ check_tup_satisfies_update:
 			result = TM_Updated;
 	}
 
+	/* Also wait for the lockers that aren't recorded on the tuple. */
+	if (result == TM_Ok)
+	{
+		bool		would_block;
+
+		if (zheap_wait_for_key_share_lockers(relation, buffer,
+											 &zheaptup.t_self,
+											 LockTupleExclusive,
+											 wait ? LockWaitBlock : LockWaitSkip,
+											 XLTW_Delete, &have_tuple_lock,
+											 &would_block))
+		{
+			if (!would_block)
+				goto check_tup_satisfies_update;
+			result = TM_BeingModified;
+		}
+	}
+
 	if (result != TM_Ok)
 	{
 		Assert(result == TM_SelfModified ||
@@ -682,7 +811,8 @@ check_tup_satisfies_update:
 			   result == TM_Deleted ||
 			   result == TM_BeingModified);
 		Assert(ItemIdIsDeleted(lp) ||
-			   IsZHeapTupleModified(zheaptup.t_data->t_infomask));
+			   IsZHeapTupleModified(zheaptup.t_data->t_infomask) ||
+			   result == TM_BeingModified);
 
 		/* If item id is deleted, tuple can't be marked as moved. */
 		if (!ItemIdIsDeleted(lp) &&
@@ -732,6 +862,7 @@ check_tup_satisfies_update:
 	{
 		LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
 
+		pgstat_count_zheap_slot_wait(relation);
 		pgstat_report_wait_start(PG_WAIT_PAGE_TRANS_SLOT);
 		pg_usleep(10000L);		/* 10 ms */
 		pgstat_report_wait_end();
@@ -868,6 +999,10 @@ check_tup_satisfies_update:
 
 	END_CRIT_SECTION();
 
+	/* Let the subsequent inserts of this subtransaction reuse the space. */
+	ZHeapRememberFreedSpace(relation, ItemPointerGetBlockNumber(tid),
+							ItemPointerGetOffsetNumber(tid), zheaptup.t_len);
+
 	/* be tidy */
 	pfree(undorecord.uur_tuple.data);
 	if (undorecord.uur_payload.len > 0)
@@ -1266,6 +1401,7 @@ zheap_update(Relation relation, ItemPointer otid, ZHeapTuple newtup,
 	bool		any_multi_locker_member_alive = false;
 	bool		lock_reacquired;
 	bool		need_toast = false;
+	bool		keyshare_reserved = false;
 	bool		hasSubXactLock = false;
 	xl_undolog_meta undometa;
 	uint8		vm_status;
@@ -1274,6 +1410,8 @@ zheap_update(Relation relation, ItemPointer otid, ZHeapTuple newtup,
 	ZHeapTupleTransInfo zinfo;
 	ZHeapPrepareUndoInfo gen_undo_info;
 	ZHeapPrepareUpdateUndoInfo zh_up_undo_info;
+	ZHeapUndoVersionSkip version_skip;
+	UndoRecPtr	version_skip_basis = InvalidUndoRecPtr;
 
 	Assert(ItemPointerIsValid(otid));
 
@@ -1319,6 +1457,14 @@ zheap_update(Relation relation, ItemPointer otid, ZHeapTuple newtup,
 	 */
 	visibilitymap_pin(relation, block, &vmbuffer);
 
+	/*
+	 * Likewise, read the undo needed for the skip information of an in-place
+	 * update before locking the buffer.
+	 */
+	if (zheap_undo_version_skip)
+		zheap_prepare_version_skip(buffer, ItemPointerGetOffsetNumber(otid),
+								   &version_skip, &version_skip_basis);
+
 	LockBuffer(buffer, BUFFER_LOCK_EXCLUSIVE);
 
 	old_offnum = ItemPointerGetOffsetNumber(otid);
@@ -1457,6 +1603,27 @@ check_tup_satisfies_update:
 			result = TM_Updated;
 	}
 
+	/*
+	 * A key update must also wait for the lockers that aren't recorded on
+	 * the tuple.  Those of a non-key update are carried over to the new
+	 * version of the tuple, if any, below.
+	 */
+	if (result == TM_Ok && *lockmode == LockTupleExclusive)
+	{
+		bool		would_block;
+
+		if (zheap_wait_for_key_share_lockers(relation, buffer,
+											 &oldtup.t_self, *lockmode,
+											 wait ? LockWaitBlock : LockWaitSkip,
+											 XLTW_Update, &have_tuple_lock,
+											 &would_block))
+		{
+			if (!would_block)
+				goto check_tup_satisfies_update;
+			result = TM_BeingModified;
+		}
+	}
+
 	if (result != TM_Ok)
 	{
 		Assert(result == TM_SelfModified ||
@@ -1464,7 +1631,8 @@ check_tup_satisfies_update:
 			   result == TM_Deleted ||
 			   result == TM_BeingModified);
 		Assert(ItemIdIsDeleted(lp) ||
-			   IsZHeapTupleModified(oldtup.t_data->t_infomask));
+			   IsZHeapTupleModified(oldtup.t_data->t_infomask) ||
+			   result == TM_BeingModified);
 
 		/* If item id is deleted, tuple can't be marked as moved. */
 		if (!ItemIdIsDeleted(lp) &&
@@ -1568,6 +1736,7 @@ check_tup_satisfies_update:
 	{
 		LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
 
+		pgstat_count_zheap_slot_wait(relation);
 		pgstat_report_wait_start(PG_WAIT_PAGE_TRANS_SLOT);
 		pg_usleep(10000L);		/* 10 ms */
 		pgstat_report_wait_end();
@@ -1826,6 +1995,7 @@ reacquire_buffer:
 
 			if (newtup_trans_slot == InvalidXactSlotId)
 			{
+				pgstat_count_zheap_slot_wait(relation);
 				pgstat_report_wait_start(PG_WAIT_PAGE_TRANS_SLOT);
 				pg_usleep(10000L);	/* 10 ms */
 				pgstat_report_wait_end();
@@ -1874,6 +2044,27 @@ reacquire_buffer:
 
 	CheckForSerializableConflictIn(relation, &(oldtup.t_self), buffer);
 
+	/*
+	 * If asked to, let the undo record of an in-place update tell readers
+	 * how to get to older versions quickly.  We leave out the cases where
+	 * we had to lock the tuple first; its previous version's undo is then
+	 * no longer where the slot points.
+	 */
+	if (zheap_undo_version_skip && use_inplace_update && !need_toast)
+	{
+		/*
+		 * Use what we computed before locking the buffer, unless the tuple
+		 * has been modified since.
+		 */
+		if (!UndoRecPtrIsValid(version_skip_basis) ||
+			!zheap_version_skip_applies(oldtup.t_data->t_infomask) ||
+			zinfo.urec_ptr != version_skip_basis)
+			zheap_init_version_skip(&version_skip);
+		zh_up_undo_info.version_skip = &version_skip;
+	}
+	else
+		zh_up_undo_info.version_skip = NULL;
+
 	/* Prepare an undo record for this operation. */
 	gen_undo_info.reloid = relation->rd_id;
 	gen_undo_info.blkno = ItemPointerGetBlockNumber(&(oldtup.t_self));
@@ -1985,6 +2176,14 @@ reacquire_buffer:
 	 */
 	XLogEnsureRecordSpace(8, 0);
 
+	/*
+	 * Make sure we'll be able to carry the KEY SHARE lockers that aren't
+	 * recorded on the old tuple over to the new one; that can't fail once
+	 * the update is WAL-logged.
+	 */
+	if (!use_inplace_update)
+		keyshare_reserved = ZHeapKeyShareReserve(relation, &oldtup.t_self);
+
 	START_CRIT_SECTION();
 
 	if ((vm_status & VISIBILITYMAP_ALL_VISIBLE) ||
@@ -2168,6 +2367,23 @@ reacquire_buffer:
 
 	END_CRIT_SECTION();
 
+	/*
+	 * Carry the KEY SHARE lockers that aren't recorded on the old tuple over
+	 * to the new one, as we did above for those that are.
+	 */
+	if (keyshare_reserved)
+		ZHeapKeyShareTransfer(relation, &oldtup.t_self, &zheaptup->t_self);
+
+	/*
+	 * The old tuple of a non-in-place update no longer needs its space
+	 * unless we roll back, so let the subsequent inserts of this
+	 * subtransaction reuse it.
+	 */
+	if (!use_inplace_update)
+		ZHeapRememberFreedSpace(relation, ItemPointerGetBlockNumber(otid),
+								ItemPointerGetOffsetNumber(otid),
+								oldtup.t_len);
+
 	/* be tidy */
 	pfree(undorecord.uur_tuple.data);
 	if (undorecord.uur_payload.len > 0)
@@ -2213,6 +2429,14 @@ reacquire_buffer:
 			pgstat_count_heap_update(relation, false);
 		else
 			pgstat_count_heap_insert(relation, 1);
+
+		/* Also remember why we couldn't update in place. */
+		if (slot_reused_or_TPD_slot)
+			pgstat_count_zheap_noninplace_slot(relation);
+		else if (is_index_updated)
+			pgstat_count_zheap_noninplace_index(relation);
+		else
+			pgstat_count_zheap_noninplace_space(relation);
 	}
 	else
 		pgstat_count_zheap_update(relation);
@@ -2787,6 +3011,22 @@ check_tup_satisfies_update:
 		}
 	}
 
+	/* A FOR UPDATE lock must also wait for the undo-free KEY SHARE lockers. */
+	if (result == TM_Ok && mode == LockTupleExclusive)
+	{
+		bool		would_block;
+
+		if (zheap_wait_for_key_share_lockers(relation, *buffer,
+											 &zhtup.t_self, mode, wait_policy,
+											 XLTW_Lock, &have_tuple_lock,
+											 &would_block))
+		{
+			if (!would_block)
+				goto check_tup_satisfies_update;
+			result = TM_WouldBlock;
+		}
+	}
+
 failed:
 	if (result != TM_Ok)
 	{
@@ -2831,6 +3071,30 @@ failed:
 		goto out_locked;
 	}
 
+	/*
+	 * A KEY SHARE lock that doesn't conflict with the tuple's lockers or
+	 * updater can usually be recorded in shared memory instead of in undo,
+	 * leaving the page alone.  See zkeyshare.c.
+	 */
+	if (mode == LockTupleKeyShare && lockopr == LockOnly)
+	{
+		if (IsSubTransaction())
+			SubXactLockTableInsert(GetCurrentSubTransactionId());
+
+		if (ZHeapKeyShareTryLock(relation, &zhtup.t_self))
+		{
+			tuple->t_tableOid = RelationGetRelid(relation);
+			tuple->t_len = zhtup.t_len;
+			tuple->t_self = zhtup.t_self;
+			tuple->t_data = palloc0(tuple->t_len);
+
+			memcpy(tuple->t_data, zhtup.t_data, zhtup.t_len);
+
+			result = TM_Ok;
+			goto out_locked;
+		}
+	}
+
 	/*
 	 * The transaction information of tuple needs to be set in transaction
 	 * slot, so needs to reserve the slot before proceeding with the actual
@@ -2849,6 +3113,7 @@ failed:
 	{
 		LockBuffer(*buffer, BUFFER_LOCK_UNLOCK);
 
+		pgstat_count_zheap_slot_wait(relation);
 		pgstat_report_wait_start(PG_WAIT_PAGE_TRANS_SLOT);
 		pg_usleep(10000L);		/* 10 ms */
 		pgstat_report_wait_end();
@@ -2941,6 +3206,56 @@ out_unlocked:
 	return result;
 }
 
+/*
+ * zheap_wait_for_key_share_lockers - wait for the undo-free KEY SHARE
+ *		lockers of a tuple
+ *
+ * Such lockers aren't recorded on the tuple (see zkeyshare.c), so the
+ * operations that conflict with KEY SHARE, which must pass mode as
+ * LockTupleExclusive, have to look for them separately.  Returns false if
+ * there are none, in which case the buffer lock was held throughout.
+ * Otherwise we release it, take the tuple lock in the given mode and wait
+ * for them, and the caller has to check the tuple again once we return
+ * with the buffer locked again; unless wait_policy is LockWaitSkip and we
+ * would have to wait, in which case *would_block is set instead.
+ */
+static bool
+zheap_wait_for_key_share_lockers(Relation relation, Buffer buffer,
+								 ItemPointer tid, LockTupleMode mode,
+								 LockWaitPolicy wait_policy, XLTW_Oper oper,
+								 bool *have_tuple_lock, bool *would_block)
+{
+	List	   *lockers;
+
+	Assert(mode == LockTupleExclusive);
+
+	*would_block = false;
+
+	lockers = ZHeapKeyShareLockers(relation, tid);
+	if (lockers == NIL)
+		return false;
+
+	LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
+
+	if (!heap_acquire_tuplock(relation, tid, mode, wait_policy,
+							  have_tuple_lock) ||
+		!ZHeapKeyShareLockersWait(relation, tid, lockers,
+								  wait_policy != LockWaitBlock, oper))
+	{
+		if (wait_policy == LockWaitError)
+			ereport(ERROR,
+					(errcode(ERRCODE_LOCK_NOT_AVAILABLE),
+					 errmsg("could not obtain lock on row in relation \"%s\"",
+							RelationGetRelationName(relation))));
+		*would_block = true;
+	}
+
+	list_free_deep(lockers);
+	LockBuffer(buffer, BUFFER_LOCK_EXCLUSIVE);
+
+	return true;
+}
+
 /*
  * zheap_tuple_already_locked - Check whether the tuple is already locked in
  *		given mode.
@@ -3998,6 +4313,22 @@ lock_tuple:
 			}
 		}
 
+		/* A FOR UPDATE lock must also wait for the undo-free KEY SHARE lockers. */
+		if (mode == LockTupleExclusive)
+		{
+			List	   *kslockers;
+
+			kslockers = ZHeapKeyShareLockers(rel, &mytup->t_self);
+			if (kslockers != NIL)
+			{
+				LockBuffer(buf, BUFFER_LOCK_UNLOCK);
+				(void) ZHeapKeyShareLockersWait(rel, &mytup->t_self, kslockers,
+												false, XLTW_LockUpdated);
+				list_free_deep(kslockers);
+				goto lock_tuple;
+			}
+		}
+
 		offnum = ItemPointerGetOffsetNumber(&mytup->t_self);
 
 		/*
@@ -4020,6 +4351,7 @@ lock_tuple:
 		{
 			LockBuffer(buf, BUFFER_LOCK_UNLOCK);
 
+			pgstat_count_zheap_slot_wait(rel);
 			pgstat_report_wait_start(PG_WAIT_PAGE_TRANS_SLOT);
 			pg_usleep(10000L);	/* 10 ms */
 			pgstat_report_wait_end();
@@ -4160,6 +4492,7 @@ zheap_lock_tuple_guts(Buffer buf, ZHeapTuple zhtup, ZHeapTupleTransInfo *tup_inf
 	xl_undolog_meta undometa;
 	int			result_trans_slot;
 	ZHeapPrepareLockUndoInfo zh_lock_undo_info;
+	XLogRecPtr	prior_lsn;
 
 	/* Compute the new xid and infomask to store into the tuple. */
 	old_infomask = zhtup->t_data->t_infomask;
@@ -4208,6 +4541,8 @@ zheap_lock_tuple_guts(Buffer buf, ZHeapTuple zhtup, ZHeapTupleTransInfo *tup_inf
 
 	urecptr = zheap_prepare_undolock(&zh_lock_undo_info, &undorecord, NULL, &undometa);
 
+	prior_lsn = PageGetLSN(BufferGetPage(buf));
+
 	START_CRIT_SECTION();
 
 	InsertPreparedUndo();
@@ -4249,6 +4584,24 @@ zheap_lock_tuple_guts(Buffer buf, ZHeapTuple zhtup, ZHeapTupleTransInfo *tup_inf
 	}
 	END_CRIT_SECTION();
 
+	/*
+	 * If the shared tuple lock table knows the lockers of this tuple, add
+	 * ourselves, so that conflicting transactions needn't walk the undo to
+	 * find us.
+	 */
+	if (needs_wal)
+	{
+		ZMultiLockMember locker;
+
+		locker.xid = XidFromFullTransactionId(current_fxid);
+		locker.subxid = hasSubXactLock ? GetCurrentSubTransactionId() :
+			InvalidSubTransactionId;
+		locker.trans_slot_id = current_trans_slot;
+		locker.mode = mode;
+		ZHeapLockTableAddLocker(buf, ItemPointerGetOffsetNumber(&zhtup->t_self),
+								prior_lsn, &locker);
+	}
+
 	pfree(undorecord.uur_tuple.data);
 	pfree(undorecord.uur_payload.data);
 	UnlockReleaseUndoBuffers();
@@ -4828,6 +5181,7 @@ zheap_fetchinsertxid(ZHeapTuple zhtup, Buffer buffer)
 		 */
 		if (urec->uur_type == UNDO_INSERT ||
 			urec->uur_type == UNDO_MULTI_INSERT ||
+			urec->uur_type == UNDO_BULK_APPEND ||
 			urec->uur_type == UNDO_INPLACE_UPDATE)
 		{
 			result = urec->uur_xid;
@@ -4873,6 +5227,7 @@ zheap_fetchinsertxid(ZHeapTuple zhtup, Buffer buffer)
 UndoRecPtr
 zheap_prepare_undoinsert(ZHeapPrepareUndoInfo *zh_undo_info,
 						 uint32 specToken, bool specIns,
+						 ZHeapReusedItem *reused_item,
 						 UnpackedUndoRecord *undorecord,
 						 XLogReaderState *xlog_record,
 						 xl_undolog_meta *undometa)
@@ -4883,7 +5238,9 @@ zheap_prepare_undoinsert(ZHeapPrepareUndoInfo *zh_undo_info,
 	 * Prepare an undo record.  Unlike other operations, insert operation
 	 * doesn't have a prior version to store in undo, so we don't need to
 	 * store any additional information like UREC_INFO_PAYLOAD_CONTAINS_SLOT
-	 * for TPD entries.
+	 * for TPD entries.  However, if the tuple has taken over the storage of
+	 * an item deleted by the same subtransaction, we need to remember where
+	 * that storage was so that the deleted item can get it back on rollback.
 	 */
 	undorecord->uur_rmid = RM_ZHEAP_ID;
 	undorecord->uur_type = UNDO_INSERT;
@@ -4918,6 +5275,16 @@ zheap_prepare_undoinsert(ZHeapPrepareUndoInfo *zh_undo_info,
 	else
 		undorecord->uur_payload.len = 0;
 
+	if (reused_item)
+	{
+		if (!specIns)
+			initStringInfo(&undorecord->uur_payload);
+		appendBinaryStringInfo(&undorecord->uur_payload,
+							   (char *) reused_item,
+							   SizeOfZHeapReusedItem);
+		undorecord->uur_info |= UREC_INFO_PAYLOAD_CONTAINS_REUSED_ITEM;
+	}
+
 	urecptr = PrepareUndoInsert(undorecord,
 								zh_undo_info->fxid,
 								zh_undo_info->undo_persistence,
@@ -4927,6 +5294,158 @@ zheap_prepare_undoinsert(ZHeapPrepareUndoInfo *zh_undo_info,
 	return urecptr;
 }
 
+/*
+ * zheap_version_skip_applies - can an in-place update of a tuple with the
+ *	given infomask extend the skip chain of the tuple's undo?
+ *
+ * Only if the tuple was last in-place updated, rather than locked, as
+ * otherwise its slot doesn't point to the undo of its previous version.
+ */
+static bool
+zheap_version_skip_applies(uint16 infomask)
+{
+	return (infomask & ZHEAP_INPLACE_UPDATED) != 0 &&
+		(infomask & (ZHEAP_XID_LOCK_ONLY | ZHEAP_MULTI_LOCKERS |
+					 ZHEAP_INVALID_XACT_SLOT)) == 0;
+}
+
+/*
+ * zheap_init_version_skip - set up skip information that starts a new chain
+ */
+static void
+zheap_init_version_skip(ZHeapUndoVersionSkip *skip)
+{
+	memset(skip, 0, sizeof(ZHeapUndoVersionSkip));
+	skip->prev_urecptr = InvalidUndoRecPtr;
+	skip->jump_urecptr = InvalidUndoRecPtr;
+	skip->jump_xid = InvalidTransactionId;
+	skip->depth = 0;
+	skip->jump_depth = 0;
+	skip->magic = ZHEAP_UNDO_VERSION_SKIP;
+}
+
+/*
+ * zheap_prepare_version_skip - compute the skip information for the undo
+ *	record of an in-place update of the tuple at offnum.
+ *
+ * If the tuple was last in-place updated and the undo of that update is
+ * still around, that undo record is the one for the previous version, and if
+ * it has skip information of its own, the new record extends its chain;
+ * otherwise the new record starts a chain.  See ZHeapUndoVersionSkip.
+ *
+ * The jump pointer of a record is chosen from the skip information of the
+ * previous record, p, and of the record p jumps to, j: if the jump from p to
+ * j covers as many records as the jump from j onwards, the new record jumps
+ * as far as j does; otherwise it jumps to p.  This gives each record a jump
+ * pointer computed from just two undo records, and any older record can be
+ * reached from it in a logarithmic number of jumps and steps.
+ *
+ * Fetching those records takes a while, so this is done before the update
+ * locks the buffer exclusively; we only take a share lock to look at the
+ * tuple.  *basis is set to the undo record of the previous version the
+ * result was computed from, or InvalidUndoRecPtr.  The update must only use
+ * the result if the tuple still points to that record once it holds the
+ * exclusive lock.
+ */
+static void
+zheap_prepare_version_skip(Buffer buffer, OffsetNumber offnum,
+						   ZHeapUndoVersionSkip *skip, UndoRecPtr *basis)
+{
+	BlockNumber blkno = BufferGetBlockNumber(buffer);
+	Page		page = BufferGetPage(buffer);
+	ItemId		lp;
+	ZHeapTupleHeaderData hdr;
+	ZHeapTupleTransInfo zinfo;
+	UnpackedUndoRecord *urec;
+	UndoRecPtr	prev_urecptr;
+	TransactionId prev_xid;
+	ZHeapUndoVersionSkip prev_skip;
+	ZHeapUndoVersionSkip jump_skip;
+	bool		found;
+
+	/* Unless we find otherwise, start a new chain. */
+	zheap_init_version_skip(skip);
+	*basis = InvalidUndoRecPtr;
+
+	LockBuffer(buffer, BUFFER_LOCK_SHARE);
+
+	lp = PageGetItemId(page, offnum);
+	if (!ItemIdIsNormal(lp))
+	{
+		LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
+		return;
+	}
+
+	memcpy(&hdr, PageGetItem(page, lp), SizeofZHeapTupleHeader);
+	if (!zheap_version_skip_applies(hdr.t_infomask))
+	{
+		LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
+		return;
+	}
+
+	GetTransactionSlotInfo(buffer, offnum,
+						   ZHeapTupleHeaderGetXactSlot(&hdr),
+						   true, false, &zinfo);
+
+	LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
+
+	if (zinfo.trans_slot == ZHTUP_SLOT_FROZEN ||
+		!TransactionIdIsNormal(zinfo.xid) ||
+		!UndoRecPtrIsValid(zinfo.urec_ptr))
+		return;
+
+	*basis = zinfo.urec_ptr;
+
+	/* Find the undo record of the previous version. */
+	urec = UndoFetchRecord(zinfo.urec_ptr, blkno, offnum, zinfo.xid,
+						   &prev_urecptr, ZHeapSatisfyUndoRecord);
+	if (urec == NULL)
+		return;
+	skip->prev_urecptr = prev_urecptr;
+	prev_xid = urec->uur_xid;
+	found = UndoRecordGetVersionSkip(urec, &prev_skip);
+	UndoRecordRelease(urec);
+	if (!found)
+		return;
+
+	skip->depth = prev_skip.depth + 1;
+
+	/* By default, jump to the previous record. */
+	skip->jump_urecptr = prev_urecptr;
+	skip->jump_xid = prev_xid;
+	skip->jump_depth = prev_skip.depth;
+
+	/*
+	 * If the previous record is the oldest of the chain, both of its jumps
+	 * are empty, so that's where we jump to.
+	 */
+	if (!UndoRecPtrIsValid(prev_skip.jump_urecptr))
+		return;
+
+	urec = UndoFetchRecord(prev_skip.jump_urecptr, blkno, offnum,
+						   prev_skip.jump_xid, NULL, ZHeapSatisfyUndoRecord);
+	if (urec == NULL)
+		return;
+	found = UndoRecordGetVersionSkip(urec, &jump_skip);
+	UndoRecordRelease(urec);
+
+	/*
+	 * The oldest record of the chain has no jump pointer, and the jump from
+	 * it would be empty, which never matches the one from the previous
+	 * record.
+	 */
+	if (!found || !UndoRecPtrIsValid(jump_skip.jump_urecptr))
+		return;
+
+	if (prev_skip.depth - prev_skip.jump_depth ==
+		prev_skip.jump_depth - jump_skip.jump_depth)
+	{
+		skip->jump_urecptr = jump_skip.jump_urecptr;
+		skip->jump_xid = jump_skip.jump_xid;
+		skip->jump_depth = jump_skip.jump_depth;
+	}
+}
+
 /*
  * zheap_prepare_undoupdate - prepare the undo record for zheap update
  *	operation.
@@ -5023,6 +5542,22 @@ zheap_prepare_undoupdate(ZHeapPrepareUpdateUndoInfo *zh_undoinfo, ZHeapTuple zht
 								   sizeof(SubTransactionId));
 		}
 
+		/*
+		 * The skip information goes last, see UndoRecordGetVersionSkip.
+		 */
+		if (zh_undoinfo->version_skip)
+		{
+			if (!hasPayload)
+			{
+				initStringInfo(&(zh_undoinfo->old_undorec->uur_payload));
+				hasPayload = true;
+			}
+
+			appendBinaryStringInfo(&(zh_undoinfo->old_undorec->uur_payload),
+								   (char *) zh_undoinfo->version_skip,
+								   SizeOfZHeapUndoVersionSkip);
+		}
+
 		if (!hasPayload)
 			zh_undoinfo->old_undorec->uur_payload.len = 0;
 
@@ -5427,6 +5962,51 @@ zheap_prepare_undo_multi_insert(ZHeapPrepareUndoInfo *zh_undo_info,
 	return urecptr;
 }
 
+/*
+ * zheap_prepare_undo_bulk_append - prepare the undo record for a bulk append
+ *	starting at zh_undo_info->blkno.
+ *
+ * The record isn't tied to any one block: it covers every page from the
+ * starting block onwards whose transaction slot points to it, and rolling it
+ * back removes all the tuples of the transaction on those pages.  See
+ * zheap_multi_insert.
+ *
+ * Returns the undo record pointer (aka location) where the undo record
+ * will be inserted in undo log.
+ */
+UndoRecPtr
+zheap_prepare_undo_bulk_append(ZHeapPrepareUndoInfo *zh_undo_info,
+							   UnpackedUndoRecord *undorecord,
+							   XLogReaderState *xlog_record,
+							   xl_undolog_meta *undometa)
+{
+	undorecord->uur_rmid = RM_ZHEAP_ID;
+	undorecord->uur_type = UNDO_BULK_APPEND;
+	undorecord->uur_info = 0;
+	undorecord->uur_prevlen = 0;
+	undorecord->uur_reloid = zh_undo_info->reloid;
+	undorecord->uur_prevxid = FrozenTransactionId;
+	undorecord->uur_xid = XidFromFullTransactionId(zh_undo_info->fxid);
+	undorecord->uur_cid = zh_undo_info->cid;
+	undorecord->uur_fork = MAIN_FORKNUM;
+	undorecord->uur_blkprev = InvalidUndoRecPtr;
+	undorecord->uur_block = InvalidBlockNumber;
+	undorecord->uur_offset = InvalidOffsetNumber;
+	undorecord->uur_tuple.len = 0;
+
+	/* The starting block goes in the payload. */
+	initStringInfo(&undorecord->uur_payload);
+	appendBinaryStringInfo(&undorecord->uur_payload,
+						   (char *) &zh_undo_info->blkno,
+						   sizeof(BlockNumber));
+
+	return PrepareUndoInsert(undorecord,
+							 InRecovery ? zh_undo_info->fxid : InvalidFullTransactionId,
+							 zh_undo_info->undo_persistence,
+							 xlog_record,
+							 undometa);
+}
+
 /*
  * log_zheap_insert - Perform XLogInsert for a zheap-insert operation.
  *
@@ -5437,7 +6017,7 @@ zheap_prepare_undo_multi_insert(ZHeapPrepareUndoInfo *zh_undo_info,
  */
 static void
 log_zheap_insert(ZHeapWALInfo *walinfo, Relation relation,
-				 int options, bool skip_undo)
+				 int options, bool skip_undo, ZHeapReusedItem *reused_item)
 {
 	xl_undo_header xlundohdr;
 	xl_zheap_insert xlrec;
@@ -5529,6 +6109,17 @@ prepare_xlog:
 						 sizeof(walinfo->new_trans_slot_id));
 	}
 
+	/*
+	 * If the tuple has taken over the storage of a deleted item, replay needs
+	 * to know which one.
+	 */
+	if (reused_item)
+	{
+		Assert(!skip_undo);
+		xlrec.flags |= XLZ_INSERT_REUSED_ITEM;
+		XLogRegisterData((char *) reused_item, SizeOfZHeapReusedItem);
+	}
+
 	xlhdr.t_infomask2 = walinfo->ztuple->t_data->t_infomask2;
 	xlhdr.t_infomask = walinfo->ztuple->t_data->t_infomask;
 	xlhdr.t_hoff = walinfo->ztuple->t_data->t_hoff;
@@ -5586,6 +6177,7 @@ log_zheap_update(ZHeapWALInfo *old_walinfo, ZHeapWALInfo *new_walinfo,
 	xl_zheap_header xlundotuphdr,
 				xlhdr;
 	xl_zheap_update xlrec;
+	ZHeapUndoVersionSkip version_skip;
 	ZHeapTuple	difftup;
 	ZHeapTupleHeader zhtuphdr;
 	uint16		prefix_suffix[2];
@@ -5738,6 +6330,12 @@ prepare_xlog:
 		XLogRegisterData((char *) &(old_walinfo->prior_trans_slot_id),
 						 sizeof(old_walinfo->prior_trans_slot_id));
 	}
+	if (inplace_update &&
+		UndoRecordGetVersionSkip(old_walinfo->undorecord, &version_skip))
+	{
+		xlrec.flags |= XLZ_UPDATE_CONTAINS_VERSION_SKIP;
+		XLogRegisterData((char *) &version_skip, SizeOfZHeapUndoVersionSkip);
+	}
 	if (!inplace_update)
 	{
 		XLogRegisterData((char *) &xlnewundohdr, SizeOfUndoHeader);
@@ -6065,6 +6663,20 @@ log_zheap_multi_insert(ZHeapMultiInsertWALInfo *multi_walinfo, bool skip_undo,
 		scratchptr += sizeof(OffsetNumber);
 	}
 
+	/* tell replay whether to insert the bulk-append undo record */
+	if (multi_walinfo->bulk_append)
+	{
+		BlockNumber bulk_start_blkno;
+
+		bulk_start_blkno = multi_walinfo->bulk_append_start ?
+			BufferGetBlockNumber(multi_walinfo->gen_walinfo->buffer) :
+			InvalidBlockNumber;
+		xlrec->flags |= XLZ_INSERT_BULK_APPEND;
+		memcpy((char *) scratchptr, (char *) &bulk_start_blkno,
+			   sizeof(BlockNumber));
+		scratchptr += sizeof(BlockNumber);
+	}
+
 	/* the rest of the scratch space is used for tuple data */
 	tupledata = scratchptr;
 
@@ -6132,8 +6744,12 @@ log_zheap_multi_insert(ZHeapMultiInsertWALInfo *multi_walinfo, bool skip_undo,
 		bufflags |= REGBUF_KEEP_DATA;
 
 prepare_xlog:
-	/* LOG undolog meta if this is the first WAL after the checkpoint. */
-	LogUndoMetaData(multi_walinfo->gen_walinfo->undometa);
+	/*
+	 * LOG undolog meta if this is the first WAL after the checkpoint.  A page
+	 * added to a bulk append doesn't write any undo.
+	 */
+	if (!multi_walinfo->bulk_append || multi_walinfo->bulk_append_start)
+		LogUndoMetaData(multi_walinfo->gen_walinfo->undometa);
 	GetFullPageWriteInfo(&RedoRecPtr, &doPageWrites);
 
 	XLogBeginInsert();
@@ -6927,6 +7543,7 @@ PageReserveTransactionSlot(Relation relation, Buffer buf, OffsetNumber offset,
 
 		if (tpd_e_slot != InvalidXactSlotId)
 		{
+			pgstat_count_zheap_tpd_slot(relation);
 			if (slot_reused_or_TPD_slot)
 				*slot_reused_or_TPD_slot = true;
 			return tpd_e_slot;
@@ -6945,6 +7562,7 @@ PageReserveTransactionSlot(Relation relation, Buffer buf, OffsetNumber offset,
 												 always_extend);
 		if (slot_no != InvalidXactSlotId)
 		{
+			pgstat_count_zheap_tpd_slot(relation);
 			if (slot_reused_or_TPD_slot)
 				*slot_reused_or_TPD_slot = true;
 			return slot_no;
@@ -7780,8 +8398,8 @@ zheap_multi_insert(Relation relation, TupleTableSlot **slots, int ntuples,
 	xl_undolog_meta undometa;
 	bool		lock_reacquired;
 	bool		skip_undo;
+	bool		bulk_append;
 
-	needwal = RelationNeedsWAL(relation);
 	saveFreeSpace = RelationGetTargetPageFreeSpace(relation,
 												   HEAP_DEFAULT_FILLFACTOR);
 
@@ -7791,6 +8409,23 @@ zheap_multi_insert(Relation relation, TupleTableSlot **slots, int ntuples,
 	 */
 	skip_undo = (options & ZHEAP_INSERT_FROZEN);
 
+	/* See zheap_prepare_insert for when we may skip WAL */
+	needwal = RelationNeedsWAL(relation) &&
+		!(skip_undo && (options & ZHEAP_INSERT_SKIP_WAL));
+
+	/*
+	 * If the relation was created or truncated by this transaction, nobody
+	 * else can insert into it, so the pages we extend it with will hold only
+	 * our tuples.  Rather than writing undo for every such page, we cover all
+	 * of them with a single UNDO_BULK_APPEND record, whose undo action
+	 * removes our tuples from every page from its starting block onwards that
+	 * points to it.  COPY skips the FSM for such a relation, so all the pages
+	 * it fills are fresh ones.
+	 */
+	bulk_append = !skip_undo &&
+		(relation->rd_createSubid != InvalidSubTransactionId ||
+		 relation->rd_newRelfilenodeSubid != InvalidSubTransactionId);
+
 	/* Toast and set header data in all the tuples */
 	zheaptuples = palloc(ntuples * sizeof(ZHeapTuple));
 	for (i = 0; i < ntuples; i++)
@@ -7826,13 +8461,17 @@ zheap_multi_insert(Relation relation, TupleTableSlot **slots, int ntuples,
 	{
 		Buffer		buffer;
 		Buffer		vmbuffer = InvalidBuffer;
+		BlockNumber blkno;
 		bool		all_visible_cleared = false;
+		bool		bulk_append_page = false;
+		bool		bulk_append_start = false;
 		int			nthispage = 0;
 		int			trans_slot_id = InvalidXactSlotId;
 		int			ucnt = 0;
 		UndoRecPtr	urecptr = InvalidUndoRecPtr,
 					prev_urecptr = InvalidUndoRecPtr;
 		UnpackedUndoRecord *undorecord = NULL;
+		UnpackedUndoRecord bulkundorecord;
 		ZHeapFreeOffsetRanges *zfree_offset_ranges;
 		OffsetNumber usedoff[MaxOffsetNumber];
 		OffsetNumber max_required_offset;
@@ -7856,6 +8495,7 @@ reacquire_buffer:
 											InvalidBuffer, options, bistate,
 											&vmbuffer, NULL);
 		page = BufferGetPage(buffer);
+		blkno = BufferGetBlockNumber(buffer);
 
 		/*
 		 * Get the unused offset ranges in the page. This is required for
@@ -7906,6 +8546,7 @@ reacquire_buffer:
 			{
 				UnlockReleaseBuffer(buffer);
 
+				pgstat_count_zheap_slot_wait(relation);
 				pgstat_report_wait_start(PG_WAIT_PAGE_TRANS_SLOT);
 				pg_usleep(10000L);	/* 10 ms */
 				pgstat_report_wait_end();
@@ -7916,17 +8557,52 @@ reacquire_buffer:
 			/* transaction slot must be reserved before adding tuple to page */
 			Assert(trans_slot_id != InvalidXactSlotId);
 
+			/*
+			 * See if the page can join the bulk append of this command, or
+			 * else start a new one.  Our slot on the page mustn't point to
+			 * any other undo of ours, and it must not be a TPD slot.
+			 */
+			bulk_append_page = false;
+			bulk_append_start = false;
+			if (bulk_append &&
+				(trans_slot_id < ZHEAP_PAGE_TRANS_SLOTS ||
+				 (trans_slot_id == ZHEAP_PAGE_TRANS_SLOTS &&
+				  !ZHeapPageHasTPDSlot((PageHeader) page))))
+			{
+				bool		fresh_page;
+
+				fresh_page = (PageGetMaxOffsetNumber(page) == 0 &&
+							  !UndoRecPtrIsValid(prev_urecptr));
+
+				if (bulk_append_state.reloid == RelationGetRelid(relation) &&
+					FullTransactionIdEquals(bulk_append_state.fxid, fxid) &&
+					bulk_append_state.subxid == GetCurrentSubTransactionId() &&
+					bulk_append_state.cid == cid &&
+					blkno >= bulk_append_state.start_blkno &&
+					(fresh_page || prev_urecptr == bulk_append_state.urecptr))
+					bulk_append_page = true;
+				else if (fresh_page)
+					bulk_append_page = bulk_append_start = true;
+			}
+
 			/* Prepare an undo record for this operation. */
 			zh_undo_info.reloid = relation->rd_id;
-			zh_undo_info.blkno = BufferGetBlockNumber(buffer);
+			zh_undo_info.blkno = blkno;
 			zh_undo_info.offnum = InvalidOffsetNumber;
 			zh_undo_info.prev_urecptr = prev_urecptr;
 			zh_undo_info.fxid = fxid;
 			zh_undo_info.cid = cid;
 			zh_undo_info.undo_persistence = UndoPersistenceForRelation(relation);
 
-			urecptr = zheap_prepare_undo_multi_insert(&zh_undo_info, zfree_offset_ranges->nranges, &undorecord,
-													  NULL, &undometa);
+			if (bulk_append_start)
+				urecptr = zheap_prepare_undo_bulk_append(&zh_undo_info,
+														 &bulkundorecord,
+														 NULL, &undometa);
+			else if (bulk_append_page)
+				urecptr = bulk_append_state.urecptr;
+			else
+				urecptr = zheap_prepare_undo_multi_insert(&zh_undo_info, zfree_offset_ranges->nranges, &undorecord,
+														  NULL, &undometa);
 		}
 
 		/*
@@ -8020,7 +8696,7 @@ reacquire_buffer:
 			 * undo records as well.
 			 */
 			zfree_offset_ranges->endOffset[i] = offnum - 1;
-			if (!skip_undo)
+			if (!skip_undo && !bulk_append_page)
 			{
 				appendBinaryStringInfo(&undorecord[i].uur_payload,
 									   (char *) &zfree_offset_ranges->startOffset[i],
@@ -8047,7 +8723,15 @@ reacquire_buffer:
 
 		MarkBufferDirty(buffer);
 
-		if (!skip_undo)
+		if (bulk_append_page)
+		{
+			/* Only the first page of a bulk append has any undo to insert. */
+			if (bulk_append_start)
+				InsertPreparedUndo();
+
+			PageSetTransactionSlotInfo(buffer, trans_slot_id, fxid, urecptr);
+		}
+		else if (!skip_undo)
 		{
 			/* Insert the undo */
 			InsertPreparedUndo();
@@ -8103,6 +8787,8 @@ reacquire_buffer:
 			ins_wal_info.ntuples = ntuples;
 			ins_wal_info.curpage_ntuples = nthispage;
 			ins_wal_info.ndone = ndone;
+			ins_wal_info.bulk_append = bulk_append_page;
+			ins_wal_info.bulk_append_start = bulk_append_start;
 
 			log_zheap_multi_insert(&ins_wal_info, skip_undo, scratch);
 		}
@@ -8110,7 +8796,9 @@ reacquire_buffer:
 		END_CRIT_SECTION();
 
 		/* be tidy */
-		if (!skip_undo)
+		if (bulk_append_start)
+			pfree(bulkundorecord.uur_payload.data);
+		else if (!skip_undo && !bulk_append_page)
 		{
 			for (i = 0; i < zfree_offset_ranges->nranges; i++)
 				pfree(undorecord[i].uur_payload.data);
@@ -8124,6 +8812,17 @@ reacquire_buffer:
 		UnlockReleaseUndoBuffers();
 		UnlockReleaseTPDBuffers();
 
+		/* Following pages of this command can join the new bulk append. */
+		if (bulk_append_start)
+		{
+			bulk_append_state.reloid = RelationGetRelid(relation);
+			bulk_append_state.fxid = fxid;
+			bulk_append_state.subxid = GetCurrentSubTransactionId();
+			bulk_append_state.cid = cid;
+			bulk_append_state.start_blkno = blkno;
+			bulk_append_state.urecptr = urecptr;
+		}
+
 		ndone += nthispage;
 	}
 
@@ -8493,27 +9192,55 @@ CheckAndLockTPDPage(Relation relation, int new_trans_slot_id, int old_trans_slot
 	}
 }
 
+/*
+ * copy_zrelation_block - copy one block of the given fork to dst
+ *
+ * The caller must have pinned the source buffer; we release the pin.
+ */
+static void
+copy_zrelation_block(SMgrRelation dst, ForkNumber forknum, BlockNumber blkno,
+					 Buffer buffer, bool use_wal)
+{
+	Page		page = (Page) BufferGetPage(buffer);
+
+	/*
+	 * WAL-log the copied page. Unfortunately we don't know what kind of a
+	 * page this is, so we have to log the full page including any unused
+	 * space.
+	 */
+	if (use_wal)
+		log_newpage(&dst->smgr_rnode.node, forknum, blkno, page, false);
+
+	PageSetChecksumInplace(page, blkno);
+
+	/*
+	 * Now write the page.  We say isTemp = true even if it's not a temp rel,
+	 * because there's no need for smgr to schedule an fsync for this write;
+	 * we'll do it ourselves below.
+	 */
+	smgrextend(dst, forknum, blkno, page, true);
+
+	ReleaseBuffer(buffer);
+}
+
 /*
  * copy_zrelation_data - copy zheap data
  *
- * In this method, we copy the main fork of a zheap relation block by block.
- * Here is the algorithm for the same:
+ * In this method, we copy the main fork and the TPD fork of a zheap relation
+ * block by block.  Here is the algorithm for the same:
  * For each zheap page,
  * a. If it's a meta page, copy it as it is.
- * b. If it's a TPD page, copy it as it is.
- * c. If it's a zheap data page, apply pending aborts, copy the page and
- *    the corresponding TPD page (if any).
+ * b. If it's a zheap data page, apply pending aborts and copy the page.
+ * Then copy all the pages of the TPD fork, if any.
  *
- * Please note that we may copy a tpd page multiple times. The reason is one
- * tpd page can be referred by multiple zheap pages. While applying pending
- * aborts on a zheap page, we also need to modify the transaction and undo
- * information in the corresponding TPD page, hence, we need to copy it again
- * to reflect the changes.
+ * While applying pending aborts on a zheap page, we also need to modify the
+ * transaction and undo information in the corresponding TPD page, hence the
+ * TPD fork is copied only after the main fork and via shared buffers, unlike
+ * the other forks.
  */
 void
 copy_zrelation_data(Relation srcRel, SMgrRelation dst)
 {
-	Page		page;
 	bool		use_wal;
 	BlockNumber nblocks;
 	BlockNumber blkno;
@@ -8530,62 +9257,19 @@ copy_zrelation_data(Relation srcRel, SMgrRelation dst)
 
 	for (blkno = 0; blkno < nblocks; blkno++)
 	{
-		BlockNumber target_blkno = InvalidBlockNumber;
-		BlockNumber tpd_blkno = InvalidBlockNumber;
-		Buffer		buffer = InvalidBuffer;
+		Buffer		buffer;
 
 		/* If we got a cancel signal during the copy of the data, quit */
 		CHECK_FOR_INTERRUPTS();
 
-		if (blkno != ZHEAP_METAPAGE)
-		{
-			buffer = ReadBuffer(srcRel, blkno);
-
-			/* If it's a zheap page, apply the pending undo actions */
-			if (!IsTPDPage(BufferGetPage(buffer)))
-				zheap_exec_pending_rollback(srcRel, buffer, InvalidXactSlotId,
-											InvalidTransactionId, &tpd_blkno);
-		}
+		buffer = ReadBuffer(srcRel, blkno);
 
-		target_blkno = blkno;
-
-copy_buffer:
-		/* Read the buffer if not already done. */
-		if (!BufferIsValid(buffer))
-			buffer = ReadBuffer(srcRel, target_blkno);
-		page = (Page) BufferGetPage(buffer);
-
-		/*
-		 * WAL-log the copied page. Unfortunately we don't know what kind of a
-		 * page this is, so we have to log the full page including any unused
-		 * space.
-		 */
-		if (use_wal)
-			log_newpage(&dst->smgr_rnode.node, MAIN_FORKNUM, target_blkno, page, false);
-
-		PageSetChecksumInplace(page, target_blkno);
-
-		/*
-		 * Now write the page.  We say isTemp = true even if it's not a temp
-		 * rel, because there's no need for smgr to schedule an fsync for this
-		 * write; we'll do it ourselves below.
-		 */
-		smgrextend(dst, MAIN_FORKNUM, target_blkno, page, true);
-
-		ReleaseBuffer(buffer);
+		/* If it's a zheap page, apply the pending undo actions */
+		if (blkno != ZHEAP_METAPAGE)
+			zheap_exec_pending_rollback(srcRel, buffer, InvalidXactSlotId,
+										InvalidTransactionId, NULL);
 
-		/*
-		 * If we have rolled back some transaction from TPD of the target page
-		 * and the TPD block number is lesser than the target block number, we
-		 * have to write the TPD page again.
-		 */
-		if (BlockNumberIsValid(tpd_blkno) && tpd_blkno < target_blkno)
-		{
-			target_blkno = tpd_blkno;
-			tpd_blkno = InvalidBlockNumber;
-			buffer = InvalidBuffer;
-			goto copy_buffer;
-		}
+		copy_zrelation_block(dst, MAIN_FORKNUM, blkno, buffer, use_wal);
 	}
 
 	/*
@@ -8605,6 +9289,30 @@ copy_buffer:
 	 */
 	if (relpersistence == RELPERSISTENCE_PERMANENT)
 		smgrimmedsync(dst, MAIN_FORKNUM);
+
+	/* Now copy the TPD fork, if it exists. */
+	if (!smgrexists(src, TPD_FORKNUM))
+		return;
+
+	smgrcreate(dst, TPD_FORKNUM, false);
+	if (relpersistence == RELPERSISTENCE_PERMANENT)
+		log_smgrcreate(&dst->smgr_rnode.node, TPD_FORKNUM);
+
+	nblocks = smgrnblocks(src, TPD_FORKNUM);
+
+	for (blkno = 0; blkno < nblocks; blkno++)
+	{
+		Buffer		buffer;
+
+		CHECK_FOR_INTERRUPTS();
+
+		buffer = ReadBufferExtended(srcRel, TPD_FORKNUM, blkno, RBM_NORMAL,
+									NULL);
+		copy_zrelation_block(dst, TPD_FORKNUM, blkno, buffer, use_wal);
+	}
+
+	if (relpersistence == RELPERSISTENCE_PERMANENT)
+		smgrimmedsync(dst, TPD_FORKNUM);
 }
 
 /*
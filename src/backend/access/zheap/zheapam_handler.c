@@ -24,6 +24,7 @@
 
 #include "miscadmin.h"
 
+#include "access/heapam.h"
 #include "access/multixact.h"
 #include "access/relscan.h"
 #include "access/rewritezheap.h"
@@ -34,6 +35,7 @@
 #include "access/visibilitymap.h"
 #include "access/xact.h"
 #include "access/zheap.h"
+#include "access/zhio.h"
 #include "access/zheapscan.h"
 #include "catalog/catalog.h"
 #include "catalog/index.h"
@@ -440,6 +442,21 @@ retry:
 }
 
 
+static void
+zheapam_finish_bulk_insert(Relation relation, int options)
+{
+	/*
+	 * If we skipped writing WAL, then we need to sync the relation.  zheap
+	 * only does that for frozen tuples, see zheap_prepare_insert.
+	 */
+	if ((options & ZHEAP_INSERT_SKIP_WAL) && (options & ZHEAP_INSERT_FROZEN))
+		heap_sync(relation);
+
+	/* Let other backends see the pages we've extended the relation by. */
+	ZHeapFinishBulkExtend(relation);
+}
+
+
 static TM_Result
 zheapam_update(Relation relation, ItemPointer otid, TupleTableSlot *slot,
 			   CommandId cid, Snapshot snapshot, Snapshot crosscheck,
@@ -559,6 +576,9 @@ zheapam_begin_index_fetch(Relation rel)
 
 	hscan->xs_base.rel = rel;
 	hscan->xs_cbuf = InvalidBuffer;
+	hscan->xs_batch_cxt = NULL;
+	hscan->xs_batch_count = 0;
+	hscan->xs_prefetched = 0;
 	/* hscan->xs_continue_hot = false; */
 
 	return &hscan->xs_base;
@@ -576,6 +596,9 @@ zheapam_reset_index_fetch(IndexFetchTableData *scan)
 		hscan->xs_cbuf = InvalidBuffer;
 	}
 
+	hscan->xs_batch_count = 0;
+	hscan->xs_prefetched = 0;
+
 	/* hscan->xs_continue_hot = false; */
 }
 
@@ -586,6 +609,9 @@ zheapam_end_index_fetch(IndexFetchTableData *scan)
 
 	zheapam_reset_index_fetch(scan);
 
+	if (hscan->xs_batch_cxt)
+		MemoryContextDelete(hscan->xs_batch_cxt);
+
 	pfree(hscan);
 }
 
@@ -604,6 +630,31 @@ zheapam_index_fetch_tuple(struct IndexFetchTableData *scan,
 	 */
 	Assert(!*call_again);
 
+	/* Has zheapam_index_fetch_batch already looked this one up? */
+	if (hscan->xs_batch_next < hscan->xs_batch_count)
+	{
+		int			i = hscan->xs_batch_next;
+
+		if (snapshot == hscan->xs_batch_snapshot &&
+			ItemPointerEquals(tid, &hscan->xs_batch_tids[i]))
+		{
+			hscan->xs_batch_next++;
+			if (all_dead)
+				*all_dead = hscan->xs_batch_all_dead[i];
+			if (hscan->xs_batch_tuples[i] == NULL)
+				return false;
+
+			zheapTuple = zheap_copytuple(hscan->xs_batch_tuples[i]);
+			*tid = zheapTuple->t_self;
+			slot->tts_tableOid = RelationGetRelid(scan->rel);
+			ExecStoreZHeapTuple(zheapTuple, slot, false);
+			return true;
+		}
+
+		/* The scan went elsewhere, so forget the rest. */
+		hscan->xs_batch_count = 0;
+	}
+
 	/* Switch to correct buffer if we don't have it already */
 	hscan->xs_cbuf = ReleaseAndReadBuffer(hscan->xs_cbuf,
 										  hscan->xs_base.rel,
@@ -625,6 +676,90 @@ zheapam_index_fetch_tuple(struct IndexFetchTableData *scan,
 	return zheapTuple != NULL;
 }
 
+/*
+ * zheapam_index_fetch_batch - look up several upcoming index entries at once
+ *
+ * The leading TIDs that point into the same block are looked up under a
+ * single lock on that block, and kept for the zheapam_index_fetch_tuple
+ * calls that follow; the blocks of the others are prefetched.  The
+ * visibility checks take predicate locks, which we shouldn't do for tuples
+ * the scan might never return, so serializable transactions don't batch.
+ */
+static int
+zheapam_index_fetch_batch(IndexFetchTableData *scan, ItemPointer tids,
+						  int ntids, Snapshot snapshot)
+{
+	IndexFetchZHeapData *hscan = (IndexFetchZHeapData *) scan;
+	BlockNumber blkno = ItemPointerGetBlockNumber(&tids[0]);
+	MemoryContext oldcxt;
+	int			nrun;
+	int			i;
+
+	Assert(ntids <= MaxIndexFetchBatch);
+
+	hscan->xs_batch_count = 0;
+
+	for (nrun = 1; nrun < ntids; nrun++)
+	{
+		if (ItemPointerGetBlockNumber(&tids[nrun]) != blkno)
+			break;
+	}
+
+	/*
+	 * Prefetch the blocks past the run, skipping the TIDs we were given last
+	 * time, which have been taken care of already.
+	 */
+	for (i = Max(nrun, hscan->xs_prefetched); i < ntids; i++)
+	{
+		BlockNumber next = ItemPointerGetBlockNumber(&tids[i]);
+
+		if (next != ItemPointerGetBlockNumber(&tids[i - 1]))
+			PrefetchBuffer(scan->rel, MAIN_FORKNUM, next);
+	}
+
+	if (nrun < 2 || IsolationIsSerializable())
+	{
+		/* We'll be called again for the next TID. */
+		hscan->xs_prefetched = ntids - 1;
+		return 0;
+	}
+	hscan->xs_prefetched = ntids - nrun;
+
+	/*
+	 * The tuples must survive until they're fetched, so they can't live in
+	 * the caller's context, which may be a per-tuple one.
+	 */
+	if (hscan->xs_batch_cxt == NULL)
+		hscan->xs_batch_cxt =
+			AllocSetContextCreate(GetMemoryChunkContext(hscan),
+								  "zheap index fetch batch",
+								  ALLOCSET_DEFAULT_SIZES);
+	else
+		MemoryContextReset(hscan->xs_batch_cxt);
+
+	hscan->xs_cbuf = ReleaseAndReadBuffer(hscan->xs_cbuf, scan->rel, blkno);
+
+	oldcxt = MemoryContextSwitchTo(hscan->xs_batch_cxt);
+	LockBuffer(hscan->xs_cbuf, BUFFER_LOCK_SHARE);
+	for (i = 0; i < nrun; i++)
+	{
+		ItemPointerData tid = tids[i];
+
+		hscan->xs_batch_tids[i] = tids[i];
+		hscan->xs_batch_tuples[i] =
+			zheap_search_buffer(&tid, scan->rel, hscan->xs_cbuf, snapshot,
+								&hscan->xs_batch_all_dead[i]);
+	}
+	LockBuffer(hscan->xs_cbuf, BUFFER_LOCK_UNLOCK);
+	MemoryContextSwitchTo(oldcxt);
+
+	hscan->xs_batch_snapshot = snapshot;
+	hscan->xs_batch_next = 0;
+	hscan->xs_batch_count = nrun;
+
+	return nrun;
+}
+
 /*
  * Similar to IndexBuildHeapRangeScan, but for zheap relations.
  */
@@ -783,7 +918,19 @@ IndexBuildZHeapRangeScan(Relation heapRelation,
 
 		CHECK_FOR_INTERRUPTS();
 
-		if (snapshot == SnapshotAny)
+		if (snapshot == SnapshotAny && scan->rs_allvisible)
+		{
+			/*
+			 * The page was all-visible when the scan read it, so the scan
+			 * has already skipped the deleted tuples and every tuple it
+			 * returned is live.  Caller holds a lock that conflicts with
+			 * vacuum and writers, so this can't have changed since.  Skip
+			 * the time qual check and the tuple copy that goes with it.
+			 */
+			tupleIsAlive = true;
+			targztuple = zheapTuple;
+		}
+		else if (snapshot == SnapshotAny)
 		{
 			/* do our own time qual check */
 			bool		indexIt;
@@ -986,10 +1133,10 @@ IndexBuildZHeapRangeScan(Relation heapRelation,
 			if (!ExecQual(predicate, econtext))
 			{
 				/*
-				 * For SnapshotAny, targztuple is locally palloced above. So,
-				 * free it.
+				 * For SnapshotAny, targztuple may be locally palloced above.
+				 * If so, free it.
 				 */
-				if (snapshot == SnapshotAny && targztuple != NULL)
+				if (targztuple != NULL && targztuple != zheapTuple)
 					pfree(targztuple);
 				continue;
 			}
@@ -1029,9 +1176,10 @@ IndexBuildZHeapRangeScan(Relation heapRelation,
 		zslot->tuple = zheapTuple;
 
 		/*
-		 * For SnapshotAny, targztuple is locally palloc'd above. So, free it.
+		 * For SnapshotAny, targztuple may be locally palloc'd above.  If so,
+		 * free it.
 		 */
-		if (snapshot == SnapshotAny && targztuple != NULL)
+		if (targztuple != NULL && targztuple != zheapTuple)
 			pfree(targztuple);
 	}
 
@@ -1244,7 +1392,6 @@ static bool
 zheapam_scan_analyze_next_block(TableScanDesc sscan, BlockNumber blockno, BufferAccessStrategy bstrategy)
 {
 	ZHeapScanDesc scan = (ZHeapScanDesc) sscan;
-	Page		targpage;
 
 	/*
 	 * We must maintain a pin on the target page's buffer to ensure that the
@@ -1265,16 +1412,6 @@ zheapam_scan_analyze_next_block(TableScanDesc sscan, BlockNumber blockno, Buffer
 									   RBM_NORMAL, bstrategy);
 	LockBuffer(scan->rs_cbuf, BUFFER_LOCK_SHARE);
 
-	/* Skip TPD pages for zheap relations. */
-	targpage = BufferGetPage(scan->rs_cbuf);
-	if (IsTPDPage(targpage))
-	{
-		UnlockReleaseBuffer(scan->rs_cbuf);
-		scan->rs_cbuf = InvalidBuffer;
-
-		return false;
-	}
-
 	return true;
 }
 
@@ -1291,8 +1428,6 @@ zheapam_scan_analyze_next_tuple(TableScanDesc sscan, TransactionId OldestXmin, d
 	targpage = BufferGetPage(scan->rs_cbuf);
 	maxoffset = PageGetMaxOffsetNumber(targpage);
 
-	Assert(!IsTPDPage(targpage));
-
 	/* Inner loop over all tuples on the selected page */
 	for (; scan->rs_cindex <= maxoffset; scan->rs_cindex++)
 	{
@@ -1654,6 +1789,12 @@ zheapam_relation_nontransactional_truncate(Relation rel)
 	 */
 	RelationTruncate(rel, ZHEAP_METAPAGE + 1);
 
+	/* None of the TPD pages can be referenced after this. */
+	TPDTruncate(rel);
+
+	/* Nor can the space freed by our deletes. */
+	ZHeapForgetReusableSpace(rel);
+
 	/*
 	 * Re-Initialize the existing meta page.
 	 */
@@ -1888,13 +2029,17 @@ zheapam_relation_copy_data(Relation rel, const RelFileNode *newrnode)
 	 */
 	RelationCreateStorage(*newrnode, rel->rd_rel->relpersistence);
 
-	/* copy main fork */
+	/* copy main fork and TPD fork */
 	copy_zrelation_data(rel, dstrel);
 
 	/* copy those extra forks that exist */
 	for (ForkNumber forkNum = MAIN_FORKNUM + 1;
 		 forkNum <= MAX_FORKNUM; forkNum++)
 	{
+		/* TPD fork is already copied by copy_zrelation_data */
+		if (forkNum == TPD_FORKNUM)
+			continue;
+
 		if (smgrexists(rel->rd_smgr, forkNum))
 		{
 			smgrcreate(dstrel, forkNum, false);
@@ -1936,9 +2081,21 @@ zheapam_relation_size(Relation rel, ForkNumber forkNumber)
 	/* InvalidForkNumber indicates returning the size for all forks */
 	if (forkNumber == InvalidForkNumber)
 	{
-		for (int i = 0; i < MAX_FORKNUM; i++)
+		for (int i = 0; i <= MAX_FORKNUM; i++)
+		{
+			if (i == INIT_FORKNUM)
+				continue;
+
+			/* TPD fork is created only when it's needed */
+			if (i == TPD_FORKNUM && !smgrexists(rel->rd_smgr, i))
+				continue;
+
 			nblocks += smgrnblocks(rel->rd_smgr, i);
+		}
 	}
+	else if (forkNumber == TPD_FORKNUM &&
+			 !smgrexists(rel->rd_smgr, TPD_FORKNUM))
+		nblocks = 0;
 	else
 		nblocks = smgrnblocks(rel->rd_smgr, forkNumber);
 
@@ -2122,6 +2279,7 @@ static const TableAmRoutine zheapam_methods = {
 	.index_fetch_reset = zheapam_reset_index_fetch,
 	.index_fetch_end = zheapam_end_index_fetch,
 	.index_fetch_tuple = zheapam_index_fetch_tuple,
+	.index_fetch_batch = zheapam_index_fetch_batch,
 
 	.tuple_insert = zheapam_insert,
 	.tuple_insert_speculative = zheapam_insert_speculative,
@@ -2130,7 +2288,7 @@ static const TableAmRoutine zheapam_methods = {
 	.tuple_delete = zheapam_delete,
 	.tuple_update = zheapam_update,
 	.tuple_lock = zheapam_lock_tuple,
-	/* finish_bulk_insert is currently not needed */
+	.finish_bulk_insert = zheapam_finish_bulk_insert,
 
 	.tuple_fetch_row_version = zheapam_fetch_row_version,
 	.tuple_get_latest_tid = zheap_get_latest_tid,
@@ -30,8 +30,10 @@
 
 #include "access/subtrans.h"
 #include "access/xact.h"
+#include "access/zcrcache.h"
 #include "access/zheap.h"
 #include "access/zmultilocker.h"
+#include "pgstat.h"
 #include "storage/bufmgr.h"
 #include "storage/proc.h"
 #include "storage/procarray.h"
@@ -72,6 +74,7 @@ static ZVersionSelector ZHeapSelectVersionSelf(ZTupleTidOp op,
 static ZVersionSelector ZHeapSelectVersionDirty(ZTupleTidOp op,
 												bool locked_only, ZHeapTupleTransInfo *zinfo,
 												Snapshot snapshot, int *snapshot_requests);
+static bool ZHeapCanJumpTo(TransactionId xid, Snapshot snapshot);
 static ZVersionSelector ZHeapTupleSatisfies(ZTupleTidOp op, bool locked_only,
 											Snapshot snapshot, ZHeapTupleTransInfo *zinfo,
 											int *snapshot_requests);
@@ -375,13 +378,15 @@ ZHeapTupleGetTransXID(ZHeapTuple zhtup, Buffer buf, bool nobuflock)
  * returned and the function returns false.  If the undo record is looked up
  * and the tuple found there is known to be the root tuple, that tuple is
  * returned and the function still returns false.  Otherwise, the tuple
- * looked up is returned and the function returns true.
+ * looked up is returned and the function returns true.  In the latter two
+ * cases, *skip is set to the skip information of the undo record, if any.
  */
 static bool
 GetTupleFromUndoRecord(UndoRecPtr urec_ptr, TransactionId xid, Buffer buffer,
 					   OffsetNumber offnum, ZHeapTupleHeader hdr,
 					   ZHeapTuple *ztuple, bool *free_ztuple,
-					   ZHeapTupleTransInfo *zinfo, ItemPointer ctid)
+					   ZHeapTupleTransInfo *zinfo, ItemPointer ctid,
+					   ZHeapUndoVersionSkip *skip)
 {
 	UnpackedUndoRecord *urec;
 	uint32		epoch;
@@ -439,6 +444,8 @@ GetTupleFromUndoRecord(UndoRecPtr urec_ptr, TransactionId xid, Buffer buffer,
 	if (ctid && urec->uur_type == UNDO_UPDATE)
 		*ctid = *((ItemPointer) urec->uur_payload.data);
 
+	UndoRecordGetVersionSkip(urec, skip);
+
 	UndoRecordRelease(urec);
 
 	/*
@@ -490,6 +497,7 @@ GetTupleFromUndo(UndoRecPtr urec_ptr, ZHeapTuple current_tuple,
 	TransactionId prev_undo_xid = InvalidTransactionId;
 	int			prev_trans_slot_id = trans_slot;
 	ZHeapTupleTransInfo zinfo;
+	ZHeapUndoVersionSkip skip;
 	bool		free_ztuple = false;
 	BlockNumber blkno = BufferGetBlockNumber(buffer);
 	ZHeapTupleHeaderData hdr;
@@ -544,7 +552,7 @@ GetTupleFromUndo(UndoRecPtr urec_ptr, ZHeapTuple current_tuple,
 
 		if (!GetTupleFromUndoRecord(urec_ptr, prev_undo_xid, buffer,
 									offnum, &hdr, visible_tuple,
-									&free_ztuple, &zinfo, ctid))
+									&free_ztuple, &zinfo, ctid, &skip))
 			break;
 
 		/*
@@ -626,6 +634,25 @@ GetTupleFromUndo(UndoRecPtr urec_ptr, ZHeapTuple current_tuple,
 		urec_ptr = zinfo.urec_ptr;
 		prev_undo_xid = zinfo.xid;
 		prev_trans_slot_id = zinfo.trans_slot;
+
+		/*
+		 * If the undo record carries skip information, it tells us where the
+		 * undo record of the next older version is, or even one further
+		 * back; see ZHeapUndoVersionSkip.
+		 */
+		if (UndoRecPtrIsValid(skip.prev_urecptr))
+			urec_ptr = skip.prev_urecptr;
+		if (UndoRecPtrIsValid(skip.jump_urecptr) &&
+			skip.jump_urecptr != skip.prev_urecptr &&
+			snapshot != NULL && IsMVCCSnapshot(snapshot) &&
+			ZHeapCanJumpTo(skip.jump_xid, snapshot))
+		{
+			urec_ptr = skip.jump_urecptr;
+			prev_undo_xid = skip.jump_xid;
+
+			/* We don't know the slot of the version we're skipping to. */
+			prev_trans_slot_id = InvalidXactSlotId;
+		}
 	}
 
 	/* Copy latest header reconstructed from undo back into ztuple. */
@@ -634,6 +661,33 @@ GetTupleFromUndo(UndoRecPtr urec_ptr, ZHeapTuple current_tuple,
 	return true;
 }
 
+/*
+ * ZHeapCanJumpTo
+ *
+ * Decide whether GetTupleFromUndo can skip the versions of a tuple created
+ * after the one the given transaction created in place, because the given
+ * MVCC snapshot can see none of them.  This is so if the snapshot can't see
+ * that transaction: the tuple can't have been modified again until that
+ * transaction had committed, so every later version was created by a
+ * transaction that committed after it.
+ */
+static bool
+ZHeapCanJumpTo(TransactionId xid, Snapshot snapshot)
+{
+	FullTransactionId fxid;
+
+	/*
+	 * We don't allow XIDs with an age of more than 2 billion in undo, so we
+	 * can infer the epoch here.
+	 */
+	fxid = FullTransactionIdFromEpochAndXid(GetEpochForXid(xid), xid);
+	if (FullTransactionIdOlderThanAllUndo(fxid))
+		return false;
+
+	return ZHeapSelectVersionMVCC(ZTUPLETID_MODIFIED, xid, snapshot) ==
+		ZVERSION_OLDER;
+}
+
 /*
  * ZHeapTidOpFromInfomask
  *
@@ -661,6 +715,8 @@ ZHeapTidOpFromInfomask(uint16 infomask)
 static ZVersionSelector
 ZHeapSelectVersionMVCC(ZTupleTidOp op, TransactionId xid, Snapshot snapshot)
 {
+	bool		in_snapshot;
+
 	Assert(IsMVCCSnapshot(snapshot));
 
 	if (TransactionIdIsCurrentTransactionId(xid))
@@ -671,6 +727,7 @@ ZHeapSelectVersionMVCC(ZTupleTidOp op, TransactionId xid, Snapshot snapshot)
 		 * snapshot belongs to an older CID, then we need the CID for this
 		 * tuple to make a final visibility decision.
 		 */
+		ZHeapCRCacheNoteUncacheable();
 		if (GetCurrentCommandIdUsed() ||
 			GetCurrentCommandId(false) != snapshot->curcid)
 			return ZVERSION_CHECK_CID;
@@ -679,7 +736,10 @@ ZHeapSelectVersionMVCC(ZTupleTidOp op, TransactionId xid, Snapshot snapshot)
 		return (op == ZTUPLETID_GONE ? ZVERSION_NONE : ZVERSION_CURRENT);
 	}
 
-	if (XidInMVCCSnapshot(xid, snapshot) || !TransactionIdDidCommit(xid))
+	in_snapshot = XidInMVCCSnapshot(xid, snapshot);
+	ZHeapCRCacheNoteXid(xid, in_snapshot);
+
+	if (in_snapshot || !TransactionIdDidCommit(xid))
 	{
 		/*
 		 * The XID is not visible to us, either because it aborted or because
@@ -862,6 +922,7 @@ ZHeapTupleFetch(Relation rel, Buffer buffer, OffsetNumber offnum,
 	ZHeapTupleTransInfo zinfo;
 	ZVersionSelector zselect;
 	bool		valid = true;
+	uint64		undo_fetched = UndoRecordsFetched;
 
 	/*
 	 * If caller wants SNAPSHOT_DIRTY semantics, certain fields need to be
@@ -972,15 +1033,21 @@ ZHeapTupleFetch(Relation rel, Buffer buffer, OffsetNumber offnum,
 		}
 		else if (is_invalid_slot)
 		{
+			bool		in_snapshot = true;
+
 			/*
 			 * The slot has been reused, but we can still skip reading the
 			 * undo if the XID we got from the transaction slot is visible to
 			 * our snapshot.  The real XID has to have committed before that
 			 * one, so it will be visible to our snapshot as well.
 			 */
-			if (TransactionIdIsValid(zinfo.xid) &&
-				IsMVCCSnapshot(snapshot) &&
-				!XidInMVCCSnapshot(zinfo.xid, snapshot))
+			if (TransactionIdIsValid(zinfo.xid) && IsMVCCSnapshot(snapshot))
+			{
+				in_snapshot = XidInMVCCSnapshot(zinfo.xid, snapshot);
+				ZHeapCRCacheNoteXid(zinfo.xid, in_snapshot);
+			}
+
+			if (!in_snapshot)
 				zinfo.trans_slot = ZHTUP_SLOT_FROZEN;
 			else
 			{
@@ -1113,6 +1180,15 @@ out:
 		*visible_tuple = tuple;
 	else if (tuple)
 		pfree(tuple);
+
+	/* Count the undo we had to read to get here. */
+	if (UndoRecordsFetched != undo_fetched)
+	{
+		PgStat_Counter nfetched = UndoRecordsFetched - undo_fetched;
+
+		pgstat_count_zheap_undo_fetch(rel, nfetched);
+	}
+
 	return (tuple != NULL && valid);
 }
 
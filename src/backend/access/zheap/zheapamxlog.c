@@ -49,8 +49,10 @@ zheap_xlog_insert(XLogReaderState *record)
 	ItemPointerData target_tid;
 	XLogRedoAction action;
 	int		   *tpd_trans_slot_id = NULL;
+	ZHeapReusedItem reused_item;
 	FullTransactionId fxid = XLogRecGetFullXid(record);
 	bool		skip_undo;
+	bool		reused;
 	ZHeapPrepareUndoInfo zh_undo_info;
 
 	/*
@@ -58,13 +60,23 @@ zheap_xlog_insert(XLogReaderState *record)
 	 * frozen.
 	 */
 	skip_undo = (xlrec->flags & XLZ_INSERT_IS_FROZEN);
+	reused = (xlrec->flags & XLZ_INSERT_REUSED_ITEM) != 0;
 
 	if (!skip_undo)
 	{
+		char	   *data;
+
 		xlundohdr = (xl_undo_header *) ((char *) xlrec + SizeOfZHeapInsert);
+		data = (char *) xlundohdr + SizeOfUndoHeader;
 
 		if (xlrec->flags & XLZ_INSERT_CONTAINS_TPD_SLOT)
-			tpd_trans_slot_id = (int *) ((char *) xlundohdr + SizeOfUndoHeader);
+		{
+			tpd_trans_slot_id = (int *) data;
+			data += sizeof(int);
+		}
+
+		if (reused)
+			memcpy(&reused_item, data, SizeOfZHeapReusedItem);
 	}
 	else if (xlrec->flags & XLZ_INSERT_CONTAINS_TPD_SLOT)
 		tpd_trans_slot_id = (int *) ((char *) xlrec + SizeOfZHeapInsert);
@@ -117,6 +129,7 @@ zheap_xlog_insert(XLogReaderState *record)
 		urecptr = zheap_prepare_undoinsert(&zh_undo_info,
 										   dummy_specToken,
 										   xlrec->flags & XLZ_INSERT_IS_SPECULATIVE ? true : false,
+										   reused ? &reused_item : NULL,
 										   &undorecord, record, NULL);
 		InsertPreparedUndo();
 
@@ -179,8 +192,12 @@ zheap_xlog_insert(XLogReaderState *record)
 		zhtup->t_infomask = xlhdr.t_infomask;
 		zhtup->t_hoff = xlhdr.t_hoff;
 
-		if (ZPageAddItem(buffer, NULL, (Item) zhtup, newlen, xlrec->offnum,
-						 true, true, true) == InvalidOffsetNumber)
+		if (reused)
+			(void) ZPageAddItemReusingStorage(page, reused_item.offnum,
+											  (Item) zhtup, newlen,
+											  xlrec->offnum);
+		else if (ZPageAddItem(buffer, NULL, (Item) zhtup, newlen, xlrec->offnum,
+							  true, true, true) == InvalidOffsetNumber)
 			elog(PANIC, "failed to add tuple");
 
 		if (!skip_undo)
@@ -458,6 +475,8 @@ zheap_xlog_update(XLogReaderState *record)
 	FullTransactionId fxid = XLogRecGetFullXid(record);
 	int		   *old_tup_trans_slot_id = NULL;
 	int		   *new_trans_slot_id = NULL;
+	char	   *version_skip_data = NULL;
+	ZHeapUndoVersionSkip version_skip;
 	int			trans_slot_id;
 	bool		inplace_update;
 	ZHeapPrepareUndoInfo gen_undo_info;
@@ -485,6 +504,17 @@ zheap_xlog_update(XLogReaderState *record)
 	else
 	{
 		inplace_update = true;
+
+		if (xlrec->flags & XLZ_UPDATE_CONTAINS_VERSION_SKIP)
+		{
+			if (old_tup_trans_slot_id)
+				version_skip_data = (char *) old_tup_trans_slot_id + sizeof(*old_tup_trans_slot_id);
+			else
+				version_skip_data = (char *) xlrec + SizeOfZHeapUpdate;
+
+			/* The main data isn't necessarily aligned for the struct. */
+			memcpy(&version_skip, version_skip_data, SizeOfZHeapUndoVersionSkip);
+		}
 	}
 
 	XLogRecGetBlockTag(record, 0, &rnode, NULL, &newblk);
@@ -553,6 +583,13 @@ zheap_xlog_update(XLogReaderState *record)
 				data = (char *) xlrec + SizeOfZHeapUpdate;
 				datalen = recordlen - SizeOfUndoHeader - SizeOfZHeapUpdate - SizeOfZHeapHeader;
 			}
+
+			/* Skip over the skip information, if any. */
+			if (version_skip_data)
+			{
+				data += SizeOfZHeapUndoVersionSkip;
+				datalen -= SizeOfZHeapUndoVersionSkip;
+			}
 		}
 		else
 		{
@@ -625,6 +662,8 @@ zheap_xlog_update(XLogReaderState *record)
 		*old_tup_trans_slot_id : InvalidXactSlotId;
 	zh_up_undo_info.new_prev_urecptr = (xlnewundohdr) ?
 		(xlnewundohdr->blkprev) : InvalidUndoRecPtr;
+	zh_up_undo_info.version_skip = (version_skip_data) ?
+		&version_skip : NULL;
 
 	urecptr = zheap_prepare_undoupdate(&zh_up_undo_info, &oldtup, record,
 									   NULL, &newurecptr);
@@ -1292,6 +1331,9 @@ zheap_xlog_multi_insert(XLogReaderState *record)
 	FullTransactionId fxid = XLogRecGetFullXid(record);
 	ZHeapFreeOffsetRanges *zfree_offset_ranges;
 	bool		skip_undo;
+	bool		bulk_append;
+	BlockNumber bulk_start_blkno = InvalidBlockNumber;
+	UnpackedUndoRecord bulkundorecord;
 
 	xlundohdr = (xl_undo_header *) XLogRecGetData(record);
 	xlrec = (xl_zheap_multi_insert *) ((char *) xlundohdr + SizeOfUndoHeader);
@@ -1348,7 +1390,45 @@ zheap_xlog_multi_insert(XLogReaderState *record)
 	 * frozen.
 	 */
 	skip_undo = (xlrec->flags & XLZ_INSERT_IS_FROZEN);
-	if (!skip_undo)
+
+	/*
+	 * A page added to a bulk append just points to its undo record, which
+	 * only the first page of the bulk append has inserted.
+	 */
+	bulk_append = (xlrec->flags & XLZ_INSERT_BULK_APPEND) != 0;
+	if (bulk_append)
+	{
+		memcpy(&bulk_start_blkno, ranges_data, sizeof(BlockNumber));
+		urecptr = xlundohdr->urec_ptr;
+
+		if (BlockNumberIsValid(bulk_start_blkno))
+		{
+			ZHeapPrepareUndoInfo zh_undo_info;
+
+			Assert(bulk_start_blkno == blkno);
+
+			zh_undo_info.reloid = xlundohdr->reloid;
+			zh_undo_info.blkno = blkno;
+			zh_undo_info.offnum = InvalidOffsetNumber;
+			zh_undo_info.prev_urecptr = InvalidUndoRecPtr;
+			zh_undo_info.fxid = fxid;
+			zh_undo_info.cid = FirstCommandId;
+			zh_undo_info.undo_persistence = UNDO_PERMANENT;
+
+			urecptr = zheap_prepare_undo_bulk_append(&zh_undo_info,
+													 &bulkundorecord,
+													 record, NULL);
+
+			/*
+			 * undo should be inserted at same location as it was during the
+			 * actual insert (DO operation).
+			 */
+			Assert(urecptr == xlundohdr->urec_ptr);
+
+			InsertPreparedUndo();
+		}
+	}
+	else if (!skip_undo)
 	{
 		ZHeapPrepareUndoInfo zh_undo_info;
 
@@ -1490,7 +1570,9 @@ zheap_xlog_multi_insert(XLogReaderState *record)
 			}
 		}
 
-		if (!skip_undo)
+		if (bulk_append)
+			PageSetTransactionSlotInfo(buffer, trans_slot_id, fxid, urecptr);
+		else if (!skip_undo)
 			PageSetUNDO(undorecord[nranges - 1], buffer, trans_slot_id, false,
 						fxid, urecptr, NULL, 0);
 
@@ -1541,7 +1623,12 @@ zheap_xlog_multi_insert(XLogReaderState *record)
 	}
 
 	/* be tidy */
-	if (!skip_undo)
+	if (bulk_append)
+	{
+		if (BlockNumberIsValid(bulk_start_blkno))
+			pfree(bulkundorecord.uur_payload.data);
+	}
+	else if (!skip_undo)
 	{
 		for (i = 0; i < nranges; i++)
 			pfree(undorecord[i].uur_payload.data);
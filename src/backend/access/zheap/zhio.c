@@ -15,7 +15,6 @@
 
 #include "postgres.h"
 
-#include "access/tpd.h"
 #include "access/visibilitymap.h"
 #include "access/zheap.h"
 #include "access/zhio.h"
@@ -25,6 +24,24 @@
 #include "storage/lmgr.h"
 #include "storage/smgr.h"
 
+/*
+ * Upper bound on the number of pages a bulk insert extends the relation by
+ * ahead of need in one go.
+ */
+#define ZHEAP_BULK_EXTEND_MAX_PAGES		64
+
+/*
+ * Range of pages pre-extended by bulk inserts into the relation with the
+ * given OID whose free space is recorded only in the bottom level of the
+ * FSM so far.  See ZHeapFinishBulkExtend.
+ */
+static Oid	bulk_extend_relid = InvalidOid;
+static BlockNumber bulk_extend_first = InvalidBlockNumber;
+static BlockNumber bulk_extend_last = InvalidBlockNumber;
+
+static void ZHeapBulkExtend(Relation relation, BulkInsertState bistate,
+							bool use_fsm);
+
 /*
  * RelationGetBufferForZTuple
  *
@@ -32,11 +49,9 @@
  *	with free space >= given len.
  *
  *	This is quite similar to RelationGetBufferForTuple except for zheap
- *	specific handling.  If the last page where tuple needs to be inserted is a
- *	TPD page, we skip it and directly extend the relation.  We could instead
- *	check the previous page, but scanning relation backwards could be costly,
- *	so we avoid it for now.  As we don't align tuples in zheap, use actual
- *	length to find the required buffer.
+ *	specific handling.  TPD pages live in a separate fork, so every page we
+ *	find here is a regular zheap page.  As we don't align tuples in zheap, use
+ *	actual length to find the required buffer.
  */
 Buffer
 RelationGetBufferForZTuple(Relation relation, Size len,
@@ -186,125 +201,76 @@ loop:
 			buffer = ReadBuffer(relation, targetBlock);
 			visibilitymap_pin(relation, targetBlock, vmbuffer);
 			LockBuffer(buffer, BUFFER_LOCK_EXCLUSIVE);
+			LockBuffer(otherBuffer, BUFFER_LOCK_EXCLUSIVE);
 
-			/*
-			 * To avoid deadlocking, we simply don't lock otherBuffer.  First
-			 * we will check that target block is TPD block or not, if TPD
-			 * block then we will not lock otherBuffer.
-			 *
-			 * We will never get TPD page from FSM but concurrently other
-			 * backend can get same page from FSM to use as new TPD page.  If
-			 * other backend gets same page, then that backend will make our
-			 * page as non-empty by putting TPD entry so here, we are checking
-			 * that if our page is TPD page or not, if TPD page, then directly
-			 * ignore page without checking PageIsEmpty.
-			 *
-			 * XXX: When we will not get any page from FSM, then we are
-			 * checking space in last block of relation.  It is possible that
-			 * last block of relation is empty TPD page(See ExtendTPDEntry,
-			 * there we are not removing empty TPD block from meta list to
-			 * avoid deadlock).  But we are not using empty TPD page.  If we
-			 * want, we can use that empty TPD page here by freeing empty TPD
-			 * page from meta list but will be costly.
-			 */
-			if (!IsTPDPage(BufferGetPage(buffer)))
-			{
-				LockBuffer(otherBuffer, BUFFER_LOCK_EXCLUSIVE);
-				other_buffer_locked = true;
-			}
+			other_buffer_locked = true;
 		}
 
-		if (IsTPDPage(BufferGetPage(buffer)))
-		{
-			/*
-			 * XXX: This is a TPD page, so we have to skip it.
-			 *
-			 * If this TPD page is an empty then we can use it after removing
-			 * from meta list but removal is costly and we will rarely get an
-			 * empty TPD page here(only when we will not get any page from FSM
-			 * and trying with last block of relation, that can be empty TPD
-			 * page (See ExtendTPDEntry)).  So we are skipping empty TPD page
-			 * also.
-			 *
-			 * Ideally, we don't need to update free-space for TPD page in FSM
-			 * because at the time of making the page as TPD page, we always
-			 * update free-space for that page as zero in FSM so we will never
-			 * get same TPD page from FSM. (See TPDAllocatePageAndAddEntry).
-			 * So we can directly call GetPageWithFreeSpace to get a new page.
-			 * However, doing so need some additional checks in the code which
-			 * don't seem necessary as this is not a common scenario for which
-			 * we need to optimize.
-			 */
-			pageFreeSpace = 0;
-		}
+		/*
+		 * We now have the target page (and the other buffer, if any)
+		 * pinned and locked.  However, since our initial PageIsAllVisible
+		 * checks were performed before acquiring the lock, the results
+		 * might now be out of date, either for the selected victim
+		 * buffer, or for the other buffer passed by the caller.  In that
+		 * case, we'll need to give up our locks, go get the pin(s) we
+		 * failed to get earlier, and re-lock.  That's pretty painful, but
+		 * hopefully shouldn't happen often.
+		 *
+		 * Note that there's a small possibility that we didn't pin the
+		 * page above but still have the correct page pinned anyway,
+		 * either because we've already made a previous pass through this
+		 * loop, or because caller passed us the right page anyway.
+		 *
+		 * Note also that it's possible that by the time we get the pin
+		 * and retake the buffer locks, the visibility map bit will have
+		 * been cleared by some other backend anyway.  In that case, we'll
+		 * have done a bit of extra work for no gain, but there's no real
+		 * harm done.
+		 *
+		 * ZBORKED: Fixme: GetVisibilityMapPins use PageIsAllVisible which
+		 * is not required for zheap, so either we need to rewrite that
+		 * function or somehow avoid the usage of that call.
+		 */
+		if (otherBuffer == InvalidBuffer || targetBlock <= otherBlock)
+			GetVisibilityMapPins(relation, buffer, otherBuffer,
+								 targetBlock, otherBlock, vmbuffer,
+								 vmbuffer_other);
 		else
-		{
-			/*
-			 * We now have the target page (and the other buffer, if any)
-			 * pinned and locked.  However, since our initial PageIsAllVisible
-			 * checks were performed before acquiring the lock, the results
-			 * might now be out of date, either for the selected victim
-			 * buffer, or for the other buffer passed by the caller.  In that
-			 * case, we'll need to give up our locks, go get the pin(s) we
-			 * failed to get earlier, and re-lock.  That's pretty painful, but
-			 * hopefully shouldn't happen often.
-			 *
-			 * Note that there's a small possibility that we didn't pin the
-			 * page above but still have the correct page pinned anyway,
-			 * either because we've already made a previous pass through this
-			 * loop, or because caller passed us the right page anyway.
-			 *
-			 * Note also that it's possible that by the time we get the pin
-			 * and retake the buffer locks, the visibility map bit will have
-			 * been cleared by some other backend anyway.  In that case, we'll
-			 * have done a bit of extra work for no gain, but there's no real
-			 * harm done.
-			 *
-			 * ZBORKED: Fixme: GetVisibilityMapPins use PageIsAllVisible which
-			 * is not required for zheap, so either we need to rewrite that
-			 * function or somehow avoid the usage of that call.
-			 */
-			if (otherBuffer == InvalidBuffer || targetBlock <= otherBlock)
-				GetVisibilityMapPins(relation, buffer, otherBuffer,
-									 targetBlock, otherBlock, vmbuffer,
-									 vmbuffer_other);
-			else
-				GetVisibilityMapPins(relation, otherBuffer, buffer,
-									 otherBlock, targetBlock, vmbuffer_other,
-									 vmbuffer);
+			GetVisibilityMapPins(relation, otherBuffer, buffer,
+								 otherBlock, targetBlock, vmbuffer_other,
+								 vmbuffer);
 
-			/*
-			 * Now we can check to see if there's enough free space here. If
-			 * so, we're done.
-			 */
-			page = BufferGetPage(buffer);
+		/*
+		 * Now we can check to see if there's enough free space here. If
+		 * so, we're done.
+		 */
+		page = BufferGetPage(buffer);
 
-			/*
-			 * If necessary initialize page, it'll be used soon.  We could
-			 * avoid dirtying the buffer here, and rely on the caller to do so
-			 * whenever it puts a tuple onto the page, but there seems not
-			 * much benefit in doing so.
-			 */
-			if (PageIsNew(page))
-			{
-				ZheapInitPage(page, BufferGetPageSize(buffer));
-				MarkBufferDirty(buffer);
-			}
+		/*
+		 * If necessary initialize page, it'll be used soon.  We could
+		 * avoid dirtying the buffer here, and rely on the caller to do so
+		 * whenever it puts a tuple onto the page, but there seems not
+		 * much benefit in doing so.
+		 */
+		if (PageIsNew(page))
+		{
+			ZheapInitPage(page, BufferGetPageSize(buffer));
+			MarkBufferDirty(buffer);
+		}
 
-			pageFreeSpace = PageGetZHeapFreeSpace(page);
-			if (len + saveFreeSpace <= pageFreeSpace)
-			{
-				/* use this page as future insert target, too */
-				RelationSetTargetBlock(relation, targetBlock);
-				return buffer;
-			}
+		pageFreeSpace = PageGetZHeapFreeSpace(page);
+		if (len + saveFreeSpace <= pageFreeSpace)
+		{
+			/* use this page as future insert target, too */
+			RelationSetTargetBlock(relation, targetBlock);
+			return buffer;
 		}
 
 		/*
-		 * Not enough space or a tpd page, so we must give up our page locks
-		 * and pin (if any) and prepare to look elsewhere.  We don't care
-		 * which order we unlock the two buffers in, so this can be slightly
-		 * simpler than the code above.
+		 * Not enough space, so we must give up our page locks and pin (if
+		 * any) and prepare to look elsewhere.  We don't care which order we
+		 * unlock the two buffers in, so this can be slightly simpler than the
+		 * code above.
 		 */
 		LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
 		if (otherBuffer == InvalidBuffer)
@@ -316,6 +282,20 @@ loop:
 			ReleaseBuffer(buffer);
 		}
 
+		/*
+		 * A bulk insert moves on to the next page it has extended the
+		 * relation by ahead of need, if any.  It's initialized above.
+		 */
+		if (bistate && bistate->next_free != InvalidBlockNumber)
+		{
+			targetBlock = bistate->next_free;
+			if (bistate->next_free == bistate->last_free)
+				bistate->next_free = bistate->last_free = InvalidBlockNumber;
+			else
+				bistate->next_free++;
+			continue;
+		}
+
 		/* Without FSM, always fall out of the loop and extend */
 		if (!use_fsm)
 			break;
@@ -404,6 +384,10 @@ loop:
 	ZheapInitPage(page, BufferGetPageSize(buffer));
 	MarkBufferDirty(buffer);
 
+	/* A bulk insert extends the relation by a run of further pages. */
+	if (bistate)
+		ZHeapBulkExtend(relation, bistate, use_fsm);
+
 	/*
 	 * Release the file-extension lock; it's now OK for someone else to extend
 	 * the relation some more.
@@ -468,3 +452,111 @@ loop:
 
 	return buffer;
 }
+
+/*
+ * ZHeapBulkExtend
+ *
+ *	Extend the relation by a run of pages ahead of need for a bulk insert,
+ *	which the caller has just extended the relation by one page for.
+ *
+ * The run doubles in length with each call, up to ZHEAP_BULK_EXTEND_MAX_PAGES,
+ * so a COPY of a few rows doesn't leave many empty pages behind while a large
+ * one takes the extension lock only once per that many pages.  The pages are
+ * left zeroed and remembered in the BulkInsertState, which hands them out in
+ * order once the current target page is full; RelationGetBufferForZTuple
+ * initializes each as it gets to it.  We go through the bulk insert's own
+ * buffer access strategy so the new pages don't push others out of shared
+ * buffers.
+ *
+ * If the FSM is in use, the free space of the new pages is recorded in its
+ * bottom level right away, which is where we'd look for them should the bulk
+ * insert release its pin; it's propagated to the upper levels, where other
+ * backends search, only by ZHeapFinishBulkExtend.
+ *
+ * The caller must hold the relation extension lock, if one is needed.
+ */
+static void
+ZHeapBulkExtend(Relation relation, BulkInsertState bistate, bool use_fsm)
+{
+	BlockNumber firstBlock = InvalidBlockNumber;
+	BlockNumber lastBlock = InvalidBlockNumber;
+	Size		freespace;
+	int			extraBlocks;
+
+	extraBlocks = Min(Max(bistate->already_extended_by, 1),
+					  ZHEAP_BULK_EXTEND_MAX_PAGES);
+
+	/* Free space of an empty zheap page, once it's initialized. */
+	freespace = BLCKSZ - SizeOfPageHeaderData -
+		MAXALIGN(ZHEAP_PAGE_TRANS_SLOTS * sizeof(TransInfo));
+
+	while (extraBlocks-- > 0)
+	{
+		Buffer		buffer;
+		BlockNumber blockNum;
+
+		buffer = ReadBufferExtended(relation, MAIN_FORKNUM, P_NEW,
+									RBM_ZERO_AND_LOCK, bistate->strategy);
+		blockNum = BufferGetBlockNumber(buffer);
+
+		if (!PageIsNew(BufferGetPage(buffer)))
+			elog(ERROR, "page %u of relation \"%s\" should be empty but is not",
+				 blockNum, RelationGetRelationName(relation));
+
+		UnlockReleaseBuffer(buffer);
+
+		if (firstBlock == InvalidBlockNumber)
+			firstBlock = blockNum;
+		lastBlock = blockNum;
+
+		if (use_fsm)
+			RecordPageWithFreeSpace(relation, blockNum, freespace);
+	}
+
+	/*
+	 * Any pages left over from an earlier run are still zeroed; they're in
+	 * the FSM for later if use_fsm, else VACUUM will get to them.
+	 */
+	bistate->next_free = firstBlock;
+	bistate->last_free = lastBlock;
+	bistate->already_extended_by += lastBlock - firstBlock + 1;
+
+	if (!use_fsm)
+		return;
+
+	/*
+	 * Remember the pages to publish in the upper levels of the FSM.  A range
+	 * left behind for another relation, say by an aborted COPY, is dropped;
+	 * the next VACUUM of that relation will publish it.
+	 */
+	if (bulk_extend_relid != RelationGetRelid(relation))
+	{
+		bulk_extend_relid = RelationGetRelid(relation);
+		bulk_extend_first = firstBlock;
+	}
+	bulk_extend_last = lastBlock;
+}
+
+/*
+ * ZHeapFinishBulkExtend
+ *
+ *	Make the free space of the pages bulk inserts have extended the relation
+ *	by ahead of need visible to other backends.
+ *
+ * Called at the end of a bulk insert.  Updating the upper levels of the FSM
+ * once for the whole range is a good deal cheaper than doing so for every run
+ * of pages.
+ */
+void
+ZHeapFinishBulkExtend(Relation relation)
+{
+	if (bulk_extend_relid != RelationGetRelid(relation))
+		return;
+
+	FreeSpaceMapVacuumRange(relation, bulk_extend_first,
+							bulk_extend_last + 1);
+
+	bulk_extend_relid = InvalidOid;
+	bulk_extend_first = InvalidBlockNumber;
+	bulk_extend_last = InvalidBlockNumber;
+}
@@ -0,0 +1,936 @@
+/*-------------------------------------------------------------------------
+ *
+ * zkeyshare.c
+ *	  Undo-free KEY SHARE locks on zheap tuples.
+ *
+ * Foreign key checks take a KEY SHARE lock on the referenced row for every
+ * row inserted into or updated in the referencing table.  Taken the usual
+ * way, each such lock writes an undo record and WAL, takes a transaction
+ * slot on the page of the referenced row (often spilling into a TPD page)
+ * and dirties that page, even though a KEY SHARE lock only conflicts with
+ * deleting the row or updating its key.
+ *
+ * So when a KEY SHARE lock doesn't have to wait for anybody, zheap_lock_tuple
+ * merely records the locker in a shared table here, keyed by the tuple's
+ * TID, and leaves the page alone.  Operations that conflict with KEY SHARE
+ * (deletes, key updates and FOR UPDATE locks) check the table before
+ * modifying the tuple and wait for the transactions they find, just as
+ * they wait for the lockers recorded in undo.  Non-key updates that move
+ * the tuple to a new TID copy the lockers over to it, as zheap does for the
+ * lockers recorded on the tuple itself.
+ *
+ * A locker's entries are removed when its transaction ends, or when the
+ * subtransaction that took them aborts; entries whose transaction is no
+ * longer running are ignored in any case, and are reclaimed when the table
+ * runs short of space.  Locks that can't be recorded because the table is
+ * full are simply taken the usual way.  The table doesn't survive a
+ * restart, which is fine for locks held by transactions that can't survive
+ * it either.  A prepared transaction can, so PREPARE TRANSACTION first takes
+ * the transaction's locks again the usual way, in undo, and then removes
+ * them from the table.
+ *
+ * Like the buffer mapping table, the table is partitioned by the hash of
+ * the tuple's TID, each partition with its own lock, so that foreign key
+ * checks on different rows don't contend.
+ *
+ * The table is sized by zheap_key_share_lock_table_size; zero disables it.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/access/zheap/zkeyshare.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/table.h"
+#include "access/tableam.h"
+#include "access/xact.h"
+#include "access/zhtup.h"
+#include "access/zkeyshare.h"
+#include "executor/tuptable.h"
+#include "storage/lwlock.h"
+#include "storage/procarray.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/relfilenodemap.h"
+#include "utils/snapmgr.h"
+
+/*
+ * Maximum number of lockers recorded for a tuple.  Further lockers take
+ * their locks the usual way.
+ */
+#define ZKS_MAX_HOLDERS		32
+
+/* Number of partitions of the table; must be a power of 2. */
+#define ZKS_NUM_PARTITIONS	16
+
+#define ZKSHashPartition(hashcode) \
+	((hashcode) % ZKS_NUM_PARTITIONS)
+#define ZKSPartitionLock(hashcode) \
+	(&ZKSCtl->locks[ZKSHashPartition(hashcode)].lock)
+
+typedef struct ZKSTag
+{
+	RelFileNode rnode;
+	BlockNumber blkno;
+	OffsetNumber offnum;
+} ZKSTag;
+
+typedef struct ZKSHolder
+{
+	TransactionId xid;
+	SubTransactionId subxid;
+} ZKSHolder;
+
+typedef struct ZKSEntry
+{
+	ZKSTag		tag;			/* hash key; must be first */
+	int			nholders;
+	ZKSHolder	holders[ZKS_MAX_HOLDERS];
+} ZKSEntry;
+
+typedef struct ZKSControl
+{
+	LWLockPadded locks[ZKS_NUM_PARTITIONS];
+
+	/*
+	 * Entries are counted and reserved across partitions, under mutex, so
+	 * that the table never needs more entries than it was sized for.
+	 */
+	slock_t		mutex;
+	int			nentries;		/* entries in the table */
+	int			nreserved;		/* entries reserved by ZHeapKeyShareReserve */
+} ZKSControl;
+
+/* A lock this backend has recorded in the table. */
+typedef struct ZKSLocal
+{
+	ZKSTag		tag;
+	TransactionId xid;
+	SubTransactionId subxid;
+	int			nestlevel;
+} ZKSLocal;
+
+/* GUC variable */
+int			zheap_key_share_lock_table_size = 4096;
+
+static ZKSControl *ZKSCtl = NULL;
+static HTAB *ZKSHash = NULL;
+
+/* Locks recorded by the current transaction, in TopTransactionContext. */
+static List *zks_held = NIL;
+
+/* Set while AtPrepare_ZHeapKeyShare takes our locks in undo. */
+static bool zks_preparing = false;
+
+static void ZKSSetTag(ZKSTag *tag, Relation rel, ItemPointer tid);
+static bool ZKSClaimEntry(bool reserved);
+static void ZKSReleaseEntry(void);
+static void ZKSReclaim(ZKSTag *tag);
+static void ZKSForgetEnded(ZKSEntry *entry, uint32 hashcode,
+						   TransactionId *ended, int nended);
+static void ZKSRemoveHolder(ZKSLocal *held);
+static void ZKSLockInUndo(ZKSLocal *held);
+
+/*
+ * ZHeapKeyShareShmemSize - report shared memory space needed
+ */
+Size
+ZHeapKeyShareShmemSize(void)
+{
+	Size		size;
+
+	if (zheap_key_share_lock_table_size <= 0)
+		return 0;
+
+	size = MAXALIGN(sizeof(ZKSControl));
+	size = add_size(size, hash_estimate_size(zheap_key_share_lock_table_size,
+											 sizeof(ZKSEntry)));
+
+	return size;
+}
+
+/*
+ * ZHeapKeyShareShmemInit - initialize the KEY SHARE lock table
+ */
+void
+ZHeapKeyShareShmemInit(void)
+{
+	HASHCTL		info;
+	bool		found;
+
+	if (zheap_key_share_lock_table_size <= 0)
+		return;
+
+	ZKSCtl = (ZKSControl *) ShmemInitStruct("ZHeap Key Share Lock Control",
+											sizeof(ZKSControl), &found);
+	if (!found)
+	{
+		int			i;
+
+		for (i = 0; i < ZKS_NUM_PARTITIONS; i++)
+			LWLockInitialize(&ZKSCtl->locks[i].lock, LWTRANCHE_ZHEAP_KEY_SHARE);
+		SpinLockInit(&ZKSCtl->mutex);
+		ZKSCtl->nentries = 0;
+		ZKSCtl->nreserved = 0;
+	}
+
+	MemSet(&info, 0, sizeof(info));
+	info.keysize = sizeof(ZKSTag);
+	info.entrysize = sizeof(ZKSEntry);
+	info.num_partitions = ZKS_NUM_PARTITIONS;
+
+	ZKSHash = ShmemInitHash("ZHeap Key Share Lock Table",
+							zheap_key_share_lock_table_size,
+							zheap_key_share_lock_table_size,
+							&info,
+							HASH_ELEM | HASH_BLOBS | HASH_PARTITION);
+}
+
+/*
+ * ZHeapKeyShareTryLock - record a KEY SHARE lock on a tuple in the table
+ *
+ * The caller must hold an exclusive lock on the tuple's buffer and must
+ * have checked that the lock doesn't conflict with the tuple's lockers and
+ * updater, and, in a subtransaction, must already hold the subtransaction's
+ * lock.  Returns false if the lock can't be recorded here, in which case
+ * the caller has to take it the usual way.
+ */
+bool
+ZHeapKeyShareTryLock(Relation rel, ItemPointer tid)
+{
+	ZKSTag		tag;
+	ZKSEntry   *entry;
+	ZKSLocal   *held;
+	TransactionId xid;
+	SubTransactionId subxid;
+	MemoryContext oldcxt;
+	uint32		hashcode;
+	LWLock	   *partitionLock;
+	bool		found;
+	bool		reclaimed = false;
+	int			i;
+
+	if (ZKSCtl == NULL || zks_preparing)
+		return false;
+
+	xid = GetTopTransactionId();
+	subxid = IsSubTransaction() ? GetCurrentSubTransactionId() :
+		InvalidSubTransactionId;
+
+	ZKSSetTag(&tag, rel, tid);
+	hashcode = get_hash_value(ZKSHash, &tag);
+	partitionLock = ZKSPartitionLock(hashcode);
+
+	for (;;)
+	{
+		LWLockAcquire(partitionLock, LW_EXCLUSIVE);
+
+		entry = (ZKSEntry *) hash_search_with_hash_value(ZKSHash, &tag,
+														 hashcode, HASH_FIND,
+														 NULL);
+		if (entry == NULL)
+		{
+			if (ZKSClaimEntry(false))
+			{
+				entry = (ZKSEntry *)
+					hash_search_with_hash_value(ZKSHash, &tag, hashcode,
+												HASH_ENTER, &found);
+				Assert(!found);
+				entry->nholders = 0;
+				break;
+			}
+		}
+		else
+		{
+			for (i = 0; i < entry->nholders; i++)
+			{
+				if (TransactionIdEquals(entry->holders[i].xid, xid) &&
+					entry->holders[i].subxid == subxid)
+				{
+					LWLockRelease(partitionLock);
+					return true;
+				}
+			}
+
+			if (entry->nholders < ZKS_MAX_HOLDERS)
+				break;
+		}
+
+		LWLockRelease(partitionLock);
+
+		/*
+		 * Out of room.  Forget the lockers that are gone, of the whole table
+		 * or of this tuple, and try once more.
+		 */
+		if (reclaimed)
+			return false;
+		ZKSReclaim(entry == NULL ? NULL : &tag);
+		reclaimed = true;
+	}
+
+	entry->holders[entry->nholders].xid = xid;
+	entry->holders[entry->nholders].subxid = subxid;
+	entry->nholders++;
+
+	LWLockRelease(partitionLock);
+
+	/* Remember to remove it again at the end of the (sub)transaction. */
+	oldcxt = MemoryContextSwitchTo(TopTransactionContext);
+	held = (ZKSLocal *) palloc(sizeof(ZKSLocal));
+	held->tag = tag;
+	held->xid = xid;
+	held->subxid = subxid;
+	held->nestlevel = GetCurrentTransactionNestLevel();
+	zks_held = lappend(zks_held, held);
+	MemoryContextSwitchTo(oldcxt);
+
+	return true;
+}
+
+/*
+ * ZHeapKeyShareLockers - get the other running transactions holding a
+ * KEY SHARE lock on a tuple
+ *
+ * The caller must hold a lock on the tuple's buffer, so that no new lockers
+ * can be added meanwhile.  Returns a list of ZMultiLockMember, with an
+ * invalid transaction slot, as those lockers don't have one.
+ */
+List *
+ZHeapKeyShareLockers(Relation rel, ItemPointer tid)
+{
+	ZKSTag		tag;
+	ZKSEntry   *entry;
+	ZKSHolder	holders[ZKS_MAX_HOLDERS];
+	TransactionId topxid;
+	List	   *lockers = NIL;
+	uint32		hashcode;
+	LWLock	   *partitionLock;
+	int			nholders;
+	int			i;
+
+	if (ZKSCtl == NULL)
+		return NIL;
+
+	ZKSSetTag(&tag, rel, tid);
+	hashcode = get_hash_value(ZKSHash, &tag);
+	partitionLock = ZKSPartitionLock(hashcode);
+
+	LWLockAcquire(partitionLock, LW_SHARED);
+
+	entry = (ZKSEntry *) hash_search_with_hash_value(ZKSHash, &tag, hashcode,
+													 HASH_FIND, NULL);
+	if (entry == NULL)
+	{
+		LWLockRelease(partitionLock);
+		return NIL;
+	}
+
+	nholders = entry->nholders;
+	memcpy(holders, entry->holders, sizeof(ZKSHolder) * nholders);
+
+	LWLockRelease(partitionLock);
+
+	topxid = GetTopTransactionIdIfAny();
+	for (i = 0; i < nholders; i++)
+	{
+		ZMultiLockMember *locker;
+
+		if (TransactionIdEquals(holders[i].xid, topxid) ||
+			!TransactionIdIsInProgress(holders[i].xid))
+			continue;
+
+		locker = (ZMultiLockMember *) palloc(sizeof(ZMultiLockMember));
+		locker->xid = holders[i].xid;
+		locker->subxid = holders[i].subxid;
+		locker->trans_slot_id = InvalidXactSlotId;
+		locker->mode = LockTupleKeyShare;
+		lockers = lappend(lockers, locker);
+	}
+
+	return lockers;
+}
+
+/*
+ * ZHeapKeyShareLockersWait - wait for the lockers returned by
+ * ZHeapKeyShareLockers to end
+ *
+ * The caller must not hold the buffer lock.  With nowait, returns false as
+ * soon as we would have to wait.
+ */
+bool
+ZHeapKeyShareLockersWait(Relation rel, ItemPointer tid, List *lockers,
+						 bool nowait, XLTW_Oper oper)
+{
+	ListCell   *lc;
+
+	foreach(lc, lockers)
+	{
+		ZMultiLockMember *locker = (ZMultiLockMember *) lfirst(lc);
+
+		if (locker->subxid != InvalidSubTransactionId)
+		{
+			if (nowait)
+			{
+				if (!ConditionalSubXactLockTableWait(locker->xid,
+													 locker->subxid))
+					return false;
+			}
+			else
+				SubXactLockTableWait(locker->xid, locker->subxid, rel, tid,
+									 oper);
+		}
+		else if (nowait)
+		{
+			if (!ConditionalXactLockTableWait(locker->xid))
+				return false;
+		}
+		else
+			XactLockTableWait(locker->xid, rel, tid, oper);
+	}
+
+	return true;
+}
+
+/*
+ * ZHeapKeyShareReserve - make room for carrying the KEY SHARE lockers of a
+ * tuple over to its new version
+ *
+ * Called by non-key updates that move the tuple to a new TID, while they
+ * hold the lock on the old tuple's buffer, right before they enter the
+ * critical section.  Once the update is WAL-logged, the lockers must be
+ * copied no matter what, so any error has to be raised here.  Returns true
+ * if the caller has to call ZHeapKeyShareTransfer after the update.
+ */
+bool
+ZHeapKeyShareReserve(Relation rel, ItemPointer oldtid)
+{
+	ZKSTag		tag;
+	ZKSEntry   *entry;
+	ZKSHolder	holders[ZKS_MAX_HOLDERS];
+	TransactionId topxid;
+	uint32		hashcode;
+	LWLock	   *partitionLock;
+	bool		reclaimed = false;
+	int			nholders;
+	int			i;
+
+	if (ZKSCtl == NULL)
+		return false;
+
+	ZKSSetTag(&tag, rel, oldtid);
+	hashcode = get_hash_value(ZKSHash, &tag);
+	partitionLock = ZKSPartitionLock(hashcode);
+
+	LWLockAcquire(partitionLock, LW_SHARED);
+
+	entry = (ZKSEntry *) hash_search_with_hash_value(ZKSHash, &tag, hashcode,
+													 HASH_FIND, NULL);
+	if (entry == NULL)
+	{
+		LWLockRelease(partitionLock);
+		return false;
+	}
+
+	nholders = entry->nholders;
+	memcpy(holders, entry->holders, sizeof(ZKSHolder) * nholders);
+
+	LWLockRelease(partitionLock);
+
+	/* Our own locks are superseded by the update. */
+	topxid = GetTopTransactionIdIfAny();
+	for (i = 0; i < nholders; i++)
+	{
+		if (!TransactionIdEquals(holders[i].xid, topxid) &&
+			TransactionIdIsInProgress(holders[i].xid))
+			break;
+	}
+	if (i >= nholders)
+		return false;
+
+	for (;;)
+	{
+		if (ZKSClaimEntry(true))
+			return true;
+
+		if (reclaimed)
+			ereport(ERROR,
+					(errcode(ERRCODE_OUT_OF_MEMORY),
+					 errmsg("out of shared memory"),
+					 errhint("You might need to increase zheap_key_share_lock_table_size.")));
+		ZKSReclaim(NULL);
+		reclaimed = true;
+	}
+}
+
+/*
+ * ZHeapKeyShareTransfer - copy the KEY SHARE lockers of a tuple to its new
+ * version
+ *
+ * Called after ZHeapKeyShareReserve returned true, once the new version is
+ * in place, while the update still holds the locks on both buffers; this
+ * can't fail.  The lockers stay recorded under the old TID as well, where
+ * they are removed when their transactions end; the copies are reclaimed
+ * once their transactions are gone.
+ *
+ * Any lockers already recorded under the new TID locked a tuple that used
+ * to be there, so they are replaced.  Hence the new version always has room
+ * for the lockers of the old one.
+ */
+void
+ZHeapKeyShareTransfer(Relation rel, ItemPointer oldtid, ItemPointer newtid)
+{
+	ZKSTag		oldtag;
+	ZKSTag		newtag;
+	ZKSEntry   *entry;
+	ZKSHolder	holders[ZKS_MAX_HOLDERS];
+	TransactionId topxid;
+	uint32		oldhashcode;
+	uint32		newhashcode;
+	LWLock	   *partitionLock;
+	bool		found;
+	int			nholders = 0;
+	int			i;
+
+	Assert(ZKSCtl != NULL);
+
+	ZKSSetTag(&oldtag, rel, oldtid);
+	ZKSSetTag(&newtag, rel, newtid);
+	oldhashcode = get_hash_value(ZKSHash, &oldtag);
+	newhashcode = get_hash_value(ZKSHash, &newtag);
+	topxid = GetTopTransactionIdIfAny();
+
+	/*
+	 * Lockers that ended since ZHeapKeyShareReserve may be gone already.
+	 * Those that ended without being removed are copied anyway; they are
+	 * ignored, and pruned when space runs short.  The two tuples' entries
+	 * may be in different partitions, so we look at them one at a time; no
+	 * new lockers can be added to the old tuple while we hold its buffer
+	 * lock.
+	 */
+	partitionLock = ZKSPartitionLock(oldhashcode);
+	LWLockAcquire(partitionLock, LW_SHARED);
+	entry = (ZKSEntry *) hash_search_with_hash_value(ZKSHash, &oldtag,
+													 oldhashcode, HASH_FIND,
+													 NULL);
+	if (entry != NULL)
+	{
+		for (i = 0; i < entry->nholders; i++)
+		{
+			if (!TransactionIdEquals(entry->holders[i].xid, topxid))
+				holders[nholders++] = entry->holders[i];
+		}
+	}
+	LWLockRelease(partitionLock);
+
+	partitionLock = ZKSPartitionLock(newhashcode);
+	LWLockAcquire(partitionLock, LW_EXCLUSIVE);
+
+	if (nholders > 0)
+	{
+		/* The reservation guarantees that this doesn't need new space. */
+		entry = (ZKSEntry *)
+			hash_search_with_hash_value(ZKSHash, &newtag, newhashcode,
+										HASH_ENTER, &found);
+		memcpy(entry->holders, holders, sizeof(ZKSHolder) * nholders);
+		entry->nholders = nholders;
+	}
+	else
+		found = true;
+
+	/* The reserved entry is now in use, or no longer needed. */
+	SpinLockAcquire(&ZKSCtl->mutex);
+	Assert(ZKSCtl->nreserved > 0);
+	ZKSCtl->nreserved--;
+	if (!found)
+		ZKSCtl->nentries++;
+	SpinLockRelease(&ZKSCtl->mutex);
+
+	LWLockRelease(partitionLock);
+}
+
+/*
+ * AtPrepare_ZHeapKeyShare - take our KEY SHARE locks in undo before
+ * PREPARE TRANSACTION
+ *
+ * The table doesn't survive a restart, but a prepared transaction must keep
+ * its locks across one, so each lock recorded in the table is taken again
+ * the usual way, on the latest version of the tuple, and then removed from
+ * the table.  By now all our subtransactions have committed, so the locks
+ * belong to the top-level transaction.
+ */
+void
+AtPrepare_ZHeapKeyShare(void)
+{
+	ListCell   *lc;
+
+	if (zks_held == NIL)
+		return;
+
+	/* Make sure zheap_lock_tuple doesn't simply record them here again. */
+	zks_preparing = true;
+
+	foreach(lc, zks_held)
+		ZKSLockInUndo((ZKSLocal *) lfirst(lc));
+
+	foreach(lc, zks_held)
+		ZKSRemoveHolder((ZKSLocal *) lfirst(lc));
+
+	zks_held = NIL;
+	zks_preparing = false;
+}
+
+/*
+ * AtEOXact_ZHeapKeyShare - release our KEY SHARE locks at transaction end
+ *
+ * When preparing a transaction, AtPrepare_ZHeapKeyShare has already done so.
+ */
+void
+AtEOXact_ZHeapKeyShare(void)
+{
+	ListCell   *lc;
+
+	zks_preparing = false;
+
+	if (zks_held == NIL)
+		return;
+
+	foreach(lc, zks_held)
+		ZKSRemoveHolder((ZKSLocal *) lfirst(lc));
+
+	/* The list itself goes away with TopTransactionContext. */
+	zks_held = NIL;
+}
+
+/*
+ * AtSubCommit_ZHeapKeyShare - hand the KEY SHARE locks of a committed
+ * subtransaction over to its parent
+ *
+ * The locks stay recorded under the subtransaction's ID, whose lock is
+ * likewise transferred to the parent, but from now on they are released
+ * when the parent aborts.
+ */
+void
+AtSubCommit_ZHeapKeyShare(int nestDepth)
+{
+	ListCell   *lc;
+
+	foreach(lc, zks_held)
+	{
+		ZKSLocal   *held = (ZKSLocal *) lfirst(lc);
+
+		if (held->nestlevel >= nestDepth)
+			held->nestlevel = nestDepth - 1;
+	}
+}
+
+/*
+ * AtSubAbort_ZHeapKeyShare - release the KEY SHARE locks taken by an
+ * aborted subtransaction and its children
+ *
+ * This must happen before the subtransaction's lock is released, so that
+ * nobody waiting for it finds the locks still recorded.
+ */
+void
+AtSubAbort_ZHeapKeyShare(int nestDepth)
+{
+	ListCell   *lc;
+	ListCell   *next;
+	ListCell   *prev = NULL;
+
+	if (zks_held == NIL)
+		return;
+
+	for (lc = list_head(zks_held); lc != NULL; lc = next)
+	{
+		ZKSLocal   *held = (ZKSLocal *) lfirst(lc);
+
+		next = lnext(lc);
+		if (held->nestlevel >= nestDepth)
+		{
+			ZKSRemoveHolder(held);
+			zks_held = list_delete_cell(zks_held, lc, prev);
+			pfree(held);
+		}
+		else
+			prev = lc;
+	}
+}
+
+/*
+ * ZKSSetTag - build the hash key for a tuple
+ *
+ * The key is hashed as a blob, so its padding must be zeroed.
+ */
+static void
+ZKSSetTag(ZKSTag *tag, Relation rel, ItemPointer tid)
+{
+	MemSet(tag, 0, sizeof(ZKSTag));
+	tag->rnode = rel->rd_node;
+	tag->blkno = ItemPointerGetBlockNumber(tid);
+	tag->offnum = ItemPointerGetOffsetNumber(tid);
+}
+
+/*
+ * ZKSClaimEntry - account for a new entry, or for a reservation
+ *
+ * New lockers leave some room for the lockers that non-key updates have to
+ * copy to the new versions of tuples; see ZHeapKeyShareReserve.  Returns
+ * false if there's no room.
+ */
+static bool
+ZKSClaimEntry(bool reserved)
+{
+	int			limit = zheap_key_share_lock_table_size;
+	bool		result = false;
+
+	if (!reserved)
+		limit = limit / 4 * 3;
+
+	SpinLockAcquire(&ZKSCtl->mutex);
+	if (ZKSCtl->nentries + ZKSCtl->nreserved < limit)
+	{
+		if (reserved)
+			ZKSCtl->nreserved++;
+		else
+			ZKSCtl->nentries++;
+		result = true;
+	}
+	SpinLockRelease(&ZKSCtl->mutex);
+
+	return result;
+}
+
+/*
+ * ZKSReleaseEntry - account for a removed entry
+ */
+static void
+ZKSReleaseEntry(void)
+{
+	SpinLockAcquire(&ZKSCtl->mutex);
+	Assert(ZKSCtl->nentries > 0);
+	ZKSCtl->nentries--;
+	SpinLockRelease(&ZKSCtl->mutex);
+}
+
+/*
+ * ZKSReclaim - forget the lockers that are no longer running
+ *
+ * Does so for the entry with the given tag, or for the whole table if tag
+ * is NULL, and removes the entries left without lockers.  Such lockers are
+ * left behind by ZHeapKeyShareTransfer.  The lockers are checked without
+ * holding the partition locks, which caller must not hold either: ended
+ * transactions can't come back, and those added to the table meanwhile
+ * are running.
+ */
+static void
+ZKSReclaim(ZKSTag *tag)
+{
+	HASH_SEQ_STATUS status;
+	ZKSEntry   *entry;
+	TransactionId *xids;
+	TransactionId *ended;
+	uint32		hashcode = 0;
+	int			maxxids;
+	int			nxids = 0;
+	int			nended = 0;
+	int			i;
+
+	if (tag != NULL)
+	{
+		hashcode = get_hash_value(ZKSHash, tag);
+		LWLockAcquire(ZKSPartitionLock(hashcode), LW_SHARED);
+
+		entry = (ZKSEntry *) hash_search_with_hash_value(ZKSHash, tag,
+														 hashcode, HASH_FIND,
+														 NULL);
+		maxxids = (entry != NULL) ? entry->nholders : 0;
+		xids = (TransactionId *) palloc(sizeof(TransactionId) *
+										Max(maxxids, 1));
+		for (i = 0; i < maxxids; i++)
+			xids[nxids++] = entry->holders[i].xid;
+
+		LWLockRelease(ZKSPartitionLock(hashcode));
+	}
+	else
+	{
+		/* Lock all partitions, in order, so that nentries can't grow. */
+		for (i = 0; i < ZKS_NUM_PARTITIONS; i++)
+			LWLockAcquire(&ZKSCtl->locks[i].lock, LW_SHARED);
+
+		maxxids = ZKSCtl->nentries * ZKS_MAX_HOLDERS;
+		xids = (TransactionId *) palloc(sizeof(TransactionId) *
+										Max(maxxids, 1));
+		hash_seq_init(&status, ZKSHash);
+		while ((entry = (ZKSEntry *) hash_seq_search(&status)) != NULL)
+		{
+			for (i = 0; i < entry->nholders; i++)
+				xids[nxids++] = entry->holders[i].xid;
+		}
+
+		for (i = ZKS_NUM_PARTITIONS; --i >= 0;)
+			LWLockRelease(&ZKSCtl->locks[i].lock);
+	}
+
+	Assert(nxids <= maxxids);
+	ended = (TransactionId *) palloc(sizeof(TransactionId) * Max(nxids, 1));
+
+	/* Keep the distinct transactions that have ended, sorted. */
+	qsort(xids, nxids, sizeof(TransactionId), xidComparator);
+	for (i = 0; i < nxids; i++)
+	{
+		if (i > 0 && TransactionIdEquals(xids[i - 1], xids[i]))
+			continue;
+		if (!TransactionIdIsInProgress(xids[i]))
+			ended[nended++] = xids[i];
+	}
+
+	if (nended > 0)
+	{
+		if (tag != NULL)
+		{
+			LWLockAcquire(ZKSPartitionLock(hashcode), LW_EXCLUSIVE);
+
+			entry = (ZKSEntry *) hash_search_with_hash_value(ZKSHash, tag,
+															 hashcode,
+															 HASH_FIND, NULL);
+			if (entry != NULL)
+				ZKSForgetEnded(entry, hashcode, ended, nended);
+
+			LWLockRelease(ZKSPartitionLock(hashcode));
+		}
+		else
+		{
+			for (i = 0; i < ZKS_NUM_PARTITIONS; i++)
+				LWLockAcquire(&ZKSCtl->locks[i].lock, LW_EXCLUSIVE);
+
+			hash_seq_init(&status, ZKSHash);
+			while ((entry = (ZKSEntry *) hash_seq_search(&status)) != NULL)
+				ZKSForgetEnded(entry, get_hash_value(ZKSHash, &entry->tag),
+							   ended, nended);
+
+			for (i = ZKS_NUM_PARTITIONS; --i >= 0;)
+				LWLockRelease(&ZKSCtl->locks[i].lock);
+		}
+	}
+
+	pfree(ended);
+	pfree(xids);
+}
+
+/*
+ * ZKSForgetEnded - remove the given ended lockers from an entry
+ *
+ * ended must be sorted.  Removes the entry if no lockers are left.  Caller
+ * must hold the entry's partition lock exclusively.
+ */
+static void
+ZKSForgetEnded(ZKSEntry *entry, uint32 hashcode, TransactionId *ended,
+			   int nended)
+{
+	int			i,
+				j = 0;
+
+	for (i = 0; i < entry->nholders; i++)
+	{
+		if (bsearch(&entry->holders[i].xid, ended, nended,
+					sizeof(TransactionId), xidComparator) == NULL)
+			entry->holders[j++] = entry->holders[i];
+	}
+	entry->nholders = j;
+
+	if (j == 0)
+	{
+		hash_search_with_hash_value(ZKSHash, &entry->tag, hashcode,
+									HASH_REMOVE, NULL);
+		ZKSReleaseEntry();
+	}
+}
+
+/*
+ * ZKSRemoveHolder - remove one of our locks from the table
+ */
+static void
+ZKSRemoveHolder(ZKSLocal *held)
+{
+	ZKSEntry   *entry;
+	uint32		hashcode;
+	LWLock	   *partitionLock;
+	int			i;
+
+	hashcode = get_hash_value(ZKSHash, &held->tag);
+	partitionLock = ZKSPartitionLock(hashcode);
+
+	LWLockAcquire(partitionLock, LW_EXCLUSIVE);
+
+	entry = (ZKSEntry *) hash_search_with_hash_value(ZKSHash, &held->tag,
+													 hashcode, HASH_FIND,
+													 NULL);
+	if (entry != NULL)
+	{
+		for (i = 0; i < entry->nholders; i++)
+		{
+			if (TransactionIdEquals(entry->holders[i].xid, held->xid) &&
+				entry->holders[i].subxid == held->subxid)
+			{
+				entry->holders[i] = entry->holders[--entry->nholders];
+				break;
+			}
+		}
+
+		if (entry->nholders == 0)
+		{
+			hash_search_with_hash_value(ZKSHash, &held->tag, hashcode,
+										HASH_REMOVE, NULL);
+			ZKSReleaseEntry();
+		}
+	}
+
+	LWLockRelease(partitionLock);
+}
+
+/*
+ * ZKSLockInUndo - take one of our locks again the usual way
+ *
+ * The tuple may have been updated since we locked it, by us or by non-key
+ * updates of others, so lock its latest version.  If we deleted it, or
+ * updated it more strongly than we locked it, there's nothing to do.
+ */
+static void
+ZKSLockInUndo(ZKSLocal *held)
+{
+	Relation	rel;
+	TupleTableSlot *slot;
+	TM_FailureData tmfd;
+	ItemPointerData tid;
+	Oid			relid;
+
+	relid = RelidByRelfilenode(held->tag.rnode.spcNode,
+							   held->tag.rnode.relNode);
+	if (!OidIsValid(relid))
+		return;
+
+	/* We locked a row of it, so this won't block. */
+	rel = table_open(relid, AccessShareLock);
+	slot = table_slot_create(rel, NULL);
+
+	ItemPointerSet(&tid, held->tag.blkno, held->tag.offnum);
+	(void) table_tuple_lock(rel, &tid, GetLatestSnapshot(), slot,
+							GetCurrentCommandId(true), LockTupleKeyShare,
+							LockWaitBlock,
+							TUPLE_LOCK_FLAG_LOCK_UPDATE_IN_PROGRESS |
+							TUPLE_LOCK_FLAG_FIND_LAST_VERSION,
+							&tmfd);
+
+	ExecDropSingleTupleTableSlot(slot);
+	table_close(rel, AccessShareLock);
+}
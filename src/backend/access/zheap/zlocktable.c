@@ -0,0 +1,530 @@
+/*-------------------------------------------------------------------------
+ *
+ * zlocktable.c
+ *	  Shared table of the lockers of zheap tuples.
+ *
+ * zheap doesn't have multixacts: when a tuple has several lockers, it only
+ * carries the ZHEAP_MULTI_LOCKERS bit, and ZGetMultiLockMembers has to walk
+ * the undo chain of every transaction slot of the page (including its TPD
+ * slots) to find out who they are.  On a tuple locked by many transactions,
+ * say a row referenced by a busy foreign key, every conflicting update or
+ * delete repeats those walks, and then repeats them once more after waiting
+ * to check that no new locker has arrived meanwhile.
+ *
+ * To avoid that, the members found by a walk are remembered here, and each
+ * transaction that locks the tuple afterwards adds itself to the entry while
+ * it still holds the buffer lock, so that later callers can take the list
+ * from shared memory instead of reading undo.  An entry is only trusted as
+ * long as it describes the current version of the page: it carries the page
+ * LSN it was last brought up to date with, and any other change to the page
+ * (an update or delete, a lock on another tuple of the page, freezing of
+ * transaction slots, applying undo) moves the LSN and leaves the entry
+ * stale.  As the numbering of the transaction slots depends on whether the
+ * page has a TPD entry, we also check that this hasn't changed, as a TPD
+ * entry can be allocated for the page before the locker's WAL record moves
+ * the LSN.  Whenever an entry can't be trusted, or the table had no room
+ * for it, or after a restart, we simply fall back to walking the undo.
+ *
+ * The entry may still list a committed transaction that a fresh walk of the
+ * undo would no longer reach because its slot has since been reused.  That
+ * is harmless, since callers only act on members that are still running or
+ * have aborted.  Members whose undo has been discarded are left out, just
+ * as the walk leaves them out.
+ *
+ * Like the buffer mapping table, the lookup table is partitioned by the
+ * hash of the tuple, each partition with its own lock, so that lockers of
+ * different tuples don't contend.  Each partition owns every
+ * ZLT_NUM_PARTITIONS'th slot of the table and runs its own clock sweep over
+ * them, as in zcrcache.c.
+ *
+ * Only WAL-logged relations can use the table, since we rely on the page
+ * LSN.  Its size is set by zheap_lock_table_size; zero disables it.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/access/zheap/zlocktable.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/transam.h"
+#include "access/xact.h"
+#include "access/zheap.h"
+#include "access/zlocktable.h"
+#include "storage/bufmgr.h"
+#include "storage/lwlock.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+#include "utils/hsearch.h"
+#include "utils/rel.h"
+
+/*
+ * Maximum number of members remembered for a tuple.  Tuples with more
+ * members than that are left to the undo walk.
+ */
+#define ZLT_MAX_MEMBERS		64
+
+/* Number of partitions of the table; must be a power of 2. */
+#define ZLT_NUM_PARTITIONS	16
+
+#define ZLockTableHashPartition(hashcode) \
+	((hashcode) % ZLT_NUM_PARTITIONS)
+#define ZLockTablePartitionLock(partition) \
+	(&ZLockTable->locks[(partition)].lock)
+
+typedef struct ZLockTableTag
+{
+	RelFileNode rnode;
+	BlockNumber blkno;
+	OffsetNumber offnum;
+} ZLockTableTag;
+
+/* Hash table entry, mapping a tuple to the slot holding its lockers. */
+typedef struct ZLockTableLookupEnt
+{
+	ZLockTableTag tag;
+	int			slot;
+} ZLockTableLookupEnt;
+
+typedef struct ZLockTableEntry
+{
+	ZLockTableTag tag;
+	bool		valid;
+	bool		has_tpd;		/* did the page have a TPD entry? */
+	pg_atomic_uint32 usage_count;	/* for the clock sweep */
+	XLogRecPtr	lsn;			/* page LSN the members are current for */
+	int			nmembers;
+	ZMultiLockMember members[ZLT_MAX_MEMBERS];
+} ZLockTableEntry;
+
+typedef struct ZLockTableControl
+{
+	LWLockPadded locks[ZLT_NUM_PARTITIONS];
+	/* clock hands, each protected by its partition's lock */
+	int			next_victim[ZLT_NUM_PARTITIONS];
+	ZLockTableEntry entries[FLEXIBLE_ARRAY_MEMBER];
+} ZLockTableControl;
+
+/* The slot after slot in the given partition's clock sweep. */
+#define ZLockTableNextSlot(partition, slot) \
+	((slot) + ZLT_NUM_PARTITIONS < zheap_lock_table_size ? \
+	 (slot) + ZLT_NUM_PARTITIONS : (partition))
+
+/* GUC variable */
+int			zheap_lock_table_size = 1024;
+
+static ZLockTableControl *ZLockTable = NULL;
+static HTAB *ZLockTableHash = NULL;
+
+static void ZLockTableSetTag(ZLockTableTag *tag, Buffer buf,
+							 OffsetNumber offnum);
+static void ZLockTableForget(ZLockTableEntry *entry, uint32 hashcode);
+static int	ZLockTableGetVictim(int partition);
+
+/*
+ * ZHeapLockTableShmemSize - report shared memory space needed
+ */
+Size
+ZHeapLockTableShmemSize(void)
+{
+	Size		size;
+
+	if (zheap_lock_table_size <= 0)
+		return 0;
+
+	size = offsetof(ZLockTableControl, entries);
+	size = add_size(size, mul_size(zheap_lock_table_size,
+								   sizeof(ZLockTableEntry)));
+	size = add_size(size, hash_estimate_size(zheap_lock_table_size,
+											 sizeof(ZLockTableLookupEnt)));
+
+	return size;
+}
+
+/*
+ * ZHeapLockTableShmemInit - initialize the tuple lock table
+ */
+void
+ZHeapLockTableShmemInit(void)
+{
+	HASHCTL		info;
+	bool		found;
+	int			i;
+
+	if (zheap_lock_table_size <= 0)
+		return;
+
+	ZLockTable = (ZLockTableControl *)
+		ShmemInitStruct("ZHeap Tuple Lock Table",
+						add_size(offsetof(ZLockTableControl, entries),
+								 mul_size(zheap_lock_table_size,
+										  sizeof(ZLockTableEntry))),
+						&found);
+
+	if (!found)
+	{
+		for (i = 0; i < ZLT_NUM_PARTITIONS; i++)
+		{
+			LWLockInitialize(&ZLockTable->locks[i].lock,
+							 LWTRANCHE_ZHEAP_LOCK_TABLE);
+			ZLockTable->next_victim[i] = i;
+		}
+		for (i = 0; i < zheap_lock_table_size; i++)
+		{
+			ZLockTable->entries[i].valid = false;
+			pg_atomic_init_u32(&ZLockTable->entries[i].usage_count, 0);
+		}
+	}
+
+	MemSet(&info, 0, sizeof(info));
+	info.keysize = sizeof(ZLockTableTag);
+	info.entrysize = sizeof(ZLockTableLookupEnt);
+	info.num_partitions = ZLT_NUM_PARTITIONS;
+
+	ZLockTableHash = ShmemInitHash("ZHeap Tuple Lock Table Lookup",
+								   zheap_lock_table_size,
+								   zheap_lock_table_size,
+								   &info,
+								   HASH_ELEM | HASH_BLOBS | HASH_PARTITION);
+}
+
+/*
+ * ZHeapLockTableUsable - can the lockers of this relation's tuples be
+ * tracked in the table?
+ */
+bool
+ZHeapLockTableUsable(Relation rel)
+{
+	return ZLockTable != NULL && RelationNeedsWAL(rel);
+}
+
+/*
+ * ZHeapLockTableLookup - get the lockers of a tuple from the table
+ *
+ * The caller must hold at least a share lock on the buffer.  Returns false
+ * if the table doesn't know the lockers of the tuple as of the current
+ * version of the page; otherwise, *members is set to the list of members,
+ * excluding our own transaction, as ZGetMultiLockMembers would return it.
+ */
+bool
+ZHeapLockTableLookup(Relation rel, Buffer buf, OffsetNumber offnum,
+					 List **members)
+{
+	ZLockTableTag tag;
+	ZLockTableLookupEnt *ent;
+	ZLockTableEntry *entry;
+	ZMultiLockMember copy[ZLT_MAX_MEMBERS];
+	PageHeader	phdr = (PageHeader) BufferGetPage(buf);
+	TransactionId oldestXidHavingUndo;
+	TransactionId topxid;
+	uint32		hashcode;
+	LWLock	   *partitionLock;
+	int			nmembers;
+	int			i;
+
+	ZLockTableSetTag(&tag, buf, offnum);
+	hashcode = get_hash_value(ZLockTableHash, &tag);
+	partitionLock = ZLockTablePartitionLock(ZLockTableHashPartition(hashcode));
+
+	LWLockAcquire(partitionLock, LW_SHARED);
+
+	ent = (ZLockTableLookupEnt *)
+		hash_search_with_hash_value(ZLockTableHash, &tag, hashcode,
+									HASH_FIND, NULL);
+	if (ent == NULL)
+	{
+		LWLockRelease(partitionLock);
+		return false;
+	}
+
+	entry = &ZLockTable->entries[ent->slot];
+	Assert(entry->valid);
+
+	if (entry->lsn != BufferGetLSNAtomic(buf) ||
+		entry->has_tpd != ZHeapPageHasTPDSlot(phdr))
+	{
+		LWLockRelease(partitionLock);
+		return false;
+	}
+
+	nmembers = entry->nmembers;
+	memcpy(copy, entry->members, sizeof(ZMultiLockMember) * nmembers);
+	pg_atomic_write_u32(&entry->usage_count, 1);
+
+	LWLockRelease(partitionLock);
+
+	oldestXidHavingUndo = GetXidFromEpochXid(
+											 pg_atomic_read_u64(&ProcGlobal->oldestXidWithEpochHavingUndo));
+	topxid = GetTopTransactionIdIfAny();
+
+	*members = NIL;
+	for (i = 0; i < nmembers; i++)
+	{
+		ZMultiLockMember *mlmember;
+
+		/* Like the undo walk, leave out our own and discarded members. */
+		if (TransactionIdEquals(copy[i].xid, topxid) ||
+			TransactionIdPrecedes(copy[i].xid, oldestXidHavingUndo))
+			continue;
+
+		mlmember = (ZMultiLockMember *) palloc(sizeof(ZMultiLockMember));
+		memcpy(mlmember, &copy[i], sizeof(ZMultiLockMember));
+		*members = lappend(*members, mlmember);
+	}
+
+	return true;
+}
+
+/*
+ * ZHeapLockTableRemember - remember the members found by walking the undo
+ *
+ * lsn and has_tpd describe the version of the page the walk started from.
+ * The walk leaves out our own transaction, so it must only be remembered if
+ * our transaction hasn't locked or modified the tuple.
+ */
+void
+ZHeapLockTableRemember(Relation rel, Buffer buf, OffsetNumber offnum,
+					   XLogRecPtr lsn, bool has_tpd, List *members)
+{
+	ZLockTableTag tag;
+	ZLockTableLookupEnt *ent;
+	ZLockTableEntry *entry;
+	ListCell   *lc;
+	uint32		hashcode;
+	int			partition;
+	LWLock	   *partitionLock;
+	bool		found;
+	int			i;
+
+	if (list_length(members) > ZLT_MAX_MEMBERS)
+		return;
+
+	ZLockTableSetTag(&tag, buf, offnum);
+	hashcode = get_hash_value(ZLockTableHash, &tag);
+	partition = ZLockTableHashPartition(hashcode);
+	partitionLock = ZLockTablePartitionLock(partition);
+
+	/* With fewer slots than partitions, some partitions have none. */
+	if (partition >= zheap_lock_table_size)
+		return;
+
+	LWLockAcquire(partitionLock, LW_EXCLUSIVE);
+
+	ent = (ZLockTableLookupEnt *)
+		hash_search_with_hash_value(ZLockTableHash, &tag, hashcode,
+									HASH_FIND, NULL);
+	if (ent != NULL)
+	{
+		/* Don't overwrite what a later version of the page told us. */
+		if (ZLockTable->entries[ent->slot].lsn >= lsn)
+		{
+			LWLockRelease(partitionLock);
+			return;
+		}
+	}
+	else
+	{
+		/*
+		 * Pick a victim among our partition's slots.  Its hash entry must go
+		 * first, as the table has no room to spare; it's in our partition
+		 * too, since the victim's tuple was remembered in one of its slots.
+		 */
+		int			slot = ZLockTableGetVictim(partition);
+
+		entry = &ZLockTable->entries[slot];
+		if (entry->valid)
+		{
+			uint32		victim_hashcode;
+
+			victim_hashcode = get_hash_value(ZLockTableHash, &entry->tag);
+			Assert(ZLockTableHashPartition(victim_hashcode) == partition);
+			hash_search_with_hash_value(ZLockTableHash, &entry->tag,
+										victim_hashcode, HASH_REMOVE, NULL);
+			entry->valid = false;
+		}
+		ent = (ZLockTableLookupEnt *)
+			hash_search_with_hash_value(ZLockTableHash, &tag, hashcode,
+										HASH_ENTER, &found);
+		Assert(!found);
+		ent->slot = slot;
+	}
+	entry = &ZLockTable->entries[ent->slot];
+
+	entry->tag = tag;
+	entry->valid = true;
+	entry->has_tpd = has_tpd;
+	pg_atomic_write_u32(&entry->usage_count, 1);
+	entry->lsn = lsn;
+
+	i = 0;
+	foreach(lc, members)
+		memcpy(&entry->members[i++], lfirst(lc), sizeof(ZMultiLockMember));
+	entry->nmembers = i;
+
+	LWLockRelease(partitionLock);
+}
+
+/*
+ * ZHeapLockTableAddLocker - record a new locker of a tuple
+ *
+ * Called after the locker's WAL record has been inserted, while the buffer
+ * is still locked exclusively.  prior_lsn is the page LSN from before the
+ * lock was taken; if the table knew the lockers of the tuple as of that
+ * version of the page, the new locker is added to them, otherwise whatever
+ * the table had for the tuple is forgotten.
+ */
+void
+ZHeapLockTableAddLocker(Buffer buf, OffsetNumber offnum,
+						XLogRecPtr prior_lsn, ZMultiLockMember *member)
+{
+	ZLockTableTag tag;
+	ZLockTableLookupEnt *ent;
+	ZLockTableEntry *entry;
+	Page		page = BufferGetPage(buf);
+	uint32		hashcode;
+	LWLock	   *partitionLock;
+
+	if (ZLockTable == NULL)
+		return;
+
+	ZLockTableSetTag(&tag, buf, offnum);
+	hashcode = get_hash_value(ZLockTableHash, &tag);
+	partitionLock = ZLockTablePartitionLock(ZLockTableHashPartition(hashcode));
+
+	/*
+	 * Most tuples that get locked have no entry, so look first with only a
+	 * shared lock.  An entry that appears meanwhile can at best describe the
+	 * version of the page before our lock, which the new page LSN already
+	 * leaves stale.
+	 */
+	LWLockAcquire(partitionLock, LW_SHARED);
+	ent = (ZLockTableLookupEnt *)
+		hash_search_with_hash_value(ZLockTableHash, &tag, hashcode,
+									HASH_FIND, NULL);
+	LWLockRelease(partitionLock);
+	if (ent == NULL)
+		return;
+
+	LWLockAcquire(partitionLock, LW_EXCLUSIVE);
+
+	ent = (ZLockTableLookupEnt *)
+		hash_search_with_hash_value(ZLockTableHash, &tag, hashcode,
+									HASH_FIND, NULL);
+	if (ent == NULL)
+	{
+		LWLockRelease(partitionLock);
+		return;
+	}
+
+	entry = &ZLockTable->entries[ent->slot];
+	if (entry->lsn != prior_lsn ||
+		entry->has_tpd != ZHeapPageHasTPDSlot((PageHeader) page))
+	{
+		ZLockTableForget(entry, hashcode);
+		LWLockRelease(partitionLock);
+		return;
+	}
+
+	if (entry->nmembers >= ZLT_MAX_MEMBERS)
+	{
+		TransactionId oldestXidHavingUndo;
+		int			i,
+					j = 0;
+
+		/* Make room by dropping the members whose undo is discarded. */
+		oldestXidHavingUndo = GetXidFromEpochXid(
+												 pg_atomic_read_u64(&ProcGlobal->oldestXidWithEpochHavingUndo));
+		for (i = 0; i < entry->nmembers; i++)
+		{
+			if (!TransactionIdPrecedes(entry->members[i].xid,
+									   oldestXidHavingUndo))
+				entry->members[j++] = entry->members[i];
+		}
+		entry->nmembers = j;
+
+		if (entry->nmembers >= ZLT_MAX_MEMBERS)
+		{
+			ZLockTableForget(entry, hashcode);
+			LWLockRelease(partitionLock);
+			return;
+		}
+	}
+
+	entry->members[entry->nmembers++] = *member;
+	entry->lsn = PageGetLSN(page);
+	pg_atomic_write_u32(&entry->usage_count, 1);
+
+	LWLockRelease(partitionLock);
+}
+
+/*
+ * ZLockTableSetTag - build the hash key for a tuple
+ *
+ * The key is hashed as a blob, so its padding must be zeroed.
+ */
+static void
+ZLockTableSetTag(ZLockTableTag *tag, Buffer buf, OffsetNumber offnum)
+{
+	ForkNumber	forknum;
+
+	MemSet(tag, 0, sizeof(ZLockTableTag));
+	BufferGetTag(buf, &tag->rnode, &forknum, &tag->blkno);
+	tag->offnum = offnum;
+}
+
+/*
+ * ZLockTableForget - drop an entry that can no longer be trusted
+ *
+ * Caller must hold the entry's partition lock exclusively.
+ */
+static void
+ZLockTableForget(ZLockTableEntry *entry, uint32 hashcode)
+{
+	hash_search_with_hash_value(ZLockTableHash, &entry->tag, hashcode,
+								HASH_REMOVE, NULL);
+	entry->valid = false;
+	pg_atomic_write_u32(&entry->usage_count, 0);
+}
+
+/*
+ * ZLockTableGetVictim - choose a slot of the given partition for a new entry
+ *
+ * Free slots are taken first; otherwise the partition's clock hand moves on
+ * until it finds a slot that hasn't been used since it last passed.  Caller
+ * must hold the partition's lock exclusively, and the partition must own a
+ * slot.
+ */
+static int
+ZLockTableGetVictim(int partition)
+{
+	int			nslots;
+	int			i;
+
+	nslots = (zheap_lock_table_size - partition + ZLT_NUM_PARTITIONS - 1) /
+		ZLT_NUM_PARTITIONS;
+	Assert(nslots > 0);
+
+	for (i = 0; i < 2 * nslots; i++)
+	{
+		int			slot = ZLockTable->next_victim[partition];
+		ZLockTableEntry *entry = &ZLockTable->entries[slot];
+
+		ZLockTable->next_victim[partition] =
+			ZLockTableNextSlot(partition, slot);
+
+		if (!entry->valid ||
+			pg_atomic_read_u32(&entry->usage_count) == 0)
+			return slot;
+		pg_atomic_write_u32(&entry->usage_count, 0);
+	}
+
+	/* Every slot was in use twice around; just take the next one. */
+	i = ZLockTable->next_victim[partition];
+	ZLockTable->next_victim[partition] = ZLockTableNextSlot(partition, i);
+	return i;
+}
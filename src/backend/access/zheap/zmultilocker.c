@@ -19,6 +19,7 @@
 
 #include "access/tpd.h"
 #include "access/xact.h"
+#include "access/zlocktable.h"
 #include "access/zmultilocker.h"
 #include "storage/bufmgr.h"
 #include "storage/buf_internals.h"
@@ -64,7 +65,8 @@ ZCurrentXactHasTupleLockMode(ZHeapTuple zhtup, UndoRecPtr urec_ptr,
 
 		uur_type = urec->uur_type;
 
-		if (uur_type == UNDO_INSERT || uur_type == UNDO_MULTI_INSERT)
+		if (uur_type == UNDO_INSERT || uur_type == UNDO_MULTI_INSERT ||
+			uur_type == UNDO_BULK_APPEND)
 		{
 			/*
 			 * We are done, once we are at the end of current chain.  We
@@ -136,6 +138,10 @@ ZCurrentXactHasTupleLockMode(ZHeapTuple zhtup, UndoRecPtr urec_ptr,
  * transactions.  The purpose of returning committed or aborted transactions
  * is that some of the callers want to take some specific action for
  * such transactions if they have updated the tuple.
+ *
+ * The members are taken from the shared tuple lock table if it knows them
+ * for the current version of the page; otherwise we walk the undo chains
+ * and remember the result there.  See zlocktable.c.
  */
 List *
 ZGetMultiLockMembers(Relation rel, ZHeapTuple zhtup, Buffer buf,
@@ -156,6 +162,10 @@ ZGetMultiLockMembers(Relation rel, ZHeapTuple zhtup, Buffer buf,
 	BlockNumber tpd_blkno = InvalidBlockNumber;
 	BlockNumber blkno = ItemPointerGetBlockNumber(&zhtup->t_self);
 	OffsetNumber offnum = ItemPointerGetOffsetNumber(&zhtup->t_self);
+	bool		use_lock_table = ZHeapLockTableUsable(rel);
+	bool		skipped_own = false;
+	XLogRecPtr	lsn;
+	bool		has_tpd;
 
 	if (nobuflock)
 	{
@@ -179,6 +189,16 @@ ZGetMultiLockMembers(Relation rel, ZHeapTuple zhtup, Buffer buf,
 		}
 	}
 
+	if (use_lock_table &&
+		ZHeapLockTableLookup(rel, buf, offnum, &multilockmembers))
+	{
+		if (nobuflock)
+			LockBuffer(buf, BUFFER_LOCK_UNLOCK);
+		return multilockmembers;
+	}
+
+	lsn = BufferGetLSNAtomic(buf);
+	has_tpd = ZHeapPageHasTPDSlot((PageHeader) BufferGetPage(buf));
 	trans_slots = GetTransactionsSlotsForPage(rel, buf, &total_trans_slots,
 											  &tpd_blkno);
 
@@ -233,6 +253,7 @@ ZGetMultiLockMembers(Relation rel, ZHeapTuple zhtup, Buffer buf,
 			 */
 			if (TransactionIdEquals(urec->uur_xid, GetTopTransactionIdIfAny()))
 			{
+				skipped_own = true;
 				urec_ptr = urec->uur_blkprev;
 				UndoRecordRelease(urec);
 				urec = NULL;
@@ -241,7 +262,8 @@ ZGetMultiLockMembers(Relation rel, ZHeapTuple zhtup, Buffer buf,
 
 			uur_type = urec->uur_type;
 
-			if (uur_type == UNDO_INSERT || uur_type == UNDO_MULTI_INSERT)
+			if (uur_type == UNDO_INSERT || uur_type == UNDO_MULTI_INSERT ||
+				uur_type == UNDO_BULK_APPEND)
 			{
 				/*
 				 * We are done, once we are at the end of current chain.  We
@@ -327,6 +349,10 @@ ZGetMultiLockMembers(Relation rel, ZHeapTuple zhtup, Buffer buf,
 	/* be tidy */
 	pfree(trans_slots);
 
+	if (use_lock_table && !skipped_own)
+		ZHeapLockTableRemember(rel, buf, offnum, lsn, has_tpd,
+							   multilockmembers);
+
 	return multilockmembers;
 }
 
@@ -730,7 +756,8 @@ GetLockerTransInfo(Relation rel, ItemPointer tid, Buffer buf,
 
 			uur_type = urec->uur_type;
 
-			if (uur_type == UNDO_INSERT || uur_type == UNDO_MULTI_INSERT)
+			if (uur_type == UNDO_INSERT || uur_type == UNDO_MULTI_INSERT ||
+				uur_type == UNDO_BULK_APPEND)
 			{
 				/*
 				 * We are done, once we are at the end of current chain.  We
@@ -29,10 +29,72 @@
 #include "postgres.h"
 
 #include "access/tpd.h"
+#include "access/xact.h"
+#include "lib/ilist.h"
 #include "miscadmin.h"
+#include "utils/hsearch.h"
 #include "utils/memdebug.h"
+#include "utils/memutils.h"
 #include "utils/ztqual.h"
 
+/*
+ * Space freed by the current transaction.
+ *
+ * The space released by a delete or a non-in-place update can't in general
+ * be reused before the transaction that released it commits, because if it
+ * aborts, the undo actions need that space to put the old tuple back.
+ * However, an insert performed later by the same subtransaction can take it
+ * over, since whatever rolls back the insert rolls back the delete as well.
+ *
+ * To find such space, each backend remembers the items deleted by its
+ * current transaction in a hash table keyed by relfilenode and block, which
+ * lives in TopTransactionContext.  The entry for a page only tracks items
+ * deleted by a single subtransaction, the one that deleted something on the
+ * page most recently.  This also takes care of the items whose delete has
+ * been rolled back by ROLLBACK TO SAVEPOINT, as subtransaction ids are never
+ * reused within a transaction.  The entries of each relation are also kept
+ * in a list, most recently freed first, in a second hash table keyed by
+ * relfilenode, from which inserts pick their block.
+ *
+ * Rewriting a relation gives it a new relfilenode, so the entries of the
+ * old one are merely left unused.  A relation can also be truncated in
+ * place, though, so inserts check that the block still exists.
+ */
+#define ZHEAP_REUSE_MAX_TRACKED_PAGES	65536
+
+/* Number of blocks inserts look at before giving up on reusing space. */
+#define ZHEAP_REUSE_MAX_CANDIDATES		8
+
+typedef struct ZReusableSpaceKey
+{
+	RelFileNode rnode;
+	BlockNumber blkno;
+} ZReusableSpaceKey;
+
+typedef struct ZReusableSpaceEntry
+{
+	ZReusableSpaceKey key;		/* hash key (must be first) */
+	dlist_node	node;			/* link in the relation's list of blocks */
+	SubTransactionId subxid;	/* subtransaction that deleted the items */
+	Size		maxlen;			/* upper bound on the largest item's length */
+	int			nitems;			/* number of items set in the bitmap below */
+	uint8		items[MaxZHeapTuplesPerPage / BITS_PER_BYTE + 1];
+} ZReusableSpaceEntry;
+
+typedef struct ZReusableSpaceRel
+{
+	RelFileNode rnode;			/* hash key (must be first) */
+	dlist_head	blocks;			/* ZReusableSpaceEntry, most recent first */
+} ZReusableSpaceRel;
+
+static HTAB *ZReusableSpace = NULL;
+static HTAB *ZReusableSpaceRels = NULL;
+static FullTransactionId ZReusableSpaceFxid;
+
+static HTAB *GetReusableSpaceHash(bool create);
+static void ForgetReusableSpace(ZReusableSpaceEntry *entry);
+static bool ZPageFindFreeLinePointer(Page page, OffsetNumber *offnum);
+
 /*
  * ZPageAddItemExtended - Add an item to a zheap page.
  *
@@ -466,6 +528,444 @@ ZHeapGetUsableOffsetRanges(Buffer buffer,
 	return zfree_offset_ranges;
 }
 
+/*
+ * GetReusableSpaceHash - Get the hash table tracking the space freed by the
+ *		current transaction.
+ *
+ * The hash tables are discarded along with TopTransactionContext at the end
+ * of each transaction, so we remember which transaction they belong to and
+ * forget about them once that transaction is over.
+ */
+static HTAB *
+GetReusableSpaceHash(bool create)
+{
+	FullTransactionId fxid = GetTopFullTransactionIdIfAny();
+
+	if (!FullTransactionIdIsValid(fxid))
+		return NULL;
+
+	if (ZReusableSpace != NULL &&
+		!FullTransactionIdEquals(ZReusableSpaceFxid, fxid))
+	{
+		ZReusableSpace = NULL;
+		ZReusableSpaceRels = NULL;
+	}
+
+	if (ZReusableSpace == NULL && create)
+	{
+		HASHCTL		ctl;
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(ZReusableSpaceKey);
+		ctl.entrysize = sizeof(ZReusableSpaceEntry);
+		ctl.hcxt = TopTransactionContext;
+		ZReusableSpace = hash_create("zheap reusable space", 256, &ctl,
+									 HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(RelFileNode);
+		ctl.entrysize = sizeof(ZReusableSpaceRel);
+		ctl.hcxt = TopTransactionContext;
+		ZReusableSpaceRels = hash_create("zheap reusable space relations", 16,
+										 &ctl,
+										 HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+		ZReusableSpaceFxid = fxid;
+	}
+
+	return ZReusableSpace;
+}
+
+/*
+ * ForgetReusableSpace - Remove an entry that is of no use anymore.
+ */
+static void
+ForgetReusableSpace(ZReusableSpaceEntry *entry)
+{
+	dlist_delete(&entry->node);
+	hash_search(ZReusableSpace, &entry->key, HASH_REMOVE, NULL);
+}
+
+/*
+ * ZHeapRememberFreedSpace - Remember that the current subtransaction has
+ *		deleted the item at the given location.
+ *
+ * This is called after a delete or a non-in-place update has been performed,
+ * so that subsequent inserts of the same subtransaction can reuse the storage
+ * of the item.  See ZPageGetReusableItem.
+ */
+void
+ZHeapRememberFreedSpace(Relation relation, BlockNumber blkno,
+						OffsetNumber offnum, Size len)
+{
+	HTAB	   *htab;
+	ZReusableSpaceKey key;
+	ZReusableSpaceEntry *entry;
+	ZReusableSpaceRel *rel;
+	SubTransactionId subxid = GetCurrentSubTransactionId();
+	bool		found;
+	bool		relfound;
+
+	htab = GetReusableSpaceHash(true);
+	if (htab == NULL)
+		return;
+
+	memset(&key, 0, sizeof(key));
+	key.rnode = relation->rd_node;
+	key.blkno = blkno;
+
+	/* Don't let the tracking grow without bound for huge deletes. */
+	if (hash_get_num_entries(htab) >= ZHEAP_REUSE_MAX_TRACKED_PAGES)
+	{
+		entry = (ZReusableSpaceEntry *) hash_search(htab, &key, HASH_FIND,
+													NULL);
+		found = (entry != NULL);
+	}
+	else
+		entry = (ZReusableSpaceEntry *) hash_search(htab, &key, HASH_ENTER,
+													&found);
+	if (entry == NULL)
+		return;
+
+	/* Move the block to the front of the relation's list. */
+	rel = (ZReusableSpaceRel *) hash_search(ZReusableSpaceRels, &key.rnode,
+											HASH_ENTER, &relfound);
+	if (!relfound)
+		dlist_init(&rel->blocks);
+	if (found)
+		dlist_delete(&entry->node);
+	dlist_push_head(&rel->blocks, &entry->node);
+
+	if (!found || entry->subxid != subxid)
+	{
+		entry->subxid = subxid;
+		entry->maxlen = 0;
+		entry->nitems = 0;
+		memset(entry->items, 0, sizeof(entry->items));
+	}
+
+	Assert(offnum <= MaxZHeapTuplesPerPage);
+	if ((entry->items[offnum / BITS_PER_BYTE] & (1 << (offnum % BITS_PER_BYTE))) == 0)
+	{
+		entry->items[offnum / BITS_PER_BYTE] |= (1 << (offnum % BITS_PER_BYTE));
+		entry->nitems++;
+	}
+	entry->maxlen = Max(entry->maxlen, SHORTALIGN(len));
+}
+
+/*
+ * ZHeapGetBlockWithReusableSpace - Find a block of the relation on which the
+ *		current subtransaction has deleted an item large enough to hold a
+ *		tuple of the given length.
+ *
+ * This only consults the backend-local tracking information; the caller must
+ * confirm the choice with ZPageGetReusableItem once the page is locked.  Only
+ * the few blocks most recently freed are considered.  Returns
+ * InvalidBlockNumber, if there is no such block.
+ */
+BlockNumber
+ZHeapGetBlockWithReusableSpace(Relation relation, Size len)
+{
+	ZReusableSpaceRel *rel;
+	dlist_mutable_iter iter;
+	SubTransactionId subxid = GetCurrentSubTransactionId();
+	BlockNumber nblocks = InvalidBlockNumber;
+	int			ncandidates = 0;
+
+	if (GetReusableSpaceHash(false) == NULL)
+		return InvalidBlockNumber;
+
+	rel = (ZReusableSpaceRel *) hash_search(ZReusableSpaceRels,
+											&relation->rd_node, HASH_FIND,
+											NULL);
+	if (rel == NULL)
+		return InvalidBlockNumber;
+
+	len = SHORTALIGN(len);
+
+	dlist_foreach_modify(iter, &rel->blocks)
+	{
+		ZReusableSpaceEntry *entry;
+
+		entry = dlist_container(ZReusableSpaceEntry, node, iter.cur);
+
+		/*
+		 * Entries whose items have all been consumed, or that belong to a
+		 * subtransaction which is no longer current, are of no use anymore.
+		 */
+		if (entry->nitems == 0 || entry->subxid != subxid)
+		{
+			ForgetReusableSpace(entry);
+			continue;
+		}
+
+		if (entry->maxlen >= len)
+		{
+			/* The relation might have been truncated meanwhile. */
+			if (nblocks == InvalidBlockNumber)
+				nblocks = RelationGetNumberOfBlocks(relation);
+			if (entry->key.blkno < nblocks)
+				return entry->key.blkno;
+
+			ForgetReusableSpace(entry);
+			continue;
+		}
+
+		if (++ncandidates >= ZHEAP_REUSE_MAX_CANDIDATES)
+			break;
+	}
+
+	return InvalidBlockNumber;
+}
+
+/*
+ * ZHeapForgetReusableSpace - Forget the space freed in a relation that is
+ *		being truncated.
+ */
+void
+ZHeapForgetReusableSpace(Relation relation)
+{
+	ZReusableSpaceRel *rel;
+	dlist_mutable_iter iter;
+
+	if (GetReusableSpaceHash(false) == NULL)
+		return;
+
+	rel = (ZReusableSpaceRel *) hash_search(ZReusableSpaceRels,
+											&relation->rd_node, HASH_FIND,
+											NULL);
+	if (rel == NULL)
+		return;
+
+	dlist_foreach_modify(iter, &rel->blocks)
+		ForgetReusableSpace(dlist_container(ZReusableSpaceEntry, node,
+											iter.cur));
+	hash_search(ZReusableSpaceRels, &relation->rd_node, HASH_REMOVE, NULL);
+}
+
+/*
+ * ZPageFindFreeLinePointer - Find a line pointer for a new item that doesn't
+ *		need any new storage.
+ *
+ * We either reuse an unused line pointer that has no pending transaction
+ * information, or extend the line pointer array if there is room for it.
+ */
+static bool
+ZPageFindFreeLinePointer(Page page, OffsetNumber *offnum)
+{
+	PageHeader	phdr = (PageHeader) page;
+	OffsetNumber limit = OffsetNumberNext(PageGetMaxOffsetNumber(page));
+	OffsetNumber off;
+
+	if (PageHasFreeLinePointers(phdr))
+	{
+		for (off = FirstOffsetNumber; off < limit; off++)
+		{
+			ItemId		itemId = PageGetItemId(page, off);
+
+			if (!ItemIdIsUsed(itemId) && !ItemIdHasStorage(itemId) &&
+				!ItemIdHasPendingXact(itemId))
+			{
+				*offnum = off;
+				return true;
+			}
+		}
+	}
+
+	if (limit <= MaxZHeapTuplesPerPage &&
+		phdr->pd_lower + sizeof(ItemIdData) <= phdr->pd_upper)
+	{
+		*offnum = limit;
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * ZPageGetReusableItem - Find an item on the page deleted by the current
+ *		subtransaction whose storage can hold a tuple of the given length.
+ *
+ * The caller must hold an exclusive lock on the buffer and must have
+ * reserved trans_slot_id for the current transaction.  We only consider the
+ * items deleted or non-in-place updated by the current subtransaction whose
+ * tuples still point to that slot.  Tuples that are locked, in-place updated
+ * or belong to a TPD slot are not considered; rolling those back needs more
+ * than the storage of the deleted tuple.
+ *
+ * Returns the offset number of the item, or InvalidOffsetNumber if there is
+ * none or there is no line pointer available for the new tuple.
+ */
+OffsetNumber
+ZPageGetReusableItem(Relation relation, Buffer buffer, int trans_slot_id,
+					 Size len)
+{
+	HTAB	   *htab;
+	ZReusableSpaceKey key;
+	ZReusableSpaceEntry *entry;
+	Page		page = BufferGetPage(buffer);
+	OffsetNumber maxoff = PageGetMaxOffsetNumber(page);
+	OffsetNumber offnum;
+	OffsetNumber newoff;
+	OffsetNumber victim = InvalidOffsetNumber;
+	Size		maxlen = 0;
+
+	htab = GetReusableSpaceHash(false);
+	if (htab == NULL)
+		return InvalidOffsetNumber;
+
+	/*
+	 * The slot of the current transaction must be a page slot, as the
+	 * deleted item will remember it in its line pointer.
+	 */
+	if (trans_slot_id == InvalidXactSlotId ||
+		trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS ||
+		(trans_slot_id == ZHEAP_PAGE_TRANS_SLOTS &&
+		 ZHeapPageHasTPDSlot((PageHeader) page)))
+		return InvalidOffsetNumber;
+
+	memset(&key, 0, sizeof(key));
+	key.rnode = relation->rd_node;
+	key.blkno = BufferGetBlockNumber(buffer);
+
+	entry = (ZReusableSpaceEntry *) hash_search(htab, &key, HASH_FIND, NULL);
+	if (entry == NULL)
+		return InvalidOffsetNumber;
+	if (entry->subxid != GetCurrentSubTransactionId())
+	{
+		ForgetReusableSpace(entry);
+		return InvalidOffsetNumber;
+	}
+
+	len = SHORTALIGN(len);
+
+	for (offnum = FirstOffsetNumber; offnum <= maxoff && offnum <= MaxZHeapTuplesPerPage; offnum++)
+	{
+		ItemId		lp;
+		ZHeapTupleHeader tup;
+		Size		itemlen;
+
+		if ((entry->items[offnum / BITS_PER_BYTE] & (1 << (offnum % BITS_PER_BYTE))) == 0)
+			continue;
+
+		lp = PageGetItemId(page, offnum);
+		if (ItemIdIsNormal(lp))
+		{
+			tup = (ZHeapTupleHeader) PageGetItem(page, lp);
+
+			if (ZHeapTupleDeleted(tup) &&
+				!(tup->t_infomask & (ZHEAP_INPLACE_UPDATED |
+									 ZHEAP_XID_LOCK_ONLY |
+									 ZHEAP_MULTI_LOCKERS |
+									 ZHEAP_INVALID_XACT_SLOT)) &&
+				ZHeapTupleHeaderGetXactSlot(tup) == trans_slot_id)
+			{
+				itemlen = SHORTALIGN(ItemIdGetLength(lp));
+				if (itemlen >= len)
+				{
+					victim = offnum;
+					break;
+				}
+				maxlen = Max(maxlen, itemlen);
+				continue;
+			}
+		}
+
+		/* The item can no longer be reused, forget it. */
+		entry->items[offnum / BITS_PER_BYTE] &= ~(1 << (offnum % BITS_PER_BYTE));
+		entry->nitems--;
+	}
+
+	if (!OffsetNumberIsValid(victim))
+	{
+		/* Remember what's left, so that we don't retry for bigger tuples. */
+		entry->maxlen = maxlen;
+		return InvalidOffsetNumber;
+	}
+
+	if (!ZPageFindFreeLinePointer(page, &newoff))
+		return InvalidOffsetNumber;
+
+	/* The caller is going to consume it. */
+	entry->items[victim / BITS_PER_BYTE] &= ~(1 << (victim % BITS_PER_BYTE));
+	entry->nitems--;
+
+	return victim;
+}
+
+/*
+ * ZPageAddItemReusingStorage - Add an item to a zheap page using the storage
+ *		of an item deleted by the same transaction.
+ *
+ * The deleted item is marked as deleted in the same way as pruning does it
+ * for the tuples deleted by a committed transaction that is not yet
+ * all-visible, so the transaction slot in the line pointer leads the readers
+ * to the prior version of the tuple in undo.  The new item is placed at the
+ * start of the freed storage.  If offnum is valid, the new item is placed at
+ * that offset (used during recovery), otherwise we choose one.
+ *
+ * Returns the offset number of the new item.  This is called inside a
+ * critical section, so must not fail.
+ */
+OffsetNumber
+ZPageAddItemReusingStorage(Page page, OffsetNumber victim, Item item,
+						   Size size, OffsetNumber offnum)
+{
+	PageHeader	phdr = (PageHeader) page;
+	ItemId		victim_lp;
+	ItemId		itemId;
+	ZHeapTupleHeader tup;
+	OffsetNumber limit;
+	int			trans_slot;
+	int			storage_off;
+	uint8		vis_info = 0;
+
+	victim_lp = PageGetItemId(page, victim);
+	Assert(ItemIdIsNormal(victim_lp));
+	Assert(SHORTALIGN(ItemIdGetLength(victim_lp)) >= SHORTALIGN(size));
+
+	if (!OffsetNumberIsValid(offnum) &&
+		!ZPageFindFreeLinePointer(page, &offnum))
+		elog(PANIC, "failed to find a free line pointer");
+
+	limit = OffsetNumberNext(PageGetMaxOffsetNumber(page));
+	if (offnum > limit)
+		elog(PANIC, "specified item offset is too large");
+
+	storage_off = ItemIdGetOffset(victim_lp);
+	tup = (ZHeapTupleHeader) PageGetItem(page, victim_lp);
+	trans_slot = ZHeapTupleHeaderGetXactSlot(tup);
+	if (ZHeapTupleDeleted(tup))
+		vis_info = ITEMID_DELETED;
+
+	ItemIdSetDeleted(victim_lp, trans_slot, vis_info);
+
+	if (offnum == limit)
+		phdr->pd_lower += sizeof(ItemIdData);
+	itemId = PageGetItemId(page, offnum);
+	ItemIdSetNormal(itemId, storage_off, size);
+
+	VALGRIND_CHECK_MEM_IS_DEFINED(item, size);
+	memcpy((char *) page + storage_off, item, size);
+
+	return offnum;
+}
+
+/*
+ * ZPageRestoreReusedItem - Give the storage taken over by an insert back to
+ *		the deleted item it was taken from.
+ *
+ * This is used while rolling back such an insert.  The tuple data of the
+ * deleted item is restored afterwards by the undo action of the delete.
+ */
+void
+ZPageRestoreReusedItem(Page page, ZHeapReusedItem *reused_item)
+{
+	ItemId		lp = PageGetItemId(page, reused_item->offnum);
+
+	Assert(ItemIdIsDeleted(lp));
+	ItemIdSetNormal(lp, reused_item->lp_off, reused_item->lp_len);
+}
+
 /*
  * Initialize zheap page.
  */
@@ -516,7 +1016,7 @@ ZheapInitMetaPage(RelFileNode rnode, ForkNumber forkNum,
 
 	START_CRIT_SECTION();
 
-	zheap_init_meta_page(buf, InvalidBlockNumber, InvalidBlockNumber);
+	zheap_init_meta_page(buf, InvalidBlockNumber, InvalidBlockNumber, 0, NULL);
 	MarkBufferDirty(buf);
 
 	/*
@@ -540,7 +1040,8 @@ ZheapInitMetaPage(RelFileNode rnode, ForkNumber forkNum,
  */
 void
 zheap_init_meta_page(Buffer metabuf, BlockNumber first_blkno,
-					 BlockNumber last_blkno)
+					 BlockNumber last_blkno, uint32 num_free_blknos,
+					 uint32 *free_blknos)
 {
 	ZHeapMetaPage metap;
 	Page		page;
@@ -554,6 +1055,12 @@ zheap_init_meta_page(Buffer metabuf, BlockNumber first_blkno,
 	metap->zhm_first_used_tpd_page = first_blkno;
 	metap->zhm_last_used_tpd_page = last_blkno;
 
+	Assert(num_free_blknos <= ZHEAP_MAX_FREE_TPD_PAGES);
+	metap->zhm_num_free_tpd_pages = num_free_blknos;
+	if (num_free_blknos > 0)
+		memcpy(metap->zhm_free_tpd_pages, free_blknos,
+			   num_free_blknos * sizeof(uint32));
+
 	/*
 	 * Set pd_lower just past the end of the metadata.  This is essential,
 	 * because without doing so, metadata will be lost if xlog.c compresses
@@ -3,9 +3,9 @@
  * zscan.c
  *	  Routines to scan zheap data pages.
  *
- * This file provides API's to scan the zheap page and get the tuples.  Zheap
- * contains different kind of meta pages (like meta and tpd pages) which
- * doesn't have tuples, so we need to always skip them during scan.
+ * This file provides API's to scan the zheap page and get the tuples.  The
+ * zheap metapage doesn't have tuples, so we need to always skip it during
+ * scan.  TPD pages are stored in a separate fork and are never seen here.
  *
  * Unlike heap, we always need to make a copy of zheap tuple before releasing
  * the containing buffer as an in-place update can change the tuple.
@@ -25,6 +25,7 @@
 #include "access/tableam.h"
 #include "access/tpd.h"
 #include "access/visibilitymap.h"
+#include "access/zcrcache.h"
 #include "access/zheapscan.h"
 #include "miscadmin.h"
 #include "nodes/tidbitmap.h"
@@ -39,6 +40,19 @@
 extern BlockNumber ss_get_location(Relation rel, BlockNumber relnblocks);
 extern void ss_report_location(Relation rel, BlockNumber location);
 
+/*
+ * Parallel scans claim blocks from the shared counter in chunks, so that
+ * each process reads runs of consecutive blocks, which keeps the kernel's
+ * read-ahead effective, and the atomic operation is off the per-block path.
+ * The chunk size is chosen so that the table is split into about
+ * ZHEAP_PARALLEL_NCHUNKS chunks, and is halved towards the end of the scan,
+ * when ZHEAP_PARALLEL_RAMPDOWN_CHUNKS of them are left, so that the
+ * processes finish at about the same time.
+ */
+#define ZHEAP_PARALLEL_NCHUNKS			2048
+#define ZHEAP_PARALLEL_RAMPDOWN_CHUNKS	64
+#define ZHEAP_PARALLEL_MAX_CHUNK_SIZE	8192
+
 /*
  * zinitscan - same as initscan except for tuple initialization
  */
@@ -139,7 +153,11 @@ zinitscan(ZHeapScanDesc scan, ScanKey key, bool keep_startblock)
 	scan->rs_numblocks = InvalidBlockNumber;
 	scan->rs_inited = false;
 	scan->rs_cbuf = InvalidBuffer;
+	scan->rs_allvisible = false;
 	scan->rs_cblock = InvalidBlockNumber;
+	scan->rs_pnallocated = 0;
+	scan->rs_pchunk_size = 0;
+	scan->rs_pchunk_remaining = 0;
 
 	/* page-at-a-time fields are always invalid when not rs_inited */
 
@@ -336,11 +354,99 @@ zheap_setscanlimits(TableScanDesc sscan, BlockNumber startBlk, BlockNumber numBl
 	scan->rs_numblocks = numBlks;
 }
 
+/*
+ * zheap_parallelscan_startblock_init - set up this process's part in a
+ *		parallel scan
+ */
+static void
+zheap_parallelscan_startblock_init(ZHeapScanDesc scan)
+{
+	ParallelBlockTableScanDesc pbscan =
+	(ParallelBlockTableScanDesc) scan->rs_base.rs_parallel;
+	uint32		chunk_size = 1;
+
+	table_block_parallelscan_startblock_init(scan->rs_base.rs_rd, pbscan);
+
+	while (chunk_size < pbscan->phs_nblocks / ZHEAP_PARALLEL_NCHUNKS &&
+		   chunk_size < ZHEAP_PARALLEL_MAX_CHUNK_SIZE)
+		chunk_size <<= 1;
+
+	scan->rs_pnallocated = 0;
+	scan->rs_pchunk_size = chunk_size;
+	scan->rs_pchunk_remaining = 0;
+}
+
+/*
+ * zheap_parallelscan_nextpage - get the next block of a parallel scan
+ *
+ * Like table_block_parallelscan_nextpage, but claims the blocks a chunk at
+ * a time, and skips the metapage.  Returns InvalidBlockNumber once all the
+ * blocks have been claimed.
+ */
+static BlockNumber
+zheap_parallelscan_nextpage(ZHeapScanDesc scan)
+{
+	ParallelBlockTableScanDesc pbscan =
+	(ParallelBlockTableScanDesc) scan->rs_base.rs_parallel;
+	BlockNumber page;
+	uint64		nallocated;
+
+	do
+	{
+		if (scan->rs_pchunk_remaining > 0)
+		{
+			nallocated = ++scan->rs_pnallocated;
+			scan->rs_pchunk_remaining--;
+		}
+		else
+		{
+			/* Ramp down towards the end, so the processes finish together. */
+			if (scan->rs_pchunk_size > 1 &&
+				scan->rs_pnallocated + (uint64) scan->rs_pchunk_size *
+				ZHEAP_PARALLEL_RAMPDOWN_CHUNKS > pbscan->phs_nblocks)
+				scan->rs_pchunk_size >>= 1;
+
+			nallocated = scan->rs_pnallocated =
+				pg_atomic_fetch_add_u64(&pbscan->phs_nallocated,
+										scan->rs_pchunk_size);
+			scan->rs_pchunk_remaining = scan->rs_pchunk_size - 1;
+		}
+
+		/*
+		 * Once the counter is past the end, the rest of our chunk is too.
+		 * See table_block_parallelscan_nextpage about why it's 64 bits wide.
+		 */
+		if (nallocated >= pbscan->phs_nblocks)
+		{
+			scan->rs_pchunk_remaining = 0;
+			page = InvalidBlockNumber;
+		}
+		else
+			page = (nallocated + pbscan->phs_startblock) % pbscan->phs_nblocks;
+
+		/*
+		 * Report scan location, as table_block_parallelscan_nextpage does.
+		 * Only the process that claims the block right past the end reports
+		 * the starting block.
+		 */
+		if (pbscan->base.phs_syncscan)
+		{
+			if (page != InvalidBlockNumber)
+				ss_report_location(scan->rs_base.rs_rd, page);
+			else if (nallocated == pbscan->phs_nblocks)
+				ss_report_location(scan->rs_base.rs_rd,
+								   pbscan->phs_startblock);
+		}
+	} while (page == ZHEAP_METAPAGE);
+
+	return page;
+}
+
 /*
  * zheapgetpage - Same as heapgetpage, but operate on zheap page and
  * in page-at-a-time mode, visible tuples are stored in rs_visztuples.
  *
- * It returns false, if we can't scan the page (like in case of TPD page),
+ * It returns false, if we can't scan the page (like in case of metapage),
  * otherwise, return true.
  */
 bool
@@ -355,6 +461,7 @@ zheapgetpage(TableScanDesc sscan, BlockNumber page)
 	OffsetNumber lineoff;
 	ItemId		lpp;
 	bool		all_visible;
+	bool		use_cr_cache;
 	uint8		vmstatus;
 	Buffer		vmbuffer = InvalidBuffer;
 
@@ -366,6 +473,7 @@ zheapgetpage(TableScanDesc sscan, BlockNumber page)
 		ReleaseBuffer(scan->rs_cbuf);
 		scan->rs_cbuf = InvalidBuffer;
 	}
+	scan->rs_allvisible = false;
 
 	if (page == ZHEAP_METAPAGE)
 	{
@@ -395,36 +503,13 @@ zheapgetpage(TableScanDesc sscan, BlockNumber page)
 
 	dp = BufferGetPage(buffer);
 
-	/*
-	 * Skip TPD pages. As of now, the size of special space in TPD pages is
-	 * different from other zheap pages like metapage and regular zheap page,
-	 * however, if that changes, we might need to explicitly store pagetype
-	 * flag somewhere.
-	 *
-	 * Fixme - As an exception, the size of special space for zheap page with
-	 * one transaction slot will match with TPD page's special size.
-	 */
-	if (IsTPDPage(dp))
-	{
-		UnlockReleaseBuffer(buffer);
-		return false;
-	}
-	else if (!(scan->rs_base.rs_flags & SO_ALLOW_PAGEMODE))
-	{
-		LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
-		scan->rs_cbuf = buffer;
-		return true;
-	}
-
 	snapshot = scan->rs_base.rs_snapshot;
 
-	TestForOldSnapshot(snapshot, scan->rs_base.rs_rd, dp);
-	lines = PageGetMaxOffsetNumber(dp);
-	ntup = 0;
-
 	/*
 	 * If the all-visible flag indicates that all tuples on the page are
-	 * visible to everyone, we can skip the per-tuple visibility tests.
+	 * visible to everyone, we can skip the per-tuple visibility tests.  In
+	 * tuple-at-a-time mode we still remember it, for callers such as index
+	 * build that scan with SnapshotAny and do their own time qual checks.
 	 *
 	 * Note: In hot standby, a tuple that's already visible to all
 	 * transactions in the master might still be invisible to a read-only
@@ -439,7 +524,8 @@ zheapgetpage(TableScanDesc sscan, BlockNumber page)
 	vmstatus = visibilitymap_get_status(scan->rs_base.rs_rd, page, &vmbuffer);
 
 	all_visible = (vmstatus & VISIBILITYMAP_ALL_VISIBLE) &&
-		!snapshot->takenDuringRecovery;
+		!(snapshot != NULL && snapshot->takenDuringRecovery);
+	scan->rs_allvisible = all_visible;
 
 	if (BufferIsValid(vmbuffer))
 	{
@@ -447,6 +533,36 @@ zheapgetpage(TableScanDesc sscan, BlockNumber page)
 		vmbuffer = InvalidBuffer;
 	}
 
+	if (!(scan->rs_base.rs_flags & SO_ALLOW_PAGEMODE))
+	{
+		LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
+		scan->rs_cbuf = buffer;
+		return true;
+	}
+
+	TestForOldSnapshot(snapshot, scan->rs_base.rs_rd, dp);
+	lines = PageGetMaxOffsetNumber(dp);
+	ntup = 0;
+
+	/*
+	 * If we'd have to check the tuples' visibility one by one, another scan
+	 * may already have done that work for a snapshot that sees the page the
+	 * same way ours does.  See zcrcache.c.
+	 */
+	use_cr_cache = !all_visible &&
+		ZHeapCRCacheUsable(scan->rs_base.rs_rd, snapshot);
+	if (use_cr_cache)
+	{
+		if (ZHeapCRCacheLookup(scan->rs_base.rs_rd, buffer, snapshot,
+							   scan->rs_visztuples, &ntup))
+		{
+			UnlockReleaseBuffer(buffer);
+			scan->rs_ntuples = ntup;
+			return true;
+		}
+		ZHeapCRCacheBeginBuild();
+	}
+
 	for (lineoff = FirstOffsetNumber, lpp = PageGetItemId(dp, lineoff);
 		 lineoff <= lines;
 		 lineoff++, lpp++)
@@ -487,6 +603,10 @@ zheapgetpage(TableScanDesc sscan, BlockNumber page)
 		}
 	}
 
+	if (use_cr_cache)
+		ZHeapCRCacheEndBuild(scan->rs_base.rs_rd, buffer,
+							 scan->rs_visztuples, ntup);
+
 	UnlockReleaseBuffer(buffer);
 
 	Assert(ntup <= MaxZHeapTuplesPerPage);
@@ -498,8 +618,7 @@ zheapgetpage(TableScanDesc sscan, BlockNumber page)
 /* ----------------
  *		zheapgettup_pagemode - fetch next zheap tuple in page-at-a-time mode
  *
- * Note that here we process only regular zheap pages, meta and tpd pages are
- * skipped.
+ * Note that here we process only regular zheap pages, metapage is skipped.
  * ----------------
  */
 static ZHeapTuple
@@ -535,19 +654,8 @@ zheapgettup_pagemode(ZHeapScanDesc scan,
 			}
 			if (scan->rs_base.rs_parallel != NULL)
 			{
-				ParallelBlockTableScanDesc pbscan =
-				(ParallelBlockTableScanDesc) scan->rs_base.rs_parallel;
-
-				table_block_parallelscan_startblock_init(scan->rs_base.rs_rd,
-														 pbscan);
-
-				page = table_block_parallelscan_nextpage(scan->rs_base.rs_rd,
-														 pbscan);
-
-				/* Skip metapage */
-				if (page == ZHEAP_METAPAGE)
-					page = table_block_parallelscan_nextpage(scan->rs_base.rs_rd,
-															 pbscan);
+				zheap_parallelscan_startblock_init(scan);
+				page = zheap_parallelscan_nextpage(scan);
 
 				/* Other processes might have already finished the scan. */
 				if (page == InvalidBlockNumber)
@@ -680,15 +788,7 @@ get_next_page:
 		}
 		else if (scan->rs_base.rs_parallel != NULL)
 		{
-			ParallelBlockTableScanDesc pbscan =
-			(ParallelBlockTableScanDesc) scan->rs_base.rs_parallel;
-
-			page = table_block_parallelscan_nextpage(scan->rs_base.rs_rd,
-													 pbscan);
-			/* Skip metapage */
-			if (page == ZHEAP_METAPAGE)
-				page = table_block_parallelscan_nextpage(scan->rs_base.rs_rd,
-														 pbscan);
+			page = zheap_parallelscan_nextpage(scan);
 			finished = (page == InvalidBlockNumber);
 		}
 		else
@@ -761,8 +861,7 @@ get_next_page:
 /*
  * Similar to heapgettup, but for fetching zheap tuple.
  *
- * Note that here we process only regular zheap pages, meta and tpd pages are
- * skipped.
+ * Note that here we process only regular zheap pages, metapage is skipped.
  */
 static ZHeapTuple
 zheapgettup(ZHeapScanDesc scan,
@@ -798,19 +897,8 @@ zheapgettup(ZHeapScanDesc scan,
 			}
 			if (scan->rs_base.rs_parallel != NULL)
 			{
-				ParallelBlockTableScanDesc pbscan =
-				(ParallelBlockTableScanDesc) scan->rs_base.rs_parallel;
-
-				table_block_parallelscan_startblock_init(scan->rs_base.rs_rd,
-														 pbscan);
-
-				page = table_block_parallelscan_nextpage(scan->rs_base.rs_rd,
-														 pbscan);
-
-				/* Skip metapage */
-				if (page == ZHEAP_METAPAGE)
-					page = table_block_parallelscan_nextpage(scan->rs_base.rs_rd,
-															 pbscan);
+				zheap_parallelscan_startblock_init(scan);
+				page = zheap_parallelscan_nextpage(scan);
 
 				/* Other processes might have already finished the scan. */
 				if (page == InvalidBlockNumber)
@@ -989,15 +1077,7 @@ get_next_page:
 		}
 		else if (scan->rs_base.rs_parallel != NULL)
 		{
-			ParallelBlockTableScanDesc pbscan =
-			(ParallelBlockTableScanDesc) scan->rs_base.rs_parallel;
-
-			page = table_block_parallelscan_nextpage(scan->rs_base.rs_rd,
-													 pbscan);
-			/* Skip metapage */
-			if (page == ZHEAP_METAPAGE)
-				page = table_block_parallelscan_nextpage(scan->rs_base.rs_rd,
-														 pbscan);
+			page = zheap_parallelscan_nextpage(scan);
 			finished = (page == InvalidBlockNumber);
 		}
 		else
@@ -1144,7 +1224,9 @@ zheap_scan_bitmap_next_block(TableScanDesc sscan,
 	BlockNumber page = tbmres->blockno;
 	Page		dp;
 	Buffer		buffer;
+	Buffer		vmbuffer = InvalidBuffer;
 	Snapshot	snapshot;
+	bool		all_visible;
 	int			ntup;
 
 	scan->rs_cindex = 0;
@@ -1179,24 +1261,59 @@ zheap_scan_bitmap_next_block(TableScanDesc sscan,
 	dp = (Page) BufferGetPage(buffer);
 
 	/*
-	 * Skip TPD pages. As of now, the size of special space in TPD pages is
-	 * different from other zheap pages like metapage and regular zheap page,
-	 * however, if that changes, we might need to explicitly store pagetype
-	 * flag somewhere.
-	 *
-	 * Fixme - As an exception, the size of special space for zheap page with
-	 * one transaction slot will match with TPD page's special size.
+	 * As in zheapgetpage, if all tuples on the page are visible to everyone
+	 * we can skip the per-tuple visibility tests, which for zheap may mean
+	 * following the undo chain.  (When no columns are needed at all, the
+	 * executor doesn't even ask us for such a page.)
 	 */
-	if (IsTPDPage(dp))
-	{
-		UnlockReleaseBuffer(buffer);
-		return false;
-	}
+	all_visible = VM_ALL_VISIBLE(scan->rs_base.rs_rd, page, &vmbuffer) &&
+		!snapshot->takenDuringRecovery;
+	if (BufferIsValid(vmbuffer))
+		ReleaseBuffer(vmbuffer);
 
 	/*
 	 * We need two separate strategies for lossy and non-lossy cases.
 	 */
-	if (tbmres->ntuples >= 0)
+	if (all_visible)
+	{
+		OffsetNumber maxoff = PageGetMaxOffsetNumber(dp);
+		int			nitems;
+		int			i;
+
+		/*
+		 * Every normal item is the visible version of its tuple, and the
+		 * others are invisible; look at those listed in tbmres, or at all of
+		 * them if the bitmap is lossy.
+		 */
+		nitems = (tbmres->ntuples >= 0) ? tbmres->ntuples : maxoff;
+		for (i = 0; i < nitems; i++)
+		{
+			OffsetNumber offnum;
+			ItemId		lpp;
+			ZHeapTuple	ztuple;
+
+			offnum = (tbmres->ntuples >= 0) ? tbmres->offsets[i] :
+				(OffsetNumber) (i + FirstOffsetNumber);
+			if (offnum > maxoff)
+				continue;
+
+			lpp = PageGetItemId(dp, offnum);
+			if (!ItemIdIsNormal(lpp))
+				continue;
+
+			ztuple = zheap_gettuple(scan->rs_base.rs_rd, buffer, offnum);
+
+			/* No transaction of ours can have inserted an all-visible tuple. */
+			PredicateLockTid(scan->rs_base.rs_rd, &ztuple->t_self, snapshot,
+							 InvalidTransactionId);
+			CheckForSerializableConflictOut(true, scan->rs_base.rs_rd,
+											(void *) &ztuple->t_self,
+											buffer, snapshot);
+
+			scan->rs_visztuples[ntup++] = ztuple;
+		}
+	}
+	else if (tbmres->ntuples >= 0)
 	{
 		/*
 		 * Bitmap is non-lossy, so we just look through the offsets listed in
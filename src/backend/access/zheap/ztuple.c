@@ -32,7 +32,10 @@
  * forming and deforming tuples, because we still sometimes need to
  * take data from a zheap table and put in the form of a heap tuple,
  * and that code would get confused if the offset had been set according
- * to zheap's weaker alignment rules.
+ * to zheap's weaker alignment rules.  Instead, zheap slots with a fixed
+ * descriptor remember the offsets of the leading pass-by-value fixed-width
+ * attributes themselves; as those are never padded, their offsets don't
+ * depend on where the tuple data starts.
  *
  * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
  * Portions Copyright (c) 1994, Regents of the University of California
@@ -62,6 +65,7 @@ static void tts_zheap_copyslot(TupleTableSlot *dstslot,
 							   TupleTableSlot *srcslot);
 static HeapTuple tts_zheap_copy_heap_tuple(TupleTableSlot *slot);
 static MinimalTuple tts_zheap_copy_minimal_tuple(TupleTableSlot *slot);
+static inline Datum fetch_unaligned_att(char *p, int attlen);
 
 const TupleTableSlotOps TTSOpsZHeapTuple = {
 	.base_slot_size = sizeof(ZHeapTupleTableSlot),
@@ -432,24 +436,7 @@ zheap_deform_tuple(ZHeapTuple tuple, TupleDesc tupleDesc,
 			off = att_align_nominal(off, thisatt->attalign);
 
 		if (thisatt->attbyval)
-		{
-			Datum		datum;
-
-			/*
-			 * Since pass-by-value attributes are not aligned in zheap, use
-			 * memcpy to copy the value into adequately-aligned storage. Since
-			 * it's pass-by-value, a Datum must be big enough.
-			 */
-			memcpy(&datum, tp + off, thisatt->attlen);
-
-			/*
-			 * We use fetch_att to set the other uninitialized bytes in datum
-			 * field as zero.  We could achieve that by just initializing
-			 * datum with zero, but this helps us to keep the code in sync
-			 * with heap.
-			 */
-			values[attnum] = fetch_att(&datum, true, thisatt->attlen);
-		}
+			values[attnum] = fetch_unaligned_att(tp + off, thisatt->attlen);
 		else
 			values[attnum] = PointerGetDatum((char *) (tp + off));
 
@@ -678,6 +665,50 @@ zheap_tuple_attr_equals(TupleDesc tupdesc, Bitmapset *att_list,
 }
 
 
+/*
+ * fetch_unaligned_att
+ *		Fetch a pass-by-value attribute stored at an arbitrary address.
+ *
+ * Since pass-by-value attributes are not aligned in zheap, we copy the value
+ * into adequately-aligned storage.  The copies are of constant size, so the
+ * compiler turns them into plain (unaligned) loads.
+ */
+static inline Datum
+fetch_unaligned_att(char *p, int attlen)
+{
+	switch (attlen)
+	{
+		case sizeof(char):
+			return CharGetDatum(*p);
+		case sizeof(int16):
+			{
+				int16		val;
+
+				memcpy(&val, p, sizeof(int16));
+				return Int16GetDatum(val);
+			}
+		case sizeof(int32):
+			{
+				int32		val;
+
+				memcpy(&val, p, sizeof(int32));
+				return Int32GetDatum(val);
+			}
+#if SIZEOF_DATUM == 8
+		case sizeof(Datum):
+			{
+				Datum		val;
+
+				memcpy(&val, p, sizeof(Datum));
+				return val;
+			}
+#endif
+		default:
+			elog(ERROR, "unsupported byval length: %d", attlen);
+			return 0;
+	}
+}
+
 /*
  * TupleTableSlotOps implementation for ZheapHeapTupleTableSlot.
  */
@@ -685,11 +716,52 @@ zheap_tuple_attr_equals(TupleDesc tupdesc, Bitmapset *att_list,
 static void
 tts_zheap_init(TupleTableSlot *slot)
 {
+	ZHeapTupleTableSlot *zslot = (ZHeapTupleTableSlot *) slot;
+	TupleDesc	tupleDesc = slot->tts_tupleDescriptor;
+	uint16		off = 0;
+	int			attnum;
+
+	/*
+	 * The descriptor of a slot that isn't fixed can change at any time, so
+	 * we don't bother to remember the attribute offsets for it.
+	 */
+	zslot->nfixedatts = 0;
+	zslot->fixedattoffs = NULL;
+	if (tupleDesc == NULL)
+		return;
+
+	/*
+	 * Remember the offsets of the leading pass-by-value attributes.  Those
+	 * are stored without any alignment padding, so the offsets are valid for
+	 * every tuple until the first null attribute.
+	 */
+	for (attnum = 0; attnum < tupleDesc->natts; attnum++)
+	{
+		if (!TupleDescAttr(tupleDesc, attnum)->attbyval)
+			break;
+	}
+
+	if (attnum == 0)
+		return;
+
+	zslot->nfixedatts = attnum;
+	zslot->fixedattoffs = (uint16 *)
+		MemoryContextAlloc(slot->tts_mcxt, sizeof(uint16) * (attnum + 1));
+	for (attnum = 0; attnum < zslot->nfixedatts; attnum++)
+	{
+		zslot->fixedattoffs[attnum] = off;
+		off += TupleDescAttr(tupleDesc, attnum)->attlen;
+	}
+	zslot->fixedattoffs[attnum] = off;
 }
 
 static void
 tts_zheap_release(TupleTableSlot *slot)
 {
+	ZHeapTupleTableSlot *zslot = (ZHeapTupleTableSlot *) slot;
+
+	if (zslot->fixedattoffs)
+		pfree(zslot->fixedattoffs);
 }
 
 static void
@@ -846,6 +918,7 @@ void
 slot_deform_ztuple(TupleTableSlot *slot, ZHeapTuple tuple,
 				   uint32 *offp, int natts)
 {
+	ZHeapTupleTableSlot *zslot = (ZHeapTupleTableSlot *) slot;
 	TupleDesc	tupleDesc = slot->tts_tupleDescriptor;
 	Datum	   *values = slot->tts_values;
 	bool	   *isnull = slot->tts_isnull;
@@ -869,7 +942,34 @@ slot_deform_ztuple(TupleTableSlot *slot, ZHeapTuple tuple,
 	else
 		off = *offp;			/* Restore state from previous execution */
 
-	tp = (char *) tup + tup->t_hoff + off;
+	tp = (char *) tup + tup->t_hoff;
+
+	/*
+	 * Fast path for the leading pass-by-value attributes, whose offsets are
+	 * known in advance.  We can use it until we see the first null; if a
+	 * previous call has already gone past a null, the saved offset won't
+	 * match the precomputed one.
+	 */
+	if (TTS_IS_ZHEAP(slot) && attnum < zslot->nfixedatts &&
+		off == zslot->fixedattoffs[attnum])
+	{
+		int			nfixed = Min(natts, zslot->nfixedatts);
+
+		for (; attnum < nfixed; attnum++)
+		{
+			if (hasnulls && att_isnull(attnum, bp))
+				break;
+
+			values[attnum] =
+				fetch_unaligned_att(tp + zslot->fixedattoffs[attnum],
+									TupleDescAttr(tupleDesc, attnum)->attlen);
+			isnull[attnum] = false;
+		}
+
+		off = zslot->fixedattoffs[attnum];
+	}
+
+	tp += off;
 
 	for (; attnum < natts; attnum++)
 	{
@@ -896,24 +996,7 @@ slot_deform_ztuple(TupleTableSlot *slot, ZHeapTuple tuple,
 		}
 
 		if (thisatt->attbyval)
-		{
-			Datum		datum;
-
-			/*
-			 * Since pass-by-value attributes are not aligned in zheap, use
-			 * memcpy to copy the value into adequately-aligned storage. Since
-			 * it's pass-by-value, a Datum must be big enough.
-			 */
-			memcpy(&datum, tp, thisatt->attlen);
-
-			/*
-			 * We use fetch_att to set the other uninitialized bytes in datum
-			 * field as zero.  We could achieve that by just initializing
-			 * datum with zero, but this helps us to keep the code in sync
-			 * with heap.
-			 */
-			values[attnum] = fetch_att(&datum, true, thisatt->attlen);
-		}
+			values[attnum] = fetch_unaligned_att(tp, thisatt->attlen);
 		else
 			values[attnum] = PointerGetDatum(tp);
 
@@ -41,6 +41,10 @@ static void RestoreXactFromUndoRecord(UnpackedUndoRecord *urec, Buffer buffer,
 static int	TransSlotFromUndoRecord(UnpackedUndoRecord *urec,
 									ZHeapTupleHeader hdr, Page page);
 static void log_zheap_undo_actions(ZHeapUndoActionWALInfo *wal_info);
+static bool zheap_undo_bulk_append(UndoRecInfo *urp_array, int first_idx,
+								   int last_idx, Oid reloid,
+								   FullTransactionId full_xid,
+								   bool blk_chain_complete);
 
 /*
  * Per-undorecord callback from UndoFetchRecord to check whether
@@ -53,6 +57,21 @@ ZHeapSatisfyUndoRecord(UnpackedUndoRecord *urec, BlockNumber blkno,
 	Assert(urec != NULL);
 	Assert(blkno != InvalidBlockNumber);
 
+	/*
+	 * A bulk-append record covers all our tuples in every block from its
+	 * starting block onwards that points to it.
+	 */
+	if (urec->uur_type == UNDO_BULK_APPEND)
+	{
+		BlockNumber start_blkno;
+
+		if (TransactionIdIsValid(xid) && !TransactionIdEquals(xid, urec->uur_xid))
+			return false;
+
+		memcpy(&start_blkno, urec->uur_payload.data, sizeof(BlockNumber));
+		return blkno >= start_blkno;
+	}
+
 	if ((urec->uur_block != blkno ||
 		 (TransactionIdIsValid(xid) && !TransactionIdEquals(xid, urec->uur_xid))))
 		return false;
@@ -205,6 +224,47 @@ TransSlotFromUndoRecord(UnpackedUndoRecord *urec, ZHeapTupleHeader hdr,
 	return trans_slot_id;
 }
 
+/*
+ * UndoRecordGetVersionSkip
+ *
+ * Extract the skip information from the payload of an in-place update's undo
+ * record, see ZHeapUndoVersionSkip.  It follows the transaction slot and the
+ * subtransaction id, if present, and is recognized by the payload being long
+ * enough to hold it and by its magic number.  Returns false, with the
+ * pointers in *skip set invalid, if the record has none.
+ */
+bool
+UndoRecordGetVersionSkip(UnpackedUndoRecord *urec, ZHeapUndoVersionSkip *skip)
+{
+	int			offset = 0;
+
+	if (urec->uur_type == UNDO_INPLACE_UPDATE)
+	{
+		if (urec->uur_info & UREC_INFO_PAYLOAD_CONTAINS_SLOT)
+			offset += sizeof(int);
+		if (urec->uur_info & UREC_INFO_PAYLOAD_CONTAINS_SUBXACT)
+			offset += sizeof(SubTransactionId);
+
+		if (urec->uur_payload.len == offset + SizeOfZHeapUndoVersionSkip)
+		{
+			/* Undo records aren't aligned, see TransSlotFromUndoRecord. */
+			memcpy(skip, urec->uur_payload.data + offset,
+				   SizeOfZHeapUndoVersionSkip);
+
+			/* Nothing else can follow the slot and subtransaction. */
+			Assert(skip->magic == ZHEAP_UNDO_VERSION_SKIP);
+			if (skip->magic == ZHEAP_UNDO_VERSION_SKIP)
+				return true;
+		}
+	}
+
+	memset(skip, 0, sizeof(ZHeapUndoVersionSkip));
+	skip->prev_urecptr = InvalidUndoRecPtr;
+	skip->jump_urecptr = InvalidUndoRecPtr;
+	skip->jump_xid = InvalidTransactionId;
+	return false;
+}
+
 /*
  * ValidateTuplesXact - Check if the tuple is modified by priorXmax.
  *
@@ -652,6 +712,45 @@ undo_action_insert(Relation rel, Page page, OffsetNumber off,
 	ZPageSetPrunable(page, xid);
 }
 
+/*
+ * undo_action_bulk_append - perform the undo action for a bulk append
+ *
+ *	All the tuples on the page that still point to our transaction slot were
+ *	inserted by the bulk append: the undo of anything else we did to them has
+ *	already been applied.  Returns true if no item on the page remains used.
+ */
+static bool
+undo_action_bulk_append(Relation rel, Page page, int slot_no,
+						TransactionId xid)
+{
+	OffsetNumber offnum,
+				maxoff;
+
+	maxoff = PageGetMaxOffsetNumber(page);
+	for (offnum = FirstOffsetNumber; offnum <= maxoff; offnum++)
+	{
+		ItemId		lp = PageGetItemId(page, offnum);
+		ZHeapTupleHeader zhtup;
+
+		if (!ItemIdIsNormal(lp))
+			continue;
+
+		zhtup = (ZHeapTupleHeader) PageGetItem(page, lp);
+		if (ZHeapTupleHeaderGetXactSlot(zhtup) == slot_no)
+			undo_action_insert(rel, page, offnum, xid);
+	}
+
+	for (offnum = FirstOffsetNumber; offnum <= maxoff; offnum++)
+	{
+		ItemId		lp = PageGetItemId(page, offnum);
+
+		if (ItemIdIsUsed(lp) || ItemIdHasPendingXact(lp))
+			return false;
+	}
+
+	return true;
+}
+
 /*
  * zheap_undo_actions - Execute the undo actions for a zheap page
  *
@@ -700,6 +799,11 @@ zheap_undo_actions(UndoRecInfo *urp_array, int first_idx, int last_idx,
 		return false;
 	}
 
+	/* Only bulk-append records aren't tied to a block. */
+	if (!BlockNumberIsValid(blkno))
+		return zheap_undo_bulk_append(urp_array, first_idx, last_idx, reloid,
+									  full_xid, blk_chain_complete);
+
 	/*
 	 * We always try to lock the relation.  If the relation is already gone,
 	 * then we can skip processing the undo actions.
@@ -849,7 +953,8 @@ zheap_undo_actions(UndoRecInfo *urp_array, int first_idx, int last_idx,
 					 * If a dead item is found, ensure that it is from
 					 * speculative abort case only.
 					 */
-					if (ItemIdIsDead(lp))
+					if (ItemIdIsDead(lp) &&
+						(uur->uur_info & UREC_INFO_PAYLOAD_CONTAINS_REUSED_ITEM) == 0)
 					{
 						/* Fetch if this is a speculative insert case */
 						specToken = *(uint32 *) uur->uur_payload.data;
@@ -863,6 +968,22 @@ zheap_undo_actions(UndoRecInfo *urp_array, int first_idx, int last_idx,
 
 					undo_action_insert(rel, page, uur->uur_offset, xid);
 
+					/*
+					 * If the tuple took over the storage of an item deleted
+					 * by the same transaction, give it back.  The undo
+					 * action of the delete will restore its contents.
+					 */
+					if (uur->uur_info & UREC_INFO_PAYLOAD_CONTAINS_REUSED_ITEM)
+					{
+						ZHeapReusedItem reused_item;
+
+						memcpy(&reused_item,
+							   uur->uur_payload.data + uur->uur_payload.len -
+							   SizeOfZHeapReusedItem,
+							   SizeOfZHeapReusedItem);
+						ZPageRestoreReusedItem(page, &reused_item);
+					}
+
 					nline = PageGetMaxOffsetNumber(page);
 					need_init = true;
 					for (i = FirstOffsetNumber; i <= nline; i++)
@@ -1018,6 +1139,9 @@ zheap_undo_actions(UndoRecInfo *urp_array, int first_idx, int last_idx,
 				break;
 			case UNDO_XID_MULTI_LOCK_ONLY:
 				break;
+			case UNDO_BULK_APPEND:
+				need_init = undo_action_bulk_append(rel, page, slot_no, xid);
+				break;
 			case UNDO_ITEMID_UNUSED:
 				{
 					int			item_count,
@@ -1120,6 +1244,142 @@ zheap_undo_actions(UndoRecInfo *urp_array, int first_idx, int last_idx,
 	return true;
 }
 
+/*
+ * zheap_undo_bulk_append - Execute the undo actions of bulk-append records
+ *
+ *	A bulk-append record covers every page from its starting block onwards
+ *	whose slot for the transaction points to it, so we scan all those pages
+ *	and remove the tuples the transaction has inserted there.  The records sort
+ *	after all the others of the relation (see undo_record_comparator), so by
+ *	now the undo of whatever else the transaction did to those pages has been
+ *	applied, and their slots point back to the bulk-append record.  It might
+ *	have cleared the xid from the slot already, if the chain of the block was
+ *	complete.
+ *
+ *	returns true, if successfully applied the undo actions, otherwise, false.
+ */
+static bool
+zheap_undo_bulk_append(UndoRecInfo *urp_array, int first_idx, int last_idx,
+					   Oid reloid, FullTransactionId full_xid,
+					   bool blk_chain_complete)
+{
+	Relation	rel;
+	BlockNumber nblocks;
+	TransactionId xid = XidFromFullTransactionId(full_xid);
+	int			i;
+
+	rel = try_relation_open(reloid, RowExclusiveLock);
+	if (rel == NULL)
+	{
+		elog(LOG, "relation is already dropped.");
+		return false;
+	}
+
+	nblocks = RelationGetNumberOfBlocks(rel);
+
+	for (i = first_idx; i <= last_idx; i++)
+	{
+		UndoRecInfo *urec_info = (UndoRecInfo *) urp_array + i;
+		UnpackedUndoRecord *uur = urec_info->uur;
+		BlockNumber start_blkno;
+		BlockNumber blkno;
+
+		Assert(uur->uur_type == UNDO_BULK_APPEND);
+		Assert(xid == uur->uur_xid);
+
+		memcpy(&start_blkno, uur->uur_payload.data, sizeof(BlockNumber));
+
+		for (blkno = start_blkno; blkno < nblocks; blkno++)
+		{
+			Buffer		buffer;
+			Page		page;
+			ZHeapPageOpaque opaque;
+			int			nslots = ZHEAP_PAGE_TRANS_SLOTS;
+			int			slot_no = InvalidXactSlotId;
+			int			j;
+			bool		need_init;
+
+			buffer = ReadBuffer(rel, blkno);
+			LockBuffer(buffer, BUFFER_LOCK_EXCLUSIVE);
+			page = BufferGetPage(buffer);
+
+			if (PageIsNew(page))
+			{
+				UnlockReleaseBuffer(buffer);
+				continue;
+			}
+
+			/*
+			 * Find our slot on the page.  Pages of a bulk append never use
+			 * TPD slots.
+			 */
+			opaque = (ZHeapPageOpaque) PageGetSpecialPointer(page);
+			if (ZHeapPageHasTPDSlot((PageHeader) page))
+				nslots--;
+			for (j = 0; j < nslots; j++)
+			{
+				TransInfo  *thistrans = &opaque->transinfo[j];
+
+				if (thistrans->urec_ptr == urec_info->urp &&
+					(FullTransactionIdEquals(thistrans->fxid, full_xid) ||
+					 !FullTransactionIdIsValid(thistrans->fxid)))
+				{
+					slot_no = j + 1;
+					break;
+				}
+			}
+
+			/* Not part of the bulk append, or already rolled back. */
+			if (slot_no == InvalidXactSlotId)
+			{
+				UnlockReleaseBuffer(buffer);
+				continue;
+			}
+
+			START_CRIT_SECTION();
+
+			need_init = undo_action_bulk_append(rel, page, slot_no, xid);
+
+			PageSetTransactionSlotInfo(buffer, slot_no,
+									   blk_chain_complete ?
+									   InvalidFullTransactionId : full_xid,
+									   uur->uur_blkprev);
+
+			MarkBufferDirty(buffer);
+
+			if (RelationNeedsWAL(rel))
+			{
+				ZHeapUndoActionWALInfo wal_info;
+
+				wal_info.buffer = buffer;
+				wal_info.vmbuffer = InvalidBuffer;
+				wal_info.prev_urecptr = uur->uur_blkprev;
+				wal_info.slot_id = slot_no;
+				wal_info.tpd_page_locked = false;
+				wal_info.tpd_offset_map = NULL;
+				wal_info.is_tpd_map_updated = false;
+				wal_info.tpd_map_size = 0;
+				wal_info.fxid = blk_chain_complete ?
+					InvalidFullTransactionId : full_xid;
+				wal_info.need_init = need_init;
+				log_zheap_undo_actions(&wal_info);
+			}
+
+			/* See zheap_undo_actions. */
+			if (need_init)
+				ZheapInitPage(page, (Size) BLCKSZ);
+
+			END_CRIT_SECTION();
+
+			UnlockReleaseBuffer(buffer);
+		}
+	}
+
+	relation_close(rel, RowExclusiveLock);
+
+	return true;
+}
+
  /*
   * log_zheap_undo_actions Perform XLogInsert for zheap_undo_actions.
   *
@@ -1270,6 +1530,7 @@ RestoreTupleFromUndoRecord(UnpackedUndoRecord *urec, Page page,
 			break;
 		case UNDO_INSERT:
 		case UNDO_MULTI_INSERT:
+		case UNDO_BULK_APPEND:
 		case UNDO_XID_MULTI_LOCK_ONLY:
 			elog(ERROR, "invalid undo record type for restoring tuple");
 			break;
@@ -268,6 +268,7 @@ reacquire_slot:
 	{
 		LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
 
+		pgstat_count_zheap_slot_wait(onerel);
 		pgstat_report_wait_start(PG_WAIT_PAGE_TRANS_SLOT);
 		pg_usleep(10000L);		/* 10 ms */
 		pgstat_report_wait_end();
@@ -836,32 +837,6 @@ lazy_scan_zheap(Relation onerel, VacuumParams *params, LVRelStats *vacrelstats,
 			continue;
 		}
 
-		/*
-		 * Skip TPD pages.  This needs to be checked before PageIsEmpty as TPD
-		 * pages can also be empty, but we don't want to deal with it like a
-		 * heap page.
-		 */
-
-		/*
-		 * Prune the TPD pages and if all the entries are removed, then record
-		 * it in FSM, so that it can be reused as a zheap page.
-		 */
-		if (IsTPDPage(page))
-		{
-			TPDPagePrune(onerel, buf, vac_strategy, InvalidOffsetNumber, 0,
-						 true, NULL, NULL);
-
-			/*
-			 * Remember the location of the last page with non-removable
-			 * tuples.
-			 */
-			if (!PageIsNew(page))
-				vacrelstats->nonempty_pages = blkno + 1;
-
-			UnlockReleaseBuffer(buf);
-			continue;
-		}
-
 		if (PageIsEmpty(page))
 		{
 			uint8		vmstatus;
@@ -1192,6 +1167,9 @@ lazy_scan_zheap(Relation onerel, VacuumParams *params, LVRelStats *vacrelstats,
 	if (blkno > next_fsm_block_to_vacuum)
 		FreeSpaceMapVacuumRange(onerel, next_fsm_block_to_vacuum, blkno);
 
+	/* TPD pages live in a separate fork, so prune them separately. */
+	TPDVacuumPages(onerel, vac_strategy);
+
 	/* Report that we're cleaning up. */
 	pgstat_progress_update_param(PROGRESS_VACUUM_PHASE,
 								 PROGRESS_VACUUM_PHASE_INDEX_CLEANUP);
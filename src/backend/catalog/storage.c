@@ -243,6 +243,7 @@ RelationTruncate(Relation rel, BlockNumber nblocks)
 	rel->rd_smgr->smgr_targblock = InvalidBlockNumber;
 	rel->rd_smgr->smgr_fsm_nblocks = InvalidBlockNumber;
 	rel->rd_smgr->smgr_vm_nblocks = InvalidBlockNumber;
+	rel->rd_smgr->smgr_tpd_nblocks = InvalidBlockNumber;
 
 	/* Truncate the FSM first if it exists */
 	fsm = smgrexists(rel->rd_smgr, FSM_FORKNUM);
@@ -636,6 +637,15 @@ smgr_redo(XLogReaderState *record)
 			smgrexists(reln, VISIBILITYMAP_FORKNUM))
 			visibilitymap_truncate(rel, xlrec->blkno);
 
+		/* TPD fork of a zheap relation, if requested, is removed entirely */
+		if ((xlrec->flags & SMGR_TRUNCATE_TPD) != 0 &&
+			smgrexists(reln, TPD_FORKNUM))
+		{
+			smgrtruncate(reln, TPD_FORKNUM, 0);
+			reln->smgr_tpd_nblocks = InvalidBlockNumber;
+			XLogTruncateRelation(xlrec->rnode, TPD_FORKNUM, 0);
+		}
+
 		FreeFakeRelcacheEntry(rel);
 	}
 	else
@@ -580,6 +580,25 @@ CREATE VIEW pg_stat_xact_user_tables AS
     WHERE schemaname NOT IN ('pg_catalog', 'information_schema') AND
           schemaname !~ '^pg_toast';
 
+CREATE VIEW pg_stat_zheap_tables AS
+    SELECT
+            C.oid AS relid,
+            N.nspname AS schemaname,
+            C.relname AS relname,
+            S.n_tup_inplace_upd,
+            S.n_tup_noninplace_upd_index,
+            S.n_tup_noninplace_upd_space,
+            S.n_tup_noninplace_upd_slot,
+            S.n_tpd_slot_alloc,
+            S.n_slot_wait,
+            S.n_undo_fetch,
+            S.max_undo_chain
+    FROM pg_class C JOIN
+         pg_am A ON (A.oid = C.relam)
+         LEFT JOIN pg_namespace N ON (N.oid = C.relnamespace),
+         LATERAL pg_stat_get_zheap_counts(C.oid) S
+    WHERE C.relkind IN ('r', 't', 'm') AND A.amname = 'zheap';
+
 CREATE VIEW pg_statio_all_tables AS
     SELECT
             C.oid AS relid,
@@ -1021,6 +1040,14 @@ CREATE VIEW pg_stat_undo_logs AS
     SELECT *
     FROM pg_stat_get_undo_logs();
 
+CREATE VIEW pg_stat_undo_queues AS
+    SELECT *
+    FROM pg_stat_get_undo_queues();
+
+CREATE VIEW pg_stat_undo_tablespaces AS
+    SELECT *
+    FROM pg_stat_get_undo_tablespaces();
+
 --
 -- We have a few function definitions in here, too.
 -- At some point there might be enough to justify breaking them out into
@@ -7,6 +7,12 @@
  * knowledge of the tuple descriptor. Fixed column widths, NOT NULLness, etc
  * can be taken advantage of.
  *
+ * Zheap tuples are deformed by the same code.  Their layout differs in the
+ * tuple header, in that pass-by-value attributes are stored without
+ * alignment padding, so those are fetched using unaligned loads, and in
+ * that the other attributes are aligned relative to their address, like
+ * zheap_deform_tuple does, as the tuple data itself needn't be aligned.
+ *
  * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
  * Portions Copyright (c) 1994, Regents of the University of California
  *
@@ -22,6 +28,7 @@
 
 #include "access/htup_details.h"
 #include "access/tupdesc_details.h"
+#include "access/zhtup.h"
 #include "executor/tuptable.h"
 #include "jit/llvmjit.h"
 #include "jit/llvmjit_emit.h"
@@ -87,6 +94,12 @@ slot_compile_deform(LLVMJitContext *context, TupleDesc desc,
 	/* if true, known_alignment describes definite offset of column */
 	bool		attguaranteedalign = true;
 
+	/*
+	 * if true, pass-by-value columns are stored without alignment, and the
+	 * others are aligned by address rather than by offset
+	 */
+	bool		zheap_layout;
+
 	int			attnum;
 
 	/* virtual tuples never need deforming, so don't generate code */
@@ -95,9 +108,11 @@ slot_compile_deform(LLVMJitContext *context, TupleDesc desc,
 
 	/* decline to JIT for slot types we don't know to handle */
 	if (ops != &TTSOpsHeapTuple && ops != &TTSOpsBufferHeapTuple &&
-		ops != &TTSOpsMinimalTuple)
+		ops != &TTSOpsMinimalTuple && ops != &TTSOpsZHeapTuple)
 		return NULL;
 
+	zheap_layout = (ops == &TTSOpsZHeapTuple);
+
 	mod = llvm_mutable_module(context);
 
 	funcname = llvm_expand_funcname(context, "deform");
@@ -208,56 +223,117 @@ slot_compile_deform(LLVMJitContext *context, TupleDesc desc,
 			l_load_struct_gep(b, v_minimalslot, FIELDNO_MINIMALTUPLETABLESLOT_TUPLE,
 							  "tupleheader");
 	}
+	else if (ops == &TTSOpsZHeapTuple)
+	{
+		LLVMValueRef v_zheapslot;
+
+		v_zheapslot =
+			LLVMBuildBitCast(b,
+							 v_slot,
+							 l_ptr(StructZHeapTupleTableSlot),
+							 "zheapslot");
+		v_slotoffp = LLVMBuildStructGEP(b, v_zheapslot, FIELDNO_ZHEAPTUPLETABLESLOT_OFF, "");
+		v_tupleheaderp =
+			l_load_struct_gep(b, v_zheapslot, FIELDNO_ZHEAPTUPLETABLESLOT_TUPLE,
+							  "tupleheader");
+	}
 	else
 	{
 		/* should've returned at the start of the function */
 		pg_unreachable();
 	}
 
-	v_tuplep =
-		l_load_struct_gep(b, v_tupleheaderp, FIELDNO_HEAPTUPLEDATA_DATA,
-						  "tuple");
-	v_bits =
-		LLVMBuildBitCast(b,
-						 LLVMBuildStructGEP(b, v_tuplep,
-											FIELDNO_HEAPTUPLEHEADERDATA_BITS,
+	if (ops == &TTSOpsZHeapTuple)
+	{
+		v_tuplep =
+			l_load_struct_gep(b, v_tupleheaderp, FIELDNO_ZHEAPTUPLEDATA_DATA,
+							  "tuple");
+		v_bits =
+			LLVMBuildBitCast(b,
+							 LLVMBuildStructGEP(b, v_tuplep,
+												FIELDNO_ZHEAPTUPLEHEADERDATA_BITS,
+												""),
+							 l_ptr(LLVMInt8Type()),
+							 "t_bits");
+		v_infomask1 =
+			l_load_struct_gep(b, v_tuplep,
+							  FIELDNO_ZHEAPTUPLEHEADERDATA_INFOMASK,
+							  "infomask1");
+		v_infomask2 =
+			l_load_struct_gep(b,
+							  v_tuplep, FIELDNO_ZHEAPTUPLEHEADERDATA_INFOMASK2,
+							  "infomask2");
+
+		/* t_infomask & ZHEAP_HASNULL */
+		v_hasnulls =
+			LLVMBuildICmp(b, LLVMIntNE,
+						  LLVMBuildAnd(b,
+									   l_int16_const(ZHEAP_HASNULL),
+									   v_infomask1, ""),
+						  l_int16_const(0),
+						  "hasnulls");
+
+		/* t_infomask2 & ZHEAP_NATTS_MASK */
+		v_maxatt = LLVMBuildAnd(b,
+								l_int16_const(ZHEAP_NATTS_MASK),
+								v_infomask2,
+								"maxatt");
+
+		/* see below for the reason to zext */
+		v_hoff =
+			LLVMBuildZExt(b,
+						  l_load_struct_gep(b, v_tuplep,
+											FIELDNO_ZHEAPTUPLEHEADERDATA_HOFF,
 											""),
-						 l_ptr(LLVMInt8Type()),
-						 "t_bits");
-	v_infomask1 =
-		l_load_struct_gep(b, v_tuplep,
-						  FIELDNO_HEAPTUPLEHEADERDATA_INFOMASK,
-						  "infomask1");
-	v_infomask2 =
-		l_load_struct_gep(b,
-						  v_tuplep, FIELDNO_HEAPTUPLEHEADERDATA_INFOMASK2,
-						  "infomask2");
-
-	/* t_infomask & HEAP_HASNULL */
-	v_hasnulls =
-		LLVMBuildICmp(b, LLVMIntNE,
-					  LLVMBuildAnd(b,
-								   l_int16_const(HEAP_HASNULL),
-								   v_infomask1, ""),
-					  l_int16_const(0),
-					  "hasnulls");
-
-	/* t_infomask2 & HEAP_NATTS_MASK */
-	v_maxatt = LLVMBuildAnd(b,
-							l_int16_const(HEAP_NATTS_MASK),
-							v_infomask2,
-							"maxatt");
+						  LLVMInt32Type(), "t_hoff");
+	}
+	else
+	{
+		v_tuplep =
+			l_load_struct_gep(b, v_tupleheaderp, FIELDNO_HEAPTUPLEDATA_DATA,
+							  "tuple");
+		v_bits =
+			LLVMBuildBitCast(b,
+							 LLVMBuildStructGEP(b, v_tuplep,
+												FIELDNO_HEAPTUPLEHEADERDATA_BITS,
+												""),
+							 l_ptr(LLVMInt8Type()),
+							 "t_bits");
+		v_infomask1 =
+			l_load_struct_gep(b, v_tuplep,
+							  FIELDNO_HEAPTUPLEHEADERDATA_INFOMASK,
+							  "infomask1");
+		v_infomask2 =
+			l_load_struct_gep(b,
+							  v_tuplep, FIELDNO_HEAPTUPLEHEADERDATA_INFOMASK2,
+							  "infomask2");
+
+		/* t_infomask & HEAP_HASNULL */
+		v_hasnulls =
+			LLVMBuildICmp(b, LLVMIntNE,
+						  LLVMBuildAnd(b,
+									   l_int16_const(HEAP_HASNULL),
+									   v_infomask1, ""),
+						  l_int16_const(0),
+						  "hasnulls");
+
+		/* t_infomask2 & HEAP_NATTS_MASK */
+		v_maxatt = LLVMBuildAnd(b,
+								l_int16_const(HEAP_NATTS_MASK),
+								v_infomask2,
+								"maxatt");
 
-	/*
-	 * Need to zext, as getelementptr otherwise treats hoff as a signed 8bit
-	 * integer, which'd yield a negative offset for t_hoff > 127.
-	 */
-	v_hoff =
-		LLVMBuildZExt(b,
-					  l_load_struct_gep(b, v_tuplep,
-										FIELDNO_HEAPTUPLEHEADERDATA_HOFF,
-										""),
-					  LLVMInt32Type(), "t_hoff");
+		/*
+		 * Need to zext, as getelementptr otherwise treats hoff as a signed
+		 * 8bit integer, which'd yield a negative offset for t_hoff > 127.
+		 */
+		v_hoff =
+			LLVMBuildZExt(b,
+						  l_load_struct_gep(b, v_tuplep,
+											FIELDNO_HEAPTUPLEHEADERDATA_HOFF,
+											""),
+						  LLVMInt32Type(), "t_hoff");
+	}
 
 	v_tupdata_base =
 		LLVMBuildGEP(b,
@@ -476,7 +552,9 @@ slot_compile_deform(LLVMJitContext *context, TupleDesc desc,
 		LLVMPositionBuilderAtEnd(b, attcheckalignblocks[attnum]);
 
 		/* determine required alignment */
-		if (att->attalign == 'i')
+		if (zheap_layout && att->attbyval)
+			alignto = 1;
+		else if (att->attalign == 'i')
 			alignto = ALIGNOF_INT;
 		else if (att->attalign == 'c')
 			alignto = 1;
@@ -497,10 +575,13 @@ slot_compile_deform(LLVMJitContext *context, TupleDesc desc,
 		 * - columns following a NOT NULL fixed width datum have known
 		 *   alignment, can skip alignment computation if that known alignment
 		 *   is compatible with current column.
+		 * Neither holds for zheap tuples, whose data needn't start at an
+		 * aligned address.
 		 * ------
 		 */
 		if (alignto > 1 &&
-			(known_alignment < 0 || known_alignment != TYPEALIGN(alignto, known_alignment)))
+			(zheap_layout || known_alignment < 0 ||
+			 known_alignment != TYPEALIGN(alignto, known_alignment)))
 		{
 			/*
 			 * When accessing a varlena field, we have to "peek" to see if we
@@ -539,7 +620,37 @@ slot_compile_deform(LLVMJitContext *context, TupleDesc desc,
 
 			LLVMPositionBuilderAtEnd(b, attalignblocks[attnum]);
 
+			/*
+			 * For zheap, translation of att_align_pointer() instead: align
+			 * the address of the column, and go back to an offset.
+			 */
+			if (zheap_layout)
+			{
+				LLVMValueRef v_base;
+				LLVMValueRef v_addr;
+				LLVMValueRef v_addr_aligned;
+				LLVMValueRef v_off = LLVMBuildLoad(b, v_offp, "");
+
+				v_base = LLVMBuildPtrToInt(b, v_tupdata_base, TypeSizeT, "");
+				v_addr = LLVMBuildAdd(b, v_base, v_off, "");
+				v_addr_aligned =
+					LLVMBuildAnd(b,
+								 LLVMBuildAdd(b, v_addr,
+											  l_sizet_const(alignto - 1), ""),
+								 l_sizet_const(~(alignto - 1)),
+								 "aligned_address");
+
+				LLVMBuildStore(b,
+							   LLVMBuildSub(b, v_addr_aligned, v_base,
+											"aligned_offset"),
+							   v_offp);
+
+				/* the offset of the following columns isn't known anymore */
+				known_alignment = -1;
+				attguaranteedalign = false;
+			}
 			/* translation of alignment code (cf TYPEALIGN()) */
+			else
 			{
 				LLVMValueRef v_off_aligned;
 				LLVMValueRef v_off = LLVMBuildLoad(b, v_offp, "");
@@ -657,6 +768,8 @@ slot_compile_deform(LLVMJitContext *context, TupleDesc desc,
 			v_tmp_loaddata =
 				LLVMBuildPointerCast(b, v_attdatap, vartypep, "");
 			v_tmp_loaddata = LLVMBuildLoad(b, v_tmp_loaddata, "attr_byval");
+			if (zheap_layout)
+				LLVMSetAlignment(v_tmp_loaddata, 1);
 			v_tmp_loaddata = LLVMBuildZExt(b, v_tmp_loaddata, TypeSizeT, "");
 
 			LLVMBuildStore(b, v_tmp_loaddata, v_resultp);
@@ -4895,11 +4895,19 @@ pgstat_get_tab_entry(PgStat_StatDBEntry *dbentry, Oid tableoid, bool create)
 		result->tuples_updated = 0;
 		result->tuples_deleted = 0;
 		result->tuples_hot_updated = 0;
+		result->tuples_inplace_updated = 0;
 		result->n_live_tuples = 0;
 		result->n_dead_tuples = 0;
 		result->changes_since_analyze = 0;
 		result->blocks_fetched = 0;
 		result->blocks_hit = 0;
+		result->zheap_noninplace_index = 0;
+		result->zheap_noninplace_space = 0;
+		result->zheap_noninplace_slot = 0;
+		result->zheap_tpd_slots = 0;
+		result->zheap_slot_waits = 0;
+		result->zheap_undo_fetched = 0;
+		result->zheap_undo_chain_max = 0;
 		result->vacuum_timestamp = 0;
 		result->vacuum_count = 0;
 		result->autovac_vacuum_timestamp = 0;
@@ -6031,6 +6039,13 @@ pgstat_recv_tabstat(PgStat_MsgTabstat *msg, int len)
 			tabentry->changes_since_analyze = tabmsg->t_counts.t_changed_tuples;
 			tabentry->blocks_fetched = tabmsg->t_counts.t_blocks_fetched;
 			tabentry->blocks_hit = tabmsg->t_counts.t_blocks_hit;
+			tabentry->zheap_noninplace_index = tabmsg->t_counts.t_zheap_noninplace_index;
+			tabentry->zheap_noninplace_space = tabmsg->t_counts.t_zheap_noninplace_space;
+			tabentry->zheap_noninplace_slot = tabmsg->t_counts.t_zheap_noninplace_slot;
+			tabentry->zheap_tpd_slots = tabmsg->t_counts.t_zheap_tpd_slots;
+			tabentry->zheap_slot_waits = tabmsg->t_counts.t_zheap_slot_waits;
+			tabentry->zheap_undo_fetched = tabmsg->t_counts.t_zheap_undo_fetched;
+			tabentry->zheap_undo_chain_max = tabmsg->t_counts.t_zheap_undo_chain_max;
 
 			tabentry->vacuum_timestamp = 0;
 			tabentry->vacuum_count = 0;
@@ -6065,6 +6080,14 @@ pgstat_recv_tabstat(PgStat_MsgTabstat *msg, int len)
 			tabentry->changes_since_analyze += tabmsg->t_counts.t_changed_tuples;
 			tabentry->blocks_fetched += tabmsg->t_counts.t_blocks_fetched;
 			tabentry->blocks_hit += tabmsg->t_counts.t_blocks_hit;
+			tabentry->zheap_noninplace_index += tabmsg->t_counts.t_zheap_noninplace_index;
+			tabentry->zheap_noninplace_space += tabmsg->t_counts.t_zheap_noninplace_space;
+			tabentry->zheap_noninplace_slot += tabmsg->t_counts.t_zheap_noninplace_slot;
+			tabentry->zheap_tpd_slots += tabmsg->t_counts.t_zheap_tpd_slots;
+			tabentry->zheap_slot_waits += tabmsg->t_counts.t_zheap_slot_waits;
+			tabentry->zheap_undo_fetched += tabmsg->t_counts.t_zheap_undo_fetched;
+			tabentry->zheap_undo_chain_max = Max(tabentry->zheap_undo_chain_max,
+												 tabmsg->t_counts.t_zheap_undo_chain_max);
 		}
 
 		/* Clamp n_live_tuples in case of negative delta_live_tuples */
@@ -24,6 +24,9 @@
 #include "access/undolog.h"
 #include "access/undorequest.h"
 #include "access/undoworker.h"
+#include "access/zcrcache.h"
+#include "access/zkeyshare.h"
+#include "access/zlocktable.h"
 #include "commands/async.h"
 #include "miscadmin.h"
 #include "pgstat.h"
@@ -153,6 +156,9 @@ CreateSharedMemoryAndSemaphores(int port)
 		size = add_size(size, AsyncShmemSize());
 		size = add_size(size, PendingUndoShmemSize());
 		size = add_size(size, UndoLauncherShmemSize());
+		size = add_size(size, ZHeapCRCacheShmemSize());
+		size = add_size(size, ZHeapLockTableShmemSize());
+		size = add_size(size, ZHeapKeyShareShmemSize());
 #ifdef EXEC_BACKEND
 		size = add_size(size, ShmemBackendArraySize());
 #endif
@@ -264,6 +270,9 @@ CreateSharedMemoryAndSemaphores(int port)
 	WalRcvShmemInit();
 	ApplyLauncherShmemInit();
 	UndoLauncherShmemInit();
+	ZHeapCRCacheShmemInit();
+	ZHeapLockTableShmemInit();
+	ZHeapKeyShareShmemInit();
 
 	/*
 	 * Set up other modules that need some shared memory space
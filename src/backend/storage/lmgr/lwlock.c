@@ -524,6 +524,10 @@ RegisterLWLockTranches(void)
 	LWLockRegisterTranche(LWTRANCHE_SXACT, "serializable_xact");
 	LWLockRegisterTranche(LWTRANCHE_UNDOLOG, "undo_log");
 	LWLockRegisterTranche(LWTRANCHE_UNDODISCARD, "undo_discard");
+	LWLockRegisterTranche(LWTRANCHE_ROLLBACK_HT, "rollback_request_hash");
+	LWLockRegisterTranche(LWTRANCHE_ZHEAP_CR_CACHE, "zheap_cr_cache");
+	LWLockRegisterTranche(LWTRANCHE_ZHEAP_KEY_SHARE, "zheap_key_share");
+	LWLockRegisterTranche(LWTRANCHE_ZHEAP_LOCK_TABLE, "zheap_lock_table");
 
 	/* Register named tranches. */
 	for (i = 0; i < NamedLWLockTrancheRequests; i++)
@@ -205,6 +205,7 @@ smgropen(RelFileNode rnode, BackendId backend)
 		reln->smgr_targblock = InvalidBlockNumber;
 		reln->smgr_fsm_nblocks = InvalidBlockNumber;
 		reln->smgr_vm_nblocks = InvalidBlockNumber;
+		reln->smgr_tpd_nblocks = InvalidBlockNumber;
 
 		/* Which storage manager implementation? */
 		reln->smgr_which = SmgrWhichForRelFileNode(rnode);
@@ -346,8 +346,22 @@ undofile_get_segment_file(SMgrRelation reln, int segno)
 		state->mru_file =
 			undofile_open_segment_file(reln->smgr_rnode.node.relNode,
 									   reln->smgr_rnode.node.spcNode,
-									   segno, InRecovery);
-		if (InRecovery && state->mru_file <= 0)
+									   segno, InRecovery || SmgrIsTemp(reln));
+		if (SmgrIsTemp(reln) && state->mru_file <= 0)
+		{
+			/*
+			 * Temporary undo logs don't create their segments up front, but
+			 * when a page first has to be written out of the local buffers.
+			 */
+			UndoLogNewTempSegment(reln->smgr_rnode.node.relNode,
+								  reln->smgr_rnode.node.spcNode,
+								  segno);
+			state->mru_file =
+				undofile_open_segment_file(reln->smgr_rnode.node.relNode,
+										   reln->smgr_rnode.node.spcNode,
+										   segno, false);
+		}
+		else if (InRecovery && state->mru_file <= 0)
 		{
 			/*
 			 * If in recovery, we may be trying to access a file that will
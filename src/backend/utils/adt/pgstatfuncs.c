@@ -173,6 +173,66 @@ pg_stat_get_tuples_inplace_updated(PG_FUNCTION_ARGS)
 }
 
 
+Datum
+pg_stat_get_zheap_counts(PG_FUNCTION_ARGS)
+{
+#define PG_STAT_GET_ZHEAP_COUNTS_COLS	8
+	Oid			relid = PG_GETARG_OID(0);
+	TupleDesc	tupdesc;
+	Datum		values[PG_STAT_GET_ZHEAP_COUNTS_COLS];
+	bool		nulls[PG_STAT_GET_ZHEAP_COUNTS_COLS];
+	PgStat_StatTabEntry *tabentry;
+
+	/* Initialise values and NULL flags arrays */
+	MemSet(values, 0, sizeof(values));
+	MemSet(nulls, 0, sizeof(nulls));
+
+	/* Initialise attributes information in the tuple descriptor */
+	tupdesc = CreateTemplateTupleDesc(PG_STAT_GET_ZHEAP_COUNTS_COLS);
+	TupleDescInitEntry(tupdesc, (AttrNumber) 1, "n_tup_inplace_upd",
+					   INT8OID, -1, 0);
+	TupleDescInitEntry(tupdesc, (AttrNumber) 2, "n_tup_noninplace_upd_index",
+					   INT8OID, -1, 0);
+	TupleDescInitEntry(tupdesc, (AttrNumber) 3, "n_tup_noninplace_upd_space",
+					   INT8OID, -1, 0);
+	TupleDescInitEntry(tupdesc, (AttrNumber) 4, "n_tup_noninplace_upd_slot",
+					   INT8OID, -1, 0);
+	TupleDescInitEntry(tupdesc, (AttrNumber) 5, "n_tpd_slot_alloc",
+					   INT8OID, -1, 0);
+	TupleDescInitEntry(tupdesc, (AttrNumber) 6, "n_slot_wait",
+					   INT8OID, -1, 0);
+	TupleDescInitEntry(tupdesc, (AttrNumber) 7, "n_undo_fetch",
+					   INT8OID, -1, 0);
+	TupleDescInitEntry(tupdesc, (AttrNumber) 8, "max_undo_chain",
+					   INT8OID, -1, 0);
+
+	BlessTupleDesc(tupdesc);
+
+	/* Fill values; all counters read as zero if the table has no entry. */
+	if ((tabentry = pgstat_fetch_stat_tabentry(relid)) != NULL)
+	{
+		values[0] = Int64GetDatum(tabentry->tuples_inplace_updated);
+		values[1] = Int64GetDatum(tabentry->zheap_noninplace_index);
+		values[2] = Int64GetDatum(tabentry->zheap_noninplace_space);
+		values[3] = Int64GetDatum(tabentry->zheap_noninplace_slot);
+		values[4] = Int64GetDatum(tabentry->zheap_tpd_slots);
+		values[5] = Int64GetDatum(tabentry->zheap_slot_waits);
+		values[6] = Int64GetDatum(tabentry->zheap_undo_fetched);
+		values[7] = Int64GetDatum(tabentry->zheap_undo_chain_max);
+	}
+	else
+	{
+		int			i;
+
+		for (i = 0; i < PG_STAT_GET_ZHEAP_COUNTS_COLS; i++)
+			values[i] = Int64GetDatum(0);
+	}
+
+	/* Returns the record as Datum */
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
+
+
 Datum
 pg_stat_get_live_tuples(PG_FUNCTION_ARGS)
 {
@@ -122,6 +122,7 @@ int			work_mem = 1024;
 int			maintenance_work_mem = 16384;
 int			max_parallel_maintenance_workers = 2;
 int			rollback_overflow_size = 64;
+int			rollback_request_queue_size = 1024;
 
 /*
  * We need this variable primarily to promote the error level to FATAL if we
@@ -35,6 +35,10 @@
 #include "access/undoworker.h"
 #include "access/xact.h"
 #include "access/xlog_internal.h"
+#include "access/zcrcache.h"
+#include "access/zheap.h"
+#include "access/zkeyshare.h"
+#include "access/zlocktable.h"
 #include "catalog/namespace.h"
 #include "catalog/pg_authid.h"
 #include "commands/async.h"
@@ -1967,6 +1971,16 @@ static struct config_bool ConfigureNamesBool[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"zheap_undo_version_skip", PGC_SUSET, CLIENT_CONN_STATEMENT,
+			gettext_noop("Records skip pointers to older row versions in the undo of in-place zheap updates."),
+			NULL
+		},
+		&zheap_undo_version_skip,
+		false,
+		NULL, NULL, NULL
+	},
+
 	/* End-of-list marker */
 	{
 		{NULL, 0, 0, NULL, NULL}, NULL, false, NULL, NULL, NULL
@@ -2947,6 +2961,47 @@ static struct config_int ConfigureNamesInt[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"rollback_request_queue_size", PGC_POSTMASTER, RESOURCES_MEM,
+			gettext_noop("Sets the number of rollback requests that can be queued for undo workers."),
+			NULL
+		},
+		&rollback_request_queue_size,
+		1024, 16, INT_MAX / 4,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"zheap_cr_cache_size", PGC_POSTMASTER, RESOURCES_MEM,
+			gettext_noop("Sets the number of consistent-read zheap page images kept in shared memory."),
+			gettext_noop("Zero disables the cache."),
+			GUC_UNIT_BLOCKS
+		},
+		&zheap_cr_cache_size,
+		128, 0, INT_MAX / 2,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"zheap_lock_table_size", PGC_POSTMASTER, RESOURCES_MEM,
+			gettext_noop("Sets the number of zheap tuples whose lockers are tracked in shared memory."),
+			gettext_noop("Zero disables the table.")
+		},
+		&zheap_lock_table_size,
+		1024, 0, INT_MAX / 2,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"zheap_key_share_lock_table_size", PGC_POSTMASTER, RESOURCES_MEM,
+			gettext_noop("Sets the number of zheap tuples whose undo-free KEY SHARE lockers can be tracked in shared memory."),
+			gettext_noop("Zero disables undo-free KEY SHARE locks.")
+		},
+		&zheap_key_share_lock_table_size,
+		4096, 0, INT_MAX / 2,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"wal_segment_size", PGC_INTERNAL, PRESET_OPTIONS,
 			gettext_noop("Shows the size of write ahead log segments."),
@@ -1255,8 +1255,11 @@ WriteEmptyXLOG(void)
 }
 
 /*
- * Find the latest modified undo checkpoint file under pg_undo directory and
- * delete all other files.
+ * Find the latest modified undo checkpoint file under pg_undo directory.
+ *
+ * The other files are left alone: the latest one may be a delta that needs
+ * the files it is based on.  The server removes them once they are no longer
+ * needed.
  */
 static bool
 FindLatestUndoCheckPointFile(char *latest_undo_checkpoint_file)
@@ -1273,7 +1276,7 @@ FindLatestUndoCheckPointFile(char *latest_undo_checkpoint_file)
 
 	/*
 	 * Start reading each file under pg_undo to identify the latest modified
-	 * file and remove the older files that are not required.
+	 * file.
 	 */
 	for (filename = filenames; *filename; filename++)
 	{
@@ -1282,14 +1285,6 @@ FindLatestUndoCheckPointFile(char *latest_undo_checkpoint_file)
 
 		if (UndoCheckPointFilenamePrecedes(latest, *filename))
 		{
-			if (latest[0] != '\0')
-			{
-				snprintf(latest_undo_checkpoint_file, MAXPGPATH, "pg_undo/%s",
-						 latest);
-				if (unlink(latest_undo_checkpoint_file) != 0)
-					fprintf(stderr, _("could not unlink file \"%s\": %s\n"),
-							*filename, strerror(errno));
-			}
 			memcpy(latest, *filename, UNDO_CHECKPOINT_FILENAME_LENGTH);
 			latest[UNDO_CHECKPOINT_FILENAME_LENGTH] = '\0';
 			result = true;
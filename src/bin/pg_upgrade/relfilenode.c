@@ -178,6 +178,9 @@ transfer_single_new_db(FileNameMap *maps, int size, char *old_tablespace)
 				if (vm_crashsafe_match)
 					transfer_relfile(&maps[mapnum], "_vm", vm_must_add_frozenbit);
 			}
+
+			/* Copy/link the TPD pages of zheap relations, if they exist */
+			transfer_relfile(&maps[mapnum], "_tpd", vm_must_add_frozenbit);
 		}
 	}
 }
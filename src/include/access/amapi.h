@@ -143,6 +143,12 @@ typedef void (*ammarkpos_function) (IndexScanDesc scan);
 /* restore marked scan position */
 typedef void (*amrestrpos_function) (IndexScanDesc scan);
 
+/* report the heap TIDs the next amgettuple calls will return */
+typedef int (*ampeektids_function) (IndexScanDesc scan,
+									ScanDirection direction,
+									ItemPointer tids,
+									int maxtids);
+
 /*
  * Callback function signatures - for parallel index scans.
  */
@@ -225,6 +231,7 @@ typedef struct IndexAmRoutine
 	amendscan_function amendscan;
 	ammarkpos_function ammarkpos;	/* can be NULL */
 	amrestrpos_function amrestrpos; /* can be NULL */
+	ampeektids_function ampeektids; /* can be NULL */
 
 	/* interface functions to support parallel index scans */
 	amestimateparallelscan_function amestimateparallelscan; /* can be NULL */
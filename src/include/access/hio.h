@@ -31,6 +31,14 @@ typedef struct BulkInsertStateData
 {
 	BufferAccessStrategy strategy;	/* our BULKWRITE strategy object */
 	Buffer		current_buf;	/* current insertion target page */
+
+	/*
+	 * Run of pages the relation has been extended by ahead of need, and the
+	 * total number of pages extended by so far.  Only zheap uses these.
+	 */
+	BlockNumber next_free;
+	BlockNumber last_free;
+	uint32		already_extended_by;
 } BulkInsertStateData;
 
 
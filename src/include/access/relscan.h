@@ -91,6 +91,8 @@ typedef struct IndexFetchTableData
 	Relation	rel;
 } IndexFetchTableData;
 
+/* Most TIDs an index scan hands to table_index_fetch_batch() at once */
+#define MaxIndexFetchBatch	32
 
 typedef struct IndexFetchZHeapData
 {
@@ -98,6 +100,17 @@ typedef struct IndexFetchZHeapData
 
 	Buffer		xs_cbuf;		/* current heap buffer in scan, if any */
 	/* NB: if xs_cbuf is not InvalidBuffer, we hold a pin on that buffer */
+
+	/* tuples looked up ahead of time by zheapam_index_fetch_batch */
+	MemoryContext xs_batch_cxt; /* holds xs_batch_tuples, or NULL */
+	struct SnapshotData *xs_batch_snapshot;
+	int			xs_batch_next;	/* next entry to be fetched */
+	int			xs_batch_count; /* number of valid entries */
+	int			xs_prefetched;	/* upcoming TIDs whose blocks were
+								 * prefetched */
+	ItemPointerData xs_batch_tids[MaxIndexFetchBatch];
+	struct ZHeapTupleData *xs_batch_tuples[MaxIndexFetchBatch];
+	bool		xs_batch_all_dead[MaxIndexFetchBatch];
 }			IndexFetchZHeapData;
 
 /*
@@ -142,6 +155,8 @@ typedef struct IndexScanDescData
 	bool		xs_heap_continue;	/* T if must keep walking, potential
 									 * further results */
 	IndexFetchTableData *xs_heapfetch;
+	int			xs_batch_remaining; /* TIDs still covered by the last
+									 * table_index_fetch_batch() */
 
 	bool		xs_recheck;		/* T means scan keys must be rechecked */
 
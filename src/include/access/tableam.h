@@ -310,6 +310,18 @@ typedef struct TableAmRoutine
 									  TupleTableSlot *slot,
 									  bool *call_again, bool *all_dead);
 
+	/*
+	 * Optional: `tids` are the next `ntids` (at least two) TIDs an index
+	 * scan will fetch with index_fetch_tuple, in that order, using the MVCC
+	 * snapshot `snapshot`.  The AM may look up some leading run of them at
+	 * once, and return how many it did, so that their index_fetch_tuple
+	 * calls can be answered from the results; or return 0.  It may also
+	 * start prefetching the rest.
+	 */
+	int			(*index_fetch_batch) (struct IndexFetchTableData *scan,
+									  ItemPointer tids, int ntids,
+									  Snapshot snapshot);
+
 
 	/* ------------------------------------------------------------------------
 	 * Callbacks for non-modifying operations on individual tuples
@@ -997,6 +1009,22 @@ table_index_fetch_tuple(struct IndexFetchTableData *scan,
 													all_dead);
 }
 
+/*
+ * Tells the AM that the next `ntids` TIDs to be fetched with
+ * table_index_fetch_tuple() and the MVCC snapshot `snapshot` are `tids`, in
+ * that order.  Returns the number of leading TIDs the AM has already looked
+ * up.  Only to be called if the AM provides index_fetch_batch.
+ */
+static inline int
+table_index_fetch_batch(struct IndexFetchTableData *scan,
+						ItemPointer tids, int ntids, Snapshot snapshot)
+{
+	Assert(IsMVCCSnapshot(snapshot));
+
+	return scan->rel->rd_tableam->index_fetch_batch(scan, tids, ntids,
+													snapshot);
+}
+
 /*
  * This is a convenience wrapper around table_index_fetch_tuple() which
  * returns whether there are table tuple items corresponding to an index
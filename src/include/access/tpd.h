@@ -92,6 +92,9 @@ extern void SetTPDLocation(Buffer heapbuffer, Buffer tpdbuffer, uint16 offset);
 extern void ClearTPDLocation(Buffer heapbuf);
 extern void TPDInitPage(Page page, Size pageSize);
 extern bool TPDFreePage(Relation rel, Buffer buf, BufferAccessStrategy bstrategy);
+extern void TPDRecordFreePage(Relation rel, Buffer buf);
+extern BlockNumber TPDNumberOfBlocks(Relation rel);
+extern void TPDTruncate(Relation rel);
 extern void ReleaseLastTPDBufferByTPDBlock(BlockNumber tpdblk);
 extern int	TPDAllocateAndReserveTransSlot(Relation relation, Buffer buf,
 										   OffsetNumber offnum, UndoRecPtr *urec_ptr,
@@ -138,6 +141,7 @@ extern void ResetRegisteredTPDBuffers(void);
 extern int	TPDPagePrune(Relation rel, Buffer tpdbuf, BufferAccessStrategy strategy,
 						 OffsetNumber target_offnum, Size space_required, bool can_free,
 						 bool *update_tpd_inplace, bool *tpd_e_pruned);
+extern void TPDVacuumPages(Relation rel, BufferAccessStrategy strategy);
 extern void TPDPagePruneExecute(Buffer tpdbuf, OffsetNumber *nowunused,
 								int nunused);
 extern void TPDPageRepairFragmentation(Page page, Page tmppage,
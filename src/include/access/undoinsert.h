@@ -28,6 +28,9 @@ typedef bool (*SatisfyUndoRecordCallback) (UnpackedUndoRecord *urec,
 										   OffsetNumber offset,
 										   TransactionId xid);
 
+/* Number of undo records read by UndoFetchRecord in this backend. */
+extern uint64 UndoRecordsFetched;
+
 extern UndoRecPtr PrepareUndoInsert(UnpackedUndoRecord *, FullTransactionId xid,
 									UndoPersistence, XLogReaderState *xlog_record,
 									xl_undolog_meta *);
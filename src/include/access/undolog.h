@@ -256,6 +256,8 @@ typedef struct UndoLogControl
 	LWLock		discard_lock;	/* prevents discarding while reading */
 
 	UndoLogNumber next_free;	/* protected by UndoLogLock */
+	int			tsstats_slot;	/* tablespace statistics slot, see undolog.c */
+	UndoLogMetaData checkpointed_meta;	/* as last written by a checkpoint */
 } UndoLogControl;
 
 #endif
@@ -306,6 +308,9 @@ extern UndoRecPtr UndoLogGetFirstValidRecord(UndoLogNumber logno);
 extern UndoRecPtr UndoLogGetNextInsertPtr(UndoLogNumber logno,
 										  TransactionId xid);
 extern void UndoLogRewind(UndoRecPtr insert_urp);
+extern bool UndoLogRewindSubXact(UndoPersistence persistence,
+								 UndoRecPtr start_urp,
+								 UndoRecPtr parent_urp);
 extern bool IsTransactionFirstRec(TransactionId xid);
 extern void UndoLogSetPrevLen(UndoLogNumber logno, uint16 prevlen);
 extern uint16 UndoLogGetPrevLen(UndoLogNumber logno);
@@ -313,6 +318,8 @@ extern bool NeedUndoMetaLog(XLogRecPtr redo_point);
 extern void UndoLogSetLSN(XLogRecPtr lsn);
 extern void LogUndoMetaData(xl_undolog_meta *xlrec);
 void		UndoLogNewSegment(UndoLogNumber logno, Oid tablespace, int segno);
+void		UndoLogNewTempSegment(UndoLogNumber logno, Oid tablespace,
+								  int segno);
 
 /* Redo interface. */
 extern void undolog_redo(XLogReaderState *record);
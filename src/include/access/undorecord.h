@@ -30,7 +30,8 @@ typedef enum undorectype
 	UNDO_XID_LOCK_ONLY,
 	UNDO_XID_LOCK_FOR_UPDATE,
 	UNDO_XID_MULTI_LOCK_ONLY,
-	UNDO_ITEMID_UNUSED
+	UNDO_ITEMID_UNUSED,
+	UNDO_BULK_APPEND
 } undorectype;
 
 /*
@@ -79,6 +80,10 @@ typedef struct UndoRecordHeader
  *
  * If UREC_INFO_PAYLOAD is set, an UndoRecordPayload structure follows.
  *
+ * If UREC_INFO_TUPLE_COMPRESSED is set, the tuple bytes of the payload are
+ * stored as a uint16 holding the uncompressed length followed by pglz
+ * compressed data, and urec_tuple_len is the length of that stored form.
+ *
  * When (as will often be the case) multiple structures are present, they
  * appear in the same order in which the constants are defined here.  That is,
  * UndoRecordRelationDetails appears first.
@@ -89,6 +94,16 @@ typedef struct UndoRecordHeader
 #define UREC_INFO_TRANSACTION				0x08
 #define UREC_INFO_PAYLOAD_CONTAINS_SLOT		0x10
 #define UREC_INFO_PAYLOAD_CONTAINS_SUBXACT	0x20
+#define UREC_INFO_PAYLOAD_CONTAINS_REUSED_ITEM	0x40
+#define UREC_INFO_TUPLE_COMPRESSED			0x80
+
+/*
+ * Tuple data of at least this many bytes is compressed before being written
+ * to undo.  This must not be made configurable: redo reconstructs undo
+ * records from WAL, so standby has to take the same decision as the primary.
+ */
+#define UNDO_TUPLE_COMPRESS_THRESHOLD		256
+
 /*
  * Additional information about a relation to which this record pertains,
  * namely the fork number.  If the fork number is MAIN_FORKNUM, this structure
@@ -200,6 +215,8 @@ typedef struct UnpackedUndoRecord
 	uint32		uur_progress;
 	StringInfoData uur_payload; /* payload bytes */
 	StringInfoData uur_tuple;	/* tuple bytes */
+	StringInfoData uur_ztuple;	/* compressed tuple bytes, valid only if
+								 * UREC_INFO_TUPLE_COMPRESSED is set */
 } UnpackedUndoRecord;
 
 
@@ -212,5 +229,6 @@ extern bool InsertUndoRecord(UnpackedUndoRecord *uur, Page page,
 extern bool UnpackUndoRecord(UnpackedUndoRecord *uur, Page page,
 							 int starting_byte, int *already_decoded, bool header_only,
 							 bool copy_data);
+extern void UndoRecordDecompressTuple(UnpackedUndoRecord *uur);
 
 #endif							/* UNDORECORD_H */
@@ -26,6 +26,7 @@ typedef enum
 } UndoWorkerQueueType;
 
 #define InvalidUndoWorkerQueue -1
+#define MAX_UNDO_WORK_QUEUES	3
 
 /* Remembers the last seen RecentGlobalXmin */
 TransactionId latestRecentGlobalXmin;
@@ -54,6 +55,7 @@ typedef struct UndoXidQueue
 	FullTransactionId full_xid;
 	UndoRecPtr	start_urec_ptr;
 	Oid			dbid;
+	TimestampTz enqueued_at;
 } UndoXidQueue;
 
 /* This is an entry for undo request queue that is sorted by size. */
@@ -63,6 +65,7 @@ typedef struct UndoSizeQueue
 	UndoRecPtr	start_urec_ptr;
 	Oid			dbid;
 	uint64		request_size;
+	TimestampTz enqueued_at;
 } UndoSizeQueue;
 
 /*
@@ -77,6 +80,18 @@ typedef struct UndoErrorQueue
 	TimestampTz err_occurred_at;
 } UndoErrorQueue;
 
+/*
+ * Summary of the pending requests in one undo worker queue.  Requests that
+ * have already been picked up through another queue are not counted.
+ */
+typedef struct UndoQueueStats
+{
+	int			nrequests;
+	uint64		pending_bytes;	/* only known for the size queue */
+	FullTransactionId oldest_full_xid;
+	TimestampTz oldest_enqueued_at;
+} UndoQueueStats;
+
 /* undo record information */
 typedef struct UndoRecInfo
 {
@@ -118,7 +133,7 @@ typedef struct UndoRequestInfo
 )
 
 /* Exposed functions for rollback request queues. */
-extern int	PendingUndoShmemSize(void);
+extern Size PendingUndoShmemSize(void);
 extern void PendingUndoShmemInit(void);
 extern bool UndoWorkerQueuesEmpty(void);
 extern void InsertRequestIntoUndoQueues(UndoRequestInfo *urinfo);
@@ -126,6 +141,7 @@ extern bool InsertRequestIntoErrorUndoQueue(volatile UndoRequestInfo *urinfo);
 extern void SetUndoWorkerQueueStart(UndoWorkerQueueType undo_worker_queue);
 extern bool UndoGetWork(bool allow_peek, bool is_undo_launcher,
 						UndoRequestInfo *urinfo, bool *in_other_db);
+extern void UndoGetQueueStats(UndoQueueStats *stats);
 
 /* Exposed functions for rollback hash table. */
 extern bool RegisterRollbackReq(UndoRecPtr end_urec_ptr, UndoRecPtr start_urec_ptr,
@@ -143,5 +159,7 @@ extern void execute_undo_actions(FullTransactionId full_xid, UndoRecPtr from_ure
 extern bool execute_undo_actions_page(UndoRecInfo *urp_array, int first_idx,
 									  int last_idx, Oid reloid, FullTransactionId full_xid,
 									  BlockNumber blkno, bool blk_chain_complete);
+extern void UndoRememberTouchedPage(UnpackedUndoRecord *uur, UndoRecPtr urp);
+extern void UndoForgetTouchedPages(void);
 
 #endif							/* _UNDOREQUEST_H */
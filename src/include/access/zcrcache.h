@@ -0,0 +1,57 @@
+/*-------------------------------------------------------------------------
+ *
+ * zcrcache.h
+ *	  POSTGRES zheap consistent-read page cache definitions.
+ *
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/access/zcrcache.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef ZCRCACHE_H
+#define ZCRCACHE_H
+
+#include "access/zhtup.h"
+#include "storage/buf.h"
+#include "utils/relcache.h"
+#include "utils/snapshot.h"
+
+/* GUC variable */
+extern int	zheap_cr_cache_size;
+
+/* Set while a page image is being built; see ZHeapCRCacheNoteXid. */
+extern bool ZHeapCRCacheBuilding;
+
+/*
+ * Visibility checks report every transaction whose visibility to the
+ * snapshot they relied upon, so that the image being built can later be
+ * handed to other snapshots that see those transactions the same way.
+ */
+#define ZHeapCRCacheNoteXid(xid, in_snapshot) \
+	do { \
+		if (ZHeapCRCacheBuilding) \
+			ZHeapCRCacheRecordXid((xid), (in_snapshot)); \
+	} while (0)
+
+#define ZHeapCRCacheNoteUncacheable() \
+	do { \
+		if (ZHeapCRCacheBuilding) \
+			ZHeapCRCacheRecordUncacheable(); \
+	} while (0)
+
+extern Size ZHeapCRCacheShmemSize(void);
+extern void ZHeapCRCacheShmemInit(void);
+
+extern bool ZHeapCRCacheUsable(Relation rel, Snapshot snapshot);
+extern bool ZHeapCRCacheLookup(Relation rel, Buffer buffer, Snapshot snapshot,
+							   ZHeapTuple *tuples, int *ntuples);
+extern void ZHeapCRCacheBeginBuild(void);
+extern void ZHeapCRCacheEndBuild(Relation rel, Buffer buffer,
+								 ZHeapTuple *tuples, int ntuples);
+extern void ZHeapCRCacheRecordXid(TransactionId xid, bool in_snapshot);
+extern void ZHeapCRCacheRecordUncacheable(void);
+
+#endif							/* ZCRCACHE_H */
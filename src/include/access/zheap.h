@@ -67,19 +67,30 @@ typedef ZHeapPageOpaqueData *ZHeapPageOpaque;
 
 #define SizeOfZHeapPageOpaqueData (ZHEAP_PAGE_TRANS_SLOTS \
 										 * sizeof(TransInfo))
+/*
+ * Maximum number of free TPD pages remembered in the metapage.  TPD pages
+ * live in their own fork, so the pages freed by pruning can't be handed back
+ * through the FSM; instead we keep a small free list of them in the metapage.
+ * Pages that don't fit in the list stay zeroed until the list has room again,
+ * see TPDVacuumPages.
+ */
+#define ZHEAP_MAX_FREE_TPD_PAGES	64
+
 typedef struct ZHeapMetaPageData
 {
 	uint32		zhm_magic;		/* magic number for zheap tables */
 	uint32		zhm_version;	/* version ID */
 	uint32		zhm_first_used_tpd_page;
 	uint32		zhm_last_used_tpd_page;
+	uint32		zhm_num_free_tpd_pages;
+	uint32		zhm_free_tpd_pages[ZHEAP_MAX_FREE_TPD_PAGES];
 } ZHeapMetaPageData;
 
 typedef ZHeapMetaPageData *ZHeapMetaPage;
 
 #define ZHEAP_METAPAGE 0		/* metapage is always block 0 */
 #define ZHEAP_MAGIC            0xA056
-#define ZHEAP_VERSION  1
+#define ZHEAP_VERSION  2
 
 #define ZHeapPageGetMeta(page) \
 		((ZHeapMetaPage) PageGetContents(page))
@@ -104,6 +115,52 @@ typedef struct ZHeapFreeOffsetRanges
 	int			nranges;
 } ZHeapFreeOffsetRanges;
 
+/*
+ * Line pointer of an item whose storage has been handed over to a tuple
+ * inserted later by the same (sub)transaction that deleted the item.  This is
+ * stored in the payload of the insert's undo record and in its WAL record, so
+ * that rolling back the insert can give the storage back to the deleted item.
+ */
+typedef struct ZHeapReusedItem
+{
+	OffsetNumber offnum;		/* offset of the deleted item */
+	uint16		lp_off;			/* its storage offset before reuse */
+	uint16		lp_len;			/* its storage length before reuse */
+} ZHeapReusedItem;
+
+#define SizeOfZHeapReusedItem	(offsetof(ZHeapReusedItem, lp_len) + sizeof(uint16))
+
+/*
+ * Skip information stored at the end of the payload of an in-place update's
+ * undo record when zheap_undo_version_skip is on, and in its WAL record.
+ *
+ * prev_urecptr points straight to the undo record of the previous version of
+ * the tuple, if known, so that readers needn't walk the undo of the other
+ * tuples on the page to find it.  The in-place updates of a tuple whose undo
+ * records all carry skip information form a chain; depth is the number of
+ * older records in it.  jump_urecptr points to an older record of the chain,
+ * chosen the way Myers' skew-binary jump pointers are, so that a reader
+ * looking for the newest version visible to it can get there in a
+ * logarithmic number of steps; jump_xid is the transaction that wrote that
+ * record, and jump_depth its depth.  The oldest record of the chain has no
+ * jump pointer.  The magic field always holds ZHEAP_UNDO_VERSION_SKIP, so
+ * that the information can't be mistaken for another payload.
+ */
+#define ZHEAP_UNDO_VERSION_SKIP		0x5A56534B	/* "ZVSK" */
+
+typedef struct ZHeapUndoVersionSkip
+{
+	UndoRecPtr	prev_urecptr;	/* undo of the previous version, if known */
+	UndoRecPtr	jump_urecptr;	/* undo of an older version, if any */
+	TransactionId jump_xid;		/* transaction that wrote jump_urecptr */
+	uint32		depth;			/* # of older records in the chain */
+	uint32		jump_depth;		/* depth of the record at jump_urecptr */
+	uint32		magic;			/* ZHEAP_UNDO_VERSION_SKIP */
+} ZHeapUndoVersionSkip;
+
+#define SizeOfZHeapUndoVersionSkip \
+	(offsetof(ZHeapUndoVersionSkip, magic) + sizeof(uint32))
+
 /* This is used to prepare undo records. */
 typedef struct ZHeapPrepareUndoInfo
 {
@@ -132,6 +189,7 @@ typedef struct ZHeapPrepareUpdateUndoInfo
 	bool		inplace_update;
 	bool		same_buf;
 	bool		hasSubXactLock;
+	ZHeapUndoVersionSkip *version_skip; /* skip information, if any */
 } ZHeapPrepareUpdateUndoInfo;
 
 /* This is used to prepare lock undo records. */
@@ -172,6 +230,8 @@ typedef struct ZHeapMultiInsertWALInfo
 	int			curpage_ntuples;	/* tuples inserted in current page */
 	int			ntuples;		/* total number of tuples inserted */
 	int			ndone;			/* tuples processed */
+	bool		bulk_append;	/* page covered by a bulk-append undo record? */
+	bool		bulk_append_start;	/* did we insert that undo record? */
 } ZHeapMultiInsertWALInfo;
 
 /* This is used to write WAL for undo actions */
@@ -189,6 +249,9 @@ typedef struct ZHeapUndoActionWALInfo
 	bool		need_init;
 } ZHeapUndoActionWALInfo;
 
+/* GUC variable */
+extern bool zheap_undo_version_skip;
+
 extern void zheap_insert(Relation relation, ZHeapTuple tup, CommandId cid,
 						 int options, BulkInsertState bistate, uint32 specToken);
 extern void simple_zheap_delete(Relation relation, ItemPointer tid, Snapshot snapshot);
@@ -256,6 +319,7 @@ extern TransactionId zheap_compute_xid_horizon_for_tuples(Relation rel,
 														  ItemPointerData *tids, int nitems);
 extern UndoRecPtr zheap_prepare_undoinsert(ZHeapPrepareUndoInfo *zh_undo_info,
 										   uint32 specToken, bool specIns,
+										   ZHeapReusedItem *reused_item,
 										   UnpackedUndoRecord *undorecord,
 										   XLogReaderState *xlog_record,
 										   xl_undolog_meta *undometa);
@@ -271,6 +335,10 @@ extern UndoRecPtr zheap_prepare_undolock(ZHeapPrepareLockUndoInfo *zh_undo_info,
 extern UndoRecPtr zheap_prepare_undo_multi_insert(ZHeapPrepareUndoInfo *zh_undo_info,
 								int nranges, UnpackedUndoRecord **uur_ptr,
 								XLogReaderState *xlog_record, xl_undolog_meta *undometa);
+extern UndoRecPtr zheap_prepare_undo_bulk_append(ZHeapPrepareUndoInfo *zh_undo_info,
+												 UnpackedUndoRecord *undorecord,
+												 XLogReaderState *xlog_record,
+												 xl_undolog_meta *undometa);
 
 
 /* Pruning related API's (prunezheap.c) */
@@ -311,9 +379,20 @@ extern void RelationPutZHeapTuple(Relation relation, Buffer buffer,
 								  ZHeapTuple tuple);
 extern ZHeapFreeOffsetRanges *ZHeapGetUsableOffsetRanges(Buffer buffer,
 														 ZHeapTuple *tuples, int ntuples, Size saveFreeSpace);
+extern void ZHeapRememberFreedSpace(Relation relation, BlockNumber blkno,
+									OffsetNumber offnum, Size len);
+extern BlockNumber ZHeapGetBlockWithReusableSpace(Relation relation, Size len);
+extern void ZHeapForgetReusableSpace(Relation relation);
+extern OffsetNumber ZPageGetReusableItem(Relation relation, Buffer buffer,
+										 int trans_slot_id, Size len);
+extern OffsetNumber ZPageAddItemReusingStorage(Page page, OffsetNumber victim,
+											   Item item, Size size,
+											   OffsetNumber offnum);
+extern void ZPageRestoreReusedItem(Page page, ZHeapReusedItem *reused_item);
 extern void ZheapInitPage(Page page, Size pageSize);
 extern void zheap_init_meta_page(Buffer metabuf, BlockNumber first_blkno,
-								 BlockNumber last_blkno);
+					 BlockNumber last_blkno, uint32 num_free_blknos,
+					 uint32 *free_blknos);
 extern void ZheapInitMetaPage(RelFileNode rnode, ForkNumber forkNum,
 							  char persistence, bool already_exists);
 extern ZHeapTuple zheap_gettuple(Relation relation, Buffer buffer,
@@ -324,6 +403,8 @@ extern bool ZHeapSatisfyUndoRecord(UnpackedUndoRecord *uurec, BlockNumber blkno,
 								   OffsetNumber offset, TransactionId xid);
 extern int	UpdateTupleHeaderFromUndoRecord(UnpackedUndoRecord *urec,
 											ZHeapTupleHeader hdr, Page page);
+extern bool UndoRecordGetVersionSkip(UnpackedUndoRecord *urec,
+									 ZHeapUndoVersionSkip *skip);
 extern bool ValidateTuplesXact(Relation relation, ZHeapTuple tuple,
 							   Snapshot snapshot, Buffer buf,
 							   TransactionId priorXmax, bool nobuflock,
@@ -64,9 +64,12 @@ typedef struct xl_zheap_metadata
 {
 	uint32		first_used_tpd_page;
 	uint32		last_used_tpd_page;
+	uint32		num_free_tpd_pages;
+	uint32		free_tpd_pages[FLEXIBLE_ARRAY_MEMBER];
 } xl_zheap_metadata;
 
-#define SizeOfMetaData	(offsetof(xl_zheap_metadata, last_used_tpd_page) + sizeof(uint32))
+#define SizeOfMetaData(nfree)	\
+	(offsetof(xl_zheap_metadata, free_tpd_pages) + (nfree) * sizeof(uint32))
 
 /* common undo record related info */
 typedef struct xl_undo_header
@@ -87,6 +90,8 @@ typedef struct xl_undo_header
 #define XLZ_INSERT_CONTAINS_NEW_TUPLE			(1<<3)
 #define XLZ_INSERT_CONTAINS_TPD_SLOT			(1<<4)
 #define XLZ_INSERT_IS_FROZEN					(1<<5)
+#define XLZ_INSERT_REUSED_ITEM					(1<<6)
+#define XLZ_INSERT_BULK_APPEND					(1<<7)
 
 /*
  * NOTE: t_hoff could be recomputed, but we may as well store it because
@@ -154,6 +159,7 @@ typedef struct xl_zheap_delete
 #define	XLZ_UPDATE_OLD_CONTAINS_TPD_SLOT		(1<<6)
 #define	XLZ_UPDATE_NEW_CONTAINS_TPD_SLOT		(1<<7)
 #define XLZ_UPDATE_CONTAINS_SUBXACT				(1<<8)
+#define XLZ_UPDATE_CONTAINS_VERSION_SKIP		(1<<9)
 
 /*
  * This is what we need to know about update|inplace_update
@@ -168,6 +174,10 @@ typedef struct xl_zheap_delete
  * old tuple on replay.
  *
  * Backup blk 1: old page, if different. (no data, just a reference to the blk)
+ *
+ * If XLZ_UPDATE_CONTAINS_VERSION_SKIP is set, which happens only for in-place
+ * updates, the main data carries the ZHeapUndoVersionSkip of the undo record
+ * right after the old tuple's TPD slot, if any.
  */
 typedef struct xl_zheap_update
 {
@@ -219,7 +229,11 @@ typedef struct xl_zheap_lock
  * This is what we need to know about a multi-insert.
  *
  * The main data of the record consists of this xl_zheap_multi_insert header,
- * 'offset ranges' and tpd transaction slot number.
+ * 'offset ranges' and tpd transaction slot number.  If XLZ_INSERT_BULK_APPEND
+ * is set, the offset ranges are followed by a BlockNumber instead of the tpd
+ * transaction slot number: the block itself if this record inserted the
+ * UNDO_BULK_APPEND undo record, or InvalidBlockNumber if the page was merely
+ * added to the bulk append of the undo record in xl_undo_header.
  *
  * In block 0's data portion, there is an xl_multi_insert_ztuple struct,
  * followed by the tuple data for each tuple. There is padding to align
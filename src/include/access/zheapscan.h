@@ -34,7 +34,12 @@ typedef struct ZHeapScanDescData
 	bool		rs_inited;		/* false = scan not initialized yet */
 	BlockNumber rs_cblock;		/* current block # in scan, if any */
 	Buffer		rs_cbuf;		/* current buffer in scan, if any */
+	bool		rs_allvisible;	/* current page was read as all-visible */
 
+	/* blocks of a parallel scan claimed by this process but not yet read */
+	uint64		rs_pnallocated; /* counter value of the last block read */
+	uint32		rs_pchunk_size; /* blocks to claim at a time */
+	uint32		rs_pchunk_remaining;	/* blocks left in the current chunk */
 
 	/* rs_numblocks is usually InvalidBlockNumber, meaning "scan whole rel" */
 	BufferAccessStrategy rs_strategy;	/* access strategy for reads */
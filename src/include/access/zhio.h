@@ -22,5 +22,6 @@ extern Buffer RelationGetBufferForZTuple(Relation relation, Size len,
 										 Buffer otherBuffer, int options,
 										 BulkInsertState bistate,
 										 Buffer *vmbuffer, Buffer *vmbuffer_other);
+extern void ZHeapFinishBulkExtend(Relation relation);
 
 #endif							/* ZHIO_H */
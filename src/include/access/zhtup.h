@@ -20,6 +20,7 @@
 #include "access/undolog.h"
 #include "access/undorecord.h"
 #include "executor/tuptable.h"
+#include "nodes/bitmapset.h"
 #include "nodes/lockoptions.h"
 #include "storage/bufpage.h"
 #include "storage/buf.h"
@@ -65,15 +66,19 @@ typedef enum LockOper
 
 typedef struct ZHeapTupleHeaderData
 {
+#define FIELDNO_ZHEAPTUPLEHEADERDATA_INFOMASK2 0
 	uint16		t_infomask2;	/* number of attributes + translot info +
 								 * various flags */
 
+#define FIELDNO_ZHEAPTUPLEHEADERDATA_INFOMASK 1
 	uint16		t_infomask;		/* various flag bits, see below */
 
+#define FIELDNO_ZHEAPTUPLEHEADERDATA_HOFF 2
 	uint8		t_hoff;			/* sizeof header incl. bitmap, padding */
 
 	/* ^ - 5 bytes - ^ */
 
+#define FIELDNO_ZHEAPTUPLEHEADERDATA_BITS 3
 	bits8		t_bits[FLEXIBLE_ARRAY_MEMBER];	/* bitmap of NULLs */
 
 	/* MORE DATA FOLLOWS AT END OF STRUCT */
@@ -88,6 +93,7 @@ typedef struct ZHeapTupleData
 	uint32		t_len;			/* length of *t_data */
 	ItemPointerData t_self;		/* SelfItemPointer */
 	Oid			t_tableOid;		/* table the tuple came from */
+#define FIELDNO_ZHEAPTUPLEDATA_DATA 3
 	ZHeapTupleHeader t_data;	/* -> tuple header and data */
 } ZHeapTupleData;
 
@@ -274,9 +280,14 @@ extern Bitmapset *zheap_tuple_attr_equals(TupleDesc tupdesc, Bitmapset *att_list
 typedef struct ZHeapTupleTableSlot
 {
 	TupleTableSlot base;
+#define FIELDNO_ZHEAPTUPLETABLESLOT_TUPLE 1
 	ZHeapTuple	tuple;			/* physical tuple */
 	ZHeapTupleData tupdata;
-	uint32		off;			/* saved state for slot_deform_tuple */
+#define FIELDNO_ZHEAPTUPLETABLESLOT_OFF 3
+	uint32		off;			/* saved state for slot_deform_ztuple */
+	int			nfixedatts;		/* # of leading atts with a fixed offset */
+	uint16	   *fixedattoffs;	/* offsets of those atts, plus the offset
+								 * just past the last one */
 } ZHeapTupleTableSlot;
 
 struct TupleTableSlot;
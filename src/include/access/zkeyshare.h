@@ -0,0 +1,42 @@
+/*-------------------------------------------------------------------------
+ *
+ * zkeyshare.h
+ *	  POSTGRES zheap undo-free KEY SHARE lock definitions.
+ *
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/access/zkeyshare.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef ZKEYSHARE_H
+#define ZKEYSHARE_H
+
+#include "nodes/pg_list.h"
+#include "storage/itemptr.h"
+#include "storage/lmgr.h"
+#include "utils/relcache.h"
+
+/* GUC variable */
+extern int	zheap_key_share_lock_table_size;
+
+extern Size ZHeapKeyShareShmemSize(void);
+extern void ZHeapKeyShareShmemInit(void);
+
+extern bool ZHeapKeyShareTryLock(Relation rel, ItemPointer tid);
+extern List *ZHeapKeyShareLockers(Relation rel, ItemPointer tid);
+extern bool ZHeapKeyShareLockersWait(Relation rel, ItemPointer tid,
+									 List *lockers, bool nowait,
+									 XLTW_Oper oper);
+extern bool ZHeapKeyShareReserve(Relation rel, ItemPointer oldtid);
+extern void ZHeapKeyShareTransfer(Relation rel, ItemPointer oldtid,
+								  ItemPointer newtid);
+
+extern void AtPrepare_ZHeapKeyShare(void);
+extern void AtEOXact_ZHeapKeyShare(void);
+extern void AtSubCommit_ZHeapKeyShare(int nestDepth);
+extern void AtSubAbort_ZHeapKeyShare(int nestDepth);
+
+#endif							/* ZKEYSHARE_H */
@@ -0,0 +1,40 @@
+/*-------------------------------------------------------------------------
+ *
+ * zlocktable.h
+ *	  POSTGRES zheap shared tuple lock table definitions.
+ *
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/access/zlocktable.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef ZLOCKTABLE_H
+#define ZLOCKTABLE_H
+
+#include "access/xlogdefs.h"
+#include "access/zhtup.h"
+#include "nodes/pg_list.h"
+#include "storage/buf.h"
+#include "storage/off.h"
+#include "utils/relcache.h"
+
+/* GUC variable */
+extern int	zheap_lock_table_size;
+
+extern Size ZHeapLockTableShmemSize(void);
+extern void ZHeapLockTableShmemInit(void);
+
+extern bool ZHeapLockTableUsable(Relation rel);
+extern bool ZHeapLockTableLookup(Relation rel, Buffer buf,
+								 OffsetNumber offnum, List **members);
+extern void ZHeapLockTableRemember(Relation rel, Buffer buf,
+								   OffsetNumber offnum, XLogRecPtr lsn,
+								   bool has_tpd, List *members);
+extern void ZHeapLockTableAddLocker(Buffer buf, OffsetNumber offnum,
+									XLogRecPtr prior_lsn,
+									ZMultiLockMember *member);
+
+#endif							/* ZLOCKTABLE_H */
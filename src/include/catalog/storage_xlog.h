@@ -40,6 +40,7 @@ typedef struct xl_smgr_create
 #define SMGR_TRUNCATE_HEAP		0x0001
 #define SMGR_TRUNCATE_VM		0x0002
 #define SMGR_TRUNCATE_FSM		0x0004
+#define SMGR_TRUNCATE_TPD		0x0008	/* always truncated to zero blocks */
 #define SMGR_TRUNCATE_ALL		\
 	(SMGR_TRUNCATE_HEAP|SMGR_TRUNCATE_VM|SMGR_TRUNCATE_FSM)
 
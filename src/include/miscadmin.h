@@ -248,6 +248,7 @@ extern PGDLLIMPORT int work_mem;
 extern PGDLLIMPORT int maintenance_work_mem;
 extern PGDLLIMPORT int max_parallel_maintenance_workers;
 extern PGDLLIMPORT int rollback_overflow_size;
+extern PGDLLIMPORT int rollback_request_queue_size;
 
 extern int	VacuumCostPageHit;
 extern int	VacuumCostPageMiss;
@@ -93,6 +93,12 @@ typedef int64 PgStat_Counter;
  * regardless of whether the transaction committed.  delta_live_tuples,
  * delta_dead_tuples, and changed_tuples are set depending on commit or abort.
  * Note that delta_live_tuples and delta_dead_tuples can be negative!
+ *
+ * The zheap_* counters are only maintained for zheap tables and are
+ * nontransactional.  noninplace_index/space/slot break down the non-in-place
+ * updates by the reason an in-place update wasn't possible.  undo_fetched
+ * counts undo records read by visibility checks, and undo_chain_max is the
+ * largest number read by a single check; it is a maximum, not a sum.
  * ----------
  */
 typedef struct PgStat_TableCounts
@@ -115,6 +121,14 @@ typedef struct PgStat_TableCounts
 
 	PgStat_Counter t_blocks_fetched;
 	PgStat_Counter t_blocks_hit;
+
+	PgStat_Counter t_zheap_noninplace_index;
+	PgStat_Counter t_zheap_noninplace_space;
+	PgStat_Counter t_zheap_noninplace_slot;
+	PgStat_Counter t_zheap_tpd_slots;
+	PgStat_Counter t_zheap_slot_waits;
+	PgStat_Counter t_zheap_undo_fetched;
+	PgStat_Counter t_zheap_undo_chain_max;
 } PgStat_TableCounts;
 
 /* Possible targets for resetting cluster-wide shared values */
@@ -587,7 +601,7 @@ typedef union PgStat_Msg
  * ------------------------------------------------------------
  */
 
-#define PGSTAT_FILE_FORMAT_ID	0x01A5BC9D
+#define PGSTAT_FILE_FORMAT_ID	0x01A5BC9E
 
 /* ----------
  * PgStat_StatDBEntry			The collector's data per database
@@ -658,6 +672,14 @@ typedef struct PgStat_StatTabEntry
 	PgStat_Counter blocks_fetched;
 	PgStat_Counter blocks_hit;
 
+	PgStat_Counter zheap_noninplace_index;
+	PgStat_Counter zheap_noninplace_space;
+	PgStat_Counter zheap_noninplace_slot;
+	PgStat_Counter zheap_tpd_slots;
+	PgStat_Counter zheap_slot_waits;
+	PgStat_Counter zheap_undo_fetched;
+	PgStat_Counter zheap_undo_chain_max;
+
 	TimestampTz vacuum_timestamp;	/* user initiated vacuum */
 	PgStat_Counter vacuum_count;
 	TimestampTz autovac_vacuum_timestamp;	/* autovacuum initiated */
@@ -1411,6 +1433,42 @@ pgstat_report_wait_end(void)
 		if ((rel)->pgstat_info != NULL)								\
 			(rel)->pgstat_info->t_counts.t_blocks_hit++;			\
 	} while (0)
+#define pgstat_count_zheap_noninplace_index(rel)					\
+	do {															\
+		if ((rel)->pgstat_info != NULL)								\
+			(rel)->pgstat_info->t_counts.t_zheap_noninplace_index++;	\
+	} while (0)
+#define pgstat_count_zheap_noninplace_space(rel)					\
+	do {															\
+		if ((rel)->pgstat_info != NULL)								\
+			(rel)->pgstat_info->t_counts.t_zheap_noninplace_space++;	\
+	} while (0)
+#define pgstat_count_zheap_noninplace_slot(rel)						\
+	do {															\
+		if ((rel)->pgstat_info != NULL)								\
+			(rel)->pgstat_info->t_counts.t_zheap_noninplace_slot++;	\
+	} while (0)
+#define pgstat_count_zheap_tpd_slot(rel)							\
+	do {															\
+		if ((rel)->pgstat_info != NULL)								\
+			(rel)->pgstat_info->t_counts.t_zheap_tpd_slots++;		\
+	} while (0)
+#define pgstat_count_zheap_slot_wait(rel)							\
+	do {															\
+		if ((rel)->pgstat_info != NULL)								\
+			(rel)->pgstat_info->t_counts.t_zheap_slot_waits++;		\
+	} while (0)
+#define pgstat_count_zheap_undo_fetch(rel, n)						\
+	do {															\
+		if ((rel)->pgstat_info != NULL)								\
+		{															\
+			PgStat_TableCounts *counts = &(rel)->pgstat_info->t_counts; \
+																	\
+			counts->t_zheap_undo_fetched += (n);					\
+			counts->t_zheap_undo_chain_max =						\
+				Max(counts->t_zheap_undo_chain_max, (n));			\
+		}															\
+	} while (0)
 #define pgstat_count_buffer_read_time(n)							\
 	(pgStatBlockReadTime += (n))
 #define pgstat_count_buffer_write_time(n)							\
@@ -223,6 +223,10 @@ typedef enum BuiltinTrancheIds
 	LWTRANCHE_UNDOLOG,
 	LWTRANCHE_UNDODISCARD,
 	LWTRANCHE_DISCARD_UPDATE,
+	LWTRANCHE_ROLLBACK_HT,
+	LWTRANCHE_ZHEAP_CR_CACHE,
+	LWTRANCHE_ZHEAP_KEY_SHARE,
+	LWTRANCHE_ZHEAP_LOCK_TABLE,
 	LWTRANCHE_FIRST_USER_DEFINED,
 }			BuiltinTrancheIds;
 
@@ -0,0 +1,30 @@
+# Consistent-read page images must not be reused once the page has changed
+#
+# s1 builds an image of the page while s2's update of one row is in
+# progress, and then finds it in the cache.  s3's update of the other row
+# changes the page without changing how s1's snapshots see s2's transaction,
+# so only the page LSN tells the image is out of date.
+
+setup
+{
+  CREATE TABLE crcache (id int, v int) USING zheap;
+  INSERT INTO crcache VALUES (1, 1), (2, 1);
+}
+
+teardown
+{
+  DROP TABLE crcache;
+}
+
+session "s1"
+step "s1s"	{ SELECT * FROM crcache ORDER BY id; }
+
+session "s2"
+setup		{ BEGIN; }
+step "s2u"	{ UPDATE crcache SET v = 2 WHERE id = 1; }
+step "s2c"	{ COMMIT; }
+
+session "s3"
+step "s3u"	{ UPDATE crcache SET v = 3 WHERE id = 2; }
+
+permutation "s2u" "s1s" "s1s" "s3u" "s1s" "s1s" "s2c" "s1s"
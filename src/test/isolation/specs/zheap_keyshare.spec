@@ -0,0 +1,37 @@
+# Undo-free KEY SHARE locks taken by foreign key checks on zheap tables must
+# keep conflicting deletes of the referenced row waiting until the locker's
+# transaction ends, including when the lock was taken in a subtransaction
+# that has since been released, and after the referenced row was updated.
+setup
+{
+ CREATE TABLE ks_parent (id int PRIMARY KEY, val int) USING zheap;
+ CREATE TABLE ks_child (pid int REFERENCES ks_parent) USING zheap;
+ INSERT INTO ks_parent VALUES (1, 0);
+}
+
+teardown
+{
+ DROP TABLE ks_child, ks_parent;
+}
+
+session "s1"
+setup		{ BEGIN; }
+step "s1sa"	{ SAVEPOINT a; }
+step "s1i"	{ INSERT INTO ks_child VALUES (1); }
+step "s1ra"	{ RELEASE a; }
+step "s1rba"	{ ROLLBACK TO a; }
+step "s1sb"	{ SAVEPOINT b; }
+step "s1rbb"	{ ROLLBACK TO b; }
+step "s1c"	{ COMMIT; }
+step "s1a"	{ ROLLBACK; }
+
+session "s2"
+step "s2u"	{ UPDATE ks_parent SET val = val + 1 WHERE id = 1; }
+step "s2d"	{ DELETE FROM ks_parent WHERE id = 1; }
+step "s2s"	{ SELECT * FROM ks_parent ORDER BY id; }
+
+permutation "s1i" "s2d" "s1c" "s2s"
+permutation "s1i" "s2d" "s1a" "s2s"
+permutation "s1sa" "s1i" "s1rba" "s2d" "s1c" "s2s"
+permutation "s1sa" "s1i" "s1ra" "s1sb" "s1rbb" "s2d" "s1c" "s2s"
+permutation "s1i" "s2u" "s2d" "s1c" "s2s"
@@ -0,0 +1,43 @@
+# Lockers of a zheap tuple remembered in the shared lock table
+#
+# s3's NOWAIT lock walks the undo of the tuple locked by s1 and s2 and
+# remembers both in the lock table.  s4 then changes another tuple of the
+# page, so the remembered entry no longer describes the page, and s5 locks
+# the tuple too.  Once s1 and s2 are gone, s3's update must still find s5
+# and wait for it.
+
+setup
+{
+  CREATE TABLE locktable (id int, v int) USING zheap;
+  INSERT INTO locktable VALUES (1, 1), (2, 1);
+}
+
+teardown
+{
+  DROP TABLE locktable;
+}
+
+session "s1"
+setup		{ BEGIN; }
+step "s1l"	{ SELECT * FROM locktable WHERE id = 1 FOR SHARE; }
+step "s1c"	{ COMMIT; }
+
+session "s2"
+setup		{ BEGIN; }
+step "s2l"	{ SELECT * FROM locktable WHERE id = 1 FOR SHARE; }
+step "s2c"	{ COMMIT; }
+
+session "s3"
+step "s3n"	{ SELECT * FROM locktable WHERE id = 1 FOR UPDATE NOWAIT; }
+step "s3u"	{ UPDATE locktable SET v = 10 WHERE id = 1; }
+step "s3s"	{ SELECT * FROM locktable ORDER BY id; }
+
+session "s4"
+step "s4u"	{ UPDATE locktable SET v = v + 1 WHERE id = 2; }
+
+session "s5"
+setup		{ BEGIN; }
+step "s5l"	{ SELECT * FROM locktable WHERE id = 1 FOR SHARE; }
+step "s5c"	{ COMMIT; }
+
+permutation "s1l" "s2l" "s3n" "s4u" "s5l" "s1c" "s2c" "s3u" "s5c" "s3s"
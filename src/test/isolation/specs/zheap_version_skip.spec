@@ -0,0 +1,39 @@
+# Reading old versions of a row through a long chain of in-place updates
+# whose undo carries skip information (zheap_undo_version_skip).
+
+setup
+{
+  CREATE TABLE version_skip (id int, v int) USING zheap;
+  INSERT INTO version_skip VALUES (1, 0);
+}
+
+teardown
+{
+  DROP TABLE version_skip;
+}
+
+session "s1"
+step "s1b"	{ BEGIN ISOLATION LEVEL REPEATABLE READ; SELECT v FROM version_skip; }
+step "s1s"	{ SELECT v FROM version_skip; }
+step "s1c"	{ COMMIT; }
+
+session "s2"
+setup		{ SET zheap_undo_version_skip = on; }
+step "s2u"
+{
+  DO $$
+  BEGIN
+    FOR i IN 1..40 LOOP
+      UPDATE version_skip SET v = v + 1 WHERE id = 1;
+      COMMIT;
+    END LOOP;
+  END $$;
+}
+step "s2s"	{ SELECT v FROM version_skip; }
+
+session "s3"
+step "s3b"	{ BEGIN ISOLATION LEVEL REPEATABLE READ; SELECT v FROM version_skip; }
+step "s3s"	{ SELECT v FROM version_skip; }
+step "s3c"	{ COMMIT; }
+
+permutation "s1b" "s2u" "s3b" "s2u" "s1s" "s3s" "s2s" "s1c" "s3c"
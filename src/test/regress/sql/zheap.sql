@@ -360,3 +360,63 @@ SELECT * FROM test_multi_insert ORDER BY 1;
 ROLLBACK;
 SELECT * FROM test_multi_insert ORDER BY 1;
 DROP TABLE test_multi_insert;
+
+-- Roll back a COPY into a relation created in the same transaction
+BEGIN;
+CREATE TABLE test_bulk_append(id int, filler text) USING zheap;
+SAVEPOINT s1;
+COPY test_bulk_append FROM STDIN;
+1	a
+2	b
+3	c
+4	d
+5	e
+\.
+SELECT count(*) FROM test_bulk_append;
+ROLLBACK TO SAVEPOINT s1;
+SELECT count(*) FROM test_bulk_append;
+INSERT INTO test_bulk_append VALUES (6, 'f');
+SELECT * FROM test_bulk_append;
+ROLLBACK;
+SELECT count(*) FROM pg_class WHERE relname = 'test_bulk_append';
+
+-- JIT tuple deforming must follow zheap's alignment rules
+SET jit_above_cost = 0;
+CREATE TABLE test_jit_deform(a int2, b text, c int8, d int2, e interval,
+	f text, g int8) USING zheap;
+INSERT INTO test_jit_deform VALUES
+	(1, 'x', 100000000000, 2, '1 day', 'abc', 3),
+	(4, NULL, -5, NULL, '2 hours', NULL, 6),
+	(NULL, 'a somewhat longer value', 7, 8, NULL, repeat('z', 300), 9);
+SELECT a, b, c, d, e, length(f), g FROM test_jit_deform ORDER BY c;
+RESET jit_above_cost;
+DROP TABLE test_jit_deform;
+
+-- Roll back a transaction that modified many pages
+CREATE TABLE test_rollback_pages(id int, filler text) USING zheap;
+INSERT INTO test_rollback_pages SELECT i, repeat('x', 500)
+	FROM generate_series(1, 100) i;
+BEGIN;
+UPDATE test_rollback_pages SET id = id + 1000 WHERE id % 10 = 0;
+DELETE FROM test_rollback_pages WHERE id % 10 = 5;
+INSERT INTO test_rollback_pages SELECT i, repeat('y', 500)
+	FROM generate_series(101, 130) i;
+ROLLBACK;
+SELECT count(*), sum(id), min(id), max(id), count(DISTINCT filler)
+	FROM test_rollback_pages;
+DROP TABLE test_rollback_pages;
+
+-- Undo of wide tuples is compressed; read it back and roll it back
+CREATE TABLE test_undo_compress(id int, t text) USING zheap;
+INSERT INTO test_undo_compress SELECT i, repeat('undo' || i, 100)
+	FROM generate_series(1, 4) i;
+BEGIN;
+DECLARE c CURSOR FOR SELECT id, t = repeat('undo' || id, 100) AS intact
+	FROM test_undo_compress ORDER BY id;
+UPDATE test_undo_compress SET t = 'short' WHERE id % 2 = 0;
+DELETE FROM test_undo_compress WHERE id % 2 = 1;
+FETCH ALL FROM c;
+ROLLBACK;
+SELECT id, length(t), t = repeat('undo' || id, 100) AS intact
+	FROM test_undo_compress ORDER BY id;
+DROP TABLE test_undo_compress;